@@ -0,0 +1,24 @@
+#ifndef __IJEL_ARENA_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <jel/jel.h>
+
+
+int   ijel_arena_attach(jel_config *cfg);
+void  ijel_arena_destroy(jel_config *cfg);
+void  ijel_arena_reset(jel_config *cfg);
+void *ijel_scratch_alloc(jel_config *cfg, size_t size);
+void  ijel_scratch_free(jel_config *cfg, void *p);
+
+prn_cache *ijel_prn_create(jel_config *cfg, int size);
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#define __IJEL_ARENA_H__
+#endif
@@ -0,0 +1,31 @@
+#ifndef __IJEL_STATS_H__
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <jel/jel.h>
+
+
+double ijel_now_usec(void);
+
+/*
+ * With stats disabled (cfg->stats == NULL) each of these is a single
+ * test of a pointer that is already in cache; the clock is only read
+ * when stats are enabled.
+ */
+#define IJEL_STATS_START(cfg)  ((cfg)->stats ? ijel_now_usec() : 0.0)
+
+#define IJEL_STATS_STOP(cfg, field, t0) \
+  do { if ((cfg)->stats) (cfg)->stats->field += ijel_now_usec() - (t0); } while (0)
+
+#define IJEL_STATS_COUNT(cfg, field, n) \
+  do { if ((cfg)->stats) (cfg)->stats->field += (unsigned long) (n); } while (0)
+
+
+#ifdef __cplusplus
+}
+#endif
+
+#define __IJEL_STATS_H__
+#endif
@@ -7,7 +7,6 @@ extern "C" {
 #include <jel/jel.h>
 
 
-int ijel_copy_markers(jel_config *cfg);
 int ijel_image_capacity(jel_config *cfg, int component);
 int ijel_capacity_iter(jel_config *cfg, int component);
 int ijel_stuff_message(jel_config *cfg, int component);
@@ -17,6 +16,71 @@ void ijel_log_qtables(jel_config *c);
 int ijel_print_energies(jel_config *cfg);
 int ac_energy(jel_config *cfg, JCOEF *mcu );
 
+/* What jel_capacity_from_header saw in the header, for the cover index: */
+typedef struct {
+  int width, height, ncomp;
+  int h_samp[3], v_samp[3];
+  unsigned short qtables[2][DCTSIZE2];  /* Luminance, chrominance; zero if absent */
+} ijel_header_info;
+
+int ijel_header_capacity(jel_config *cfg, unsigned char *mem, int size, ijel_header_info *info);
+void ijel_apply_settings(jel_config *from, jel_config *to);
+void ijel_memory_src(jel_config *cfg, unsigned char *mem, int size);
+void _makeSeed16v(unsigned long seed, unsigned short *seed16v);
+
+/* jel-log.c: */
+int ijel_log_ring_push(jel_config *cfg, const char *format, va_list arg);
+
+/* jel-plan.c: */
+int ijel_plan_attach(jel_config *cfg, prn_cache *cache, int size);
+
+/* jel-splice.c: */
+void ijel_splice_destroy(jel_config *cfg);
+void ijel_splice_source(jel_config *cfg, int whole);
+void ijel_splice_check(jel_config *cfg);
+int  ijel_splice_active(jel_config *cfg);
+void ijel_splice_forget(jel_config *cfg);
+void ijel_splice_mark(jel_config *cfg, int ci, int row, int col);
+int  ijel_splice_output(jel_config *cfg);
+void ijel_splice_done(jel_config *cfg);
+int  ijel_nbits(int v);
+
+/* libjpeg's zigzag to natural (row-major) order, from jutils.c; it is
+ * declared in jpegint.h, which is not for applications: */
+extern const int jpeg_natural_order[];
+
+/* jel-huff.c: */
+void ijel_huff_destroy(jel_config *cfg);
+void ijel_huff_source(jel_config *cfg);
+void ijel_huff_check(jel_config *cfg);
+int  ijel_huff_active(jel_config *cfg);
+void ijel_huff_forget(jel_config *cfg);
+void ijel_huff_update(jel_config *cfg, int ci, const JCOEF *before, const JCOEF *after);
+int  ijel_huff_output(jel_config *cfg);
+
+/* jel-requant.c: */
+int  ijel_requantize(jel_config *cfg);
+
+/* jel-scans.c: */
+void ijel_scans_destroy(jel_config *cfg);
+void ijel_scans_source(jel_config *cfg);
+void ijel_scans_check(jel_config *cfg);
+int  ijel_scans_output(jel_config *cfg);
+
+/* jel-markers.c: */
+void ijel_markers_destroy(jel_config *cfg);
+void ijel_markers_skip(jel_config *cfg);
+void ijel_markers_source(jel_config *cfg, int whole);
+int  ijel_copy_markers(jel_config *cfg);
+
+/* jel-raw.c: */
+void ijel_raw_destroy(jel_config *cfg);
+int  ijel_raw_source(jel_config *cfg, const unsigned char *pixels, int width, int height,
+                     jel_pixel_format format);
+int  ijel_raw_active(jel_config *cfg);
+jvirt_barray_ptr *ijel_raw_coefficients(jel_config *cfg);
+int  ijel_raw_release(jel_config *cfg);
+
 
   
 #ifdef __cplusplus
@@ -55,7 +55,11 @@
 extern "C" {
 #endif
 
-  /* switches on verbose logging; defined and set in jel.c */
+  /* switches on verbose logging; defined and set in jel.c.  This is
+   * process-wide configuration, not state: libjel only reads it, so
+   * set it before starting threads.  Everything else libjel keeps
+   * lives in the jel_config, and distinct configs may be used from
+   * different threads at the same time. */
   extern bool jel_verbose;
 
 #define JEL_NLEVELS 8  /* Default number of quanta for each freq. */
@@ -102,11 +106,19 @@ typedef enum jel_ecc_method
   /* #define JEL_ECC_BLKSIZE 200 */
 
 
+struct jel_config;
+struct jel_arena;
+struct jel_stats;
+struct jel_log_ring;
+struct jel_plan;
+
 typedef struct {
   int ncalls;
   int k;        /* Index to the next PRN to be used. */
   int nlist;    /* Number of PRNs in list.           */
   long* list;   /* List of PRNs - really a ring.     */
+  struct jel_config *owner;  /* Non-NULL if list lives in the owner's scratch memory */
+  int shared;   /* Non-zero if list belongs to a jel_plan */
 } prn_cache;
 
 prn_cache* jelprn_create(int size, unsigned short seed[3]);
@@ -148,7 +160,9 @@ typedef struct jel_config {
             * level.  Is set through the jel_setprop call,
             * which will automatically recompute output
             * quant tables.  If not -1, then message
-            * embedding uses this quality level. */
+            * embedding uses this quality level, and the
+            * coefficients are requantized to it first
+            * (jel-requant.c). */
 
   int extract_only;    /* If this is 1, then the dstinfo object is
               ignored and we will only extract a message.
@@ -237,7 +251,38 @@ typedef struct jel_config {
   int needFinishDecompress;
   int needFinishCompress;
 
-  int copy_markers;            // 1 if source markers are to be copied, 0 otherwise
+  struct jpeg_source_mgr *stdio_src;       // Source managers, one of each kind, allocated on first use
+  struct jpeg_source_mgr *mem_src;
+  struct jpeg_destination_mgr *stdio_dest; // Destination managers, likewise
+  struct jpeg_destination_mgr *mem_dest;
+
+  int copy_markers;            // 1 if source markers are to be copied, 0 if not, -1 (the default) for FILE sources only
+  struct jel_markers *markers; // Markers kept in place in a memory source, or NULL (jel-markers.c)
+
+  int user_mcu_density;        // mcu_density as last set through jel_setprop; jel_reset restores it
+  int user_freqs;              // 1 if the frequency list was supplied explicitly; jel_reset keeps it
+
+  struct jel_arena *arena;     // Per-image memory for libjpeg's JPOOL_IMAGE and libjel scratch (jel-arena.c)
+
+  unsigned char *held;         // Output encoded by jel_embed_size, waiting for jel_embed_output
+  size_t held_alloc;           // Allocated size of 'held'; kept across jel_reset
+  int held_len;                // Bytes of 'held' in use
+  int held_ret;                // What the held embedding returned
+
+  struct jel_stats *stats;     // Phase timings and counters, or NULL when disabled (jel-stats.c)
+  struct jel_log_ring *log_ring; // Deferred log entries, or NULL to log synchronously (jel-log.c)
+  struct jel_plan *plan;       // Shared, read-only PRN list for this seed, or NULL (jel-plan.c)
+
+  int splice_blocks;           // 1 (the default) to copy unchanged blocks' coded bits from a memory source
+  struct jel_splice *splice;   // Where each source block's bits start, or NULL (jel-splice.c)
+
+  int optimize_huffman;        // 1 to write optimal Huffman tables rather than the standard ones
+  struct jel_huff *huff;       // Source symbol counts, or NULL (jel-huff.c)
+
+  int keep_scans;              // 1 to write a progressive source's output with the same scans
+  struct jel_scans *scans;     // The source's scan script, or NULL (jel-scans.c)
+
+  struct jel_raw *raw;         // Output of the compressor for a pixel source, or NULL (jel-raw.c)
 
 } jel_config;
 
@@ -251,14 +296,354 @@ void jel_free( jel_config *cfg );   /* Free the jel_config struct. */
 
 void jel_release( jel_config *cfg ); /* Release jel_config dynamic sub-structures */
 
-#if 0
 void jel_reset( jel_config *cfg );   /* Reset the jel_config struct for reuse */
-#endif
 
 void jel_copy_settings (jel_config *cfgIn, jel_config *cfgOut);	/* Copies parameters from one jel_config struct to another */
 
 void jel_describe( jel_config *cfg, int level ); /* Describe the jel object in the log */
 
+/*
+ * jel_config pools.  A pool hands out configs that have been through
+ * jel_reset (), so that high-rate senders do not pay for jel_init and
+ * jel_free on every message.  All pool calls are thread-safe; a
+ * config must only be used by one thread between acquire and release.
+ */
+typedef struct jel_pool jel_pool;
+
+jel_pool   * jel_pool_create( jel_config *tmpl, int max_idle );  /* tmpl may be NULL */
+jel_config * jel_pool_acquire( jel_pool *pool );
+void         jel_pool_release( jel_pool *pool, jel_config *cfg );
+void         jel_pool_destroy( jel_pool *pool );
+
+/* where:
+ *
+ * tmpl      Optional config whose settings (jel_copy_settings, plus the
+ *           component list) are applied to every config the pool hands out
+ * max_idle  Maximum number of idle configs kept; extras are jel_free'd
+ *
+ * jel_pool_destroy frees the idle configs only.  Configs that are still
+ * checked out must be released first, or freed by the caller.
+ */
+
+/*
+ * Link plans.  A plan holds what every message on a link derives from
+ * the seed alone, drawn once so that each embed or extract is left
+ * with decoding, stuffing and encoding.  Plans are immutable and
+ * reference counted: attach one to as many configs as share the seed,
+ * on any threads, and release the creator's reference when done.  A
+ * pool template's plan is attached to every config the pool hands out.
+ */
+typedef struct jel_plan jel_plan;
+
+jel_plan * jel_plan_create( jel_config *cfg, int nprns );  /* For cfg's seed */
+void       jel_plan_release( jel_plan *plan );
+void       jel_set_plan( jel_config *cfg, jel_plan *plan );   /* NULL detaches */
+
+/* where:
+ *
+ * nprns     PRNs to draw, or 0 for JEL_DEFAULT_PRN_CACHE_SIZE.  Images
+ *           that need more (one per admissible MCU), or configs whose
+ *           seed has since changed, draw their own as before.
+ */
+
+/*
+ * Asynchronous embedding and extraction.  An executor runs whole
+ * decode-embed-encode (or decode-extract) cycles on its own threads
+ * and calls done () from the worker thread when each one finishes.
+ * The cover, destination and message buffers, and the config, belong
+ * to the job until done () has been called.  Each job starts with a
+ * jel_reset () of its config, so a config can be handed to one job
+ * after another, and what it embeds can be extracted with a fresh
+ * config of the same settings.  Submission never blocks:
+ * once max_pending jobs are queued or running, it returns JEL_ERR_BUSY
+ * and the caller should try again after a completion.
+ */
+typedef struct jel_executor jel_executor;
+
+typedef void (*jel_prepare_fn)( jel_config *cfg, void *arg );
+typedef void (*jel_done_fn)( jel_config *cfg, int result, void *arg );
+
+jel_executor * jel_executor_create( int nthreads, int max_pending, jel_prepare_fn prepare );
+void           jel_executor_destroy( jel_executor *ex );
+long jel_embed_async( jel_executor *ex, jel_config *cfg,
+                      unsigned char *cover, int cover_len,
+                      unsigned char *dst, int dst_len,
+                      unsigned char *msg, int msglen,
+                      jel_done_fn done, void *arg );
+long jel_extract_async( jel_executor *ex, jel_config *cfg,
+                        unsigned char *cover, int cover_len,
+                        unsigned char *msg, int maxlen,
+                        jel_done_fn done, void *arg );
+int  jel_async_cancel( jel_executor *ex, long job );
+int  jel_executor_pending( jel_executor *ex );
+
+/* where:
+ *
+ * prepare   Optional; called in the worker once the cover has been set
+ *           as cfg's source, for settings that depend on the cover
+ *           (jel_set_components, jel_init_frequencies, ...)
+ * result    What jel_embed or jel_extract returned, or JEL_ERR_CANCELED
+ * job       The id returned by jel_embed_async or jel_extract_async,
+ *           which is positive; a negative return is a JEL_ERR_* code,
+ *           JEL_ERR_BUSY if the executor is full or JEL_ERR_NOMEM
+ *
+ * jel_async_cancel returns 0 if the job had not started, in which case
+ * done () has been called with JEL_ERR_CANCELED before it returns, and
+ * -1 if the job is already running or finished.  jel_executor_destroy
+ * cancels the jobs that have not started and waits for the rest.
+ */
+
+/*
+ * One message split across several covers.  jel_embed_segments embeds
+ * the segments in parallel on ex, and hands the finished images to
+ * deliver () in segment order, from the calling thread, as soon as
+ * each one and all of its predecessors are done.  Segment i carries
+ * the msglen bytes of msg that follow those of segments 0..i-1.
+ */
+typedef struct jel_segment {
+  jel_config *cfg;           /* One config per segment */
+  unsigned char *cover;      /* In-memory cover JPEG */
+  int cover_len;
+  unsigned char *dst;        /* Receives the embedded JPEG */
+  int dst_len;
+  int msglen;                /* Message bytes carried by this segment */
+  void *arg;                 /* Caller's data; also passed to the executor's prepare () */
+  int result;                /* Set to what jel_embed returned */
+  struct ijel_seg_group *group;  /* Private */
+} jel_segment;
+
+typedef int (*jel_deliver_fn)( int seg, unsigned char *jpeg, int jpeglen, void *arg );
+
+int jel_embed_segments( jel_executor *ex, unsigned char *msg,
+                        jel_segment *segs, int nsegs,
+                        jel_deliver_fn deliver, void *arg );
+
+/* Returns the number of segments delivered.  Delivery stops at the
+ * first segment that fails to embed, or for which deliver () returns
+ * non-zero; segments that have not started by then are canceled.
+ * When the executor is full and none of this message's segments are
+ * in flight, the next segment is embedded in the calling thread. */
+
+/*
+ * Per-image memory.  By default each config serves libjpeg's
+ * JPOOL_IMAGE allocations and libjel's per-message scratch from one
+ * bump arena, which is reset once an image has been written or
+ * extracted.  Reused configs (jel_reset, jel_pool) then stop calling
+ * malloc after their first image.  The counters below are kept with
+ * or without the arena, so the two can be compared.
+ */
+typedef struct {
+  int enabled;                /* 1 if the arena is serving allocations */
+  unsigned long allocs;       /* JPOOL_IMAGE and scratch allocations requested */
+  unsigned long sys_allocs;   /* malloc calls made to grow the arena */
+  unsigned long resets;       /* Arena resets (about one per image) */
+  size_t image_peak;          /* Most bytes libjpeg requested for one image */
+  size_t peak;                /* High-water mark of the arena (0 if disabled) */
+  size_t in_use;              /* Arena bytes currently handed out */
+  size_t capacity;            /* Arena bytes held */
+} jel_arena_stats;
+
+int  jel_set_arena( jel_config *cfg, int enable );  /* Only between images */
+int  jel_get_arena_stats( jel_config *cfg, jel_arena_stats *stats );
+void jel_reset_arena_stats( jel_config *cfg );
+
+/*
+ * Splicing.  When the source was set with jel_set_mem_source, jel_embed
+ * copies the coded bits of every block the message left alone from
+ * the source, and only Huffman-codes the blocks it changed.  The
+ * output then uses the source's Huffman tables rather than the
+ * standard ones.  The source buffer must stay valid until jel_embed
+ * returns.  On by default; the setting applies from the next source.
+ */
+int  jel_set_splice( jel_config *cfg, int enable );
+
+/*
+ * Optimized Huffman tables.  jel_embed writes the output with tables
+ * fitted to its own symbols, which makes it smaller, but means every
+ * block is coded again (no splicing).  The symbol counts are taken as
+ * the source is decoded and kept up to date as the message goes in, so
+ * there is no separate statistics pass unless the source is one that
+ * cannot be counted.  Off by default; the setting applies from the
+ * next source.
+ */
+int  jel_set_optimize( jel_config *cfg, int enable );
+
+/*
+ * Progressive covers.  jel_embed writes a sequential JPEG, whatever the
+ * source.  With this set, the output of a progressive source has the
+ * source's scan script instead, so that it keeps the cover's format.
+ * libjpeg then fits the Huffman tables to each scan, and there is no
+ * splicing.  Off by default; the setting applies from the next source.
+ */
+int  jel_set_keep_scans( jel_config *cfg, int enable );
+
+/*
+ * Markers.  jel_embed copies the source's COM and APPn markers (EXIF,
+ * XMP, ICC profiles and so on) to the output, other than the JFIF and
+ * Adobe markers libjpeg writes itself.  By default only a FILE
+ * source's markers are copied, and memory and pixel sources drop
+ * theirs, as they always have; enable = 1 copies them from every
+ * source, 0 from none, and -1 restores the default.  A memory source's
+ * markers are copied straight from its buffer, which must then stay
+ * valid until jel_embed returns.  The setting applies from the next
+ * source.
+ */
+int  jel_set_copy_markers( jel_config *cfg, int enable );
+
+/*
+ * Instrumentation.  Once enabled, jel_embed, jel_extract, jel_capacity
+ * and the jel_set_*_source calls add to these counters; they keep
+ * accumulating, across jel_reset too, until jel_reset_stats.  Times
+ * are in microseconds of the monotonic clock, and the phases do not
+ * overlap: "stuff" excludes the MCU selection and ECC done inside it.
+ * Disabled (the default), the cost is a NULL test per phase.
+ */
+typedef struct jel_stats {
+  double decode_usec;         /* Source header and coefficient decode */
+  double plan_usec;           /* Capacity, frequency choice, message split, PRN tables */
+  double select_usec;         /* MCU selection */
+  double stuff_usec;          /* Bit insertion (embed) or extraction */
+  double ecc_usec;            /* Reed-Solomon encode or decode */
+  double encode_usec;         /* Entropy coding of the output */
+  unsigned long sources;      /* Images decoded */
+  unsigned long embeds;
+  unsigned long extracts;
+  unsigned long capacities;
+  unsigned long mcus_visited; /* MCUs walked by stuff / unstuff */
+  unsigned long mcus_active;  /* ... of which were selected for the message */
+  unsigned long prn_draws;    /* Numbers taken from the PRN cache */
+  unsigned long jpeg_bytes_in;  /* Compressed source bytes (memory sources only) */
+  unsigned long jpeg_bytes_out; /* Compressed bytes written */
+  unsigned long msg_bytes_in;   /* Message bytes embedded */
+  unsigned long msg_bytes_out;  /* Message bytes extracted */
+  unsigned long blocks_spliced; /* Output blocks copied from the source's coded data */
+  unsigned long tables_fused;   /* Outputs given optimal tables without a statistics pass */
+  unsigned long scans_kept;     /* Outputs written with the source's progressive scans */
+  unsigned long blocks_requantized; /* Blocks brought over to the JEL_PROP_QUALITY tables (in "plan") */
+  unsigned long raw_sources;    /* Sources set from pixels; their forward DCT is in "decode" */
+  unsigned long marker_bytes;   /* Source marker bytes copied to the output (in "encode") */
+  size_t peak_memory;         /* Most per-image libjpeg memory for one image */
+} jel_stats;
+
+int  jel_enable_stats( jel_config *cfg, int enable );
+int  jel_get_stats( jel_config *cfg, jel_stats *stats );
+void jel_reset_stats( jel_config *cfg );
+
+/*
+ * Capacity index over a directory of covers (jel-index.c).  The index
+ * is kept in a sidecar file, <dir>/.jel-index unless another path is
+ * given, and only files that changed since it was written are read
+ * again.  jel_index_take finds the smallest unused cover that holds a
+ * message in logarithmic time, without decoding anything.
+ */
+typedef struct jel_index jel_index;
+
+jel_index  *jel_index_open( const char *dirpath, const char *indexpath, jel_config *cfg );
+int         jel_index_update( jel_index *idx );   /* Rescan; returns the number of files read */
+int         jel_index_size( jel_index *idx );
+const char *jel_index_take( jel_index *idx, int min_capacity );
+void        jel_index_reset_used( jel_index *idx );
+void        jel_index_close( jel_index *idx );
+
+/*
+ * Splitting a message over covers (jel-split.c).  Given the capacity
+ * of each cover at hand, from the index or jel_capacity_from_header,
+ * jel_plan_segments picks the fewest covers that carry payload bytes
+ * and, among those, the smallest, then sizes the segments so that
+ * every chosen image is about equally full.  jel_index_plan does the
+ * same over the unused covers of an index and marks its picks used.
+ */
+typedef struct {
+  const char *path;          /* Cover file */
+  int capacity;              /* Its capacity, as recorded in the index */
+  int msglen;                /* Payload bytes to embed in it */
+} jel_cover_pick;
+
+int jel_plan_segments( const int *capacity, int ncovers, int payload,
+                       int overhead, int margin, int *seglen );
+int jel_index_plan( jel_index *idx, int payload, int overhead, int margin,
+                    jel_cover_pick **picks );
+
+/* where:
+ *
+ * overhead  Bytes each segment adds to its share of the payload (the
+ *           caller's segment header), counted against the capacity
+ * margin    Bytes of each cover's capacity to leave unused
+ * seglen    Filled with the payload bytes for each cover, 0 if unused
+ *
+ * Both return the number of covers chosen, JEL_ERR_NOMSG for an empty
+ * payload, JEL_ERR_MSG_OVERFLOW if the covers cannot hold it, or
+ * JEL_ERR_NOMEM if memory runs out.
+ */
+
+/*
+ * Reassembly of messages that arrive as segments (jel-reasm.c).
+ * Partial messages are keyed by sender and message id and spread over
+ * independently locked shards, so many receive threads can add
+ * segments at once.  Each message's buffer is allocated at its full
+ * length when the first segment arrives, and every segment is placed
+ * directly at its final offset.
+ */
+typedef struct jel_reasm jel_reasm;
+
+jel_reasm     * jel_reasm_create( int nshards );
+void            jel_reasm_destroy( jel_reasm *r );
+unsigned char * jel_reasm_claim( jel_reasm *r, unsigned int sender, unsigned int msgid,
+                                 int nsegs, int seg, int msglen, int offset, int seglen,
+                                 int *status );
+int             jel_reasm_commit( jel_reasm *r, unsigned int sender, unsigned int msgid, int seg,
+                                  unsigned char **msg, int *msglen );
+void            jel_reasm_abort( jel_reasm *r, unsigned int sender, unsigned int msgid, int seg );
+int             jel_reasm_add( jel_reasm *r, unsigned int sender, unsigned int msgid,
+                               int nsegs, int seg, int msglen, int offset,
+                               unsigned char *data, int seglen,
+                               unsigned char **msg, int *len );
+int             jel_reasm_pending( jel_reasm *r );   /* Partial messages held */
+
+/*
+ * Expiry.  With a non-zero expiry, a partial message that is still
+ * incomplete that many seconds after its first segment is freed.
+ * Timing is kept on a timer wheel that moves whenever a segment is
+ * claimed, and with every jel_reasm_tick, which a receiver that may
+ * go quiet should call from a timer (about once a second).
+ */
+typedef struct {
+  unsigned long pending_messages;   /* Partial messages held now */
+  unsigned long pending_bytes;      /* and the buffer bytes they hold */
+  unsigned long expired_messages;   /* Partial messages evicted so far */
+  unsigned long expired_bytes;      /* and the buffer bytes freed with them */
+} jel_reasm_stats;
+
+void jel_reasm_set_expiry( jel_reasm *r, int seconds );
+void jel_reasm_tick( jel_reasm *r, long now );      /* now is time (NULL) if 0 */
+int  jel_reasm_get_stats( jel_reasm *r, jel_reasm_stats *stats );
+
+/* where:
+ *
+ * nsegs, msglen  Segment count and total length of the message, which
+ *                every segment of it must agree on
+ * seg, offset    This segment's index and its byte offset in the message
+ *
+ * jel_reasm_claim returns where the seglen bytes of segment seg go,
+ * and the caller may write them there (for example by extracting
+ * straight into it) without holding any lock.  It then calls
+ * jel_reasm_commit, or jel_reasm_abort if the segment could not be
+ * read.  On failure claim returns NULL and sets *status to one of the
+ * JEL_REASM_* errors.  jel_reasm_add is claim, copy and commit.
+ *
+ * commit and add return JEL_REASM_WHOLE once the last segment is in,
+ * with *msg (which the caller frees) and its length; otherwise
+ * JEL_REASM_PARTIAL or an error.  The values match RACEJel's RJEL_*.
+ */
+enum {
+  JEL_REASM_WHOLE       =  1,
+  JEL_REASM_PARTIAL     =  0,
+  JEL_REASM_OUT_OF_MEM  = -1,
+  JEL_REASM_DUP_SEGMENT = -3,
+  JEL_REASM_BAD_SEG_IDX = -4,
+  JEL_REASM_BAD_NUM_SEG = -5
+};
+
 #endif /* notdef SWIG */
 
 /*
@@ -288,6 +673,22 @@ typedef enum jel_property {
   _JEL_PROP_LAST  = JEL_PROP_NORMALIZE
 } jel_property;
 
+/*
+ * Pixel sources.  jel_set_raw_source compresses a frame of 8-bit
+ * samples, rows packed top to bottom, with the JEL_PROP_QUALITY tables
+ * (quality 75 if unset) and makes the result the source, much as
+ * compressing it to memory and calling jel_set_mem_source would, but
+ * without coding the frame only to decode it again: jel_embed codes
+ * each block once.  YCbCr is full range, as in JFIF.  The pixels are
+ * not needed once the call returns.  Returns JEL_ERR_BADDIMS for an
+ * unknown format or an empty or oversized frame.
+ */
+typedef enum jel_pixel_format {
+  JEL_PIXELS_GRAY,              /* 1 byte per pixel */
+  JEL_PIXELS_RGB,               /* 3 bytes per pixel: R, G, B */
+  JEL_PIXELS_YCBCR              /* 3 bytes per pixel: Y, Cb, Cr */
+} jel_pixel_format;
+
 #if !defined SWIG
 
 /*
@@ -297,6 +698,8 @@ typedef enum jel_property {
 int jel_set_file_source(jel_config * cfg, char * filename);
 int jel_set_fp_source(jel_config * cfg, FILE *fp);
 int jel_set_mem_source(jel_config * cfg, unsigned char *mem, int len);
+int jel_set_raw_source(jel_config * cfg, const unsigned char *pixels, int width, int height,
+                       jel_pixel_format format);
 
 int jel_set_file_dest(jel_config * cfg, char *filename);
 int jel_set_fp_dest(jel_config * cfg, FILE *fp);
@@ -336,6 +739,8 @@ int jel_open_log( jel_config *cfg, char *filename);
 int jel_close_log( jel_config *cfg);
 int jel_log( jel_config *cfg, const char *format, ... );
 int jel_vlog( jel_config *cfg, int level, const char *format, ... );
+int jel_set_log_ring( jel_config *cfg, int nslots );  /* Defer logging to a ring of nslots entries; 0 to stop */
+int jel_drain_log( jel_config *cfg );                 /* Write deferred entries to the log */
 int jel_set_log_fd( jel_config *cfg, FILE *fd);
 
 /* where:
@@ -373,6 +778,15 @@ int jel_set_frequencies(jel_config *cfg, int *flist, int len_flist);
 int    jel_capacity( jel_config * cfg );      /* Returns the capacity in bytes of the source. */
 int    jel_raw_capacity( jel_config * cfg );  /* Returns the "raw" capacity in bytes of the source. */
 
+/*
+ * jel_capacity_from_header returns what jel_capacity would for the
+ * JPEG image in mem, but only parses its header (SOF, DQT, ...), so
+ * it costs a small fraction of a decode.  mem need only hold the
+ * markers up to the first SOS.  Any source already set on cfg is
+ * dropped.
+ */
+int    jel_capacity_from_header( unsigned char *mem, int size, jel_config * cfg );
+
 /* Allocates a buffer that is sufficient to hold any message
  * (per-frame) in the source.  Any such buffer can be passed to
  * free().
@@ -395,6 +809,23 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len);
  */
 
 
+/*
+ * Sizing the output before writing it.  jel_embed_size embeds msg
+ * exactly as jel_embed would, but into a buffer owned by cfg, and
+ * returns the exact size of the resulting JPEG (or a negative error
+ * code).  The destination set on cfg is not touched.
+ * jel_embed_output then copies the held JPEG to mem, which must hold
+ * at least that many bytes, and returns what jel_embed would have.
+ *
+ * jel_embed itself never writes past the end of a memory
+ * destination: if the JPEG does not fit, it returns
+ * JEL_ERR_DEST_OVERFLOW and sets cfg->jpeglen to the size that was
+ * needed.
+ */
+int jel_embed_size( jel_config * cfg, unsigned char * msg, int len);
+int jel_embed_output( jel_config * cfg, unsigned char * mem, int size);
+
+
 /* Extract a message from an image. */
 
 int jel_extract( jel_config * cfg, unsigned char * msg, int len);
@@ -420,7 +851,17 @@ void jel_perror( char *, int  );
 
 #endif /* notdef SWIG */
 
-#define JEL_LOG if (jel_verbose) jel_vlog
+/*
+ * JEL_LOG statements above JEL_LOG_MAX_LEVEL are compiled out, so the
+ * per-MCU and per-bit trace (levels 4 and up) costs nothing in release
+ * builds.  configure --enable-trace-log (or --enable-debug) keeps them.
+ */
+#ifndef JEL_LOG_MAX_LEVEL
+#define JEL_LOG_MAX_LEVEL 3
+#endif
+
+#define JEL_LOG(cfg, level, ...) \
+  do { if ((level) <= JEL_LOG_MAX_LEVEL && jel_verbose) jel_vlog((cfg), (level), __VA_ARGS__); } while (0)
 
 /*
  * Error Codes:
@@ -439,7 +880,12 @@ typedef enum jel_error_enum {
     JEL_ERR_MSG_OVERFLOW = -10,
     JEL_ERR_CREATE_MCU   = -11,
     JEL_ERR_ECC          = -12,
-    JEL_ERR_CHECKSUM     = -13
+    JEL_ERR_CHECKSUM     = -13,
+    JEL_ERR_ARENA        = -14,
+    JEL_ERR_DEST_OVERFLOW = -15,
+    JEL_ERR_BUSY         = -16,
+    JEL_ERR_CANCELED     = -17,
+    JEL_ERR_NOMEM        = -18
 } jel_error_enum;
 
 #ifdef __cplusplus
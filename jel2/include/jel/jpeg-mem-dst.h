@@ -10,6 +10,7 @@ extern "C" {
 
 void jpeg_memory_dest (j_compress_ptr cinfo, unsigned char* data, int size);
 int jpeg_mem_packet_size(j_compress_ptr cinfo);
+int jpeg_mem_overflow(j_compress_ptr cinfo);
 
   
 #ifdef __cplusplus
@@ -60,6 +60,8 @@ typedef my_coef_controller * my_coef_ptr;
 /* Forward declarations */
 METHODDEF(boolean) compress_data
     JPP((j_compress_ptr cinfo, JSAMPIMAGE input_buf));
+LOCAL(boolean) capture_data
+    JPP((j_compress_ptr cinfo, JSAMPIMAGE input_buf));
 #ifdef FULL_COEF_BUFFER_SUPPORTED
 METHODDEF(boolean) compress_first_pass
     JPP((j_compress_ptr cinfo, JSAMPIMAGE input_buf));
@@ -150,6 +152,9 @@ compress_data (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
   JDIMENSION ypos, xpos;
   jpeg_component_info *compptr;
 
+  if (cinfo->coef_capture != NULL)
+    return capture_data(cinfo, input_buf);
+
   /* Loop to write as much as one whole iMCU row */
   for (yoffset = coef->MCU_vert_offset; yoffset < coef->MCU_rows_per_iMCU_row;
        yoffset++) {
@@ -218,31 +223,22 @@ compress_data (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
 }
 
 
-#ifdef FULL_COEF_BUFFER_SUPPORTED
-
 /*
- * Process some data in the first pass of a multi-pass case.
- * We process the equivalent of one fully interleaved MCU row ("iMCU" row)
- * per call, ie, v_samp_factor block rows for each component in the image.
- * This amount of data is read from the source buffer, DCT'd and quantized,
- * and saved into the virtual arrays.  We also generate suitable dummy blocks
- * as needed at the right and lower edges.  (The dummy blocks are constructed
- * in the virtual arrays, which have been padded appropriately.)  This makes
- * it possible for subsequent passes not to worry about real vs. dummy blocks.
- *
- * We must also emit the data to the entropy encoder.  This is conveniently
- * done by calling compress_output() after we've loaded the current strip
- * of the virtual arrays.
+ * DCT and quantize one iMCU row of every component into the virtual
+ * arrays, adding dummy blocks as needed at the right and lower edges.
+ * (The dummy blocks are constructed in the virtual arrays, which have
+ * been padded appropriately.)  This makes it possible for whoever reads
+ * the arrays not to worry about real vs. dummy blocks.
  *
  * NB: input_buf contains a plane for each component in image.  All
- * components are DCT'd and loaded into the virtual arrays in this pass.
- * However, it may be that only a subset of the components are emitted to
- * the entropy encoder during this first pass; be careful about looking
- * at the scan-dependent variables (MCU dimensions, etc).
+ * components are DCT'd and loaded into the virtual arrays, whether or
+ * not they appear in the current scan; be careful about looking at the
+ * scan-dependent variables (MCU dimensions, etc).
  */
 
-METHODDEF(boolean)
-compress_first_pass (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
+LOCAL(void)
+dct_iMCU_row (j_compress_ptr cinfo, JSAMPIMAGE input_buf,
+	      jvirt_barray_ptr * arrays)
 {
   my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
   JDIMENSION last_iMCU_row = cinfo->total_iMCU_rows - 1;
@@ -257,7 +253,7 @@ compress_first_pass (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
        ci++, compptr++) {
     /* Align the virtual buffer for this component. */
     buffer = (*cinfo->mem->access_virt_barray)
-      ((j_common_ptr) cinfo, coef->whole_image[ci],
+      ((j_common_ptr) cinfo, arrays[ci],
        coef->iMCU_row_num * compptr->v_samp_factor,
        (JDIMENSION) compptr->v_samp_factor, TRUE);
     /* Count non-dummy DCT block rows in this iMCU row. */
@@ -318,6 +314,52 @@ compress_first_pass (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
       }
     }
   }
+}
+
+
+/*
+ * Process some data when the application has asked for the quantized
+ * coefficients (coef_capture) instead of a coded scan.  We DCT one iMCU
+ * row of every component into the application's arrays and emit
+ * nothing; the file gets headers and an empty scan.
+ * Always returns TRUE, since there is no output to suspend on.
+ */
+
+LOCAL(boolean)
+capture_data (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+
+  dct_iMCU_row(cinfo, input_buf, cinfo->coef_capture);
+
+  /* Completed the iMCU row, advance counters for next one */
+  coef->iMCU_row_num++;
+  start_iMCU_row(cinfo);
+  return TRUE;
+}
+
+
+#ifdef FULL_COEF_BUFFER_SUPPORTED
+
+/*
+ * Process some data in the first pass of a multi-pass case.
+ * We process the equivalent of one fully interleaved MCU row ("iMCU" row)
+ * per call, ie, v_samp_factor block rows for each component in the image.
+ * This amount of data is read from the source buffer, DCT'd and quantized,
+ * and saved into the virtual arrays by dct_iMCU_row.
+ *
+ * We must also emit the data to the entropy encoder.  This is conveniently
+ * done by calling compress_output() after we've loaded the current strip
+ * of the virtual arrays.
+ */
+
+METHODDEF(boolean)
+compress_first_pass (j_compress_ptr cinfo, JSAMPIMAGE input_buf)
+{
+  my_coef_ptr coef = (my_coef_ptr) cinfo->coef;
+
+  dct_iMCU_row(cinfo, input_buf, coef->whole_image);
+
   /* NB: compress_output will increment iMCU_row_num if successful.
    * A suspension return will result in redoing all the work above next time.
    */
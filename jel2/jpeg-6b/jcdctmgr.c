@@ -17,6 +17,7 @@
 #include "jdct.h"		/* Private declarations for DCT subsystem */
 
 
+
 /* Private subobject for this module */
 
 typedef struct {
@@ -31,6 +32,11 @@ typedef struct {
    */
   DCTELEM * divisors[NUM_QUANT_TBLS];
 
+#ifdef JSIMD_ISLOW
+  /* For the SIMD quantizer, 1/divisor for each of the islow divisors */
+  float * recips[NUM_QUANT_TBLS];
+#endif
+
 #ifdef DCT_FLOAT_SUPPORTED
   /* Same as above for the floating-point case. */
   float_DCT_method_ptr do_float_dct;
@@ -84,6 +90,16 @@ start_pass_fdctmgr (j_compress_ptr cinfo)
       for (i = 0; i < DCTSIZE2; i++) {
 	dtbl[i] = ((DCTELEM) qtbl->quantval[i]) << 3;
       }
+#ifdef JSIMD_ISLOW
+      if (fdct->recips[qtblno] == NULL) {
+	fdct->recips[qtblno] = (float *)
+	  (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				      DCTSIZE2 * SIZEOF(float));
+      }
+      for (i = 0; i < DCTSIZE2; i++) {
+	fdct->recips[qtblno][i] = 1.0f / (float) dtbl[i];
+      }
+#endif
       break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
@@ -264,6 +280,251 @@ forward_DCT (j_compress_ptr cinfo, jpeg_component_info * compptr,
 }
 
 
+#ifdef JSIMD_ISLOW
+
+/*
+ * The SIMD islow DCT is jpeg_fdct_islow's arithmetic, with the same
+ * constants, products and roundings, done on a row or column of lanes
+ * at a time: the block is transposed so that each vector holds one
+ * input of the 1-D DCT for every row, transposed back for the columns,
+ * and never leaves the registers between the sample load and the
+ * quantized store.  The quantizer divides with a single-precision
+ * reciprocal and corrects the quotient by one step; every dividend the
+ * DCT can produce is far below 2^24, where the estimate can be off by
+ * more than one, so the result is the same as DIVIDE_BY's.
+ */
+
+#define ISLOW_CONST_BITS  13	/* As in jfdctint.c */
+#define ISLOW_PASS1_BITS  2
+
+#define FIX_0_298631336  2446
+#define FIX_0_390180644  3196
+#define FIX_0_541196100  4433
+#define FIX_0_765366865  6270
+#define FIX_0_899976223  7373
+#define FIX_1_175875602  9633
+#define FIX_1_501321110  12299
+#define FIX_1_847759065  15137
+#define FIX_1_961570560  16069
+#define FIX_2_053119869  16819
+#define FIX_2_562915447  20995
+#define FIX_3_072711026  25172
+
+/*
+ * One 1-D pass over d[0..7], with jpeg_fdct_islow's pass-1 names.
+ * Outputs 0 and 4 are left unscaled, and the rest undescaled, for the
+ * caller to finish as the pass requires.
+ */
+
+JSIMD_INLINE void
+fdct_simd_pass (SVEC * d)
+{
+  SVEC tmp0, tmp1, tmp2, tmp3, tmp4, tmp5, tmp6, tmp7;
+  SVEC tmp10, tmp11, tmp12, tmp13;
+  SVEC z1, z2, z3, z4, z5;
+
+  tmp0 = VADD(d[0], d[7]);
+  tmp7 = VSUB(d[0], d[7]);
+  tmp1 = VADD(d[1], d[6]);
+  tmp6 = VSUB(d[1], d[6]);
+  tmp2 = VADD(d[2], d[5]);
+  tmp5 = VSUB(d[2], d[5]);
+  tmp3 = VADD(d[3], d[4]);
+  tmp4 = VSUB(d[3], d[4]);
+
+  /* Even part */
+  tmp10 = VADD(tmp0, tmp3);
+  tmp13 = VSUB(tmp0, tmp3);
+  tmp11 = VADD(tmp1, tmp2);
+  tmp12 = VSUB(tmp1, tmp2);
+
+  d[0] = VADD(tmp10, tmp11);
+  d[4] = VSUB(tmp10, tmp11);
+
+  z1 = VMULC(VADD(tmp12, tmp13), FIX_0_541196100);
+  d[2] = VADD(z1, VMULC(tmp13, FIX_0_765366865));
+  d[6] = VADD(z1, VMULC(tmp12, - FIX_1_847759065));
+
+  /* Odd part */
+  z1 = VADD(tmp4, tmp7);
+  z2 = VADD(tmp5, tmp6);
+  z3 = VADD(tmp4, tmp6);
+  z4 = VADD(tmp5, tmp7);
+  z5 = VMULC(VADD(z3, z4), FIX_1_175875602);
+
+  tmp4 = VMULC(tmp4, FIX_0_298631336);
+  tmp5 = VMULC(tmp5, FIX_2_053119869);
+  tmp6 = VMULC(tmp6, FIX_3_072711026);
+  tmp7 = VMULC(tmp7, FIX_1_501321110);
+  z1 = VMULC(z1, - FIX_0_899976223);
+  z2 = VMULC(z2, - FIX_2_562915447);
+  z3 = VMULC(z3, - FIX_1_961570560);
+  z4 = VMULC(z4, - FIX_0_390180644);
+
+  z3 = VADD(z3, z5);
+  z4 = VADD(z4, z5);
+
+  d[7] = VADD(VADD(tmp4, z1), z3);
+  d[5] = VADD(VADD(tmp5, z2), z4);
+  d[3] = VADD(VADD(tmp6, z2), z3);
+  d[1] = VADD(VADD(tmp7, z1), z4);
+}
+
+/* Pass 1 leaves the results scaled up by PASS1_BITS; pass 2 removes it. */
+
+#define FDCT_SIMD_DESCALE1(d) \
+  (d[0] = VSHL(d[0], ISLOW_PASS1_BITS), \
+   d[4] = VSHL(d[4], ISLOW_PASS1_BITS), \
+   d[1] = VDESCALE(d[1], ISLOW_CONST_BITS-ISLOW_PASS1_BITS), \
+   d[2] = VDESCALE(d[2], ISLOW_CONST_BITS-ISLOW_PASS1_BITS), \
+   d[3] = VDESCALE(d[3], ISLOW_CONST_BITS-ISLOW_PASS1_BITS), \
+   d[5] = VDESCALE(d[5], ISLOW_CONST_BITS-ISLOW_PASS1_BITS), \
+   d[6] = VDESCALE(d[6], ISLOW_CONST_BITS-ISLOW_PASS1_BITS), \
+   d[7] = VDESCALE(d[7], ISLOW_CONST_BITS-ISLOW_PASS1_BITS))
+
+#define FDCT_SIMD_DESCALE2(d) \
+  (d[0] = VDESCALE(d[0], ISLOW_PASS1_BITS), \
+   d[4] = VDESCALE(d[4], ISLOW_PASS1_BITS), \
+   d[1] = VDESCALE(d[1], ISLOW_CONST_BITS+ISLOW_PASS1_BITS), \
+   d[2] = VDESCALE(d[2], ISLOW_CONST_BITS+ISLOW_PASS1_BITS), \
+   d[3] = VDESCALE(d[3], ISLOW_CONST_BITS+ISLOW_PASS1_BITS), \
+   d[5] = VDESCALE(d[5], ISLOW_CONST_BITS+ISLOW_PASS1_BITS), \
+   d[6] = VDESCALE(d[6], ISLOW_CONST_BITS+ISLOW_PASS1_BITS), \
+   d[7] = VDESCALE(d[7], ISLOW_CONST_BITS+ISLOW_PASS1_BITS))
+
+
+#ifdef JSIMD_AVX2
+
+/* Quantizes one row of coefficients as forward_DCT does. */
+
+JSIMD_INLINE __m256i
+quantize_avx2 (__m256i coef, const DCTELEM * divisors, const float * recips)
+{
+  __m256i qval = _mm256_loadu_si256((const __m256i *) divisors);
+  __m256i temp, quot, rem;
+
+  temp = _mm256_add_epi32(_mm256_abs_epi32(coef), _mm256_srli_epi32(qval, 1));
+  quot = _mm256_cvttps_epi32(_mm256_mul_ps(_mm256_cvtepi32_ps(temp),
+					   _mm256_loadu_ps(recips)));
+  rem = _mm256_sub_epi32(temp, _mm256_mullo_epi32(quot, qval));
+  quot = _mm256_sub_epi32(quot, _mm256_cmpgt_epi32(rem, _mm256_sub_epi32(qval, _mm256_set1_epi32(1))));
+  quot = _mm256_add_epi32(quot, _mm256_cmpgt_epi32(_mm256_setzero_si256(), rem));
+  return _mm256_sign_epi32(quot, coef);
+}
+
+
+JSIMD_TARGET METHODDEF(void)
+forward_DCT_simd (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		  JSAMPARRAY sample_data, JBLOCKROW coef_blocks,
+		  JDIMENSION start_row, JDIMENSION start_col,
+		  JDIMENSION num_blocks)
+{
+  my_fdct_ptr fdct = (my_fdct_ptr) cinfo->fdct;
+  DCTELEM * divisors = fdct->divisors[compptr->quant_tbl_no];
+  float * recips = fdct->recips[compptr->quant_tbl_no];
+  __m256i center = _mm256_set1_epi32(CENTERJSAMPLE);
+  __m256i d[DCTSIZE];
+  JCOEFPTR output_ptr;
+  JDIMENSION bi;
+  int r;
+
+  sample_data += start_row;
+
+  for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
+    for (r = 0; r < DCTSIZE; r++)
+      d[r] = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)
+			       (sample_data[r] + start_col))), center);
+
+    jsimd_transpose(d);
+    fdct_simd_pass(d);
+    FDCT_SIMD_DESCALE1(d);
+    jsimd_transpose(d);
+    fdct_simd_pass(d);
+    FDCT_SIMD_DESCALE2(d);
+
+    output_ptr = coef_blocks[bi];
+    for (r = 0; r < DCTSIZE; r += 2) {
+      /* packs works within 128-bit lanes; the permute puts rows back together */
+      _mm256_storeu_si256((__m256i *) (output_ptr + r * DCTSIZE),
+	_mm256_permute4x64_epi64(_mm256_packs_epi32(
+	  quantize_avx2(d[r], divisors + r * DCTSIZE, recips + r * DCTSIZE),
+	  quantize_avx2(d[r+1], divisors + (r+1) * DCTSIZE, recips + (r+1) * DCTSIZE)), 0xD8));
+    }
+  }
+}
+
+#else /* JSIMD_NEON */
+
+/* Quantizes four coefficients as forward_DCT does. */
+
+JSIMD_INLINE int16x4_t
+quantize_neon (int32x4_t coef, const DCTELEM * divisors, const float * recips)
+{
+  int32x4_t qval = vld1q_s32((const int32_t *) divisors);
+  int32x4_t sign = vshrq_n_s32(coef, 31);
+  int32x4_t temp, quot, rem;
+
+  temp = vaddq_s32(vabsq_s32(coef), vshrq_n_s32(qval, 1));
+  quot = vcvtq_s32_f32(vmulq_f32(vcvtq_f32_s32(temp), vld1q_f32(recips)));
+  rem = vmlsq_s32(temp, quot, qval);
+  quot = vsubq_s32(quot, vreinterpretq_s32_u32(vcgeq_s32(rem, qval)));
+  quot = vaddq_s32(quot, vreinterpretq_s32_u32(vcltq_s32(rem, vdupq_n_s32(0))));
+  return vmovn_s32(vsubq_s32(veorq_s32(quot, sign), sign));
+}
+
+
+METHODDEF(void)
+forward_DCT_simd (j_compress_ptr cinfo, jpeg_component_info * compptr,
+		  JSAMPARRAY sample_data, JBLOCKROW coef_blocks,
+		  JDIMENSION start_row, JDIMENSION start_col,
+		  JDIMENSION num_blocks)
+{
+  my_fdct_ptr fdct = (my_fdct_ptr) cinfo->fdct;
+  DCTELEM * divisors = fdct->divisors[compptr->quant_tbl_no];
+  float * recips = fdct->recips[compptr->quant_tbl_no];
+  int16x8_t center = vdupq_n_s16(CENTERJSAMPLE);
+  int32x4_t lo[DCTSIZE], hi[DCTSIZE];
+  int16x8_t row;
+  JCOEFPTR output_ptr;
+  JDIMENSION bi;
+  int r;
+
+  sample_data += start_row;
+
+  for (bi = 0; bi < num_blocks; bi++, start_col += DCTSIZE) {
+    for (r = 0; r < DCTSIZE; r++) {
+      row = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(sample_data[r] + start_col))),
+		      center);
+      lo[r] = vmovl_s16(vget_low_s16(row));
+      hi[r] = vmovl_s16(vget_high_s16(row));
+    }
+
+    jsimd_transpose(lo, hi);
+    fdct_simd_pass(lo);
+    fdct_simd_pass(hi);
+    FDCT_SIMD_DESCALE1(lo);
+    FDCT_SIMD_DESCALE1(hi);
+    jsimd_transpose(lo, hi);
+    fdct_simd_pass(lo);
+    fdct_simd_pass(hi);
+    FDCT_SIMD_DESCALE2(lo);
+    FDCT_SIMD_DESCALE2(hi);
+
+    output_ptr = coef_blocks[bi];
+    for (r = 0; r < DCTSIZE; r++) {
+      vst1q_s16(output_ptr + r * DCTSIZE,
+		vcombine_s16(quantize_neon(lo[r], divisors + r * DCTSIZE, recips + r * DCTSIZE),
+			     quantize_neon(hi[r], divisors + r * DCTSIZE + 4,
+					   recips + r * DCTSIZE + 4)));
+    }
+  }
+}
+
+#endif /* JSIMD_AVX2 */
+
+#endif /* JSIMD_ISLOW */
+
+
 #ifdef DCT_FLOAT_SUPPORTED
 
 METHODDEF(void)
@@ -358,6 +619,10 @@ jinit_forward_dct (j_compress_ptr cinfo)
   case JDCT_ISLOW:
     fdct->pub.forward_DCT = forward_DCT;
     fdct->do_dct = jpeg_fdct_islow;
+#ifdef JSIMD_ISLOW
+    if (jsimd_supported())
+      fdct->pub.forward_DCT = forward_DCT_simd;
+#endif
     break;
 #endif
 #ifdef DCT_IFAST_SUPPORTED
@@ -380,6 +645,9 @@ jinit_forward_dct (j_compress_ptr cinfo)
   /* Mark divisor tables unallocated */
   for (i = 0; i < NUM_QUANT_TBLS; i++) {
     fdct->divisors[i] = NULL;
+#ifdef JSIMD_ISLOW
+    fdct->recips[i] = NULL;
+#endif
 #ifdef DCT_FLOAT_SUPPORTED
     fdct->float_divisors[i] = NULL;
 #endif
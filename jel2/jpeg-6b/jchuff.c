@@ -26,8 +26,21 @@
  * but must not be updated permanently until we complete the MCU.
  */
 
+/* The bit accumulator.  On machines with 64-bit words, a 64-bit
+ * accumulator lets a Huffman code and the value bits after it go in
+ * together, and lets up to seven bytes come out at once.
+ */
+
+#if defined(_LP64) || defined(__LP64__) || defined(_WIN64)
+typedef size_t put_buf_type;	/* type of bit-accumulation buffer */
+#define PUT_BUF_SIZE  64	/* size of buffer in bits */
+#else
+typedef unsigned long put_buf_type;
+#define PUT_BUF_SIZE  32
+#endif
+
 typedef struct {
-  INT32 put_buffer;		/* current bit-accumulation buffer */
+  put_buf_type put_buffer;	/* current bit-accumulation buffer */
   int put_bits;			/* # of bits now in it */
   int last_dc_val[MAX_COMPS_IN_SCAN]; /* last DC coef for each component */
 } savable_state;
@@ -61,6 +74,8 @@ typedef struct {
   unsigned int restarts_to_go;	/* MCUs left in this restart interval */
   int next_restart_num;		/* next restart number to write (0-7) */
 
+  long splice_next;		/* splice_sources index of the next block */
+
   /* Pointers to derived tables (these workspaces have image lifespan) */
   c_derived_tbl * dc_derived_tbls[NUM_HUFF_TBLS];
   c_derived_tbl * ac_derived_tbls[NUM_HUFF_TBLS];
@@ -121,6 +136,9 @@ start_pass_huff (j_compress_ptr cinfo, boolean gather_statistics)
     entropy->pub.finish_pass = finish_pass_huff;
   }
 
+  entropy->splice_next = 0;
+  cinfo->splice_count = 0;
+
   for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
     compptr = cinfo->cur_comp_info[ci];
     dctbl = compptr->dc_tbl_no;
@@ -291,42 +309,75 @@ dump_buffer (working_state * state)
 
 /* Outputting bits to the file */
 
-/* Only the right 24 bits of put_buffer are used; the valid bits are
- * left-justified in this part.  At most 16 bits can be passed to emit_bits
- * in one call, and we never retain more than 7 bits in put_buffer
- * between calls, so 24 bits are sufficient.
+/* The valid bits are right-justified in put_buffer.  Whole bytes are
+ * written out only once PUT_FLUSH_BITS or more bits are waiting, so
+ * fewer than that are held between calls.  A call may add up to
+ * PUT_BUF_SIZE - PUT_FLUSH_BITS + 1 bits: 17 with a 32-bit buffer,
+ * enough for any Huffman code, and 33 with a 64-bit one, enough for a
+ * code plus the value bits that follow it.
  */
 
+#define PUT_FLUSH_BITS  (PUT_BUF_SIZE / 2)
+
+/* Every byte of a put_buf_type set to 0x01, and to 0x80: */
+#define PUT_ONES   (((put_buf_type) ~((put_buf_type) 0)) / 0xFF)
+#define PUT_HIGHS  (PUT_ONES << 7)
+
+
+LOCAL(boolean)
+flush_bytes (working_state * state, put_buf_type put_buffer, int put_bits)
+/* Write out all whole bytes in put_buffer; the caller keeps the rest */
+{
+  register int nbytes = put_bits >> 3;
+  register put_buf_type bytes = put_buffer >> (put_bits & 7);
+  register put_buf_type t = ~bytes;	/* 0xFF bytes become zero bytes */
+  register int i, c;
+
+  /* If none of the bytes is 0xFF and there is room for all of them,
+   * they go straight into the buffer with no stuffing checks.
+   */
+  if (((t - PUT_ONES) & ~t & PUT_HIGHS &
+       ((((put_buf_type) 1) << (nbytes << 3)) - 1)) == 0 &&
+      state->free_in_buffer > (size_t) nbytes) {
+    for (i = nbytes; i-- > 0; )
+      *state->next_output_byte++ = (JOCTET) (bytes >> (i << 3));
+    state->free_in_buffer -= nbytes;
+    return TRUE;
+  }
+
+  for (i = nbytes; i-- > 0; ) {
+    c = (int) ((bytes >> (i << 3)) & 0xFF);
+    emit_byte(state, c, return FALSE);
+    if (c == 0xFF) {		/* need to stuff a zero byte? */
+      emit_byte(state, 0, return FALSE);
+    }
+  }
+  return TRUE;
+}
+
+
 INLINE
 LOCAL(boolean)
 emit_bits (working_state * state, unsigned int code, int size)
 /* Emit some bits; return TRUE if successful, FALSE if must suspend */
 {
   /* This routine is heavily used, so it's worth coding tightly. */
-  register INT32 put_buffer = (INT32) code;
+  register put_buf_type put_buffer = state->cur.put_buffer;
   register int put_bits = state->cur.put_bits;
 
   /* if size is 0, caller used an invalid Huffman table entry */
   if (size == 0)
     ERREXIT(state->cinfo, JERR_HUFF_MISSING_CODE);
 
-  put_buffer &= (((INT32) 1)<<size) - 1; /* mask off any extra bits in code */
-  
+  /* mask off any extra bits in code, and append it */
+  put_buffer = (put_buffer << size) |
+	       ((put_buf_type) code & ((((put_buf_type) 1) << size) - 1));
   put_bits += size;		/* new number of bits in buffer */
-  
-  put_buffer <<= 24 - put_bits; /* align incoming bits */
 
-  put_buffer |= state->cur.put_buffer; /* and merge with old buffer contents */
-  
-  while (put_bits >= 8) {
-    int c = (int) ((put_buffer >> 16) & 0xFF);
-    
-    emit_byte(state, c, return FALSE);
-    if (c == 0xFF) {		/* need to stuff a zero byte? */
-      emit_byte(state, 0, return FALSE);
-    }
-    put_buffer <<= 8;
-    put_bits -= 8;
+  if (put_bits >= PUT_FLUSH_BITS) {
+    if (! flush_bytes(state, put_buffer, put_bits))
+      return FALSE;
+    put_bits &= 7;
   }
 
   state->cur.put_buffer = put_buffer; /* update state variables */
@@ -341,12 +392,62 @@ flush_bits (working_state * state)
 {
   if (! emit_bits(state, 0x7F, 7)) /* fill any partial byte with ones */
     return FALSE;
+  if (! flush_bytes(state, state->cur.put_buffer, state->cur.put_bits))
+    return FALSE;
   state->cur.put_buffer = 0;	/* and reset bit-buffer to empty */
   state->cur.put_bits = 0;
   return TRUE;
 }
 
 
+/* A Huffman code followed by nbits bits of value.  With a 64-bit
+ * buffer the two go in as one emit_bits call.
+ */
+
+#if PUT_BUF_SIZE == 64
+#define EMIT_CODE_VALUE(state,code,size,value,nbits,action)  \
+	{ if ((size) == 0)  \
+	    ERREXIT((state)->cinfo, JERR_HUFF_MISSING_CODE);  \
+	  if (! emit_bits(state, ((code) << (nbits)) |  \
+			  ((unsigned int) (value) & ((1U << (nbits)) - 1)),  \
+			  (size) + (nbits)))  \
+	    { action; } }
+#else
+#define EMIT_CODE_VALUE(state,code,size,value,nbits,action)  \
+	{ if (! emit_bits(state, code, size))  \
+	    { action; }  \
+	  if ((nbits) && ! emit_bits(state, (unsigned int) (value), nbits))  \
+	    { action; } }
+#endif
+
+
+/* The number of bits needed for the magnitude of a nonzero value.
+ * Count-leading-zeros does this without a loop where the compiler
+ * offers it.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+#define JPEG_NBITS_NONZERO(x)  \
+	((int) (SIZEOF(unsigned int) * 8) - __builtin_clz((unsigned int) (x)))
+#if PUT_BUF_SIZE == 64
+/* Index of the lowest set bit of a nonzero put_buf_type: */
+#define JPEG_FIRST_SET(x)  __builtin_ctzll((unsigned long long) (x))
+#endif
+#else
+#define JPEG_NBITS_NONZERO(x)  jpeg_nbits_nonzero((unsigned int) (x))
+
+LOCAL(int)
+jpeg_nbits_nonzero (unsigned int x)
+{
+  int nbits = 1;		/* there must be at least one 1 bit */
+
+  while ((x >>= 1))
+    nbits++;
+  return nbits;
+}
+#endif
+
+
 /* Encode a single block's worth of coefficients */
 
 LOCAL(boolean)
@@ -355,7 +456,10 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
 {
   register int temp, temp2;
   register int nbits;
-  register int k, r, i;
+  register int k, r, i, sign;
+#ifdef JPEG_FIRST_SET
+  register put_buf_type nonzero;	/* bit k set if coefficient k is */
+#endif
   
   /* Encode the DC coefficient difference per section F.1.2.1 */
   
@@ -369,71 +473,89 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
   }
   
   /* Find the number of bits needed for the magnitude of the coefficient */
-  nbits = 0;
-  while (temp) {
-    nbits++;
-    temp >>= 1;
-  }
+  nbits = temp ? JPEG_NBITS_NONZERO(temp) : 0;
   /* Check for out-of-range coefficient values.
    * Since we're encoding a difference, the range limit is twice as much.
    */
   if (nbits > MAX_COEF_BITS+1)
     ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
   
-  /* Emit the Huffman-coded symbol for the number of bits */
-  if (! emit_bits(state, dctbl->ehufco[nbits], dctbl->ehufsi[nbits]))
-    return FALSE;
-
-  /* Emit that number of bits of the value, if positive, */
+  /* Emit the Huffman-coded symbol for the number of bits, then */
+  /* that number of bits of the value, if positive, */
   /* or the complement of its magnitude, if negative. */
-  if (nbits)			/* emit_bits rejects calls with size 0 */
-    if (! emit_bits(state, (unsigned int) temp2, nbits))
-      return FALSE;
+  EMIT_CODE_VALUE(state, dctbl->ehufco[nbits], dctbl->ehufsi[nbits],
+		  temp2, nbits, return FALSE);
 
   /* Encode the AC coefficients per section F.1.2.2 */
   
   r = 0;			/* r = run length of zeros */
-  
-  for (k = 1; k < DCTSIZE2; k++) {
+  k = 0;
+
+#ifdef JPEG_FIRST_SET
+  /* Most AC coefficients are zero, and testing each one in turn costs
+   * a mispredicted branch whenever zeros and nonzeros alternate.  So
+   * note which are nonzero first, without branching, and then visit
+   * only those; the gaps between them are the run lengths.
+   */
+  nonzero = 0;
+  for (i = 1; i < DCTSIZE2; i++)
+    nonzero |= (put_buf_type) (block[jpeg_natural_order[i]] != 0) << i;
+#endif
+
+  for (;;) {
+#ifdef JPEG_FIRST_SET
+    if (nonzero == 0)
+      break;
+    i = JPEG_FIRST_SET(nonzero);
+    nonzero &= nonzero - 1;
+    r = i - k - 1;
+    k = i;
+    temp = block[jpeg_natural_order[k]];
+#else
+    if (++k >= DCTSIZE2)
+      break;
     if ((temp = block[jpeg_natural_order[k]]) == 0) {
       r++;
-    } else {
-      /* if run length > 15, must emit special run-length-16 codes (0xF0) */
-      while (r > 15) {
-	if (! emit_bits(state, actbl->ehufco[0xF0], actbl->ehufsi[0xF0]))
-	  return FALSE;
-	r -= 16;
-      }
-
-      temp2 = temp;
-      if (temp < 0) {
-	temp = -temp;		/* temp is abs value of input */
-	/* This code assumes we are on a two's complement machine */
-	temp2--;
-      }
-      
-      /* Find the number of bits needed for the magnitude of the coefficient */
-      nbits = 1;		/* there must be at least one 1 bit */
-      while ((temp >>= 1))
-	nbits++;
-      /* Check for out-of-range coefficient values */
-      if (nbits > MAX_COEF_BITS)
-	ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
-      
-      /* Emit Huffman symbol for run length / number of bits */
-      i = (r << 4) + nbits;
-      if (! emit_bits(state, actbl->ehufco[i], actbl->ehufsi[i]))
-	return FALSE;
+      continue;
+    }
+#endif
 
-      /* Emit that number of bits of the value, if positive, */
-      /* or the complement of its magnitude, if negative. */
-      if (! emit_bits(state, (unsigned int) temp2, nbits))
+    /* if run length > 15, must emit special run-length-16 codes (0xF0) */
+    while (r > 15) {
+      if (! emit_bits(state, actbl->ehufco[0xF0], actbl->ehufsi[0xF0]))
 	return FALSE;
-      
-      r = 0;
+      r -= 16;
     }
+
+    /* temp becomes the abs value of the input, and temp2 the input, or
+     * the input less one if negative, without a branch on the sign,
+     * which is unpredictable.  sign is 0 or all ones.  This code
+     * assumes we are on a two's complement machine.
+     */
+    sign = - (temp < 0);
+    temp2 = temp + sign;
+    temp = (temp ^ sign) - sign;
+    
+    /* Find the number of bits needed for the magnitude of the coefficient */
+    nbits = JPEG_NBITS_NONZERO(temp);
+    /* Check for out-of-range coefficient values */
+    if (nbits > MAX_COEF_BITS)
+      ERREXIT(state->cinfo, JERR_BAD_DCT_COEF);
+    
+    /* Emit Huffman symbol for run length / number of bits, then */
+    /* that number of bits of the value, if positive, */
+    /* or the complement of its magnitude, if negative. */
+    i = (r << 4) + nbits;
+    EMIT_CODE_VALUE(state, actbl->ehufco[i], actbl->ehufsi[i],
+		    temp2, nbits, return FALSE);
+    
+    r = 0;
   }
 
+#ifdef JPEG_FIRST_SET
+  r = DCTSIZE2 - 1 - k;		/* zeros after the last nonzero */
+#endif
+
   /* If the last coef(s) were zero, emit an end-of-block code */
   if (r > 0)
     if (! emit_bits(state, actbl->ehufco[0], actbl->ehufsi[0]))
@@ -443,6 +565,117 @@ encode_one_block (working_state * state, JCOEFPTR block, int last_dc_val,
 }
 
 
+/*
+ * Block splicing.  An unmodified block whose DC prediction is the same
+ * as in the source has the same coded bits as it had there, so they are
+ * copied rather than coded again.  They run from the block's recorded
+ * position to the next block's, with no marker in between, so each
+ * 0xFF byte among them is followed by a stuffed zero.
+ */
+
+/* Bits copied at once where there are no 0xFF bytes: as many whole */
+/* bytes as fit in the bit buffer alongside a partial byte */
+#define SPLICE_CHUNK_BITS  (PUT_BUF_SIZE - 8)
+
+
+LOCAL(const JOCTET *)
+splice_position (const jpeg_block_source * src, int * skip)
+/* Find the byte holding a block's first bit, and how many bits before */
+/* that one in the same byte belong to the previous block */
+{
+  const JOCTET * p = src->next_input_byte;
+  int nbytes = (src->bits_left + 7) >> 3;
+
+  /* Step back over the bytes the decoder had read ahead, and the
+   * zeros stuffed after any 0xFF among them.
+   */
+  while (nbytes-- > 0) {
+    p--;
+    if (*p == 0 && p[-1] == 0xFF)
+      p--;
+  }
+  *skip = (8 - (src->bits_left & 7)) & 7;
+  return p;
+}
+
+
+LOCAL(boolean)
+emit_chunk (working_state * state, put_buf_type bits)
+/* Emit SPLICE_CHUNK_BITS bits, first writing out whole bytes for room */
+{
+  register put_buf_type put_buffer = state->cur.put_buffer;
+  register int put_bits = state->cur.put_bits;
+
+  if (put_bits >= 8) {
+    if (! flush_bytes(state, put_buffer, put_bits))
+      return FALSE;
+    put_bits &= 7;
+  }
+  put_buffer = (put_buffer << SPLICE_CHUNK_BITS) | bits;
+  put_bits += SPLICE_CHUNK_BITS;
+  if (! flush_bytes(state, put_buffer, put_bits))
+    return FALSE;
+
+  state->cur.put_buffer = put_buffer;
+  state->cur.put_bits = put_bits & 7;
+  return TRUE;
+}
+
+
+LOCAL(boolean)
+splice_block (working_state * state, const jpeg_block_source * src)
+/* Copy the coded bits of one block, which end where src[1] begins */
+{
+  register const JOCTET * p;
+  const JOCTET * end;
+  register put_buf_type bits;
+  register int i;
+  int skip, end_bits;
+
+  p = splice_position(src, &skip);
+  end = splice_position(src + 1, &end_bits);
+
+  if (p == end) {
+    /* The whole block lies within one byte */
+    if (end_bits > skip)
+      if (! emit_bits(state, (unsigned int) (*p >> (8 - end_bits)), end_bits - skip))
+	return FALSE;
+    return TRUE;
+  }
+
+  /* The rest of the first byte; emit_bits masks off the skipped bits */
+  if (! emit_bits(state, (unsigned int) *p, 8 - skip))
+    return FALSE;
+  p += (*p == 0xFF) ? 2 : 1;
+
+  /* Whole bytes in between, a chunk at a time while there is no */
+  /* stuffed byte to drop */
+  while (p < end) {
+    if (end - p >= SPLICE_CHUNK_BITS / 8) {
+      bits = 0;
+      for (i = 0; i < SPLICE_CHUNK_BITS / 8 && p[i] != 0xFF; i++)
+	bits = (bits << 8) | (put_buf_type) p[i];
+      if (i == SPLICE_CHUNK_BITS / 8) {
+	if (! emit_chunk(state, bits))
+	  return FALSE;
+	p += i;
+	continue;
+      }
+    }
+    if (! emit_bits(state, (unsigned int) *p, 8))
+      return FALSE;
+    p += (*p == 0xFF) ? 2 : 1;
+  }
+
+  /* The start of the byte in which the next block begins */
+  if (end_bits > 0)
+    if (! emit_bits(state, (unsigned int) (*end >> (8 - end_bits)), end_bits))
+      return FALSE;
+
+  return TRUE;
+}
+
+
 /*
  * Emit a restart marker & resynchronize predictions.
  */
@@ -479,6 +712,15 @@ encode_mcu_huff (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   working_state state;
   int blkn, ci;
   jpeg_component_info * compptr;
+  const jpeg_block_source * src = NULL;
+  long navail = 0;
+  int nspliced = 0;
+
+  /* Block positions in the source, if it is to be spliced */
+  if (cinfo->splice_sources != NULL) {
+    src = cinfo->splice_sources + entropy->splice_next;
+    navail = cinfo->num_splice_sources - entropy->splice_next;
+  }
 
   /* Load up working state */
   state.next_output_byte = cinfo->dest->next_output_byte;
@@ -497,10 +739,18 @@ encode_mcu_huff (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
     ci = cinfo->MCU_membership[blkn];
     compptr = cinfo->cur_comp_info[ci];
-    if (! encode_one_block(&state,
-			   MCU_data[blkn][0], state.cur.last_dc_val[ci],
-			   entropy->dc_derived_tbls[compptr->dc_tbl_no],
-			   entropy->ac_derived_tbls[compptr->ac_tbl_no]))
+    /* Copy the block from the source if it, its DC prediction, and the */
+    /* end of its coded bits (not followed by a restart) are as they were */
+    if (blkn + 1 < navail && ! src[blkn].modified && ! src[blkn+1].restart &&
+	src[blkn].dc == MCU_data[blkn][0][0] &&
+	src[blkn].dc_pred == state.cur.last_dc_val[ci]) {
+      if (! splice_block(&state, src + blkn))
+	return FALSE;
+      nspliced++;
+    } else if (! encode_one_block(&state,
+				  MCU_data[blkn][0], state.cur.last_dc_val[ci],
+				  entropy->dc_derived_tbls[compptr->dc_tbl_no],
+				  entropy->ac_derived_tbls[compptr->ac_tbl_no]))
       return FALSE;
     /* Update last_dc_val */
     state.cur.last_dc_val[ci] = MCU_data[blkn][0][0];
@@ -510,6 +760,8 @@ encode_mcu_huff (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   cinfo->dest->next_output_byte = state.next_output_byte;
   cinfo->dest->free_in_buffer = state.free_in_buffer;
   ASSIGN_STATE(entropy->saved, state.cur);
+  entropy->splice_next += cinfo->blocks_in_MCU;
+  cinfo->splice_count += nspliced;
 
   /* Update restart-interval state too */
   if (cinfo->restart_interval) {
@@ -455,6 +455,32 @@ encode_mcu_DC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
 }
 
 
+/* As in jchuff.c, count-leading and -trailing-zeros find bit lengths
+ * and the next nonzero coefficient without a loop where the compiler
+ * offers them.  A band has at most 63 coefficients, so one 64-bit
+ * mask covers it on any machine.
+ */
+
+#if defined(__GNUC__) && (__GNUC__ > 3 || (__GNUC__ == 3 && __GNUC_MINOR__ >= 4))
+#define JPEG_NBITS_NONZERO(x)  \
+	((int) (SIZEOF(unsigned int) * 8) - __builtin_clz((unsigned int) (x)))
+#define JPEG_FIRST_SET(x)  __builtin_ctzll(x)
+typedef unsigned long long band_mask;
+#else
+#define JPEG_NBITS_NONZERO(x)  jpeg_nbits_nonzero((unsigned int) (x))
+
+LOCAL(int)
+jpeg_nbits_nonzero (unsigned int x)
+{
+  int nbits = 1;		/* there must be at least one 1 bit */
+
+  while ((x >>= 1))
+    nbits++;
+  return nbits;
+}
+#endif
+
+
 /*
  * MCU encoding for AC initial scan (either spectral selection,
  * or first pass of successive approximation).
@@ -470,6 +496,10 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   int Se = cinfo->Se;
   int Al = cinfo->Al;
   JBLOCKROW block;
+#ifdef JPEG_FIRST_SET
+  register int i, sign;
+  band_mask nonzero;		/* bit i set if coefficient Ss+i is */
+#endif
 
   entropy->next_output_byte = cinfo->dest->next_output_byte;
   entropy->free_in_buffer = cinfo->dest->free_in_buffer;
@@ -485,12 +515,38 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
   /* Encode the AC coefficients per section G.1.2.2, fig. G.3 */
   
   r = 0;			/* r = run length of zeros */
-   
-  for (k = cinfo->Ss; k <= Se; k++) {
+  k = cinfo->Ss - 1;
+
+#ifdef JPEG_FIRST_SET
+  /* Note which coefficients are nonzero after the point transform
+   * first, without branching, and then visit only those; the gaps
+   * between them are the run lengths.  Bit 0 of the mask is Ss.
+   */
+  nonzero = 0;
+  for (i = cinfo->Ss; i <= Se; i++) {
+    temp = (*block)[jpeg_natural_order[i]];
+    sign = - (temp < 0);
+    nonzero |= (band_mask) ((((temp ^ sign) - sign) >> Al) != 0) << (i - cinfo->Ss);
+  }
+#endif
+
+  for (;;) {
+#ifdef JPEG_FIRST_SET
+    if (nonzero == 0)
+      break;
+    i = cinfo->Ss + JPEG_FIRST_SET(nonzero);
+    nonzero &= nonzero - 1;
+    r = i - k - 1;
+    k = i;
+    temp = (*block)[jpeg_natural_order[k]];
+#else
+    if (++k > Se)
+      break;
     if ((temp = (*block)[jpeg_natural_order[k]]) == 0) {
       r++;
       continue;
     }
+#endif
     /* We must apply the point transform by Al.  For AC coefficients this
      * is an integer division with rounding towards 0.  To do this portably
      * in C, we shift after obtaining the absolute value; so the code is
@@ -521,9 +577,7 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     }
 
     /* Find the number of bits needed for the magnitude of the coefficient */
-    nbits = 1;			/* there must be at least one 1 bit */
-    while ((temp >>= 1))
-      nbits++;
+    nbits = JPEG_NBITS_NONZERO(temp);
     /* Check for out-of-range coefficient values */
     if (nbits > MAX_COEF_BITS)
       ERREXIT(cinfo, JERR_BAD_DCT_COEF);
@@ -538,6 +592,10 @@ encode_mcu_AC_first (j_compress_ptr cinfo, JBLOCKROW *MCU_data)
     r = 0;			/* reset zero run length */
   }
 
+#ifdef JPEG_FIRST_SET
+  r = Se - k;			/* zeros after the last nonzero */
+#endif
+
   if (r > 0) {			/* If there are trailing zeroes, */
     entropy->EOBRUN++;		/* count an EOB */
     if (entropy->EOBRUN == 0x7FFF)
@@ -157,6 +157,168 @@ ycc_rgb_convert (j_decompress_ptr cinfo,
 }
 
 
+#if defined(JSIMD) && RGB_PIXELSIZE == 3
+
+/*
+ * SIMD version of ycc_rgb_convert, selected where JSIMD allows.  Rather
+ * than look up the tables, it computes their entries as they were built,
+ * in 32-bit lanes, and saturates where the C code goes through
+ * range_limit; the sums there are always within the table.  Columns left
+ * over at the end of a row are done as above.
+ */
+
+#ifdef JSIMD_AVX2
+
+#define YCC_SIMD_COLS  16
+
+/* One channel of 8 pixels from Y and the scaled-up Cb/Cr term */
+#define YCC_CHANNEL(y, term)  _mm256_add_epi32(y, _mm256_srai_epi32(term, SCALEBITS))
+
+/* Two halves of 8 pixels to 16 samples, in order */
+JSIMD_INLINE __m128i
+ycc_pack (__m256i lo, __m256i hi)
+{
+  __m256i words = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+
+  return _mm_packus_epi16(_mm256_castsi256_si128(words),
+			  _mm256_extracti128_si256(words, 1));
+}
+
+/* Shuffles placing one channel's samples in each 16 bytes of 16
+ * interleaved pixels, by byte offset within the pixel; -1 leaves a zero.
+ */
+static const signed char ycc_interleave[3][3][16] = {
+  { { 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5 },
+    { -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1 },
+    { -1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1 } },
+  { { -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1 },
+    { 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10 },
+    { -1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1 } },
+  { { -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1 },
+    { -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1 },
+    { 10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15 } }
+};
+
+#define YCC_SHUFFLE(chan, i, offset) \
+  _mm_shuffle_epi8(chan, _mm_loadu_si128((const __m128i *) ycc_interleave[i][offset]))
+
+JSIMD_INLINE void
+ycc_rgb_simd_cols (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+		   JSAMPROW outptr)
+{
+  __m256i center = _mm256_set1_epi32(CENTERJSAMPLE);
+  __m256i y, cb, cr, red[2], green[2], blue[2];
+  __m128i r, g, b;
+  int h;
+
+  for (h = 0; h < 2; h++) {
+    y = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *) (inptr0 + 8*h)));
+    cb = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)
+							       (inptr1 + 8*h))), center);
+    cr = _mm256_sub_epi32(_mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)
+							       (inptr2 + 8*h))), center);
+    red[h] = YCC_CHANNEL(y, _mm256_add_epi32(_mm256_mullo_epi32(cr, _mm256_set1_epi32(FIX(1.40200))),
+					     _mm256_set1_epi32(ONE_HALF)));
+    green[h] = YCC_CHANNEL(y, _mm256_add_epi32(_mm256_add_epi32(
+		 _mm256_mullo_epi32(cb, _mm256_set1_epi32(- FIX(0.34414))),
+		 _mm256_mullo_epi32(cr, _mm256_set1_epi32(- FIX(0.71414)))),
+					       _mm256_set1_epi32(ONE_HALF)));
+    blue[h] = YCC_CHANNEL(y, _mm256_add_epi32(_mm256_mullo_epi32(cb, _mm256_set1_epi32(FIX(1.77200))),
+					      _mm256_set1_epi32(ONE_HALF)));
+  }
+  r = ycc_pack(red[0], red[1]);
+  g = ycc_pack(green[0], green[1]);
+  b = ycc_pack(blue[0], blue[1]);
+
+  for (h = 0; h < 3; h++)
+    _mm_storeu_si128((__m128i *) (outptr + 16*h),
+		     _mm_or_si128(_mm_or_si128(YCC_SHUFFLE(r, h, RGB_RED),
+					       YCC_SHUFFLE(g, h, RGB_GREEN)),
+				  YCC_SHUFFLE(b, h, RGB_BLUE)));
+}
+
+#else /* JSIMD_NEON */
+
+#define YCC_SIMD_COLS  8
+
+#define YCC_CHANNEL(y, term)  vaddq_s32(y, vshrq_n_s32(term, SCALEBITS))
+
+/* Two halves of 8 pixels to 8 samples */
+#define ycc_pack(lo, hi)  vqmovun_s16(vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)))
+
+JSIMD_INLINE void
+ycc_rgb_simd_cols (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW inptr2,
+		   JSAMPROW outptr)
+{
+  int16x8_t center = vdupq_n_s16(CENTERJSAMPLE);
+  int16x8_t y8, cb8, cr8;
+  int32x4_t y, cb, cr, red[2], green[2], blue[2];
+  uint8x8x3_t out;
+  int h;
+
+  y8 = vreinterpretq_s16_u16(vmovl_u8(vld1_u8(inptr0)));
+  cb8 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(inptr1))), center);
+  cr8 = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(vld1_u8(inptr2))), center);
+  for (h = 0; h < 2; h++) {
+    y = vmovl_s16(h ? vget_high_s16(y8) : vget_low_s16(y8));
+    cb = vmovl_s16(h ? vget_high_s16(cb8) : vget_low_s16(cb8));
+    cr = vmovl_s16(h ? vget_high_s16(cr8) : vget_low_s16(cr8));
+    red[h] = YCC_CHANNEL(y, vmlaq_n_s32(vdupq_n_s32(ONE_HALF), cr, FIX(1.40200)));
+    green[h] = YCC_CHANNEL(y, vmlaq_n_s32(vmlaq_n_s32(vdupq_n_s32(ONE_HALF), cb, - FIX(0.34414)),
+					  cr, - FIX(0.71414)));
+    blue[h] = YCC_CHANNEL(y, vmlaq_n_s32(vdupq_n_s32(ONE_HALF), cb, FIX(1.77200)));
+  }
+  out.val[RGB_RED] = ycc_pack(red[0], red[1]);
+  out.val[RGB_GREEN] = ycc_pack(green[0], green[1]);
+  out.val[RGB_BLUE] = ycc_pack(blue[0], blue[1]);
+  vst3_u8(outptr, out);
+}
+
+#endif /* JSIMD_AVX2 */
+
+
+JSIMD_TARGET METHODDEF(void)
+ycc_rgb_convert_simd (j_decompress_ptr cinfo,
+		      JSAMPIMAGE input_buf, JDIMENSION input_row,
+		      JSAMPARRAY output_buf, int num_rows)
+{
+  my_cconvert_ptr cconvert = (my_cconvert_ptr) cinfo->cconvert;
+  int y, cb, cr;
+  JSAMPROW outptr;
+  JSAMPROW inptr0, inptr1, inptr2;
+  JDIMENSION col;
+  JDIMENSION num_cols = cinfo->output_width;
+  JSAMPLE * range_limit = cinfo->sample_range_limit;
+  int * Crrtab = cconvert->Cr_r_tab;
+  int * Cbbtab = cconvert->Cb_b_tab;
+  INT32 * Crgtab = cconvert->Cr_g_tab;
+  INT32 * Cbgtab = cconvert->Cb_g_tab;
+  SHIFT_TEMPS
+
+  while (--num_rows >= 0) {
+    inptr0 = input_buf[0][input_row];
+    inptr1 = input_buf[1][input_row];
+    inptr2 = input_buf[2][input_row];
+    input_row++;
+    outptr = *output_buf++;
+    for (col = 0; col + YCC_SIMD_COLS <= num_cols; col += YCC_SIMD_COLS)
+      ycc_rgb_simd_cols(inptr0 + col, inptr1 + col, inptr2 + col,
+			outptr + col * RGB_PIXELSIZE);
+    for (; col < num_cols; col++) {
+      y  = GETJSAMPLE(inptr0[col]);
+      cb = GETJSAMPLE(inptr1[col]);
+      cr = GETJSAMPLE(inptr2[col]);
+      outptr[col * RGB_PIXELSIZE + RGB_RED] = range_limit[y + Crrtab[cr]];
+      outptr[col * RGB_PIXELSIZE + RGB_GREEN] =
+	range_limit[y + ((int) RIGHT_SHIFT(Cbgtab[cb] + Crgtab[cr], SCALEBITS))];
+      outptr[col * RGB_PIXELSIZE + RGB_BLUE] = range_limit[y + Cbbtab[cb]];
+    }
+  }
+}
+
+#endif /* JSIMD */
+
+
 /**************** Cases other than YCbCr -> RGB **************/
 
 
@@ -359,6 +521,10 @@ jinit_color_deconverter (j_decompress_ptr cinfo)
     cinfo->out_color_components = RGB_PIXELSIZE;
     if (cinfo->jpeg_color_space == JCS_YCbCr) {
       cconvert->pub.color_convert = ycc_rgb_convert;
+#if defined(JSIMD) && RGB_PIXELSIZE == 3
+      if (jsimd_supported())
+	cconvert->pub.color_convert = ycc_rgb_convert_simd;
+#endif
       build_ycc_rgb_table(cinfo);
     } else if (cinfo->jpeg_color_space == JCS_GRAYSCALE) {
       cconvert->pub.color_convert = gray_rgb_convert;
@@ -78,6 +78,108 @@ typedef FAST_FLOAT FLOAT_MULT_TYPE; /* preferred floating type */
 #define RANGE_MASK  (MAXJSAMPLE * 4 + 3) /* 2 bits wider than legal samples */
 
 
+/*
+ * Vector arithmetic for the SIMD islow DCTs (see JSIMD in jpegint.h).
+ * An SVEC holds INT32 lanes, which take the same values, through the same
+ * products and roundings, as the scalar code's variables: with AVX2 one
+ * vector is a whole row or column of a block, with NEON half of one.
+ * jsimd_transpose turns the rows of a block, held a vector (or, with
+ * NEON, two) to a row, into its columns.
+ */
+
+#if defined(JSIMD) && defined(DCT_ISLOW_SUPPORTED) && DCTSIZE == 8
+#define JSIMD_ISLOW
+
+#ifdef JSIMD_AVX2
+
+typedef __m256i SVEC;
+#define VADD(a,b)      _mm256_add_epi32(a, b)
+#define VSUB(a,b)      _mm256_sub_epi32(a, b)
+#define VMULC(a,c)     _mm256_mullo_epi32(a, _mm256_set1_epi32(c))
+#define VSHL(a,n)      _mm256_slli_epi32(a, n)
+#define VDESCALE(a,n)  _mm256_srai_epi32(_mm256_add_epi32(a, \
+			 _mm256_set1_epi32(1 << ((n)-1))), n)
+
+JSIMD_INLINE void
+jsimd_transpose (__m256i * d)
+{
+  __m256i t0, t1, t2, t3, t4, t5, t6, t7;
+  __m256i u0, u1, u2, u3, u4, u5, u6, u7;
+
+  t0 = _mm256_unpacklo_epi32(d[0], d[1]);
+  t1 = _mm256_unpackhi_epi32(d[0], d[1]);
+  t2 = _mm256_unpacklo_epi32(d[2], d[3]);
+  t3 = _mm256_unpackhi_epi32(d[2], d[3]);
+  t4 = _mm256_unpacklo_epi32(d[4], d[5]);
+  t5 = _mm256_unpackhi_epi32(d[4], d[5]);
+  t6 = _mm256_unpacklo_epi32(d[6], d[7]);
+  t7 = _mm256_unpackhi_epi32(d[6], d[7]);
+
+  u0 = _mm256_unpacklo_epi64(t0, t2);	/* Columns 0 and 4 of rows 0-3 */
+  u1 = _mm256_unpackhi_epi64(t0, t2);	/* 1 and 5 */
+  u2 = _mm256_unpacklo_epi64(t1, t3);	/* 2 and 6 */
+  u3 = _mm256_unpackhi_epi64(t1, t3);	/* 3 and 7 */
+  u4 = _mm256_unpacklo_epi64(t4, t6);	/* The same of rows 4-7 */
+  u5 = _mm256_unpackhi_epi64(t4, t6);
+  u6 = _mm256_unpacklo_epi64(t5, t7);
+  u7 = _mm256_unpackhi_epi64(t5, t7);
+
+  d[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+  d[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+  d[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+  d[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+  d[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+  d[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+  d[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+  d[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+}
+
+#else /* JSIMD_NEON */
+
+typedef int32x4_t SVEC;
+#define VADD(a,b)      vaddq_s32(a, b)
+#define VSUB(a,b)      vsubq_s32(a, b)
+#define VMULC(a,c)     vmulq_n_s32(a, c)
+#define VSHL(a,n)      vshlq_n_s32(a, n)
+#define VDESCALE(a,n)  vrshrq_n_s32(a, n)
+
+JSIMD_INLINE void
+jsimd_transpose4 (int32x4_t * a, int32x4_t * b, int32x4_t * c, int32x4_t * d)
+{
+  int32x4x2_t ab = vtrnq_s32(*a, *b);
+  int32x4x2_t cd = vtrnq_s32(*c, *d);
+
+  *a = vcombine_s32(vget_low_s32(ab.val[0]), vget_low_s32(cd.val[0]));
+  *b = vcombine_s32(vget_low_s32(ab.val[1]), vget_low_s32(cd.val[1]));
+  *c = vcombine_s32(vget_high_s32(ab.val[0]), vget_high_s32(cd.val[0]));
+  *d = vcombine_s32(vget_high_s32(ab.val[1]), vget_high_s32(cd.val[1]));
+}
+
+/* Columns 0-3 of each row are in lo[], and 4-7 in hi[]. */
+
+JSIMD_INLINE void
+jsimd_transpose (int32x4_t * lo, int32x4_t * hi)
+{
+  int32x4_t t;
+  int i;
+
+  jsimd_transpose4(&lo[0], &lo[1], &lo[2], &lo[3]);
+  jsimd_transpose4(&lo[4], &lo[5], &lo[6], &lo[7]);
+  jsimd_transpose4(&hi[0], &hi[1], &hi[2], &hi[3]);
+  jsimd_transpose4(&hi[4], &hi[5], &hi[6], &hi[7]);
+  /* The off-diagonal quarters trade places */
+  for (i = 0; i < 4; i++) {
+    t = lo[i+4];
+    lo[i+4] = hi[i];
+    hi[i] = t;
+  }
+}
+
+#endif /* JSIMD_AVX2 */
+
+#endif /* JSIMD_ISLOW */
+
+
 /* Short forms of external names for systems with brain-damaged linkers. */
 
 #ifdef NEED_SHORT_EXTERNAL_NAMES
@@ -85,6 +187,7 @@ typedef FAST_FLOAT FLOAT_MULT_TYPE; /* preferred floating type */
 #define jpeg_fdct_ifast		jFDifast
 #define jpeg_fdct_float		jFDfloat
 #define jpeg_idct_islow		jRDislow
+#define jpeg_idct_islow_simd	jRDislowsimd
 #define jpeg_idct_ifast		jRDifast
 #define jpeg_idct_float		jRDfloat
 #define jpeg_idct_4x4		jRD4x4
@@ -101,6 +204,11 @@ EXTERN(void) jpeg_fdct_float JPP((FAST_FLOAT * data));
 EXTERN(void) jpeg_idct_islow
     JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
 	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+#ifdef JSIMD_ISLOW
+EXTERN(void) jpeg_idct_islow_simd
+    JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
+	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
+#endif
 EXTERN(void) jpeg_idct_ifast
     JPP((j_decompress_ptr cinfo, jpeg_component_info * compptr,
 	 JCOEFPTR coef_block, JSAMPARRAY output_buf, JDIMENSION output_col));
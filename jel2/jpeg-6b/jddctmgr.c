@@ -118,6 +118,10 @@ start_pass (j_decompress_ptr cinfo)
 #ifdef DCT_ISLOW_SUPPORTED
       case JDCT_ISLOW:
 	method_ptr = jpeg_idct_islow;
+#ifdef JSIMD_ISLOW
+	if (jsimd_supported())
+	  method_ptr = jpeg_idct_islow_simd;
+#endif
 	method = JDCT_ISLOW;
 	break;
 #endif
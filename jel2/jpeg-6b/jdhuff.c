@@ -60,6 +60,7 @@ typedef struct {
 
   /* These fields are NOT loaded into local working state. */
   unsigned int restarts_to_go;	/* MCUs left in this restart interval */
+  boolean restarted;		/* TRUE until the MCU after a restart is done */
 
   /* Pointers to derived tables (these workspaces have image lifespan) */
   d_derived_tbl * dc_derived_tbls[NUM_HUFF_TBLS];
@@ -135,6 +136,11 @@ start_pass_huff_decoder (j_decompress_ptr cinfo)
 
   /* Initialize restart counter */
   entropy->restarts_to_go = cinfo->restart_interval;
+  entropy->restarted = FALSE;
+
+  /* Block positions are only recorded for single-scan files */
+  if (cinfo->block_sources != NULL && cinfo->block_source_count != 0)
+    cinfo->block_source_count = -1;
 }
 
 
@@ -263,6 +269,30 @@ jpeg_make_d_derived_tbl (j_decompress_ptr cinfo, boolean isDC, int tblno,
 	ERREXIT(cinfo, JERR_BAD_HUFF_TABLE);
     }
   }
+
+  /* Compute the combined tables from the plain lookahead tables.
+   * A code of l bits whose symbol calls for s extra bits fits if
+   * l + s <= HUFF_LOOKAHEAD, in which case the extra bits are simply
+   * the next s bits of the same table index.
+   */
+
+  for (lookbits = 0; lookbits < (1 << HUFF_LOOKAHEAD); lookbits++) {
+    int sym, r, s, extra;
+
+    dtbl->look_run[lookbits] = 0;
+    if ((l = dtbl->look_nbits[lookbits]) == 0)
+      continue;
+    sym = dtbl->look_sym[lookbits];
+    r = isDC ? 0 : sym >> 4;
+    s = isDC ? sym : sym & 15;
+    if ((s == 0 && ! isDC) || l + s > HUFF_LOOKAHEAD)
+      continue;
+    extra = (lookbits >> (HUFF_LOOKAHEAD - l - s)) & ((1 << s) - 1);
+    if (s && extra < (1 << (s-1)))	/* Figure F.12: extend sign bit */
+      extra -= (1 << s) - 1;
+    dtbl->look_val[lookbits] = (JCOEF) extra;
+    dtbl->look_run[lookbits] = (UINT8) ((r << 4) | (l + s));
+  }
 }
 
 
@@ -304,6 +334,32 @@ jpeg_fill_bit_buffer (bitread_working_state * state,
   /* We fail to do so only if we hit a marker or are forced to suspend. */
 
   if (cinfo->unread_marker == 0) {	/* cannot advance past a marker */
+#if BIT_BUF_SIZE == 64
+    /* Fast path: if the next eight bytes are all in the buffer and none
+     * of them is 0xFF, there is no stuffing or marker to deal with, and
+     * as many of them as fit can be shifted in at once.  Otherwise the
+     * byte-at-a-time loop below takes care of it.
+     */
+    if (bits_left < MIN_GET_BITS && bytes_in_buffer >= 8) {
+      register bit_buf_type w = 0, t;
+      register int i, nbytes;
+
+      for (i = 0; i < 8; i++)
+	w = (w << 8) | GETJOCTET(next_input_byte[i]);
+      t = ~w;			/* 0xFF bytes become zero bytes */
+      if (((t - (bit_buf_type) 0x0101010101010101) & ~t &
+	   (bit_buf_type) 0x8080808080808080) == 0) {
+	nbytes = (BIT_BUF_SIZE - bits_left) >> 3;
+	if (nbytes == 8)
+	  get_buffer = w;
+	else
+	  get_buffer = (get_buffer << (nbytes << 3)) | (w >> ((8 - nbytes) << 3));
+	bits_left += nbytes << 3;
+	next_input_byte += nbytes;
+	bytes_in_buffer -= nbytes;
+      }
+    }
+#endif
     while (bits_left < MIN_GET_BITS) {
       register int c;
 
@@ -485,6 +541,7 @@ process_restart (j_decompress_ptr cinfo)
 
   /* Reset restart counter */
   entropy->restarts_to_go = cinfo->restart_interval;
+  entropy->restarted = TRUE;
 
   /* Reset out-of-data flag, unless read_restart_marker left us smack up
    * against a marker.  In that case we will end up treating the next data
@@ -520,6 +577,9 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   int blkn;
   BITREAD_STATE_VARS;
   savable_state state;
+  jpeg_block_source * sources;
+  long * dc_count = NULL;
+  long * ac_count = NULL;
 
   /* Process restart marker if needed; may have to suspend */
   if (cinfo->restart_interval) {
@@ -537,6 +597,16 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
     BITREAD_LOAD_STATE(cinfo,entropy->bitstate);
     ASSIGN_STATE(state, entropy->saved);
 
+    /* Find where this MCU's block positions go, if they are wanted */
+    sources = NULL;
+    if (cinfo->block_sources != NULL && cinfo->block_source_count >= 0) {
+      if (cinfo->block_source_count + cinfo->blocks_in_MCU <=
+	  cinfo->max_block_sources)
+	sources = cinfo->block_sources + cinfo->block_source_count;
+      else
+	cinfo->block_source_count = -1;
+    }
+
     /* Outer loop handles each block in the MCU */
 
     for (blkn = 0; blkn < cinfo->blocks_in_MCU; blkn++) {
@@ -545,15 +615,44 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
       d_derived_tbl * actbl = entropy->ac_cur_tbls[blkn];
       register int s, k, r;
 
+      if (cinfo->symbol_counts != NULL) {
+	jpeg_symbol_counts * counts = cinfo->symbol_counts +
+	  cinfo->cur_comp_info[cinfo->MCU_membership[blkn]]->component_index;
+	dc_count = counts->dc;
+	ac_count = counts->ac;
+      }
+
+      if (sources != NULL) {
+	/* Once the bit buffer has read up to the marker that ends the
+	 * data, the marker and its fill bytes lie behind next_input_byte.
+	 */
+	sources[blkn].next_input_byte = br_state.next_input_byte;
+	if (cinfo->unread_marker != 0) {
+	  sources[blkn].next_input_byte--;
+	  while (sources[blkn].next_input_byte[-1] == 0xFF)
+	    sources[blkn].next_input_byte--;
+	}
+	sources[blkn].bits_left = (UINT8) bits_left;
+	sources[blkn].restart = (UINT8) (blkn == 0 && entropy->restarted);
+	sources[blkn].modified = 0;
+	sources[blkn].dc = 0;
+	sources[blkn].dc_pred =
+	  (JCOEF) state.last_dc_val[cinfo->MCU_membership[blkn]];
+      }
+
       /* Decode a single block's worth of coefficients */
 
       /* Section F.2.2.1: decode the DC coefficient difference */
+      HUFF_DECODE_FAST(s, r, br_state, dctbl, dc_count, return FALSE, dc_done);
       HUFF_DECODE(s, br_state, dctbl, return FALSE, label1);
+      if (dc_count != NULL)
+	dc_count[s]++;
       if (s) {
 	CHECK_BIT_BUFFER(br_state, s, return FALSE);
 	r = GET_BITS(s);
 	s = HUFF_EXTEND(r, s);
       }
+    dc_done:
 
       if (entropy->dc_needed[blkn]) {
 	/* Convert DC difference to actual value, update last_dc_val */
@@ -562,6 +661,8 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	state.last_dc_val[ci] = s;
 	/* Output the DC coefficient (assumes jpeg_natural_order[0] = 0) */
 	(*block)[0] = (JCOEF) s;
+	if (sources != NULL)
+	  sources[blkn].dc = (JCOEF) s;
       }
 
       if (entropy->ac_needed[blkn]) {
@@ -569,7 +670,10 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	/* Section F.2.2.2: decode the AC coefficients */
 	/* Since zeroes are skipped, output area must be cleared beforehand */
 	for (k = 1; k < DCTSIZE2; k++) {
+	  HUFF_DECODE_FAST(s, r, br_state, actbl, ac_count, return FALSE, ac_fast);
 	  HUFF_DECODE(s, br_state, actbl, return FALSE, label2);
+	  if (ac_count != NULL)
+	    ac_count[s]++;
       
 	  r = s >> 4;
 	  s &= 15;
@@ -589,6 +693,11 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	      break;
 	    k += 15;
 	  }
+	  continue;
+
+	ac_fast:
+	  k += r;
+	  (*block)[jpeg_natural_order[k]] = (JCOEF) s;
 	}
 
       } else {
@@ -596,7 +705,10 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	/* Section F.2.2.2: decode the AC coefficients */
 	/* In this path we just discard the values */
 	for (k = 1; k < DCTSIZE2; k++) {
+	  HUFF_DECODE_FAST(s, r, br_state, actbl, ac_count, return FALSE, skip_fast);
 	  HUFF_DECODE(s, br_state, actbl, return FALSE, label3);
+	  if (ac_count != NULL)
+	    ac_count[s]++;
       
 	  r = s >> 4;
 	  s &= 15;
@@ -610,6 +722,10 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	      break;
 	    k += 15;
 	  }
+	  continue;
+
+	skip_fast:
+	  k += r;
 	}
 
       }
@@ -618,8 +734,15 @@ decode_mcu (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
     /* Completed MCU, so update state */
     BITREAD_SAVE_STATE(cinfo,entropy->bitstate);
     ASSIGN_STATE(entropy->saved, state);
+    if (sources != NULL)
+      cinfo->block_source_count += cinfo->blocks_in_MCU;
   }
 
+  /* Blocks that were never in the file cannot be copied from it */
+  if (entropy->pub.insufficient_data && cinfo->block_sources != NULL)
+    cinfo->block_source_count = -1;
+  entropy->restarted = FALSE;
+
   /* Account for restart interval (no-op if not using restarts) */
   entropy->restarts_to_go--;
 
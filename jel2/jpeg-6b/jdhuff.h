@@ -21,7 +21,7 @@
 
 /* Derived data constructed for each Huffman table */
 
-#define HUFF_LOOKAHEAD	8	/* # of bits of lookahead */
+#define HUFF_LOOKAHEAD	10	/* # of bits of lookahead */
 
 typedef struct {
   /* Basic tables: (element [0] of each array is unused) */
@@ -43,6 +43,15 @@ typedef struct {
    */
   int look_nbits[1<<HUFF_LOOKAHEAD]; /* # bits, or 0 if too long */
   UINT8 look_sym[1<<HUFF_LOOKAHEAD]; /* symbol, or unused */
+
+  /* Combined lookahead tables (see HUFF_DECODE_FAST): if a code and
+   * the extra bits that follow it both fit in HUFF_LOOKAHEAD bits,
+   * these give the decoded coefficient (or DC difference) directly.
+   * look_run holds run << 4 | total bits, and is 0 if it does not fit;
+   * AC codes with no extra bits (EOB, ZRL) are never entered here.
+   */
+  UINT8 look_run[1<<HUFF_LOOKAHEAD]; /* zero run << 4 | # bits, or 0 */
+  JCOEF look_val[1<<HUFF_LOOKAHEAD]; /* coefficient value, or unused */
 } d_derived_tbl;
 
 /* Expand a Huffman table definition into the derived format */
@@ -69,15 +78,21 @@ EXTERN(void) jpeg_make_d_derived_tbl
  * necessary.
  */
 
+/* On machines with 64-bit words, a 64-bit buffer needs refilling only
+ * about half as often, and each refill can take up to eight bytes at
+ * once.  Unfortunately we can't define the size with something like
+ * #define BIT_BUF_SIZE (sizeof(bit_buf_type)*8) because not all machines
+ * measure sizeof in 8-bit bytes, so the 64-bit case is chosen from the
+ * usual data-model macros.
+ */
+
+#if defined(_LP64) || defined(__LP64__) || defined(_WIN64)
+typedef size_t bit_buf_type;	/* type of bit-extraction buffer */
+#define BIT_BUF_SIZE  64	/* size of buffer in bits */
+#else
 typedef INT32 bit_buf_type;	/* type of bit-extraction buffer */
 #define BIT_BUF_SIZE  32	/* size of buffer in bits */
-
-/* If long is > 32 bits on your machine, and shifting/masking longs is
- * reasonably fast, making bit_buf_type be long and setting BIT_BUF_SIZE
- * appropriately should be a win.  Unfortunately we can't define the size
- * with something like  #define BIT_BUF_SIZE (sizeof(bit_buf_type)*8)
- * because not all machines measure sizeof in 8-bit bytes.
- */
+#endif
 
 typedef struct {		/* Bitreading state saved across MCUs */
   bit_buf_type get_buffer;	/* current bit-extraction buffer */
@@ -195,6 +210,34 @@ slowlabel: \
   } \
 }
 
+/*
+ * The sequential decoder, and the progressive one outside EOB runs and
+ * correction bits, consult the combined tables first.  If the next
+ * code and its extra bits are in them, HUFF_DECODE_FAST consumes both,
+ * leaves the value in result and the zero run in run, and jumps to
+ * donelabel; otherwise it falls through to the usual HUFF_DECODE path
+ * with nothing consumed.  If count is not NULL, the symbol decoded is
+ * added to it.
+ */
+
+#define HUFF_DECODE_FAST(result,run,state,htbl,count,failaction,donelabel) \
+{ register int look, rb; \
+  if (bits_left < HUFF_LOOKAHEAD) { \
+    if (! jpeg_fill_bit_buffer(&state,get_buffer,bits_left, 0)) {failaction;} \
+    get_buffer = state.get_buffer; bits_left = state.bits_left; \
+  } \
+  if (bits_left >= HUFF_LOOKAHEAD) { \
+    look = PEEK_BITS(HUFF_LOOKAHEAD); \
+    if ((rb = htbl->look_run[look]) != 0) { \
+      DROP_BITS(rb & 15); \
+      run = rb >> 4; \
+      result = htbl->look_val[look]; \
+      if ((count) != NULL) (count)[htbl->look_sym[look]]++; \
+      goto donelabel; \
+    } \
+  } \
+}
+
 /* Out-of-line case for Huffman code fetching */
 EXTERN(int) jpeg_huff_decode
 	JPP((bitread_working_state * state, register bit_buf_type get_buffer,
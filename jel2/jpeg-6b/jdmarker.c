@@ -356,6 +356,22 @@ get_sos (j_decompress_ptr cinfo)
   TRACEMS4(cinfo, 1, JTRC_SOS_PARAMS, cinfo->Ss, cinfo->Se,
 	   cinfo->Ah, cinfo->Al);
 
+  /* Record the scan, if the application asked for the script */
+  if (cinfo->scan_script != NULL && cinfo->scan_script_count >= 0) {
+    if (cinfo->scan_script_count < cinfo->max_scan_script) {
+      jpeg_scan_info * scanptr = cinfo->scan_script + cinfo->scan_script_count++;
+
+      scanptr->comps_in_scan = n;
+      for (i = 0; i < n; i++)
+	scanptr->component_index[i] = cinfo->cur_comp_info[i]->component_index;
+      scanptr->Ss = cinfo->Ss;
+      scanptr->Se = cinfo->Se;
+      scanptr->Ah = cinfo->Ah;
+      scanptr->Al = cinfo->Al;
+    } else
+      cinfo->scan_script_count = -1;
+  }
+
   /* Prepare to scan data & restart markers */
   cinfo->marker->next_restart_num = 0;
 
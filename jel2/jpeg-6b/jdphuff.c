@@ -322,12 +322,14 @@ decode_mcu_DC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
       /* Decode a single block's worth of coefficients */
 
       /* Section F.2.2.1: decode the DC coefficient difference */
+      HUFF_DECODE_FAST(s, r, br_state, tbl, (long *) NULL, return FALSE, dc_done);
       HUFF_DECODE(s, br_state, tbl, return FALSE, label1);
       if (s) {
 	CHECK_BIT_BUFFER(br_state, s, return FALSE);
 	r = GET_BITS(s);
 	s = HUFF_EXTEND(r, s);
       }
+    dc_done:
 
       /* Convert DC difference to actual value, update last_dc_val */
       s += state.last_dc_val[ci];
@@ -392,6 +394,7 @@ decode_mcu_AC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
       tbl = entropy->ac_derived_tbl;
 
       for (k = cinfo->Ss; k <= Se; k++) {
+	HUFF_DECODE_FAST(s, r, br_state, tbl, (long *) NULL, return FALSE, ac_fast);
 	HUFF_DECODE(s, br_state, tbl, return FALSE, label2);
 	r = s >> 4;
 	s &= 15;
@@ -416,6 +419,11 @@ decode_mcu_AC_first (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	    break;		/* force end-of-band */
 	  }
 	}
+	continue;
+
+      ac_fast:
+	k += r;
+	(*block)[jpeg_natural_order[k]] = (JCOEF) (s << Al);
       }
 
       BITREAD_SAVE_STATE(cinfo,entropy->bitstate);
@@ -502,6 +510,8 @@ decode_mcu_AC_refine (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
   d_derived_tbl * tbl;
   int num_newnz;
   int newnz_pos[DCTSIZE2];
+  int num_nz, nbits, bits, i, j;
+  int nz_pos[DCTSIZE2+1];
 
   /* Process restart marker if needed; may have to suspend */
   if (cinfo->restart_interval) {
@@ -535,6 +545,8 @@ decode_mcu_AC_refine (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 
     if (EOBRUN == 0) {
       for (; k <= Se; k++) {
+	/* The combined tables give a size-1 code and its sign bit as +-1 */
+	HUFF_DECODE_FAST(s, r, br_state, tbl, (long *) NULL, goto undoit, refine_fast);
 	HUFF_DECODE(s, br_state, tbl, goto undoit, label3);
 	r = s >> 4;
 	s &= 15;
@@ -543,9 +555,9 @@ decode_mcu_AC_refine (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	    WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
 	  CHECK_BIT_BUFFER(br_state, 1, goto undoit);
 	  if (GET_BITS(1))
-	    s = p1;		/* newly nonzero coef is positive */
+	    s = 1;		/* newly nonzero coef is positive */
 	  else
-	    s = m1;		/* newly nonzero coef is negative */
+	    s = -1;		/* newly nonzero coef is negative */
 	} else {
 	  if (r != 15) {
 	    EOBRUN = 1 << r;	/* EOBr, run length is 2^r + appended bits */
@@ -558,6 +570,9 @@ decode_mcu_AC_refine (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	  }
 	  /* note s = 0 for processing ZRL */
 	}
+      refine_fast:
+	if (s > 1 || s < -1)	/* a larger size from the combined tables */
+	  WARNMS(cinfo, JWRN_HUFF_BAD_CODE);
 	/* Advance over already-nonzero coefs and r still-zero coefs,
 	 * appending correction bits to the nonzeroes.  A correction bit is 1
 	 * if the absolute value of the coefficient must be increased.
@@ -583,7 +598,7 @@ decode_mcu_AC_refine (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
 	if (s) {
 	  int pos = jpeg_natural_order[k];
 	  /* Output newly nonzero coefficient */
-	  (*block)[pos] = (JCOEF) s;
+	  (*block)[pos] = (JCOEF) (s > 0 ? p1 : m1);
 	  /* Remember its position in case we have to suspend */
 	  newnz_pos[num_newnz++] = pos;
 	}
@@ -596,18 +611,26 @@ decode_mcu_AC_refine (j_decompress_ptr cinfo, JBLOCKROW *MCU_data)
        * bit to each already-nonzero coefficient.  A correction bit is 1
        * if the absolute value of the coefficient must be increased.
        */
+      /* Most positions are still zero, and where the nonzero ones fall
+       * is unpredictable; so first list the nonzero ones without a branch
+       * per position, then take their correction bits up to 16 at a time.
+       */
+      num_nz = 0;
       for (; k <= Se; k++) {
-	thiscoef = *block + jpeg_natural_order[k];
-	if (*thiscoef != 0) {
-	  CHECK_BIT_BUFFER(br_state, 1, goto undoit);
-	  if (GET_BITS(1)) {
-	    if ((*thiscoef & p1) == 0) { /* do nothing if already changed it */
-	      if (*thiscoef >= 0)
-		*thiscoef += p1;
-	      else
-		*thiscoef += m1;
-	    }
-	  }
+	nz_pos[num_nz] = jpeg_natural_order[k];
+	num_nz += ((*block)[jpeg_natural_order[k]] != 0);
+      }
+      for (i = 0; i < num_nz; i += nbits) {
+	nbits = num_nz - i;
+	if (nbits > 16)
+	  nbits = 16;
+	CHECK_BIT_BUFFER(br_state, nbits, goto undoit);
+	bits = GET_BITS(nbits);
+	for (j = nbits - 1; j >= 0; j--) {
+	  thiscoef = *block + nz_pos[i + nbits - 1 - j];
+	  /* do nothing if already changed it */
+	  if (((bits >> j) & 1) && (*thiscoef & p1) == 0)
+	    *thiscoef += (*thiscoef >= 0) ? p1 : m1;
 	}
       }
       /* Count one block completed in EOB run */
@@ -391,6 +391,182 @@ h2v2_fancy_upsample (j_decompress_ptr cinfo, jpeg_component_info * compptr,
 }
 
 
+#ifdef JSIMD
+
+/*
+ * SIMD versions of the two fancy upsamplers above.  Away from the ends of
+ * a row, each output sample is the same weighted sum of its input sample
+ * and one neighbour, so a vector of input columns is done at once, in 16
+ * bits; the end columns and what is left over are done as above.
+ * UPSAMPLE_SIMD_COLS input columns are read at a time, along with the
+ * column on each side of them.
+ */
+
+#ifdef JSIMD_AVX2
+
+#define UPSAMPLE_SIMD_COLS  16
+
+#define LOAD16(ptr)  _mm256_cvtepu8_epi16(_mm_loadu_si128((const __m128i *) (ptr)))
+
+/* Even and odd outputs, both 0..MAXJSAMPLE, interleave as the bytes of
+ * 16-bit lanes.
+ */
+#define STORE_INTERLEAVED(ptr, even, odd) \
+  _mm256_storeu_si256((__m256i *) (ptr), \
+		      _mm256_or_si256(even, _mm256_slli_epi16(odd, 8)))
+
+JSIMD_INLINE void
+h2v1_fancy_simd_cols (JSAMPROW inptr, JSAMPROW outptr)
+{
+  __m256i invalue = _mm256_mullo_epi16(LOAD16(inptr), _mm256_set1_epi16(3));
+
+  STORE_INTERLEAVED(outptr,
+    _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(invalue, LOAD16(inptr - 1)),
+				       _mm256_set1_epi16(1)), 2),
+    _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(invalue, LOAD16(inptr + 1)),
+				       _mm256_set1_epi16(2)), 2));
+}
+
+JSIMD_INLINE void
+h2v2_fancy_simd_cols (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW outptr)
+{
+  __m256i three = _mm256_set1_epi16(3);
+  __m256i thiscolsum, lastcolsum, nextcolsum;
+
+  thiscolsum = _mm256_add_epi16(_mm256_mullo_epi16(LOAD16(inptr0), three), LOAD16(inptr1));
+  lastcolsum = _mm256_add_epi16(_mm256_mullo_epi16(LOAD16(inptr0 - 1), three),
+				LOAD16(inptr1 - 1));
+  nextcolsum = _mm256_add_epi16(_mm256_mullo_epi16(LOAD16(inptr0 + 1), three),
+				LOAD16(inptr1 + 1));
+  thiscolsum = _mm256_mullo_epi16(thiscolsum, three);
+
+  STORE_INTERLEAVED(outptr,
+    _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(thiscolsum, lastcolsum),
+				       _mm256_set1_epi16(8)), 4),
+    _mm256_srli_epi16(_mm256_add_epi16(_mm256_add_epi16(thiscolsum, nextcolsum),
+				       _mm256_set1_epi16(7)), 4));
+}
+
+#else /* JSIMD_NEON */
+
+#define UPSAMPLE_SIMD_COLS  8
+
+#define LOAD16(ptr)  vmovl_u8(vld1_u8(ptr))
+
+#define STORE_INTERLEAVED(ptr, even, odd) \
+  { uint8x8x2_t out_; \
+    out_.val[0] = vmovn_u16(even); \
+    out_.val[1] = vmovn_u16(odd); \
+    vst2_u8(ptr, out_); }
+
+JSIMD_INLINE void
+h2v1_fancy_simd_cols (JSAMPROW inptr, JSAMPROW outptr)
+{
+  uint16x8_t invalue = vmulq_n_u16(LOAD16(inptr), 3);
+
+  STORE_INTERLEAVED(outptr,
+    vshrq_n_u16(vaddq_u16(vaddq_u16(invalue, LOAD16(inptr - 1)), vdupq_n_u16(1)), 2),
+    vshrq_n_u16(vaddq_u16(vaddq_u16(invalue, LOAD16(inptr + 1)), vdupq_n_u16(2)), 2));
+}
+
+JSIMD_INLINE void
+h2v2_fancy_simd_cols (JSAMPROW inptr0, JSAMPROW inptr1, JSAMPROW outptr)
+{
+  uint16x8_t thiscolsum, lastcolsum, nextcolsum;
+
+  thiscolsum = vmlaq_n_u16(LOAD16(inptr1), LOAD16(inptr0), 3);
+  lastcolsum = vmlaq_n_u16(LOAD16(inptr1 - 1), LOAD16(inptr0 - 1), 3);
+  nextcolsum = vmlaq_n_u16(LOAD16(inptr1 + 1), LOAD16(inptr0 + 1), 3);
+  thiscolsum = vmulq_n_u16(thiscolsum, 3);
+
+  STORE_INTERLEAVED(outptr,
+    vshrq_n_u16(vaddq_u16(vaddq_u16(thiscolsum, lastcolsum), vdupq_n_u16(8)), 4),
+    vshrq_n_u16(vaddq_u16(vaddq_u16(thiscolsum, nextcolsum), vdupq_n_u16(7)), 4));
+}
+
+#endif /* JSIMD_AVX2 */
+
+
+JSIMD_TARGET METHODDEF(void)
+h2v1_fancy_upsample_simd (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+			  JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  JSAMPARRAY output_data = *output_data_ptr;
+  JSAMPROW inptr, outptr;
+  int invalue;
+  JDIMENSION col, width = compptr->downsampled_width;
+  int inrow;
+
+  for (inrow = 0; inrow < cinfo->max_v_samp_factor; inrow++) {
+    inptr = input_data[inrow];
+    outptr = output_data[inrow];
+    /* Special case for first column */
+    invalue = GETJSAMPLE(inptr[0]);
+    outptr[0] = (JSAMPLE) invalue;
+    outptr[1] = (JSAMPLE) ((invalue * 3 + GETJSAMPLE(inptr[1]) + 2) >> 2);
+
+    for (col = 1; col + UPSAMPLE_SIMD_COLS < width; col += UPSAMPLE_SIMD_COLS)
+      h2v1_fancy_simd_cols(inptr + col, outptr + 2 * col);
+    for (; col < width - 1; col++) {
+      invalue = GETJSAMPLE(inptr[col]) * 3;
+      outptr[2 * col] = (JSAMPLE) ((invalue + GETJSAMPLE(inptr[col-1]) + 1) >> 2);
+      outptr[2 * col + 1] = (JSAMPLE) ((invalue + GETJSAMPLE(inptr[col+1]) + 2) >> 2);
+    }
+
+    /* Special case for last column */
+    invalue = GETJSAMPLE(inptr[col]);
+    outptr[2 * col] = (JSAMPLE) ((invalue * 3 + GETJSAMPLE(inptr[col-1]) + 1) >> 2);
+    outptr[2 * col + 1] = (JSAMPLE) invalue;
+  }
+}
+
+
+JSIMD_TARGET METHODDEF(void)
+h2v2_fancy_upsample_simd (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+			  JSAMPARRAY input_data, JSAMPARRAY * output_data_ptr)
+{
+  JSAMPARRAY output_data = *output_data_ptr;
+  JSAMPROW inptr0, inptr1, outptr;
+  int thiscolsum, lastcolsum, nextcolsum;
+  JDIMENSION col, width = compptr->downsampled_width;
+  int inrow, outrow, v;
+
+  inrow = outrow = 0;
+  while (outrow < cinfo->max_v_samp_factor) {
+    for (v = 0; v < 2; v++) {
+      /* inptr0 points to nearest input row, inptr1 points to next nearest */
+      inptr0 = input_data[inrow];
+      inptr1 = input_data[v == 0 ? inrow-1 : inrow+1];
+      outptr = output_data[outrow++];
+
+      /* Special case for first column */
+      thiscolsum = GETJSAMPLE(inptr0[0]) * 3 + GETJSAMPLE(inptr1[0]);
+      nextcolsum = GETJSAMPLE(inptr0[1]) * 3 + GETJSAMPLE(inptr1[1]);
+      outptr[0] = (JSAMPLE) ((thiscolsum * 4 + 8) >> 4);
+      outptr[1] = (JSAMPLE) ((thiscolsum * 3 + nextcolsum + 7) >> 4);
+
+      for (col = 1; col + UPSAMPLE_SIMD_COLS < width; col += UPSAMPLE_SIMD_COLS)
+	h2v2_fancy_simd_cols(inptr0 + col, inptr1 + col, outptr + 2 * col);
+      lastcolsum = GETJSAMPLE(inptr0[col-1]) * 3 + GETJSAMPLE(inptr1[col-1]);
+      thiscolsum = GETJSAMPLE(inptr0[col]) * 3 + GETJSAMPLE(inptr1[col]);
+      for (; col < width - 1; col++) {
+	nextcolsum = GETJSAMPLE(inptr0[col+1]) * 3 + GETJSAMPLE(inptr1[col+1]);
+	outptr[2 * col] = (JSAMPLE) ((thiscolsum * 3 + lastcolsum + 8) >> 4);
+	outptr[2 * col + 1] = (JSAMPLE) ((thiscolsum * 3 + nextcolsum + 7) >> 4);
+	lastcolsum = thiscolsum; thiscolsum = nextcolsum;
+      }
+
+      /* Special case for last column */
+      outptr[2 * col] = (JSAMPLE) ((thiscolsum * 3 + lastcolsum + 8) >> 4);
+      outptr[2 * col + 1] = (JSAMPLE) ((thiscolsum * 4 + 7) >> 4);
+    }
+    inrow++;
+  }
+}
+
+#endif /* JSIMD */
+
+
 /*
  * Module initialization routine for upsampling.
  */
@@ -447,15 +623,23 @@ jinit_upsampler (j_decompress_ptr cinfo)
     } else if (h_in_group * 2 == h_out_group &&
 	       v_in_group == v_out_group) {
       /* Special cases for 2h1v upsampling */
-      if (do_fancy && compptr->downsampled_width > 2)
+      if (do_fancy && compptr->downsampled_width > 2) {
 	upsample->methods[ci] = h2v1_fancy_upsample;
-      else
+#ifdef JSIMD
+	if (jsimd_supported())
+	  upsample->methods[ci] = h2v1_fancy_upsample_simd;
+#endif
+      } else
 	upsample->methods[ci] = h2v1_upsample;
     } else if (h_in_group * 2 == h_out_group &&
 	       v_in_group * 2 == v_out_group) {
       /* Special cases for 2h2v upsampling */
       if (do_fancy && compptr->downsampled_width > 2) {
 	upsample->methods[ci] = h2v2_fancy_upsample;
+#ifdef JSIMD
+	if (jsimd_supported())
+	  upsample->methods[ci] = h2v2_fancy_upsample_simd;
+#endif
 	upsample->pub.need_context_rows = TRUE;
       } else
 	upsample->methods[ci] = h2v2_upsample;
@@ -386,4 +386,227 @@ jpeg_idct_islow (j_decompress_ptr cinfo, jpeg_component_info * compptr,
   }
 }
 
+
+#ifdef JSIMD_ISLOW
+
+/*
+ * SIMD version of the above, selected by jddctmgr.c where JSIMD allows.
+ * The passes are the same arithmetic on a row of lanes at a time, but in
+ * 32 bits, where INT32 may be wider.  That is exact for every block whose
+ * dequantized coefficients are within IDCT_SIMD_LIMIT: bounding each
+ * intermediate by the sum of the magnitudes of its terms, none can then
+ * reach 2^31 (the largest allowed would be 1173), and so neither can
+ * the short cuts for zero columns and rows change a result.  Every block
+ * an 8-bit encoder writes is within it - the largest DCT coefficient of
+ * 8-bit samples is 1024, and quantization rounds by at most 128 - and
+ * any other block goes to jpeg_idct_islow.
+ */
+
+#define IDCT_SIMD_LIMIT  1152
+
+/*
+ * One 1-D pass over d[0..7], with jpeg_idct_islow's names, leaving the
+ * outputs undescaled.
+ */
+
+JSIMD_INLINE void
+idct_simd_pass (SVEC * d)
+{
+  SVEC tmp0, tmp1, tmp2, tmp3;
+  SVEC tmp10, tmp11, tmp12, tmp13;
+  SVEC z1, z2, z3, z4, z5;
+
+  /* Even part */
+  z2 = d[2];
+  z3 = d[6];
+  z1 = VMULC(VADD(z2, z3), FIX_0_541196100);
+  tmp2 = VADD(z1, VMULC(z3, - FIX_1_847759065));
+  tmp3 = VADD(z1, VMULC(z2, FIX_0_765366865));
+
+  tmp0 = VSHL(VADD(d[0], d[4]), CONST_BITS);
+  tmp1 = VSHL(VSUB(d[0], d[4]), CONST_BITS);
+
+  tmp10 = VADD(tmp0, tmp3);
+  tmp13 = VSUB(tmp0, tmp3);
+  tmp11 = VADD(tmp1, tmp2);
+  tmp12 = VSUB(tmp1, tmp2);
+
+  /* Odd part */
+  tmp0 = d[7];
+  tmp1 = d[5];
+  tmp2 = d[3];
+  tmp3 = d[1];
+
+  z1 = VADD(tmp0, tmp3);
+  z2 = VADD(tmp1, tmp2);
+  z3 = VADD(tmp0, tmp2);
+  z4 = VADD(tmp1, tmp3);
+  z5 = VMULC(VADD(z3, z4), FIX_1_175875602);
+
+  tmp0 = VMULC(tmp0, FIX_0_298631336);
+  tmp1 = VMULC(tmp1, FIX_2_053119869);
+  tmp2 = VMULC(tmp2, FIX_3_072711026);
+  tmp3 = VMULC(tmp3, FIX_1_501321110);
+  z1 = VMULC(z1, - FIX_0_899976223);
+  z2 = VMULC(z2, - FIX_2_562915447);
+  z3 = VMULC(z3, - FIX_1_961570560);
+  z4 = VMULC(z4, - FIX_0_390180644);
+
+  z3 = VADD(z3, z5);
+  z4 = VADD(z4, z5);
+
+  tmp0 = VADD(tmp0, VADD(z1, z3));
+  tmp1 = VADD(tmp1, VADD(z2, z4));
+  tmp2 = VADD(tmp2, VADD(z2, z3));
+  tmp3 = VADD(tmp3, VADD(z1, z4));
+
+  d[0] = VADD(tmp10, tmp3);
+  d[7] = VSUB(tmp10, tmp3);
+  d[1] = VADD(tmp11, tmp2);
+  d[6] = VSUB(tmp11, tmp2);
+  d[2] = VADD(tmp12, tmp1);
+  d[5] = VSUB(tmp12, tmp1);
+  d[3] = VADD(tmp13, tmp0);
+  d[4] = VSUB(tmp13, tmp0);
+}
+
+/* The final descale, and range_limit[x & RANGE_MASK] as arithmetic: the
+ * mask wraps x into -512..511, and the table clamps that to a sample.
+ * Here x is left offset by CENTERJSAMPLE, for the caller to saturate.
+ */
+
+#define IDCT_SIMD_WRAP(x) \
+  VSUB(VAND(VADD(VDESCALE(x, CONST_BITS+PASS1_BITS+3), VSET(RANGE_MASK/2 + 1)), \
+	    VSET(RANGE_MASK)), VSET(RANGE_MASK/2 + 1 - CENTERJSAMPLE))
+
+
+#ifdef JSIMD_AVX2
+
+#define VAND(a,b)  _mm256_and_si256(a, b)
+#define VSET(c)    _mm256_set1_epi32(c)
+
+JSIMD_TARGET GLOBAL(void)
+jpeg_idct_islow_simd (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  __m256i d[DCTSIZE];
+  __m256i q, big, packed;
+  int i;
+
+  /* Dequantize, a row of the block to a vector */
+  big = _mm256_setzero_si256();
+  for (i = 0; i < DCTSIZE; i++) {
+    if (SIZEOF(ISLOW_MULT_TYPE) == 2)
+      q = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *) (quantptr + i*DCTSIZE)));
+    else
+      q = _mm256_loadu_si256((const __m256i *) (quantptr + i*DCTSIZE));
+    d[i] = _mm256_mullo_epi32(q, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)
+						       (coef_block + i*DCTSIZE))));
+    big = _mm256_or_si256(big, _mm256_cmpgt_epi32(_mm256_abs_epi32(d[i]),
+						  _mm256_set1_epi32(IDCT_SIMD_LIMIT)));
+  }
+  if (! _mm256_testz_si256(big, big)) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: columns, a lane each */
+  idct_simd_pass(d);
+  for (i = 0; i < DCTSIZE; i++)
+    d[i] = VDESCALE(d[i], CONST_BITS-PASS1_BITS);
+
+  /* Pass 2: rows, a lane each */
+  jsimd_transpose(d);
+  idct_simd_pass(d);
+  for (i = 0; i < DCTSIZE; i++)
+    d[i] = IDCT_SIMD_WRAP(d[i]);
+  jsimd_transpose(d);
+
+  /* Saturate to samples, four rows at a time */
+  for (i = 0; i < DCTSIZE; i += 4) {
+    packed = _mm256_packus_epi16(_mm256_packs_epi32(d[i], d[i+1]),
+				 _mm256_packs_epi32(d[i+2], d[i+3]));
+    packed = _mm256_permutevar8x32_epi32(packed, _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7));
+    _mm_storel_epi64((__m128i *) (output_buf[i] + output_col),
+		     _mm256_castsi256_si128(packed));
+    _mm_storel_epi64((__m128i *) (output_buf[i+1] + output_col),
+		     _mm_srli_si128(_mm256_castsi256_si128(packed), 8));
+    _mm_storel_epi64((__m128i *) (output_buf[i+2] + output_col),
+		     _mm256_extracti128_si256(packed, 1));
+    _mm_storel_epi64((__m128i *) (output_buf[i+3] + output_col),
+		     _mm_srli_si128(_mm256_extracti128_si256(packed, 1), 8));
+  }
+}
+
+#else /* JSIMD_NEON */
+
+#define VAND(a,b)  vandq_s32(a, b)
+#define VSET(c)    vdupq_n_s32(c)
+
+GLOBAL(void)
+jpeg_idct_islow_simd (j_decompress_ptr cinfo, jpeg_component_info * compptr,
+		      JCOEFPTR coef_block,
+		      JSAMPARRAY output_buf, JDIMENSION output_col)
+{
+  ISLOW_MULT_TYPE * quantptr = (ISLOW_MULT_TYPE *) compptr->dct_table;
+  int32x4_t lo[DCTSIZE], hi[DCTSIZE];
+  int32x4_t qlo, qhi, limit = vdupq_n_s32(IDCT_SIMD_LIMIT);
+  int16x8_t coefs;
+  uint32x4_t big;
+  uint32x2_t big2;
+  int i;
+
+  /* Dequantize, a row of the block to a pair of vectors */
+  big = vdupq_n_u32(0);
+  for (i = 0; i < DCTSIZE; i++) {
+    if (SIZEOF(ISLOW_MULT_TYPE) == 2) {
+      int16x8_t q = vld1q_s16((const int16_t *) (quantptr + i*DCTSIZE));
+      qlo = vmovl_s16(vget_low_s16(q));
+      qhi = vmovl_s16(vget_high_s16(q));
+    } else {
+      qlo = vld1q_s32((const int32_t *) (quantptr + i*DCTSIZE));
+      qhi = vld1q_s32((const int32_t *) (quantptr + i*DCTSIZE + 4));
+    }
+    coefs = vld1q_s16(coef_block + i*DCTSIZE);
+    lo[i] = vmulq_s32(qlo, vmovl_s16(vget_low_s16(coefs)));
+    hi[i] = vmulq_s32(qhi, vmovl_s16(vget_high_s16(coefs)));
+    big = vorrq_u32(big, vorrq_u32(vcgtq_s32(vabsq_s32(lo[i]), limit),
+				   vcgtq_s32(vabsq_s32(hi[i]), limit)));
+  }
+  big2 = vorr_u32(vget_low_u32(big), vget_high_u32(big));
+  if (vget_lane_u32(vpmax_u32(big2, big2), 0)) {
+    jpeg_idct_islow(cinfo, compptr, coef_block, output_buf, output_col);
+    return;
+  }
+
+  /* Pass 1: columns, a lane each */
+  idct_simd_pass(lo);
+  idct_simd_pass(hi);
+  for (i = 0; i < DCTSIZE; i++) {
+    lo[i] = VDESCALE(lo[i], CONST_BITS-PASS1_BITS);
+    hi[i] = VDESCALE(hi[i], CONST_BITS-PASS1_BITS);
+  }
+
+  /* Pass 2: rows, a lane each */
+  jsimd_transpose(lo, hi);
+  idct_simd_pass(lo);
+  idct_simd_pass(hi);
+  for (i = 0; i < DCTSIZE; i++) {
+    lo[i] = IDCT_SIMD_WRAP(lo[i]);
+    hi[i] = IDCT_SIMD_WRAP(hi[i]);
+  }
+  jsimd_transpose(lo, hi);
+
+  /* Saturate to samples */
+  for (i = 0; i < DCTSIZE; i++)
+    vst1_u8(output_buf[i] + output_col,
+	    vqmovun_s16(vcombine_s16(vqmovn_s32(lo[i]), vqmovn_s32(hi[i]))));
+}
+
+#endif /* JSIMD_AVX2 */
+
+#endif /* JSIMD_ISLOW */
+
 #endif /* DCT_ISLOW_SUPPORTED */
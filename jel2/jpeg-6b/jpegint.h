@@ -382,6 +382,36 @@ extern const int jpeg_zigzag_order[]; /* natural coef order to zigzag order */
 #endif
 extern const int jpeg_natural_order[]; /* zigzag coef order to natural order */
 
+/*
+ * SIMD.  Some inner loops (the islow DCTs, fancy upsampling and YCbCr->RGB
+ * conversion) have AVX2 and NEON versions, which give exactly the samples
+ * and coefficients of the C code.  AVX2 is used only if the CPU turns out
+ * to have it; NEON is part of every CPU the compiler will target it for.
+ * Define NO_SIMD to leave them out.
+ */
+
+#ifndef NO_SIMD
+#if BITS_IN_JSAMPLE == 8 && defined(HAVE_UNSIGNED_CHAR) && defined(__GNUC__)
+#if (__GNUC__ >= 5 || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define JSIMD_AVX2
+#define JSIMD_TARGET  __attribute__((target("avx2")))
+#define jsimd_supported()  (__builtin_cpu_supports("avx2") ? TRUE : FALSE)
+#include <immintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define JSIMD_NEON
+#define JSIMD_TARGET
+#define jsimd_supported()  TRUE
+#include <arm_neon.h>
+#endif
+#endif
+#endif
+
+#if defined(JSIMD_AVX2) || defined(JSIMD_NEON)
+#define JSIMD
+/* For helpers, which must be inlined into their JSIMD_TARGET callers */
+#define JSIMD_INLINE  JSIMD_TARGET static __inline__ __attribute__((always_inline))
+#endif
+
 /* Suppress undefined-structure complaints if necessary. */
 
 #ifdef INCOMPLETE_TYPES_BROKEN
@@ -201,6 +201,60 @@ struct jpeg_marker_struct {
   /* the marker length word is not counted in data_length or original_length */
 };
 
+/* Where one block of a sequential Huffman-coded scan begins in the
+ * source.  A transcoder can have the decompressor record these, in scan
+ * order, and pass them to the compressor, which then copies the coded
+ * bits of every block not marked as modified rather than coding it
+ * again.  The output must use the source's Huffman tables, and the data
+ * source must keep the whole scan in memory until compression is done.
+ * (This is a local extension to the IJG library.)
+ */
+
+#define JPEG_BLOCK_SPLICING	/* so applications can test for it */
+
+typedef struct {
+  const JOCTET FAR * next_input_byte; /* decoder's input position */
+  JCOEF dc;			/* the block's DC coefficient */
+  JCOEF dc_pred;		/* DC prediction it was coded against */
+  UINT8 bits_left;		/* bits before next_input_byte not yet used */
+  UINT8 restart;		/* TRUE if a restart marker precedes the block */
+  UINT8 modified;		/* set by the application if it changed the block */
+} jpeg_block_source;
+
+/* How often each Huffman symbol of one component was decoded from a
+ * sequential Huffman-coded source.  A transcoder that writes most of
+ * the coefficients back unchanged can adjust these for the blocks it
+ * changes, and build optimal tables for its output from them with
+ * jpeg_gen_optimal_table, instead of having the compressor make a
+ * statistics pass over every block first.
+ * (This is a local extension to the IJG library.)
+ */
+
+#define JPEG_SYMBOL_COUNTS	/* so applications can test for it */
+
+typedef struct {
+  long dc[257];			/* jpeg_gen_optimal_table wants 257 entries */
+  long ac[257];
+} jpeg_symbol_counts;
+
+/* The decompressor can also record its source's scan sequence (see
+ * scan_script below), which a transcoder can give the compressor as
+ * scan_info to write its output with the same scans.
+ * (This is a local extension to the IJG library.)
+ */
+
+#define JPEG_SCAN_SCRIPT	/* so applications can test for it */
+
+/* The compressor can hand back its quantized coefficients instead of
+ * coding them (see coef_capture below), so that a transcoder starting
+ * from pixels can change them and write them with
+ * jpeg_write_coefficients, coding each block only once.
+ * (This is a local extension to the IJG library.)
+ */
+
+#define JPEG_COEF_CAPTURE	/* so applications can test for it */
+
+
 /* Known color spaces. */
 
 typedef enum {
@@ -389,6 +443,24 @@ struct jpeg_compress_struct {
 
   int Ss, Se, Ah, Al;		/* progressive JPEG parameters for scan */
 
+  /* Block splicing: if splice_sources is not NULL, the Huffman encoder
+   * copies each unmodified block it can from the source instead of
+   * coding it, and counts those in splice_count.
+   */
+  const jpeg_block_source * splice_sources;
+  long num_splice_sources;	/* # of entries in splice_sources */
+  long splice_count;		/* # of blocks copied in the last scan */
+
+  /* Coefficient capture: if coef_capture is not NULL while a single-scan
+   * compression without a statistics pass runs, the coefficient controller
+   * stores every component's quantized blocks, edge padding included,
+   * in these arrays instead of coding them, and the scan written is
+   * empty.  The application sets it after jpeg_start_compress, when the
+   * components' sizes are known, to arrays as jpeg_read_coefficients
+   * would make them, already realized.
+   */
+  struct jvirt_barray_control ** coef_capture; /* jvirt_barray_ptr * */
+
   /*
    * Links to compression subobjects (methods and private variables of modules)
    */
@@ -613,6 +685,33 @@ struct jpeg_decompress_struct {
    */
   int unread_marker;
 
+  /* Block splicing: if block_sources is not NULL, the Huffman decoder
+   * records where each block of the scan begins, for at most
+   * max_block_sources blocks.  block_source_count becomes -1 if there
+   * is more than one scan, too many blocks or too little data, since
+   * the records are then no use for splicing.
+   */
+  jpeg_block_source * block_sources;
+  long max_block_sources;	/* # of entries allocated by the application */
+  long block_source_count;	/* # of entries filled in, or -1 */
+
+  /* Symbol statistics: if symbol_counts is not NULL, it holds one entry
+   * per component, indexed by component_index, and the sequential
+   * Huffman decoder adds each symbol it decodes to its component's.
+   * The application must zero the entries beforehand.
+   */
+  jpeg_symbol_counts * symbol_counts;
+
+  /* Scan script: if scan_script is not NULL, the marker reader records
+   * each SOS it reads there, for at most max_scan_script scans.
+   * scan_script_count becomes -1 if there are more.  The application
+   * sets scan_script before jpeg_read_header, which reads the first SOS,
+   * and zeroes scan_script_count.
+   */
+  jpeg_scan_info * scan_script;
+  int max_scan_script;		/* # of entries allocated by the application */
+  int scan_script_count;	/* # of entries filled in, or -1 */
+
   /*
    * Links to decompression subobjects (methods, private variables of modules)
    */
@@ -847,6 +946,7 @@ typedef JMETHOD(boolean, jpeg_marker_parser_method, (j_decompress_ptr cinfo));
 #define jpeg_suppress_tables	jSuppressTables
 #define jpeg_alloc_quant_table	jAlcQTable
 #define jpeg_alloc_huff_table	jAlcHTable
+#define jpeg_gen_optimal_table	jGenOptTbl
 #define jpeg_start_compress	jStrtCompress
 #define jpeg_write_scanlines	jWrtScanlines
 #define jpeg_finish_compress	jFinCompress
@@ -931,6 +1031,9 @@ EXTERN(void) jpeg_suppress_tables JPP((j_compress_ptr cinfo,
 				       boolean suppress));
 EXTERN(JQUANT_TBL *) jpeg_alloc_quant_table JPP((j_common_ptr cinfo));
 EXTERN(JHUFF_TBL *) jpeg_alloc_huff_table JPP((j_common_ptr cinfo));
+/* Optimal Huffman table for the given symbol counts (see jchuff.c) */
+EXTERN(void) jpeg_gen_optimal_table JPP((j_compress_ptr cinfo,
+					 JHUFF_TBL * htbl, long freq[]));
 
 /* Main entry points for compression */
 EXTERN(void) jpeg_start_compress JPP((j_compress_ptr cinfo,
@@ -3,6 +3,7 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <pthread.h>
 
 #include "ecc.h"
 #include "jel/ijel-ecc.h"
@@ -23,24 +24,24 @@
 #define HACK 2
 
 /*
- * Converts the plaintext message in msg into ecc-encoded blocks.
- * Each block's first byte is a length, followed by at most 255 bytes.
+ * There is no mutable state at file scope: the block length comes
+ * from the caller's jel_config on every call, the rscode scratch
+ * arrays are per thread, and the galois tables are filled in exactly
+ * once, whichever thread gets here first.
  */
-static int init = 1;
-static int block_len = BLOCKLEN;
-static int max_mlen = BLOCKLEN-NPAR;
+static pthread_once_t ecc_once = PTHREAD_ONCE_INIT;
 
 
-int ijel_set_ecc_blocklen(int new_len) {
-  block_len = new_len;
-  max_mlen = block_len - NPAR;
-  // printf("ijel_set_ecc_blocklen:  block_len = %d, max_mlen = %d\n", block_len, max_mlen);
-  return max_mlen;
+static void ijel_init_ecc(void) {
+  pthread_once(&ecc_once, initialize_ecc);
 }
 
 
+/*
+ * The block length used by a freshly initialized jel_config.
+ */
 int ijel_get_ecc_blocklen() {
-  return block_len;
+  return BLOCKLEN;
 }
 
 
@@ -65,17 +66,14 @@ int ijel_get_ecc_blocklen() {
 
 
 
-unsigned char *ijel_encode_ecc(unsigned char *msg, int msglen, int *outlen) {
+unsigned char *ijel_encode_ecc(int block_len, unsigned char *msg, int msglen, int *outlen) {
+  int max_mlen = block_len - NPAR;
   int n_out, in_len, nblocks, i, msgchunk;
   unsigned char message[256];
   unsigned char *out, *next_out;
   unsigned char *in;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
+  ijel_init_ecc();
   
   /* This is the max number of bytes of message that we will put in
    * each block, EXCLUSIVE of length and parity: */
@@ -142,18 +140,15 @@ unsigned char *ijel_encode_ecc(unsigned char *msg, int msglen, int *outlen) {
  * ecc-encoded data buffer.  Caller must free when done.
  */
 
-unsigned char *ijel_decode_ecc(unsigned char *ecc, int ecclen, int *msglen) {
+unsigned char *ijel_decode_ecc(int block_len, unsigned char *ecc, int ecclen, int *msglen) {
+  int max_mlen = block_len - NPAR;
   int mlen, nblocks, in_len, i, k; //n_out, 
   unsigned char *out=NULL, *next_out=NULL;
   unsigned char *limit;
   unsigned char *in=NULL;
   int done = 0;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
+  ijel_init_ecc();
 
   /* 
    * The size of ECC-encoded data, ecclen, must be a multiple of block_len,
@@ -236,7 +231,8 @@ unsigned char *ijel_decode_ecc(unsigned char *ecc, int ecclen, int *msglen) {
  * that space, and then compute the number of bytes of message that
  * can be supported with ECC.  This is always less than 'nbytes'.
  */
-int ijel_capacity_ecc(int nbytes) {
+int ijel_capacity_ecc(int block_len, int nbytes) {
+  int max_mlen = block_len - NPAR;
   int num_ecc_blocks = (nbytes / block_len);  /* conservative estimate */
 
   return num_ecc_blocks * (max_mlen-1);  /* We can fit this many plaintext bytes AFTER RS coding. */
@@ -253,7 +249,8 @@ int ijel_capacity_ecc(int nbytes) {
  * was ijel_ecc_length
  */
 
-int ijel_message_ecc_length(int msglen, int embed_len) {
+int ijel_message_ecc_length(int block_len, int msglen, int embed_len) {
+  int max_mlen = block_len - NPAR;
   assert( embed_len == 0 || embed_len == 1 );
   /* If embed_len is 1, then we are embedding length in each block.
    * If 0, then we are not embedding the length.  */
@@ -277,7 +274,7 @@ int ijel_message_ecc_length(int msglen, int embed_len) {
  * After reading 'nbytes' bytes to be decoded, ceiling that up to a
  * length that is a multiple of the ECC block length:
  */
-int ijel_ecc_block_length(int nbytes) {
+int ijel_ecc_block_length(int block_len, int nbytes) {
   int nblocks = nbytes / block_len;
   if (nbytes % block_len > 0) nblocks++;
 
@@ -299,6 +296,8 @@ int ijel_ecc_sanity_check(unsigned char *msg, int msglen) {
   int msgchunk = 80 + NPAR < buffer_sz ? 80 : buffer_sz - NPAR;
   int xor = 0;
 
+  ijel_init_ecc();
+
   memcpy(buffer1, msg, (size_t) msgchunk);
   encode_data(buffer1, msgchunk, buffer2);
   decode_data(buffer2, msgchunk+NPAR);
@@ -324,7 +323,7 @@ int ijel_ecc_sanity_check(unsigned char *msg, int msglen) {
  * when length is treated as a shared secret in the ECC case:
  */
 
-unsigned char *ijel_encode_ecc_nolength(unsigned char *msg, int msglen, int *outlen) {
+unsigned char *ijel_encode_ecc_nolength(int block_len, unsigned char *msg, int msglen, int *outlen) {
   /* Ok, secretly this is identical to ijel_encode_ecc.  We reserve
      the right to modify it though, e.g., to eliminate the length
      byte. */
@@ -332,12 +331,9 @@ unsigned char *ijel_encode_ecc_nolength(unsigned char *msg, int msglen, int *out
   unsigned char message[256];
   unsigned char *out, *next_out;
   unsigned char *in;
+  int max_mlen = block_len - NPAR;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
+  ijel_init_ecc();
 
   /* This is the max number of bytes of message that we will put in
    * each block, EXCLUSIVE of length and parity: */
@@ -403,18 +399,15 @@ unsigned char *ijel_encode_ecc_nolength(unsigned char *msg, int msglen, int *out
  * ecc-encoded data buffer.  Caller must free when done.
  */
 
-unsigned char *ijel_decode_ecc_nolength(unsigned char *ecc, int ecclen, int length) {
+unsigned char *ijel_decode_ecc_nolength(int block_len, unsigned char *ecc, int ecclen, int length) {
   int nblocks, in_len, i, k; //n_out, 
   int msgchunk;
   int plain_len;
   unsigned char *out, *next_out;
   unsigned char *in;
+  int max_mlen = block_len - NPAR;
 
-  if (init) {
-    /* make the race as short as possible */
-    init = 0;
-    initialize_ecc();
-  }
+  ijel_init_ecc();
 
   /* 
    * The size of ECC-encoded data, ecclen, must be a multiple of block_len,
@@ -992,7 +992,7 @@ unsigned char *ijel_maybe_init_ecc(jel_config *cfg, unsigned char *raw_msg, int
       /* iam asks: why do we carry on regardless? */
     }
     
-    message = ijel_encode_ecc(raw_msg,  raw_msg_len, &i);
+    message = ijel_encode_ecc(cfg->ecc_blocklen, raw_msg,  raw_msg_len, &i);
 
     if (!message) {
       message = raw_msg; /* No ecc */
@@ -1818,7 +1818,7 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
      */
     int truek;
     unsigned char *raw = 0;
-    truek = ijel_ecc_block_length(msg_nbytes);
+    truek = ijel_ecc_block_length(cfg->ecc_blocklen, msg_nbytes);
     JEL_LOG(cfg, 2, "ijel_unstuff_message: truek = %d, k = %d, %d\n", truek, k, msg_nbytes);
 	  
 
@@ -1835,7 +1835,7 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
     
     /* If we are not embedding length, then plaintext length is a
      * shared secret and we pass it: */
-    raw = ijel_decode_ecc(message,  truek, &i);
+    raw = ijel_decode_ecc(cfg->ecc_blocklen, message,  truek, &i);
 
     /* 'raw' is a newly-allocated buffer.  When should it be freed?? */
     if (raw) {
@@ -15,6 +15,8 @@
 #include "jel/jel.h"
 #include "jel/ijel-ecc.h"
 #include "jel/ijel.h"
+#include "jel/ijel-arena.h"
+#include "jel/ijel-stats.h"
 
 // #define BITS_TO_PRINT 1024
 #define BITS_TO_PRINT 0
@@ -200,14 +202,20 @@ int jelbs_copy_message(jelbs *dst, char *src, int n) {
 }
 
 jelbs *jelbs_create(jel_config *cfg, int size) {
-  /* Creates and returns a bit stream object from a requested message size. */
-  jelbs* obj = (jelbs*) calloc(1, sizeof(jelbs));
+  /* Creates and returns a bit stream object from a requested message
+   * size, or NULL if out of memory. */
+  jelbs* obj = (jelbs*) ijel_scratch_alloc(cfg, sizeof(jelbs));
+  if (!obj) return NULL;
   obj->cfg = cfg;
   
   obj->msgsize = size;
   //  obj->bufsize = 2*size + 1;  // Provide ample space just in case.
   obj->bufsize = 4*size;  // Provide ample space just in case.
-  obj->msg = calloc(1, (unsigned int) obj->bufsize);
+  obj->msg = ijel_scratch_alloc(cfg, (size_t) obj->bufsize);
+  if (!obj->msg) {
+    ijel_scratch_free(cfg, obj);
+    return NULL;
+  }
   JEL_LOG(cfg, 2, "jelbs_create: size=%d, allocated %d bytes.\n", size, obj->bufsize);
   jelbs_reset(obj);
   return obj;
@@ -218,8 +226,9 @@ jelbs *jelbs_create(jel_config *cfg, int size) {
  * been allocated by the jelbs API. */
 void jelbs_destroy(jelbs **obj) {
   if ( *obj ) {
-    if ( (*obj)->msg ) free((*obj)->msg);
-    free(*obj);
+    jel_config *cfg = (*obj)->cfg;
+    if ( (*obj)->msg ) ijel_scratch_free(cfg, (*obj)->msg);
+    ijel_scratch_free(cfg, *obj);
     *obj = NULL;
   }
 }
@@ -500,26 +509,17 @@ int *ijel_permute_freqs( jel_config *cfg ) {
  *
  */
 int ijel_max_mcus(jel_config *cfg, int component) {
-  /* Returns the number of admissible MCUs */
+  /* Returns the number of admissible MCUs.  This only depends on the
+   * block dimensions of the component, so it works as soon as the
+   * source header has been read - no coefficients are needed. */
   struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
   struct jpeg_compress_struct *dinfo = &(cfg->dstinfo);
-  jvirt_barray_ptr *coef_arrays = cfg->coefs;
   jel_freq_spec *fspec = &(cfg->freqs);
 
-  /* This could use some cleanup to make sure that we really need all
-   * these variables! */
   int compnum = component; /* Component (0 = luminance, 1 = U, 2 = V) */
-  /* need to be able to know what went wrong in deployments */
-  //  int debug = (cfg->logger != NULL);
-  int blk_y, bheight, bwidth, offset_y, i, j;
-  int mcu_count = 0;
-  //  JDIMENSION blocknum, MCU_cols;
-  JDIMENSION blocknum;
-  jvirt_barray_ptr comp_array = coef_arrays[compnum];
+  int bheight, bwidth, vsamp, i, j;
   jpeg_component_info *compptr;
   JQUANT_TBL *qtable;
-  //  JCOEF *mcu;
-  //JBLOCKARRAY row_ptrs;
 
   /* If not already specified, find a set of frequencies suitable for
      embedding 8 bits per MCU.  Use the destination object, NOT cinfo,
@@ -544,33 +544,23 @@ int ijel_max_mcus(jel_config *cfg, int component) {
     JEL_LOG(cfg, 2, "]\n");
   }
 
-
-  bheight = (int) cinfo->comp_info[compnum].height_in_blocks;
-  bwidth = (int) cinfo->comp_info[compnum].width_in_blocks;
+  /* Grayscale sources have no chroma to count: */
+  if (compnum >= cinfo->num_components) return 0;
 
   compptr = cinfo->comp_info + compnum;
+  bheight = (int) compptr->height_in_blocks;
+  bwidth = (int) compptr->width_in_blocks;
+  vsamp = compptr->v_samp_factor;
 
-  /* Now we walk through the MCUs of the JPEG image. */
-  for (blk_y = 0; blk_y < bheight; blk_y += compptr->v_samp_factor) {
-
-    /* row_ptrs = */ ( (cinfo)->mem->access_virt_barray ) 
-      ((j_common_ptr) cinfo,
-       comp_array,
-       (JDIMENSION) blk_y,
-       (JDIMENSION) compptr->v_samp_factor,
-       TRUE);
-
-    for (offset_y = 0; offset_y < compptr->v_samp_factor;  offset_y++) {
-
-      for (blocknum=0; blocknum < (JDIMENSION) bwidth; blocknum++) mcu_count++;
-    }
-  }
-  
-  return mcu_count;
+  /* The MCU walk covers whole iMCU rows of v_samp_factor block rows,
+   * bwidth blocks each, so the last partial row counts in full: */
+  return ((bheight + vsamp - 1) / vsamp) * vsamp * bwidth;
 }
 
 
 
+static int ijel_destroy_mcu_map(jel_config *cfg);
+
 static
 int ijel_create_mcu_map(jel_config *cfg, int compnum) {
   int i, max_mcus;
@@ -579,9 +569,14 @@ int ijel_create_mcu_map(jel_config *cfg, int compnum) {
   max_mcus = ijel_max_mcus(cfg, compnum); // only component 0 for now
   cfg->maxmcus =  max_mcus;
 
-  cfg->mcu_list = (unsigned int*) calloc(1, sizeof(unsigned int) * (size_t) max_mcus);
-  cfg->mcu_flag = (unsigned char*) calloc(1, sizeof(unsigned char) * (size_t) max_mcus);
-  cfg->dc_values = (unsigned int*) calloc(1, sizeof(unsigned int) * (size_t) max_mcus);
+  cfg->mcu_list = (unsigned int*) ijel_scratch_alloc(cfg, sizeof(unsigned int) * (size_t) max_mcus);
+  cfg->mcu_flag = (unsigned char*) ijel_scratch_alloc(cfg, sizeof(unsigned char) * (size_t) max_mcus);
+  cfg->dc_values = (unsigned int*) ijel_scratch_alloc(cfg, sizeof(unsigned int) * (size_t) max_mcus);
+  if (!cfg->mcu_list || !cfg->mcu_flag || !cfg->dc_values) {
+    JEL_LOG(cfg, 1, "ijel_create_mcu_map: out of memory for %d MCUs.\n", max_mcus);
+    ijel_destroy_mcu_map(cfg);
+    return JEL_ERR_NOMEM;
+  }
 
   
   for (i = 0; i < max_mcus; i++) {
@@ -599,6 +594,7 @@ int ijel_create_mcu_map(jel_config *cfg, int compnum) {
 static
 int ijel_select_mcus( jel_config *cfg, int compnum ) {
   int i, j, n, tmp;
+  double t0 = IJEL_STATS_START(cfg);
 
   JEL_LOG(cfg, 3, "ijel_select_mcus maxmcus = %d, number of MCUs to use = %d, seed = %d\n",
 	  cfg->maxmcus, cfg->nmcus, cfg->seed);
@@ -607,7 +603,10 @@ int ijel_select_mcus( jel_config *cfg, int compnum ) {
 
   if (!cfg->mcu_list) {
     i = ijel_create_mcu_map( cfg, compnum );
-    if ( i != cfg->maxmcus ) return 0;
+    if ( i != cfg->maxmcus ) {
+      IJEL_STATS_STOP(cfg, select_usec, t0);
+      return 0;
+    }
   }
 
   for (i = 0; i < n; i++) {
@@ -658,6 +657,7 @@ int ijel_select_mcus( jel_config *cfg, int compnum ) {
     JEL_LOG(cfg, 3, "ijel_select_mcus: prn call count after = %d\n", cfg->prn_cache->ncalls);
 #endif
   }
+  IJEL_STATS_STOP(cfg, select_usec, t0);
   return cfg->nmcus;
 }
 
@@ -743,13 +743,13 @@ int ijel_destroy_mcu_map(jel_config *cfg) {
 
   cfg->maxmcus =  0;
 
-  free(cfg->mcu_list);
+  ijel_scratch_free(cfg, cfg->mcu_list);
   cfg->mcu_list = NULL;
 
-  free(cfg->mcu_flag);
+  ijel_scratch_free(cfg, cfg->mcu_flag);
   cfg->mcu_flag = NULL;
 
-  free(cfg->dc_values);
+  ijel_scratch_free(cfg, cfg->dc_values);
   cfg->dc_values = NULL;
 
   return(1);
@@ -1068,7 +1068,7 @@ unsigned char *ijel_maybe_init_ecc(jel_config *cfg, unsigned char *raw_msg, int
       /* iam asks: why do we carry on regardless? */
     }
     
-    message = ijel_encode_ecc(raw_msg,  raw_msg_len, &i);
+    message = ijel_encode_ecc(cfg->ecc_blocklen, raw_msg,  raw_msg_len, &i);
 
     if (!message) {
       message = raw_msg; /* No ecc */
@@ -1265,14 +1265,25 @@ int ijel_insert_bits(jel_config *cfg,  jelbs *stream, JCOEF *mcu) {
 }
 
 
+/*
+ * Goes to the config's logger rather than stdout, one row per line,
+ * so that concurrent embeds on different configs do not interleave.
+ */
 static void maybe_describe_mcu(jel_config *cfg, JCOEF *mcu, int all_mcus, int nm, char* when) {
+  char row[8*12+1];
+  int i, j, n;
+
   // If debug_mcu is -2, that indicates that we should dump all
   // MCUs.
   if (  cfg->debug_mcu == -2 || (cfg->mcu_flag[ all_mcus ] && cfg->debug_mcu == nm) ) {
-    if (cfg->mcu_flag[ all_mcus ]) printf("===== %s embedding: MCU %d (ACTIVE) =====\n", when, all_mcus);
-    else printf("===== %s embedding: MCU %d  =====\n", when, all_mcus);
-    ijel_print_mcu(cfg, mcu, 1);
-    printf("^^^^^^^^^^^^^^^^^^\n");
+    if (cfg->mcu_flag[ all_mcus ]) jel_log(cfg, "===== %s embedding: MCU %d (ACTIVE) =====\n", when, all_mcus);
+    else jel_log(cfg, "===== %s embedding: MCU %d  =====\n", when, all_mcus);
+    for (i = 0; i < 8; i++) {
+      for (j = 0, n = 0; j < 8; j++)
+        n += snprintf(row + n, sizeof(row) - (size_t) n, "%4d ", (int) mcu[8*i+j]);
+      jel_log(cfg, "%s\n", row);
+    }
+    jel_log(cfg, "^^^^^^^^^^^^^^^^^^\n");
   }
 }
 
@@ -1317,6 +1328,7 @@ int ijel_stuff_message(jel_config *cfg, int chan) {
   /* ECC variables: */
   unsigned char *raw = cfg->data_ptr[chan];
   int ecc = 0;
+  double t0;
   int plain_len = 0;
 
   /* This could use some cleanup to make sure that we really need all
@@ -1332,6 +1344,9 @@ int ijel_stuff_message(jel_config *cfg, int chan) {
   JQUANT_TBL *qtable;
   JCOEF *mcu;
   JBLOCKARRAY row_ptrs;
+  JBLOCK before;                /* An MCU as it was, to see if it changed */
+  int splicing = ijel_splice_active(cfg);
+  int counting = ijel_huff_active(cfg);
   // int count;
 
   /* If we explicitly set the output quality, then this will be
@@ -1356,7 +1371,9 @@ int ijel_stuff_message(jel_config *cfg, int chan) {
   plain_len = msglen; /* Save the plaintext length */
 
   /* Check to see if we want ECC turned on - potential leakage here? */
+  t0 = IJEL_STATS_START(cfg);
   message = ijel_maybe_init_ecc(cfg, raw, &msglen, &ecc);
+  IJEL_STATS_STOP(cfg, ecc_usec, t0);
 
   /* If needed, message and msglen have now been updated to reflect
      ECC-related expansion. */
@@ -1364,6 +1381,10 @@ int ijel_stuff_message(jel_config *cfg, int chan) {
   /* Use the length of the message to create a bitstream, then copy
    * message into the bitstream */
   bs = jelbs_create(cfg, msglen);
+  if (!bs) {
+    if (ecc) free(message);
+    return JEL_ERR_NOMEM;
+  }
   jelbs_copy_message(bs, (char*) message, msglen);
   jelbs_set_msgsize(bs, msglen);
   jelbs_set_density(bs, (unsigned char) cfg->mcu_density);
@@ -1447,10 +1468,11 @@ int ijel_stuff_message(jel_config *cfg, int chan) {
   }
 
   // This can't be done before we understand the image parameters:
-  if (!ijel_create_mcu_map(cfg, compnum)) {
+  if ((i = ijel_create_mcu_map(cfg, compnum)) <= 0) {
     jel_log(cfg, "ijel_stuff_message: Was not able to initialize the MCU map.  Density = %d\n", cfg->mcu_density);
     jelbs_destroy(&bs);
-    return JEL_ERR_CREATE_MCU;
+    if (ecc) free(message);
+    return i < 0 ? i : JEL_ERR_CREATE_MCU;
   }
 
   // Initialize state for bit stuffing:
@@ -1505,7 +1527,7 @@ int ijel_stuff_message(jel_config *cfg, int chan) {
       for (blocknum=0; blocknum < (JDIMENSION) bwidth; blocknum++) {
 #if USE_PRN_CACHE
 	JEL_LOG(cfg, 4, "MCU %8d (%c): prn calls=%d \n", all_mcus, cfg->mcu_flag[all_mcus] ? '*' : 'x', cfg->prn_cache->ncalls);
-else
+#else
 	JEL_LOG(cfg, 4, "MCU %8d (%c): ", all_mcus, cfg->mcu_flag[all_mcus] ? '*' : 'x');
 #endif
 	if (cfg->seed) ijel_permute_freqs(cfg);
@@ -1518,6 +1540,7 @@ else
 	  if (cfg->mcu_flag[ all_mcus ]) nm++;
 	
 	  if (jel_verbose) maybe_describe_mcu(cfg, mcu, all_mcus, nm, "Before");
+	  if (splicing || counting) memcpy(before, mcu, sizeof(JBLOCK));
 
 	  if (!first) nb = ijel_insert_bits(cfg, bs, mcu);
 	  else {
@@ -1532,6 +1555,11 @@ else
 	  }
 
 	  if (jel_verbose) maybe_describe_mcu(cfg, mcu, all_mcus, nm, "After");
+	  /* Only changed MCUs need to be coded again, or counted again: */
+	  if ((splicing || counting) && memcmp(before, mcu, sizeof(JBLOCK))) {
+	    if (splicing) ijel_splice_mark(cfg, compnum, blk_y + offset_y, (int) blocknum);
+	    if (counting) ijel_huff_update(cfg, compnum, before, mcu);
+	  }
 
 	  nbits_in += nb;
 	  /* if ( nb > 0 ) mcu_count++; */
@@ -1547,6 +1575,9 @@ else
       jel_log(cfg, "ijel_stuff_message: MCU map overflow!  (%d vs %d)\n", cfg->mcu_index, cfg->maxmcus);
   }
   
+  IJEL_STATS_COUNT(cfg, mcus_visited, all_mcus);
+  IJEL_STATS_COUNT(cfg, mcus_active, nm + 1);
+
   if (jel_verbose) {
     JEL_LOG(cfg, 1, "ijel_stuff_message:    END OF MAIN PROCESSING LOOP\n");
     JEL_LOG(cfg, 2, "ijel_stuff_message:  <<<<<   bitstream after embedding:\n");
@@ -1695,6 +1726,7 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
   JBLOCKARRAY row_ptrs;
   int fDoECC = jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE ? 1 : 0;
   int status = 0;
+  double t0;
   int first = TRUE;   // The next MCU we process will be the first one.
   /* need to be able to know what went wrong in deployments */
   int debug = (cfg->logger != NULL);
@@ -1720,6 +1752,7 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
   cfg->maxmcus = ijel_max_mcus(cfg, compnum); // only one component
 
   bs = jelbs_create(cfg, cfg->capacity[chan]);      // points to data buffer
+  if (!bs) return JEL_ERR_NOMEM;
   /* This is the maximum message size. */
   msg_nbytes = cfg->data_lengths[chan];
 
@@ -1758,8 +1791,10 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
   
   msg_nbits = bs->nbits;
   // This can't be done before we understand the image parameters:
-  if (!ijel_create_mcu_map(cfg, compnum))
-    return JEL_ERR_CREATE_MCU;
+  if ((i = ijel_create_mcu_map(cfg, compnum)) <= 0) {
+    jelbs_destroy(&bs);
+    return i < 0 ? i : JEL_ERR_CREATE_MCU;
+  }
 
   if (!cfg->embed_bitstream_header) {
     
@@ -1902,6 +1937,9 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
     }
   }
 
+  IJEL_STATS_COUNT(cfg, mcus_visited, all_mcus);
+  IJEL_STATS_COUNT(cfg, mcus_active, nm + 1);
+
   if ( jel_verbose ) {
     JEL_LOG(cfg, 1, "ijel_unstuff_message:    END OF MAIN PROCESSING LOOP\n");
     JEL_LOG(cfg, 1, "ijel_unstuff_message: Processed %d MCUs.\n", all_mcus);
@@ -1927,7 +1965,7 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
      */
     int truek;
     unsigned char *raw = 0;
-    truek = ijel_ecc_block_length(msg_nbytes);
+    truek = ijel_ecc_block_length(cfg->ecc_blocklen, msg_nbytes);
     JEL_LOG(cfg, 2, "ijel_unstuff_message: truek = %d, k = %d, %d\n", truek, k, msg_nbytes);
 	  
 
@@ -1944,7 +1982,9 @@ int ijel_unstuff_message(jel_config *cfg, int chan) {
     
     /* If we are not embedding length, then plaintext length is a
      * shared secret and we pass it: */
-    raw = ijel_decode_ecc(message,  truek, &i);
+    t0 = IJEL_STATS_START(cfg);
+    raw = ijel_decode_ecc(cfg->ecc_blocklen, message,  truek, &i);
+    IJEL_STATS_STOP(cfg, ecc_usec, t0);
 
     /* 'raw' is a newly-allocated buffer.  When should it be freed?? */
     if (raw) {
@@ -2257,65 +2297,6 @@ void ijel_log_qtables(jel_config *c) {
 
 
 
-/* Returns the number of markers copied: */
-int ijel_copy_markers(jel_config *c)  {
-  int count, write_marker;
-  
-  struct jpeg_compress_struct *cinfo = &(c->dstinfo);
-  struct jpeg_decompress_struct *dinfo = &(c->srcinfo);
-    
-  jpeg_saved_marker_ptr marker_p;
-
-
-  count = 0;
-  if (!cinfo || !dinfo) {
-    jel_log(c, "ijel_copy_markers: Source or destination compress structs are missing.  Doing nothing.");
-    return count;
-  }
-
-  marker_p = dinfo->marker_list;
-  while ( marker_p ) {
-    write_marker = 1;
-    
-    /* libjpeg emits some markers automatically so skip these to avoid duplicates... */
-
-    /* skip JFIF (APP0) marker */
-    if ( marker_p->marker == JPEG_APP0 && marker_p->data_length >= 14 &&
-	 marker_p->data[0] == 0x4a &&
-	 marker_p->data[1] == 0x46 &&
-	 marker_p->data[2] == 0x49 &&
-	 marker_p->data[3] == 0x46 &&
-	 marker_p->data[4] == 0x00 ) 
-      write_marker=0;
-
-    /* skip Adobe (APP14) marker */
-    if ( marker_p->marker == JPEG_APP0+14 && marker_p->data_length >= 12 &&
-	 marker_p->data[0] == 0x41 &&
-	 marker_p->data[1] == 0x64 &&
-	 marker_p->data[2] == 0x6f &&
-	 marker_p->data[3] == 0x62 &&
-	 marker_p->data[4] == 0x65 ) 
-      write_marker=0;
-
-    if (write_marker) {
-      count++;
-      jpeg_write_marker(cinfo, marker_p->marker, marker_p->data, marker_p->data_length);
-    }
-    
-    marker_p = marker_p->next;
-  }
-  return count;
-}
-
-
-
-
-
-
-
-
-
-
 /* ================   Here be dead code:    ================   */
 
 
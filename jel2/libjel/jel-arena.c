@@ -0,0 +1,543 @@
+/*
+ * JPEG Embedding Library - jel-arena.c
+ *
+ * Per-config bump allocator.  libjpeg's JPOOL_IMAGE allocations, for
+ * both the decompressor and the compressor, and libjel's per-message
+ * scratch (MCU maps, PRN lists, bitstream buffers) are carved out of
+ * one region.  Once both images have been released the region is
+ * reset in O(1), so a config that is reused (see jel_reset and
+ * jel_pool) stops calling malloc altogether after its first image.
+ *
+ * The arena is hooked in by replacing the methods of each libjpeg
+ * object's memory manager right after jpeg_create_*.  Requests for
+ * JPOOL_PERMANENT go to the original methods, as does everything when
+ * the arena is disabled; allocations are counted either way.  Virtual
+ * arrays are always realized in memory - neither the bundled jpeg-6b
+ * (jmemnobs.c) nor libjpeg-turbo has backing store to fall back on.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "jel/jel.h"
+#include "jel/ijel-arena.h"
+
+
+#define ARENA_ALIGN      32             /* Row alignment expected by libjpeg-turbo's SIMD code */
+#define ARENA_MIN_CHUNK  (256 * 1024)
+
+#define ARENA_ROUND(n)   (((n) + ARENA_ALIGN - 1) & ~((size_t) ARENA_ALIGN - 1))
+
+
+typedef struct arena_chunk {
+  struct arena_chunk *next;
+  size_t size;                  /* Usable bytes at data */
+  size_t used;
+  unsigned char *data;          /* ARENA_ALIGN-aligned */
+} arena_chunk;
+
+
+/* Our virtual arrays.  libjpeg only sees these through the opaque
+ * jvirt_[bs]array_ptr types, and only ever hands them back to the
+ * access methods below. */
+typedef struct arena_varray {
+  struct arena_varray *next;
+  void **rows;                  /* JSAMPARRAY or JBLOCKARRAY once realized */
+  JDIMENSION rows_in_array;
+  JDIMENSION width;             /* Samples or blocks per row */
+  size_t elsize;                /* sizeof(JSAMPLE) or sizeof(JBLOCK) */
+  boolean pre_zero;
+} arena_varray;
+
+
+typedef struct {
+  struct jpeg_memory_mgr orig;  /* libjpeg's own methods */
+  arena_varray *varrays;        /* Virtual arrays requested since the last free_pool */
+  int live;                     /* Holds JPOOL_IMAGE memory */
+  size_t image_bytes;           /* Bytes requested for JPOOL_IMAGE since the last free_pool */
+} arena_side;
+
+
+struct jel_arena {
+  int enabled;
+  arena_chunk *chunks;          /* Current chunk first */
+  size_t capacity;
+  size_t in_use;
+  int scratch;                  /* Outstanding libjel scratch blocks */
+  arena_side side[2];           /* 0 = srcinfo, 1 = dstinfo */
+  jel_arena_stats stats;
+};
+
+
+static jel_config *arena_cfg(j_common_ptr cinfo, arena_side **side) {
+  jel_config *cfg;
+
+  if (cinfo->is_decompressor) {
+    cfg = (jel_config *) ((char *) cinfo - offsetof(jel_config, srcinfo));
+    *side = &cfg->arena->side[0];
+  } else {
+    cfg = (jel_config *) ((char *) cinfo - offsetof(jel_config, dstinfo));
+    *side = &cfg->arena->side[1];
+  }
+  return cfg;
+}
+
+
+static arena_chunk *arena_new_chunk(struct jel_arena *a, size_t size) {
+  arena_chunk *c = malloc(sizeof(arena_chunk) + size + ARENA_ALIGN);
+
+  if (!c) return NULL;
+  c->data = (unsigned char *) ARENA_ROUND((uintptr_t) (c + 1));
+  c->size = size;
+  c->used = 0;
+  c->next = a->chunks;
+  a->chunks = c;
+  a->capacity += size;
+  a->stats.sys_allocs++;
+  a->stats.capacity = a->capacity;
+  return c;
+}
+
+
+static void *arena_take(struct jel_arena *a, size_t size) {
+  arena_chunk *c = a->chunks;
+  void *p;
+
+  size = ARENA_ROUND(size);
+  if (!c || c->size - c->used < size) {
+    /* Grow geometrically so that a large image needs few chunks: */
+    size_t n = a->capacity > ARENA_MIN_CHUNK ? a->capacity : ARENA_MIN_CHUNK;
+    if (n < size) n = size;
+    if (!(c = arena_new_chunk(a, n))) return NULL;
+  }
+
+  p = c->data + c->used;
+  c->used += size;
+  a->in_use += size;
+  if (a->in_use > a->stats.peak) a->stats.peak = a->in_use;
+  return p;
+}
+
+
+/*
+ * O(1) unless the previous image needed more than one chunk, in which
+ * case the chunks are merged so that the next image of that size fits
+ * in one.
+ */
+static void arena_reset(struct jel_arena *a) {
+  arena_chunk *c, *next;
+  size_t total = a->capacity;
+
+  if (a->chunks && a->chunks->next) {
+    for (c = a->chunks; c; c = next) {
+      next = c->next;
+      free(c);
+    }
+    a->chunks = NULL;
+    a->capacity = 0;
+    (void) arena_new_chunk(a, total);
+  }
+  if (a->chunks) a->chunks->used = 0;
+  a->in_use = 0;
+  a->stats.resets++;
+}
+
+
+static void arena_maybe_reset(struct jel_arena *a) {
+  if (!a->side[0].live && !a->side[1].live && a->scratch == 0 && a->in_use > 0)
+    arena_reset(a);
+}
+
+
+/* Allocation for libjpeg: errors exit through the object's error manager. */
+static void *arena_image_alloc(j_common_ptr cinfo, struct jel_arena *a, arena_side *s, size_t size) {
+  void *p = arena_take(a, size);
+
+  if (!p) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 7);
+  s->live = 1;
+  return p;
+}
+
+
+static void arena_count(struct jel_arena *a, arena_side *s, size_t size) {
+  a->stats.allocs++;
+  s->image_bytes += size;
+  if (s->image_bytes > a->stats.image_peak) a->stats.image_peak = s->image_bytes;
+}
+
+
+METHODDEF(void *)
+arena_alloc_small (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+
+  if (pool_id != JPOOL_IMAGE) return (*s->orig.alloc_small) (cinfo, pool_id, sizeofobject);
+
+  arena_count(a, s, sizeofobject);
+  if (!a->enabled) return (*s->orig.alloc_small) (cinfo, pool_id, sizeofobject);
+  return arena_image_alloc(cinfo, a, s, sizeofobject);
+}
+
+
+METHODDEF(void *)
+arena_alloc_large (j_common_ptr cinfo, int pool_id, size_t sizeofobject)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+
+  if (pool_id != JPOOL_IMAGE) return (*s->orig.alloc_large) (cinfo, pool_id, sizeofobject);
+
+  arena_count(a, s, sizeofobject);
+  if (!a->enabled) return (*s->orig.alloc_large) (cinfo, pool_id, sizeofobject);
+  return arena_image_alloc(cinfo, a, s, sizeofobject);
+}
+
+
+/* Rows are laid out contiguously after the row pointers. */
+static void **arena_rows(j_common_ptr cinfo, struct jel_arena *a, arena_side *s,
+                         size_t rowsize, JDIMENSION numrows) {
+  size_t ptrsize = ARENA_ROUND((size_t) numrows * sizeof(void *));
+  unsigned char *mem;
+  void **rows;
+  JDIMENSION i;
+
+  rowsize = ARENA_ROUND(rowsize);
+  mem = arena_image_alloc(cinfo, a, s, ptrsize + rowsize * numrows);
+  rows = (void **) mem;
+  mem += ptrsize;
+  for (i = 0; i < numrows; i++, mem += rowsize) rows[i] = mem;
+  return rows;
+}
+
+
+METHODDEF(JSAMPARRAY)
+arena_alloc_sarray (j_common_ptr cinfo, int pool_id,
+                    JDIMENSION samplesperrow, JDIMENSION numrows)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+  size_t rowsize = (size_t) samplesperrow * sizeof(JSAMPLE);
+
+  if (pool_id != JPOOL_IMAGE) return (*s->orig.alloc_sarray) (cinfo, pool_id, samplesperrow, numrows);
+
+  arena_count(a, s, rowsize * numrows);
+  if (!a->enabled) return (*s->orig.alloc_sarray) (cinfo, pool_id, samplesperrow, numrows);
+  return (JSAMPARRAY) arena_rows(cinfo, a, s, rowsize, numrows);
+}
+
+
+METHODDEF(JBLOCKARRAY)
+arena_alloc_barray (j_common_ptr cinfo, int pool_id,
+                    JDIMENSION blocksperrow, JDIMENSION numrows)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+  size_t rowsize = (size_t) blocksperrow * sizeof(JBLOCK);
+
+  if (pool_id != JPOOL_IMAGE) return (*s->orig.alloc_barray) (cinfo, pool_id, blocksperrow, numrows);
+
+  arena_count(a, s, rowsize * numrows);
+  if (!a->enabled) return (*s->orig.alloc_barray) (cinfo, pool_id, blocksperrow, numrows);
+  return (JBLOCKARRAY) arena_rows(cinfo, a, s, rowsize, numrows);
+}
+
+
+static arena_varray *arena_request(j_common_ptr cinfo, struct jel_arena *a, arena_side *s,
+                                   boolean pre_zero, JDIMENSION width, JDIMENSION numrows,
+                                   size_t elsize) {
+  arena_varray *v;
+
+  /* Only image-lifetime virtual arrays are allowed (as in jmemmgr.c): */
+  v = arena_image_alloc(cinfo, a, s, sizeof(arena_varray));
+  v->rows = NULL;
+  v->rows_in_array = numrows;
+  v->width = width;
+  v->elsize = elsize;
+  v->pre_zero = pre_zero;
+  v->next = s->varrays;
+  s->varrays = v;
+  return v;
+}
+
+
+METHODDEF(jvirt_sarray_ptr)
+arena_request_virt_sarray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
+                           JDIMENSION samplesperrow, JDIMENSION numrows,
+                           JDIMENSION maxaccess)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+
+  arena_count(a, s, (size_t) samplesperrow * numrows * sizeof(JSAMPLE));
+  if (!a->enabled)
+    return (*s->orig.request_virt_sarray) (cinfo, pool_id, pre_zero, samplesperrow, numrows, maxaccess);
+
+  if (pool_id != JPOOL_IMAGE) ERREXIT1(cinfo, JERR_BAD_POOL_ID, pool_id);
+  return (jvirt_sarray_ptr) arena_request(cinfo, a, s, pre_zero, samplesperrow, numrows,
+                                          sizeof(JSAMPLE));
+}
+
+
+METHODDEF(jvirt_barray_ptr)
+arena_request_virt_barray (j_common_ptr cinfo, int pool_id, boolean pre_zero,
+                           JDIMENSION blocksperrow, JDIMENSION numrows,
+                           JDIMENSION maxaccess)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+
+  arena_count(a, s, (size_t) blocksperrow * numrows * sizeof(JBLOCK));
+  if (!a->enabled)
+    return (*s->orig.request_virt_barray) (cinfo, pool_id, pre_zero, blocksperrow, numrows, maxaccess);
+
+  if (pool_id != JPOOL_IMAGE) ERREXIT1(cinfo, JERR_BAD_POOL_ID, pool_id);
+  return (jvirt_barray_ptr) arena_request(cinfo, a, s, pre_zero, blocksperrow, numrows,
+                                          sizeof(JBLOCK));
+}
+
+
+METHODDEF(void)
+arena_realize_virt_arrays (j_common_ptr cinfo)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+  arena_varray *v;
+  size_t rowsize;
+
+  if (!a->enabled) {
+    (*s->orig.realize_virt_arrays) (cinfo);
+    return;
+  }
+
+  for (v = s->varrays; v; v = v->next) {
+    if (v->rows) continue;
+    rowsize = (size_t) v->width * v->elsize;
+    v->rows = arena_rows(cinfo, a, s, rowsize, v->rows_in_array);
+    if (v->pre_zero)
+      memset(v->rows[0], 0, ARENA_ROUND(rowsize) * v->rows_in_array);
+  }
+}
+
+
+static void **arena_access(j_common_ptr cinfo, arena_varray *v,
+                           JDIMENSION start_row, JDIMENSION num_rows) {
+  if (v->rows == NULL || start_row + num_rows > v->rows_in_array)
+    ERREXIT(cinfo, JERR_BAD_VIRTUAL_ACCESS);
+  return v->rows + start_row;
+}
+
+
+METHODDEF(JSAMPARRAY)
+arena_access_virt_sarray (j_common_ptr cinfo, jvirt_sarray_ptr ptr,
+                          JDIMENSION start_row, JDIMENSION num_rows,
+                          boolean writable)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+
+  if (!cfg->arena->enabled)
+    return (*s->orig.access_virt_sarray) (cinfo, ptr, start_row, num_rows, writable);
+  return (JSAMPARRAY) arena_access(cinfo, (arena_varray *) ptr, start_row, num_rows);
+}
+
+
+METHODDEF(JBLOCKARRAY)
+arena_access_virt_barray (j_common_ptr cinfo, jvirt_barray_ptr ptr,
+                          JDIMENSION start_row, JDIMENSION num_rows,
+                          boolean writable)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+
+  if (!cfg->arena->enabled)
+    return (*s->orig.access_virt_barray) (cinfo, ptr, start_row, num_rows, writable);
+  return (JBLOCKARRAY) arena_access(cinfo, (arena_varray *) ptr, start_row, num_rows);
+}
+
+
+METHODDEF(void)
+arena_free_pool (j_common_ptr cinfo, int pool_id)
+{
+  arena_side *s;
+  jel_config *cfg = arena_cfg(cinfo, &s);
+  struct jel_arena *a = cfg->arena;
+
+  (*s->orig.free_pool) (cinfo, pool_id);
+
+  if (pool_id == JPOOL_IMAGE) {
+    s->varrays = NULL;
+    s->live = 0;
+    s->image_bytes = 0;
+    arena_maybe_reset(a);
+  }
+}
+
+
+static void arena_install(arena_side *s, j_common_ptr cinfo) {
+  struct jpeg_memory_mgr *mem = cinfo->mem;
+
+  s->orig = *mem;
+  s->varrays = NULL;
+  s->live = 0;
+  s->image_bytes = 0;
+
+  mem->alloc_small = arena_alloc_small;
+  mem->alloc_large = arena_alloc_large;
+  mem->alloc_sarray = arena_alloc_sarray;
+  mem->alloc_barray = arena_alloc_barray;
+  mem->request_virt_sarray = arena_request_virt_sarray;
+  mem->request_virt_barray = arena_request_virt_barray;
+  mem->realize_virt_arrays = arena_realize_virt_arrays;
+  mem->access_virt_sarray = arena_access_virt_sarray;
+  mem->access_virt_barray = arena_access_virt_barray;
+  mem->free_pool = arena_free_pool;
+}
+
+
+/*
+ * Creates the arena if needed and hooks it into whichever libjpeg
+ * objects have not been hooked yet.  Must be called right after
+ * jpeg_create_* and before anything is allocated in JPOOL_IMAGE.
+ */
+int ijel_arena_attach(jel_config *cfg) {
+  struct jel_arena *a = cfg->arena;
+
+  if (!a) {
+    a = calloc(1, sizeof(struct jel_arena));
+    if (!a) return JEL_ERR_ARENA;
+    a->enabled = 1;
+    cfg->arena = a;
+  }
+
+  if (cfg->srcinfo.mem && cfg->srcinfo.mem->free_pool != arena_free_pool)
+    arena_install(&a->side[0], (j_common_ptr) &cfg->srcinfo);
+  if (cfg->dstinfo.mem && cfg->dstinfo.mem->free_pool != arena_free_pool)
+    arena_install(&a->side[1], (j_common_ptr) &cfg->dstinfo);
+
+  return 0;
+}
+
+
+/* Frees the arena's memory.  The libjpeg objects must already be destroyed. */
+void ijel_arena_destroy(jel_config *cfg) {
+  struct jel_arena *a = cfg->arena;
+  arena_chunk *c, *next;
+
+  if (!a) return;
+  for (c = a->chunks; c; c = next) {
+    next = c->next;
+    free(c);
+  }
+  free(a);
+  cfg->arena = NULL;
+}
+
+
+/*
+ * Forget all outstanding scratch and reset, for jel_reset - the
+ * libjpeg objects must have been aborted already.
+ */
+void ijel_arena_reset(jel_config *cfg) {
+  struct jel_arena *a = cfg->arena;
+
+  if (!a) return;
+  a->scratch = 0;
+  a->side[0].live = a->side[1].live = 0;
+  a->side[0].varrays = a->side[1].varrays = NULL;
+  if (a->in_use > 0) arena_reset(a);
+}
+
+
+/*
+ * Zeroed scratch memory for libjel, released with ijel_scratch_free.
+ * Comes from the arena when it is enabled, and from calloc otherwise.
+ */
+void *ijel_scratch_alloc(jel_config *cfg, size_t size) {
+  struct jel_arena *a = cfg->arena;
+  void *p;
+
+  if (!a) return calloc(1, size);
+
+  a->stats.allocs++;
+  if (!a->enabled)
+    p = calloc(1, size);
+  else if ((p = arena_take(a, size)) != NULL)
+    memset(p, 0, size);
+  if (p) a->scratch++;
+  return p;
+}
+
+
+void ijel_scratch_free(jel_config *cfg, void *p) {
+  struct jel_arena *a = cfg->arena;
+
+  if (!p) return;
+  if (!a) {
+    free(p);
+    return;
+  }
+  if (a->scratch > 0) a->scratch--;
+  if (!a->enabled)
+    free(p);
+  else
+    arena_maybe_reset(a);
+}
+
+
+/*
+ * Public API.  Switching the arena on or off is only allowed between
+ * images, i.e. after jel_init or jel_reset and before a source is set.
+ */
+int jel_set_arena(jel_config *cfg, int enable) {
+  struct jel_arena *a = cfg->arena;
+
+  if (!a) return cfg->jel_errno = JEL_ERR_ARENA;
+  if (a->side[0].live || a->side[1].live || a->scratch > 0 || cfg->coefs)
+    return cfg->jel_errno = JEL_ERR_ARENA;
+
+  a->enabled = enable ? 1 : 0;
+  if (!a->enabled) {
+    /* Give the memory back; it will not be used until re-enabled. */
+    arena_chunk *c, *next;
+    for (c = a->chunks; c; c = next) {
+      next = c->next;
+      free(c);
+    }
+    a->chunks = NULL;
+    a->capacity = 0;
+    a->in_use = 0;
+    a->stats.capacity = 0;
+  }
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+int jel_get_arena_stats(jel_config *cfg, jel_arena_stats *stats) {
+  struct jel_arena *a = cfg->arena;
+
+  if (!a) {
+    memset(stats, 0, sizeof(jel_arena_stats));
+    return cfg->jel_errno = JEL_ERR_ARENA;
+  }
+  *stats = a->stats;
+  stats->enabled = a->enabled;
+  stats->in_use = a->in_use;
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+void jel_reset_arena_stats(jel_config *cfg) {
+  struct jel_arena *a = cfg->arena;
+
+  if (!a) return;
+  memset(&a->stats, 0, sizeof(jel_arena_stats));
+  a->stats.capacity = a->capacity;
+}
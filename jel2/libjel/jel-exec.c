@@ -0,0 +1,367 @@
+/*
+ * JPEG Embedding Library - jel-exec.c
+ *
+ * A bounded executor for jel_embed and jel_extract.  Callers that run
+ * an event loop cannot afford to block for a whole decode, embed and
+ * encode, so they hand the job to a fixed set of worker threads and
+ * get a callback when it is done.  Jobs wait in a FIFO; at most
+ * max_pending are queued or running at once, and submitting beyond
+ * that fails with JEL_ERR_BUSY rather than blocking the caller.
+ *
+ * jel_embed_segments builds on this to embed the pieces of one long
+ * message in parallel while still delivering them in order.
+ */
+
+#include <pthread.h>
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+typedef struct jel_job {
+  struct jel_job *next;
+  long id;
+  int extract;               /* 1 for jel_extract, 0 for jel_embed */
+  jel_config *cfg;
+  unsigned char *cover;
+  int cover_len;
+  unsigned char *dst;        /* Embed only */
+  int dst_len;
+  unsigned char *msg;        /* Message to embed, or buffer to extract into */
+  int msglen;
+  jel_done_fn done;
+  void *arg;
+} jel_job;
+
+
+struct jel_executor {
+  pthread_mutex_t lock;
+  pthread_cond_t wake;       /* Signalled when a job is queued or on shutdown */
+  pthread_t *threads;
+  int nthreads;
+  int max_pending;
+  int pending;               /* Queued plus running */
+  int shutdown;
+  long next_id;
+  jel_job *head, *tail;
+  jel_prepare_fn prepare;
+};
+
+
+struct ijel_seg_group {
+  pthread_mutex_t lock;
+  pthread_cond_t done;       /* Signalled whenever a segment finishes */
+  jel_segment *segs;
+  int *finished;             /* finished[i] is set once segs[i].result is */
+  int nfinished;
+};
+
+
+static int ijel_run_job(jel_executor *ex, jel_job *job) {
+  jel_config *cfg = job->cfg;
+  int ret;
+
+  /* The config may have been through a job already: */
+  jel_reset(cfg);
+  if ((ret = jel_set_mem_source(cfg, job->cover, job->cover_len)) != 0) return ret;
+  if (ex->prepare) ex->prepare(cfg, job->arg);
+
+  if (job->extract) return jel_extract(cfg, job->msg, job->msglen);
+
+  jel_set_mem_dest(cfg, job->dst, job->dst_len);
+  return jel_embed(cfg, job->msg, job->msglen);
+}
+
+
+static void *ijel_worker(void *arg) {
+  jel_executor *ex = arg;
+  jel_job *job;
+  int ret;
+
+  for (;;) {
+    pthread_mutex_lock(&ex->lock);
+    while (!ex->head && !ex->shutdown) pthread_cond_wait(&ex->wake, &ex->lock);
+    job = ex->head;
+    if (!job) {
+      pthread_mutex_unlock(&ex->lock);
+      return NULL;
+    }
+    ex->head = job->next;
+    if (!ex->head) ex->tail = NULL;
+    pthread_mutex_unlock(&ex->lock);
+
+    ret = ijel_run_job(ex, job);
+    if (job->done) job->done(job->cfg, ret, job->arg);
+    free(job);
+
+    /* Only now is there room for another job: */
+    pthread_mutex_lock(&ex->lock);
+    ex->pending--;
+    pthread_mutex_unlock(&ex->lock);
+  }
+}
+
+
+jel_executor *jel_executor_create( int nthreads, int max_pending, jel_prepare_fn prepare ) {
+  jel_executor *ex;
+  int i;
+
+  if (nthreads <= 0) nthreads = 1;
+  if (max_pending < nthreads) max_pending = nthreads;
+
+  ex = calloc(1, sizeof(jel_executor));
+  if (!ex) return NULL;
+
+  ex->threads = calloc((size_t) nthreads, sizeof(pthread_t));
+  if (!ex->threads) {
+    free(ex);
+    return NULL;
+  }
+  ex->max_pending = max_pending;
+  ex->prepare = prepare;
+  ex->next_id = 1;
+  pthread_mutex_init(&ex->lock, NULL);
+  pthread_cond_init(&ex->wake, NULL);
+
+  for (i = 0; i < nthreads; i++) {
+    if (pthread_create(&ex->threads[i], NULL, ijel_worker, ex) != 0) break;
+    ex->nthreads++;
+  }
+  if (ex->nthreads == 0) {
+    jel_executor_destroy(ex);
+    return NULL;
+  }
+
+  return ex;
+}
+
+
+static long ijel_submit(jel_executor *ex, jel_job *job) {
+  long id;
+
+  pthread_mutex_lock(&ex->lock);
+  if (ex->shutdown || ex->pending >= ex->max_pending) {
+    pthread_mutex_unlock(&ex->lock);
+    free(job);
+    return JEL_ERR_BUSY;
+  }
+  id = job->id = ex->next_id++;
+  ex->pending++;
+  if (ex->tail) ex->tail->next = job;
+  else ex->head = job;
+  ex->tail = job;
+  pthread_cond_signal(&ex->wake);
+  pthread_mutex_unlock(&ex->lock);
+
+  return id;
+}
+
+
+long jel_embed_async( jel_executor *ex, jel_config *cfg,
+                      unsigned char *cover, int cover_len,
+                      unsigned char *dst, int dst_len,
+                      unsigned char *msg, int msglen,
+                      jel_done_fn done, void *arg ) {
+  jel_job *job = calloc(1, sizeof(jel_job));
+
+  if (!job) return JEL_ERR_NOMEM;
+
+  job->cfg = cfg;
+  job->cover = cover;
+  job->cover_len = cover_len;
+  job->dst = dst;
+  job->dst_len = dst_len;
+  job->msg = msg;
+  job->msglen = msglen;
+  job->done = done;
+  job->arg = arg;
+
+  return ijel_submit(ex, job);
+}
+
+
+long jel_extract_async( jel_executor *ex, jel_config *cfg,
+                        unsigned char *cover, int cover_len,
+                        unsigned char *msg, int maxlen,
+                        jel_done_fn done, void *arg ) {
+  jel_job *job = calloc(1, sizeof(jel_job));
+
+  if (!job) return JEL_ERR_NOMEM;
+
+  job->extract = 1;
+  job->cfg = cfg;
+  job->cover = cover;
+  job->cover_len = cover_len;
+  job->msg = msg;
+  job->msglen = maxlen;
+  job->done = done;
+  job->arg = arg;
+
+  return ijel_submit(ex, job);
+}
+
+
+/*
+ * Removes a job that no worker has picked up yet.  The done callback
+ * runs here, in the caller's thread, outside the lock.
+ */
+int jel_async_cancel( jel_executor *ex, long id ) {
+  jel_job *job, *prev = NULL;
+
+  pthread_mutex_lock(&ex->lock);
+  for (job = ex->head; job && job->id != id; job = job->next) prev = job;
+  if (job) {
+    if (prev) prev->next = job->next;
+    else ex->head = job->next;
+    if (ex->tail == job) ex->tail = prev;
+    ex->pending--;
+  }
+  pthread_mutex_unlock(&ex->lock);
+
+  if (!job) return -1;
+
+  if (job->done) job->done(job->cfg, JEL_ERR_CANCELED, job->arg);
+  free(job);
+  return 0;
+}
+
+
+int jel_executor_pending( jel_executor *ex ) {
+  int n;
+
+  pthread_mutex_lock(&ex->lock);
+  n = ex->pending;
+  pthread_mutex_unlock(&ex->lock);
+  return n;
+}
+
+
+void jel_executor_destroy( jel_executor *ex ) {
+  jel_job *job, *next;
+  int i;
+
+  if (!ex) return;
+
+  pthread_mutex_lock(&ex->lock);
+  ex->shutdown = 1;
+  job = ex->head;
+  ex->head = ex->tail = NULL;
+  pthread_cond_broadcast(&ex->wake);
+  pthread_mutex_unlock(&ex->lock);
+
+  for (; job; job = next) {
+    next = job->next;
+    if (job->done) job->done(job->cfg, JEL_ERR_CANCELED, job->arg);
+    free(job);
+  }
+
+  for (i = 0; i < ex->nthreads; i++) pthread_join(ex->threads[i], NULL);
+
+  pthread_cond_destroy(&ex->wake);
+  pthread_mutex_destroy(&ex->lock);
+  free(ex->threads);
+  free(ex);
+}
+
+
+static void ijel_segment_done(jel_config *cfg, int result, void *arg) {
+  jel_segment *seg = arg;
+  struct ijel_seg_group *g = seg->group;
+
+  pthread_mutex_lock(&g->lock);
+  seg->result = result;
+  g->finished[seg - g->segs] = 1;
+  g->nfinished++;
+  pthread_cond_signal(&g->done);
+  pthread_mutex_unlock(&g->lock);
+}
+
+
+int jel_embed_segments( jel_executor *ex, unsigned char *msg,
+                        jel_segment *segs, int nsegs,
+                        jel_deliver_fn deliver, void *arg ) {
+  struct ijel_seg_group g;
+  long *ids;
+  int *offsets;
+  int i, off = 0, submitted = 0, delivered = 0, failed = 0;
+  jel_segment *seg;
+  jel_job job;
+  long id;
+
+  if (nsegs <= 0) return 0;
+
+  ids = calloc((size_t) nsegs, sizeof(long));
+  offsets = calloc((size_t) nsegs, sizeof(int));
+  g.finished = calloc((size_t) nsegs, sizeof(int));
+  if (!ids || !offsets || !g.finished) {
+    free(ids);
+    free(offsets);
+    free(g.finished);
+    return 0;
+  }
+  g.segs = segs;
+  g.nfinished = 0;
+  pthread_mutex_init(&g.lock, NULL);
+  pthread_cond_init(&g.done, NULL);
+
+  for (i = 0; i < nsegs; i++) {
+    segs[i].group = &g;
+    offsets[i] = off;
+    off += segs[i].msglen;
+  }
+
+  while (delivered < nsegs && !failed) {
+    /* Keep as many segments in flight as the executor will take: */
+    for (; submitted < nsegs; submitted++) {
+      seg = segs + submitted;
+      id = jel_embed_async(ex, seg->cfg, seg->cover, seg->cover_len, seg->dst, seg->dst_len,
+                           msg + offsets[submitted], seg->msglen, ijel_segment_done, seg);
+      if (id < 0) break;
+      ids[submitted] = id;
+    }
+
+    /* The executor is full of other callers' work, so make progress
+     * here rather than wait for it: */
+    if (submitted == delivered) {
+      seg = segs + submitted;
+      memset(&job, 0, sizeof(job));
+      job.cfg = seg->cfg;
+      job.cover = seg->cover;
+      job.cover_len = seg->cover_len;
+      job.dst = seg->dst;
+      job.dst_len = seg->dst_len;
+      job.msg = msg + offsets[submitted];
+      job.msglen = seg->msglen;
+      job.arg = seg;
+      ijel_segment_done(seg->cfg, ijel_run_job(ex, &job), seg);
+      submitted++;
+    }
+
+    pthread_mutex_lock(&g.lock);
+    while (!g.finished[delivered]) pthread_cond_wait(&g.done, &g.lock);
+    pthread_mutex_unlock(&g.lock);
+
+    seg = segs + delivered;
+    if (seg->result < 0 ||
+        (deliver && deliver(delivered, seg->dst, seg->cfg->jpeglen, arg) != 0)) failed = 1;
+    else delivered++;
+  }
+
+  /* After a failure, drop what has not started and wait for the rest,
+   * since they are still writing into the caller's buffers: */
+  for (i = delivered + 1; i < submitted; i++)
+    if (ids[i] > 0) jel_async_cancel(ex, ids[i]);
+
+  pthread_mutex_lock(&g.lock);
+  while (g.nfinished < submitted) pthread_cond_wait(&g.done, &g.lock);
+  pthread_mutex_unlock(&g.lock);
+
+  for (i = 0; i < nsegs; i++) segs[i].group = NULL;
+  pthread_cond_destroy(&g.done);
+  pthread_mutex_destroy(&g.lock);
+  free(g.finished);
+  free(offsets);
+  free(ids);
+
+  return delivered;
+}
@@ -0,0 +1,212 @@
+/*
+ * JPEG Embedding Library - jel-huff.c
+ *
+ * Optimized Huffman tables.  Output bytes are what a sender pays for,
+ * and tables fitted to the image typically save several percent over
+ * the standard ones.  libjpeg builds them with optimize_coding, at the
+ * price of a whole extra pass over the coefficients to gather symbol
+ * statistics before the real one writes them out.  jel_embed has no
+ * need of that pass: the decoder counts every symbol as it reads the
+ * source (see jpeg_symbol_counts in jpeglib.h), and ijel_stuff_message
+ * takes the old block's AC symbols off and puts the new block's on for
+ * each block it changes.  The counts then describe the output, and the
+ * tables come straight from them.
+ *
+ * DC differences are not followed through a change (a new DC value
+ * alters the next block's difference too), nor through the source's
+ * restart intervals, so every DC category keeps at least a count of
+ * one; likewise the end-of-block code, which padding blocks at the
+ * image edges need.  That costs a few bits of table, and never an
+ * uncodable block.
+ *
+ * A source the counts cannot cover (progressive or arithmetic-coded,
+ * with libjpeg warnings, or any source under a libjpeg without
+ * JPEG_SYMBOL_COUNTS) falls back to libjpeg's own optimize_coding.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+#include "jel/ijel-stats.h"
+
+
+int jel_set_optimize( jel_config *cfg, int enable ) {
+  cfg->optimize_huffman = enable ? 1 : 0;
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+#ifdef JPEG_SYMBOL_COUNTS
+
+struct jel_huff {
+  jpeg_symbol_counts *counts; /* One per source component */
+  int alloc;                  /* Entries allocated; only ever grows */
+  int usable;                 /* 1 once the decoder filled them in */
+};
+
+
+void ijel_huff_destroy(jel_config *cfg) {
+  if (!cfg->huff) return;
+  free(cfg->huff->counts);
+  free(cfg->huff);
+  cfg->huff = NULL;
+}
+
+
+/* Called between jpeg_read_header and jpeg_read_coefficients: */
+void ijel_huff_source(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_huff *hp = cfg->huff;
+
+  cinfo->symbol_counts = NULL;
+  if (hp) hp->usable = 0;
+
+  if (!cfg->optimize_huffman || cinfo->progressive_mode || cinfo->arith_code)
+    return;
+
+  if (!hp) {
+    hp = calloc(1, sizeof(struct jel_huff));
+    if (!hp) return;
+    cfg->huff = hp;
+  }
+
+  if (cinfo->num_components > hp->alloc) {
+    free(hp->counts);
+    hp->alloc = 0;
+    hp->counts = malloc((size_t) cinfo->num_components * sizeof(jpeg_symbol_counts));
+    if (!hp->counts) return;
+    hp->alloc = cinfo->num_components;
+  }
+  memset(hp->counts, 0, (size_t) cinfo->num_components * sizeof(jpeg_symbol_counts));
+
+  cinfo->symbol_counts = hp->counts;
+}
+
+
+/* Called after jpeg_read_coefficients: */
+void ijel_huff_check(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+
+  if (!cfg->huff || !cinfo->symbol_counts) return;
+  cinfo->symbol_counts = NULL;
+
+  /* A corrupt or truncated scan leaves blocks that were never counted: */
+  if (cinfo->err->num_warnings == 0) cfg->huff->usable = 1;
+}
+
+
+int ijel_huff_active(jel_config *cfg) {
+  return cfg->huff && cfg->huff->usable;
+}
+
+
+/* Every block has changed (see jel-requant.c), so the counts are no
+ * longer those of the output: */
+void ijel_huff_forget(jel_config *cfg) {
+  if (cfg->huff) cfg->huff->usable = 0;
+}
+
+
+/* Adds delta to the counts of the AC symbols block is coded with: */
+static void ijel_huff_count_ac(long *ac, const JCOEF *block, int delta) {
+  int k, r = 0;
+
+  for (k = 1; k < DCTSIZE2; k++) {
+    if (block[jpeg_natural_order[k]] == 0) {
+      r++;
+      continue;
+    }
+    for (; r > 15; r -= 16) ac[0xF0] += delta;
+    ac[(r << 4) + ijel_nbits(block[jpeg_natural_order[k]])] += delta;
+    r = 0;
+  }
+  if (r > 0) ac[0] += delta;
+}
+
+
+/* Block 'before' of component ci is now 'after': */
+void ijel_huff_update(jel_config *cfg, int ci, const JCOEF *before, const JCOEF *after) {
+  long *ac;
+
+  if (!ijel_huff_active(cfg)) return;
+  ac = cfg->huff->counts[ci].ac;
+  ijel_huff_count_ac(ac, before, -1);
+  ijel_huff_count_ac(ac, after, 1);
+}
+
+
+/*
+ * Called just before jpeg_write_coefficients.  Returns 1, having given
+ * the compressor optimal tables, if the counts allowed it.  Otherwise
+ * turns on optimize_coding if optimized tables were asked for, and
+ * returns 0.
+ */
+int ijel_huff_output(jel_config *cfg) {
+  struct jpeg_compress_struct *dstinfo = &(cfg->dstinfo);
+  jpeg_symbol_counts *counts;
+  JHUFF_TBL **htblptr;
+  long freq[257];
+  int ci, k, t, dc, used;
+
+  if (!cfg->optimize_huffman) return 0;
+
+  if (!ijel_huff_active(cfg) || dstinfo->progressive_mode || dstinfo->arith_code ||
+      dstinfo->num_scans > 0 || dstinfo->num_components != cfg->srcinfo.num_components) {
+    JEL_LOG(cfg, 2, "ijel_huff_output: no symbol counts; libjpeg will gather them.\n");
+    dstinfo->optimize_coding = TRUE;
+    return 0;
+  }
+
+  counts = cfg->huff->counts;
+  for (dc = 0; dc < 2; dc++) {
+    for (t = 0; t < NUM_HUFF_TBLS; t++) {
+      memset(freq, 0, sizeof(freq));
+      used = 0;
+      for (ci = 0; ci < dstinfo->num_components; ci++) {
+        if ((dc ? dstinfo->comp_info[ci].dc_tbl_no : dstinfo->comp_info[ci].ac_tbl_no) != t)
+          continue;
+        for (k = 0; k < 256; k++)
+          freq[k] += dc ? counts[ci].dc[k] : counts[ci].ac[k];
+        used = 1;
+      }
+      if (!used) continue;
+
+      /* Counts that went below zero came from a source that coded a
+       * block differently than libjpeg would; no block needs those: */
+      for (k = 0; k < 256; k++)
+        if (freq[k] < 0) freq[k] = 0;
+      if (dc) {
+        /* DC differences of up to BITS_IN_JSAMPLE + 3 bits: */
+        for (k = 0; k <= BITS_IN_JSAMPLE + 3; k++)
+          if (freq[k] == 0) freq[k] = 1;
+      } else if (freq[0] == 0) freq[0] = 1;
+
+      htblptr = dc ? &dstinfo->dc_huff_tbl_ptrs[t] : &dstinfo->ac_huff_tbl_ptrs[t];
+      if (*htblptr == NULL)
+        *htblptr = jpeg_alloc_huff_table((j_common_ptr) dstinfo);
+      jpeg_gen_optimal_table(dstinfo, *htblptr, freq);
+    }
+  }
+
+  dstinfo->optimize_coding = FALSE;
+  IJEL_STATS_COUNT(cfg, tables_fused, 1);
+  return 1;
+}
+
+
+#else  /* A libjpeg without symbol counts: optimize_coding does it all */
+
+void ijel_huff_destroy(jel_config *cfg) { (void) cfg; }
+void ijel_huff_source(jel_config *cfg) { (void) cfg; }
+void ijel_huff_check(jel_config *cfg) { (void) cfg; }
+int  ijel_huff_active(jel_config *cfg) { (void) cfg; return 0; }
+void ijel_huff_forget(jel_config *cfg) { (void) cfg; }
+void ijel_huff_update(jel_config *cfg, int ci, const JCOEF *before, const JCOEF *after) {
+  (void) cfg; (void) ci; (void) before; (void) after;
+}
+
+int ijel_huff_output(jel_config *cfg) {
+  if (cfg->optimize_huffman) cfg->dstinfo.optimize_coding = TRUE;
+  return 0;
+}
+
+#endif
@@ -0,0 +1,659 @@
+/*
+ * JPEG Embedding Library - jel-index.c
+ *
+ * A persistent capacity index over a directory of cover images.  For
+ * every JPEG in the directory the index records its size and mtime,
+ * its dimensions, sampling factors and quant tables (as read by
+ * jel_capacity_from_header), and its capacity under the settings of
+ * the config the index was opened with.  Records are kept sorted by
+ * capacity, so "the smallest unused cover that holds N bytes" is a
+ * binary search.
+ *
+ * The index lives in a sidecar file (by default <dir>/.jel-index)
+ * that is memory-mapped where mmap is available.  Opening or updating
+ * the index only re-reads files whose size or mtime changed, and the
+ * whole index is rebuilt if the capacity settings differ from the
+ * ones it was built with.
+ *
+ * File layout, in native byte order:
+ *   ijel_index_header
+ *   ijel_index_record[nrecords]    sorted by capacity, then file size
+ *   names                          NUL-terminated, strings_size bytes
+ */
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+#define JEL_INDEX_NAME     ".jel-index"
+#define JEL_INDEX_MAGIC    "JELIDX\0\1"
+#define JEL_INDEX_PREFIX   (64 * 1024)   /* Enough for the header of most JPEGs */
+
+
+typedef struct {
+  char magic[8];
+  uint32_t record_size;
+  uint32_t nrecords;
+  uint32_t settings;         /* ijel_index_settings () of the building config */
+  uint32_t strings_size;
+} ijel_index_header;
+
+
+typedef struct {
+  uint64_t size;
+  int64_t mtime;
+  uint32_t name;             /* Offset into the names */
+  int32_t capacity;          /* Message bytes, as from jel_capacity */
+  uint16_t width, height;
+  uint8_t ncomp;
+  uint8_t samp[3];           /* h_samp_factor << 4 | v_samp_factor */
+  uint16_t qtables[2][DCTSIZE2];
+} ijel_index_record;
+
+
+struct jel_index {
+  char *dirpath;
+  char *indexpath;
+  jel_config *cfg;           /* Private copy of the caller's settings */
+
+  unsigned char *base;       /* Whole index image, mapped or malloc'ed */
+  size_t len;
+  int mapped;
+
+  const ijel_index_header *hdr;
+  const ijel_index_record *recs;
+  const char *names;
+  int n;
+
+  int *next;                 /* next[i]: first unused record >= i; next[n] == n */
+  char *path;                /* Buffer for jel_index_take's result */
+  size_t pathlen;
+};
+
+
+/* FNV-1a over everything that changes a capacity: */
+static uint32_t ijel_index_settings(jel_config *cfg) {
+  int v[16 + DCTSIZE2];
+  int i, n = 0;
+  uint32_t h = 2166136261u;
+  unsigned char *p;
+
+  v[n++] = cfg->freqs.nlevels;
+  v[n++] = cfg->freqs.nfreqs;
+  v[n++] = cfg->freqs.maxfreqs;
+  v[n++] = cfg->bits_per_freq;
+  v[n++] = cfg->mcu_density;
+  v[n++] = cfg->quality;
+  v[n++] = cfg->ecc_method;
+  v[n++] = cfg->ecc_blocklen;
+  v[n++] = cfg->components[0];
+  v[n++] = cfg->components[1];
+  v[n++] = cfg->components[2];
+  v[n++] = cfg->user_freqs;
+  if (cfg->user_freqs)
+    for (i = 0; i < cfg->freqs.maxfreqs && i < DCTSIZE2; i++) v[n++] = cfg->freqs.freqs[i];
+
+  for (p = (unsigned char *) v; p < (unsigned char *) (v + n); p++) {
+    h ^= *p;
+    h *= 16777619u;
+  }
+  return h;
+}
+
+
+static int ijel_is_jpeg_name(const char *name) {
+  const char *dot = strrchr(name, '.');
+
+  if (!dot || name[0] == '.') return 0;
+  return !strcasecmp(dot, ".jpg") || !strcasecmp(dot, ".jpeg");
+}
+
+
+static int ijel_record_cmp(const void *a, const void *b) {
+  const ijel_index_record *x = a, *y = b;
+
+  if (x->capacity != y->capacity) return x->capacity < y->capacity ? -1 : 1;
+  if (x->size != y->size) return x->size < y->size ? -1 : 1;
+  return x->name < y->name ? -1 : (x->name > y->name);
+}
+
+
+/* Reads the header of one cover and fills in rec, except for the name. */
+static int ijel_index_read_cover(jel_index *idx, const char *path, ijel_index_record *rec) {
+  ijel_header_info info;
+  unsigned char *buf;
+  FILE *fp;
+  size_t want = JEL_INDEX_PREFIX, got;
+  int cap, ci, k;
+
+  if (!(fp = fopen(path, "rb"))) return JEL_ERR_CANTOPENFILE;
+
+  for (;;) {
+    if (!(buf = malloc(want))) {
+      fclose(fp);
+      return JEL_ERR_NOMEM;
+    }
+    rewind(fp);
+    got = fread(buf, 1, want, fp);
+    cap = ijel_header_capacity(idx->cfg, buf, (int) got, &info);
+    free(buf);
+    /* A header larger than the prefix (big EXIF or ICC data) fails to
+     * parse; try again with the whole file: */
+    if (cap >= 0 || got < want || want >= (size_t) rec->size) break;
+    want = (size_t) rec->size;
+  }
+  fclose(fp);
+  if (cap < 0) return cap;
+
+  rec->capacity = cap;
+  rec->width = (uint16_t) info.width;
+  rec->height = (uint16_t) info.height;
+  rec->ncomp = (uint8_t) info.ncomp;
+  for (ci = 0; ci < 3; ci++)
+    rec->samp[ci] = (uint8_t) (info.h_samp[ci] << 4 | info.v_samp[ci]);
+  for (k = 0; k < 2; k++)
+    memcpy(rec->qtables[k], info.qtables[k], sizeof(rec->qtables[k]));
+  return 0;
+}
+
+
+/* Points the index at a complete image in base; the index is left as
+ * it was if there is no memory for the used-cover links. */
+static int ijel_index_attach(jel_index *idx, unsigned char *base, size_t len, int mapped) {
+  const ijel_index_header *hdr = (const ijel_index_header *) base;
+  int *next, i;
+
+  if (!(next = malloc(sizeof(int) * ((size_t) hdr->nrecords + 1)))) return JEL_ERR_NOMEM;
+
+  idx->base = base;
+  idx->len = len;
+  idx->mapped = mapped;
+  idx->hdr = (const ijel_index_header *) base;
+  idx->recs = (const ijel_index_record *) (base + sizeof(ijel_index_header));
+  idx->n = (int) idx->hdr->nrecords;
+  idx->names = (const char *) (idx->recs + idx->n);
+
+  free(idx->next);
+  idx->next = next;
+  for (i = 0; i <= idx->n; i++) idx->next[i] = i;
+  return 0;
+}
+
+
+static void ijel_index_detach(jel_index *idx) {
+  if (!idx->base) return;
+#ifdef HAVE_SYS_MMAN_H
+  if (idx->mapped) munmap(idx->base, idx->len);
+  else
+#endif
+    free(idx->base);
+  idx->base = NULL;
+  idx->hdr = NULL;
+  idx->recs = NULL;
+  idx->names = NULL;
+  idx->n = 0;
+}
+
+
+/* Maps (or reads) the index file; 0 if it is missing or malformed. */
+static int ijel_index_load(jel_index *idx) {
+  const ijel_index_header *hdr;
+  unsigned char *base;
+  struct stat st;
+  size_t need;
+  int fd, mapped = 0;
+  uint32_t i;
+
+  if ((fd = open(idx->indexpath, O_RDONLY)) < 0) return 0;
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ijel_index_header)) {
+    close(fd);
+    return 0;
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  base = mmap(NULL, (size_t) st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (base == MAP_FAILED) base = NULL;
+  else mapped = 1;
+#else
+  base = NULL;
+#endif
+  if (!base) {
+    base = malloc((size_t) st.st_size);
+    if (base && read(fd, base, (size_t) st.st_size) != (ssize_t) st.st_size) {
+      free(base);
+      base = NULL;
+    }
+  }
+  close(fd);
+  if (!base) return 0;
+
+  hdr = (const ijel_index_header *) base;
+  need = sizeof(ijel_index_header) + (size_t) hdr->nrecords * sizeof(ijel_index_record) + hdr->strings_size;
+  if (memcmp(hdr->magic, JEL_INDEX_MAGIC, 8) != 0 ||
+      hdr->record_size != sizeof(ijel_index_record) ||
+      need != (size_t) st.st_size ||
+      hdr->strings_size == 0 || base[need - 1] != '\0') {
+    hdr = NULL;
+  } else {
+    const ijel_index_record *r = (const ijel_index_record *) (base + sizeof(ijel_index_header));
+    for (i = 0; i < hdr->nrecords; i++)
+      if (r[i].name >= hdr->strings_size) {
+        hdr = NULL;
+        break;
+      }
+  }
+  if (hdr) {
+    ijel_index_detach(idx);
+    if (ijel_index_attach(idx, base, (size_t) st.st_size, mapped) == 0) return 1;
+  }
+
+#ifdef HAVE_SYS_MMAN_H
+  if (mapped) munmap(base, (size_t) st.st_size);
+  else
+#endif
+    free(base);
+  return 0;
+}
+
+
+/* Writes the image atomically; the old file stays if anything fails. */
+static int ijel_index_save(jel_index *idx, unsigned char *base, size_t len) {
+  size_t n = strlen(idx->indexpath) + 5;
+  char *tmp = malloc(n);
+  FILE *fp;
+  int ok;
+
+  if (!tmp) return 0;
+  snprintf(tmp, n, "%s.tmp", idx->indexpath);
+  if (!(fp = fopen(tmp, "wb"))) {
+    free(tmp);
+    return 0;
+  }
+  ok = fwrite(base, 1, len, fp) == len;
+  ok = (fclose(fp) == 0) && ok;
+  if (ok) ok = rename(tmp, idx->indexpath) == 0;
+  if (!ok) remove(tmp);
+  free(tmp);
+  return ok;
+}
+
+
+typedef struct {
+  const char *name;
+  int i;
+} ijel_name_ref;
+
+static int ijel_name_cmp(const void *a, const void *b) {
+  return strcmp(((const ijel_name_ref *) a)->name, ((const ijel_name_ref *) b)->name);
+}
+
+
+static int ijel_str_cmp(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+
+static void ijel_index_mark_used(jel_index *idx, int i) {
+  idx->next[i] = i + 1;
+}
+
+
+/* First unused record at or after i, with path halving: */
+static int ijel_index_find(jel_index *idx, int i) {
+  while (idx->next[i] != i) {
+    idx->next[i] = idx->next[idx->next[i]];
+    i = idx->next[i];
+  }
+  return i;
+}
+
+
+/*
+ * Rescans the directory.  Records for unchanged files are kept, and
+ * only new or modified files are read.  Returns the number of files
+ * read (including ones that turned out not to be JPEGs), or a
+ * negative error code.  If memory runs out (JEL_ERR_NOMEM) the index
+ * is left as it was, unless the new image was already built, in which
+ * case it is left empty.
+ */
+int jel_index_update( jel_index *idx ) {
+  ijel_name_ref *old = NULL, key, *hit;
+  ijel_index_record *recs = NULL, *r;
+  ijel_index_header hdr;
+  unsigned char *base = NULL;
+  char *names = NULL, *path = NULL, **taken = NULL, *name;
+  void *more;
+  size_t nnames = 0, maxnames = 4096, maxrecs = 256, pathmax = 0, len, need;
+  uint32_t settings = ijel_index_settings(idx->cfg);
+  int reuse, changed, nrecs = 0, nread = 0, ntaken = 0, ret, i;
+  struct dirent *de;
+  struct stat st;
+  DIR *dir;
+
+  if (!(dir = opendir(idx->dirpath))) return JEL_ERR_CANTOPENFILE;
+
+  /* Old records by name, if they were built with the same settings: */
+  reuse = idx->base && idx->hdr->settings == settings;
+  changed = !reuse;
+  if (reuse && idx->n > 0) {
+    if (!(old = malloc(sizeof(ijel_name_ref) * (size_t) idx->n))) goto nomem;
+    for (i = 0; i < idx->n; i++) {
+      old[i].name = idx->names + idx->recs[i].name;
+      old[i].i = i;
+    }
+    qsort(old, (size_t) idx->n, sizeof(ijel_name_ref), ijel_name_cmp);
+  }
+
+  recs = malloc(maxrecs * sizeof(ijel_index_record));
+  names = malloc(maxnames);
+  if (!recs || !names) goto nomem;
+
+  while ((de = readdir(dir)) != NULL) {
+    if (!ijel_is_jpeg_name(de->d_name)) continue;
+
+    len = strlen(idx->dirpath) + strlen(de->d_name) + 2;
+    if (len > pathmax) {
+      if (!(more = realloc(path, 2 * len))) goto nomem;
+      path = more;
+      pathmax = 2 * len;
+    }
+    snprintf(path, pathmax, "%s/%s", idx->dirpath, de->d_name);
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+
+    if ((size_t) nrecs == maxrecs) {
+      if (!(more = realloc(recs, 2 * maxrecs * sizeof(ijel_index_record)))) goto nomem;
+      recs = more;
+      maxrecs *= 2;
+    }
+    r = &recs[nrecs];
+
+    hit = NULL;
+    if (old) {
+      key.name = de->d_name;
+      hit = bsearch(&key, old, (size_t) idx->n, sizeof(ijel_name_ref), ijel_name_cmp);
+    }
+    if (hit && idx->recs[hit->i].size == (uint64_t) st.st_size &&
+        idx->recs[hit->i].mtime == (int64_t) st.st_mtime) {
+      *r = idx->recs[hit->i];
+    } else {
+      memset(r, 0, sizeof(ijel_index_record));
+      r->size = (uint64_t) st.st_size;
+      r->mtime = (int64_t) st.st_mtime;
+      changed = 1;
+      nread++;
+      /* Files that are not usable JPEGs are kept, so that they are not
+       * read again, but with a capacity that never matches.  Running
+       * out of memory says nothing about the file: */
+      ret = ijel_index_read_cover(idx, path, r);
+      if (ret == JEL_ERR_NOMEM) goto nomem;
+      if (ret != 0) r->capacity = -1;
+    }
+
+    len = strlen(de->d_name) + 1;
+    while (nnames + len > maxnames) {
+      if (!(more = realloc(names, 2 * maxnames))) goto nomem;
+      names = more;
+      maxnames *= 2;
+    }
+    r->name = (uint32_t) nnames;
+    memcpy(names + nnames, de->d_name, len);
+    nnames += len;
+    nrecs++;
+  }
+  closedir(dir);
+  dir = NULL;
+  free(path);
+  path = NULL;
+  free(old);
+  old = NULL;
+
+  if (!changed && nrecs == idx->n) {   /* Nothing added, modified or deleted */
+    free(recs);
+    free(names);
+    return 0;
+  }
+
+  qsort(recs, (size_t) nrecs, sizeof(ijel_index_record), ijel_record_cmp);
+
+  if (nnames == 0) names[nnames++] = '\0';   /* Never an empty string table */
+  need = sizeof(ijel_index_header) + (size_t) nrecs * sizeof(ijel_index_record) + nnames;
+  if (!(base = malloc(need))) goto nomem;
+  memset(&hdr, 0, sizeof(hdr));
+  memcpy(hdr.magic, JEL_INDEX_MAGIC, 8);
+  hdr.record_size = sizeof(ijel_index_record);
+  hdr.nrecords = (uint32_t) nrecs;
+  hdr.settings = settings;
+  hdr.strings_size = (uint32_t) nnames;
+  memcpy(base, &hdr, sizeof(hdr));
+  memcpy(base + sizeof(hdr), recs, (size_t) nrecs * sizeof(ijel_index_record));
+  memcpy(base + sizeof(hdr) + (size_t) nrecs * sizeof(ijel_index_record), names, nnames);
+  free(recs);
+  recs = NULL;
+  free(names);
+  names = NULL;
+
+  /* Covers that were taken before the update stay taken: */
+  if (idx->base) {
+    if (!(taken = malloc(sizeof(char *) * (size_t) (idx->n + 1)))) goto nomem;
+    for (i = 0; i < idx->n; i++)
+      if (ijel_index_find(idx, i) != i) {
+        if (!(taken[ntaken] = strdup(idx->names + idx->recs[i].name))) goto nomem;
+        ntaken++;
+      }
+    qsort(taken, (size_t) ntaken, sizeof(char *), ijel_str_cmp);
+  }
+
+  /* Prefer the mapped file, so that processes sharing a directory
+   * share its pages; fall back to the in-memory image: */
+  ijel_index_detach(idx);
+  if (ijel_index_save(idx, base, need) && ijel_index_load(idx))
+    free(base);
+  else if (ijel_index_attach(idx, base, need, 0) != 0)
+    goto nomem;
+
+  if (taken) {
+    for (i = 0; i < idx->n && ntaken > 0; i++) {
+      name = (char *) idx->names + idx->recs[i].name;
+      if (bsearch(&name, taken, (size_t) ntaken, sizeof(char *), ijel_str_cmp))
+        ijel_index_mark_used(idx, i);
+    }
+    for (i = 0; i < ntaken; i++) free(taken[i]);
+    free(taken);
+  }
+
+  return nread;
+
+ nomem:
+  if (dir) closedir(dir);
+  for (i = 0; i < ntaken; i++) free(taken[i]);
+  free(taken);
+  free(base);
+  free(names);
+  free(recs);
+  free(path);
+  free(old);
+  return JEL_ERR_NOMEM;
+}
+
+
+/*
+ * Opens the index for the JPEGs in dirpath, building or refreshing it
+ * as needed.  indexpath may be NULL for <dirpath>/.jel-index.
+ * Capacities are computed with cfg's settings (components, frequency
+ * selection, MCU density, ECC and output quality), which the index
+ * takes a copy of.  Returns NULL, with cfg->jel_errno set, if the
+ * directory cannot be read or memory runs out.
+ */
+jel_index *jel_index_open( const char *dirpath, const char *indexpath, jel_config *cfg ) {
+  jel_index *idx = calloc(1, sizeof(jel_index));
+  size_t n;
+  int ret;
+
+  if (!idx) {
+    cfg->jel_errno = JEL_ERR_NOMEM;
+    return NULL;
+  }
+
+  idx->dirpath = strdup(dirpath);
+  if (indexpath)
+    idx->indexpath = strdup(indexpath);
+  else {
+    n = strlen(dirpath) + strlen(JEL_INDEX_NAME) + 2;
+    if ((idx->indexpath = malloc(n)) != NULL)
+      snprintf(idx->indexpath, n, "%s/%s", dirpath, JEL_INDEX_NAME);
+  }
+  idx->cfg = jel_init(cfg->freqs.nlevels);
+  if (!idx->dirpath || !idx->indexpath || !idx->cfg) {
+    jel_index_close(idx);
+    cfg->jel_errno = JEL_ERR_NOMEM;
+    return NULL;
+  }
+  ijel_apply_settings(cfg, idx->cfg);
+
+  (void) ijel_index_load(idx);
+  if ((ret = jel_index_update(idx)) < 0) {
+    jel_index_close(idx);
+    cfg->jel_errno = ret;
+    return NULL;
+  }
+  return idx;
+}
+
+
+void jel_index_close( jel_index *idx ) {
+  if (!idx) return;
+  ijel_index_detach(idx);
+  if (idx->cfg) jel_free(idx->cfg);
+  free(idx->next);
+  free(idx->path);
+  free(idx->dirpath);
+  free(idx->indexpath);
+  free(idx);
+}
+
+
+/* First record with at least min_capacity bytes: */
+static int ijel_index_lower_bound(jel_index *idx, int min_capacity) {
+  int lo = 0, hi = idx->n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (idx->recs[mid].capacity < min_capacity) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+
+/* Number of usable covers in the index: */
+int jel_index_size( jel_index *idx ) {
+  return idx->n - ijel_index_lower_bound(idx, 0);
+}
+
+
+/*
+ * Returns the path of the smallest unused cover that can hold
+ * min_capacity message bytes, and marks it used.  Returns NULL if
+ * there is none, or if there is no memory for the path.  The path is
+ * valid until the next call on idx.
+ */
+const char *jel_index_take( jel_index *idx, int min_capacity ) {
+  const char *name;
+  size_t len;
+  int lo;
+
+  lo = ijel_index_lower_bound(idx, min_capacity > 0 ? min_capacity : 0);
+  lo = ijel_index_find(idx, lo);
+  if (lo >= idx->n) return NULL;
+
+  name = idx->names + idx->recs[lo].name;
+  len = strlen(idx->dirpath) + strlen(name) + 2;
+  if (len > idx->pathlen) {
+    free(idx->path);
+    idx->pathlen = 0;
+    if (!(idx->path = malloc(2 * len))) return NULL;
+    idx->pathlen = 2 * len;
+  }
+  snprintf(idx->path, idx->pathlen, "%s/%s", idx->dirpath, name);
+  ijel_index_mark_used(idx, lo);
+  return idx->path;
+}
+
+
+/* Makes every cover available to jel_index_take again: */
+void jel_index_reset_used( jel_index *idx ) {
+  int i;
+
+  for (i = 0; i <= idx->n; i++) idx->next[i] = i;
+}
+
+
+/*
+ * Plans how to carry payload bytes over unused covers (see
+ * jel_plan_segments) and marks the chosen ones used.  On success
+ * *picks is one malloc'ed block, paths included, for the caller to
+ * free, and the number of picks is returned.
+ */
+int jel_index_plan( jel_index *idx, int payload, int overhead, int margin, jel_cover_pick **picks ) {
+  int *recno, *cap, *seglen;
+  int i, m = 0, k, j;
+  size_t strings = 0;
+  jel_cover_pick *p;
+  char *s;
+
+  *picks = NULL;
+  recno = malloc((size_t) (idx->n + 1) * sizeof(int));
+  cap = malloc((size_t) (idx->n + 1) * sizeof(int));
+  seglen = malloc((size_t) (idx->n + 1) * sizeof(int));
+  if (!recno || !cap || !seglen) {
+    k = JEL_ERR_NOMEM;
+    goto done;
+  }
+
+  for (i = ijel_index_find(idx, ijel_index_lower_bound(idx, 1)); i < idx->n;
+       i = ijel_index_find(idx, i + 1)) {
+    recno[m] = i;
+    cap[m] = idx->recs[i].capacity;
+    m++;
+  }
+
+  k = jel_plan_segments(cap, m, payload, overhead, margin, seglen);
+  if (k <= 0) goto done;
+
+  for (i = 0; i < m; i++)
+    if (seglen[i] > 0)
+      strings += strlen(idx->dirpath) + strlen(idx->names + idx->recs[recno[i]].name) + 2;
+
+  p = malloc((size_t) k * sizeof(jel_cover_pick) + strings);
+  if (!p) {
+    k = JEL_ERR_NOMEM;
+    goto done;
+  }
+  s = (char *) (p + k);
+  for (i = 0, j = 0; i < m; i++) {
+    if (seglen[i] <= 0) continue;
+    p[j].path = s;
+    s += sprintf(s, "%s/%s", idx->dirpath, idx->names + idx->recs[recno[i]].name) + 1;
+    p[j].capacity = cap[i];
+    p[j].msglen = seglen[i];
+    ijel_index_mark_used(idx, recno[i]);
+    j++;
+  }
+  *picks = p;
+
+ done:
+  free(recno);
+  free(cap);
+  free(seglen);
+  return k;
+}
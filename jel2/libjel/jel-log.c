@@ -0,0 +1,120 @@
+/*
+ * JPEG Embedding Library - jel-log.c
+ *
+ * Deferred logging.  By default jel_log and jel_vlog write straight
+ * to cfg->logger and flush, which multiplies embedding time once the
+ * per-MCU trace is on.  With a log ring installed (jel_set_log_ring)
+ * they only format into the next free slot of a ring owned by the
+ * config, and jel_drain_log writes the slots out later - from the
+ * same thread between messages, or from a logging thread while the
+ * config is embedding.
+ *
+ * A config is only ever used by one thread at a time, so each ring
+ * has exactly one producer; with at most one thread draining it, the
+ * ring needs no lock, only acquire/release ordering on its two
+ * indices.  When the ring is full, entries are dropped and counted
+ * rather than making the embedding thread wait.
+ */
+
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+#define JEL_LOG_LINE 256      /* Longer entries are truncated */
+
+typedef struct {
+  char text[JEL_LOG_LINE];
+} jel_log_slot;
+
+struct jel_log_ring {
+  atomic_ulong head;          /* Next slot to fill; moved by the producer */
+  atomic_ulong tail;          /* Next slot to drain; moved by the consumer */
+  atomic_ulong dropped;       /* Entries lost to a full ring */
+  unsigned long nslots;
+  jel_log_slot *slots;
+};
+
+
+/*
+ * Install a ring of nslots entries, replacing any previous one.  With
+ * nslots <= 0, drain and remove the ring, so that logging goes
+ * straight to cfg->logger again.  Not to be called while another
+ * thread is draining.
+ */
+int jel_set_log_ring( jel_config *cfg, int nslots ) {
+  struct jel_log_ring *r;
+
+  if (cfg->log_ring) {
+    jel_drain_log(cfg);
+    free(cfg->log_ring->slots);
+    free(cfg->log_ring);
+    cfg->log_ring = (struct jel_log_ring *) NULL;
+  }
+  if (nslots <= 0) return cfg->jel_errno = JEL_SUCCESS;
+
+  r = calloc(1, sizeof(struct jel_log_ring));
+  if (r) r->slots = malloc((size_t) nslots * sizeof(jel_log_slot));
+  if (!r || !r->slots) {
+    free(r);
+    return cfg->jel_errno = JEL_ERR_CANTOPENLOG;
+  }
+  r->nslots = (unsigned long) nslots;
+  atomic_init(&r->head, 0UL);
+  atomic_init(&r->tail, 0UL);
+  atomic_init(&r->dropped, 0UL);
+  cfg->log_ring = r;
+
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+/* Called by jel_log and jel_vlog in place of vfprintf: */
+int ijel_log_ring_push( jel_config *cfg, const char *format, va_list arg ) {
+  struct jel_log_ring *r = cfg->log_ring;
+  unsigned long head = atomic_load_explicit(&r->head, memory_order_relaxed);
+  unsigned long tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+  int n;
+
+  if (head - tail >= r->nslots) {
+    atomic_fetch_add_explicit(&r->dropped, 1UL, memory_order_relaxed);
+    return 0;
+  }
+
+  n = vsnprintf(r->slots[head % r->nslots].text, JEL_LOG_LINE, format, arg);
+  atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+  return n;
+}
+
+
+/*
+ * Write the pending entries to cfg->logger (or discard them if there
+ * is none).  Returns the number of entries drained.
+ */
+int jel_drain_log( jel_config *cfg ) {
+  struct jel_log_ring *r = cfg->log_ring;
+  unsigned long head, tail, dropped;
+  FILE *fp = cfg->logger;
+  int n = 0;
+
+  if (!r) return 0;
+
+  tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+  head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+  for (; tail != head; tail++, n++) {
+    if (fp) fputs(r->slots[tail % r->nslots].text, fp);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+  }
+
+  dropped = atomic_exchange_explicit(&r->dropped, 0UL, memory_order_relaxed);
+  if (fp) {
+    if (dropped) fprintf(fp, "\n[jel: %lu log entries dropped]\n", dropped);
+    fflush(fp);
+  }
+
+  return n;
+}
@@ -0,0 +1,223 @@
+/*
+ * JPEG Embedding Library - jel-markers.c
+ *
+ * Marker passthrough.  The source's COM and APPn markers (EXIF, XMP,
+ * ICC profiles and the like) are written to the output after its own
+ * headers.  jpeg_save_markers copies each marker into pool memory at
+ * decode, and jpeg_write_marker then copies it again a byte at a time,
+ * which on phone-camera covers comes to tens of KB per image.
+ *
+ * When the whole source is in memory, the markers are instead noted
+ * where they lie in the source buffer, and each goes to the output
+ * with one memcpy into the destination's buffer - with jpeg_memory_dest,
+ * the caller's own.  APP0 and APP14 are still saved by libjpeg, which
+ * reads the JFIF and Adobe markers among them; they are small, and are
+ * merged back in source order.  A FILE source has no buffer to point
+ * into, so all of its markers are saved.
+ *
+ * By default only FILE sources pass their markers on, as they always
+ * have; memory and pixel sources drop theirs unless
+ * jel_set_copy_markers turns copying on.  With it off, none are kept
+ * at all.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+#include "jel/ijel-stats.h"
+
+
+typedef struct {
+  const JOCTET *data;         /* In the source buffer */
+  unsigned int length;        /* Bytes of data, without the length field */
+  int code;                   /* JPEG_COM or JPEG_APP0+n */
+  int saved_before;           /* Markers libjpeg had saved when this one came */
+} jel_marker_ref;
+
+struct jel_markers {
+  jel_marker_ref *ref;        /* In source order */
+  int count;
+  int alloc;                  /* Only ever grows */
+};
+
+
+/* enable < 0 goes back to the default, copying from FILE sources only: */
+int jel_set_copy_markers( jel_config *cfg, int enable ) {
+  cfg->copy_markers = enable < 0 ? -1 : enable ? 1 : 0;
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+void ijel_markers_destroy(jel_config *cfg) {
+  if (!cfg->markers) return;
+  free(cfg->markers->ref);
+  free(cfg->markers);
+  cfg->markers = NULL;
+}
+
+
+/*
+ * libjpeg's marker processor for the markers kept in place.  The
+ * source hands over the whole image at once, so the marker lies in
+ * the buffer unless the source is truncated; then it is skipped, as
+ * libjpeg would have done.
+ */
+static boolean ijel_marker_ref_processor(j_decompress_ptr cinfo) {
+  jel_config *cfg = (jel_config *) ((char *) cinfo - offsetof(jel_config, srcinfo));
+  struct jpeg_source_mgr *src = cinfo->src;
+  struct jel_markers *mp = cfg->markers;
+  jpeg_saved_marker_ptr saved;
+  jel_marker_ref *ref;
+  long length;
+  int n;
+
+  if (src->bytes_in_buffer < 2) {
+    if (!(*src->fill_input_buffer) (cinfo)) return FALSE;
+  }
+  length = ((long) GETJOCTET(src->next_input_byte[0]) << 8) + GETJOCTET(src->next_input_byte[1]);
+  src->next_input_byte += 2;
+  src->bytes_in_buffer -= 2;
+  length -= 2;
+  if (length <= 0) return TRUE;
+
+  if ((size_t) length <= src->bytes_in_buffer && mp) {
+    if (mp->count == mp->alloc) {
+      n = mp->alloc ? 2 * mp->alloc : 16;
+      ref = realloc(mp->ref, (size_t) n * sizeof(jel_marker_ref));
+      if (ref) {
+        mp->ref = ref;
+        mp->alloc = n;
+      }
+    }
+    if (mp->count < mp->alloc) {
+      ref = mp->ref + mp->count++;
+      ref->data = src->next_input_byte;
+      ref->length = (unsigned int) length;
+      ref->code = cinfo->unread_marker;
+      for (n = 0, saved = cinfo->marker_list; saved; saved = saved->next) n++;
+      ref->saved_before = n;
+    }
+  }
+
+  (*src->skip_input_data) (cinfo, length);
+  return TRUE;
+}
+
+
+/* Forgets the markers of the last source, and has the decoder skip
+ * them from now on: */
+void ijel_markers_skip(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  int j;
+
+  if (cfg->markers) cfg->markers->count = 0;
+  jpeg_save_markers(cinfo, JPEG_COM, 0);
+  for (j = 0; j <= 15; j++)
+    jpeg_save_markers(cinfo, JPEG_APP0+j, 0);
+}
+
+
+/*
+ * Called before jpeg_read_header.  'whole' is set if the source manager
+ * hands over the entire image at once, as for splicing.
+ */
+void ijel_markers_source(jel_config *cfg, int whole) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_markers *mp = cfg->markers;
+  int j;
+
+  ijel_markers_skip(cfg);
+  if (!cfg->copy_markers || (cfg->copy_markers < 0 && whole)) return;
+
+  if (whole && !mp) {
+    mp = calloc(1, sizeof(struct jel_markers));
+    cfg->markers = mp;
+  }
+
+  /* Save Those Markers!  In place if possible: */
+  if (!whole || !mp) {
+    jpeg_save_markers(cinfo, JPEG_COM, 0xffff);
+    for (j = 0; j <= 15; j++)
+      jpeg_save_markers(cinfo, JPEG_APP0+j, 0xffff);
+    return;
+  }
+
+  jpeg_set_marker_processor(cinfo, JPEG_COM, ijel_marker_ref_processor);
+  for (j = 0; j <= 15; j++) {
+    if (j == 0 || j == 14)
+      jpeg_save_markers(cinfo, JPEG_APP0+j, 0xffff);
+    else
+      jpeg_set_marker_processor(cinfo, JPEG_APP0+j, ijel_marker_ref_processor);
+  }
+}
+
+
+/* libjpeg writes its own JFIF (APP0) and Adobe (APP14) markers, so
+ * copies of the source's would be duplicates: */
+static int ijel_marker_wanted(int code, const JOCTET *data, unsigned int length) {
+  if (code == JPEG_APP0 && length >= 14 &&
+      data[0] == 0x4a && data[1] == 0x46 && data[2] == 0x49 && data[3] == 0x46 && data[4] == 0x00)
+    return 0;
+  if (code == JPEG_APP0+14 && length >= 12 &&
+      data[0] == 0x41 && data[1] == 0x64 && data[2] == 0x6f && data[3] == 0x62 && data[4] == 0x65)
+    return 0;
+  return 1;
+}
+
+
+/* Copies n bytes to the destination, a buffer at a time.  As with
+ * libjpeg's own emit_byte, a full buffer is emptied straight away. */
+static void ijel_dest_write(j_compress_ptr cinfo, const JOCTET *data, size_t n) {
+  struct jpeg_destination_mgr *dest = cinfo->dest;
+  size_t k;
+
+  while (n > 0) {
+    k = n < dest->free_in_buffer ? n : dest->free_in_buffer;
+    memcpy(dest->next_output_byte, data, k);
+    dest->next_output_byte += k;
+    dest->free_in_buffer -= k;
+    data += k;
+    n -= k;
+    if (dest->free_in_buffer == 0 && !(*dest->empty_output_buffer) (cinfo))
+      ERREXIT(cinfo, JERR_CANT_SUSPEND);
+  }
+}
+
+
+static int ijel_write_marker(jel_config *c, int code, const JOCTET *data, unsigned int length) {
+  j_compress_ptr cinfo = &(c->dstinfo);
+  JOCTET header[4];
+
+  if (!ijel_marker_wanted(code, data, length) || length > 65533) return 0;
+  header[0] = 0xFF;
+  header[1] = (JOCTET) code;
+  header[2] = (JOCTET) ((length + 2) >> 8);
+  header[3] = (JOCTET) ((length + 2) & 0xFF);
+  ijel_dest_write(cinfo, header, sizeof(header));
+  ijel_dest_write(cinfo, data, length);
+  IJEL_STATS_COUNT(c, marker_bytes, (unsigned long) length + 4);
+  return 1;
+}
+
+
+/*
+ * Called just after jpeg_write_coefficients, which has written SOI and
+ * the JFIF or Adobe marker.  Returns the number of markers copied.
+ */
+int ijel_copy_markers(jel_config *c)  {
+  struct jpeg_decompress_struct *dinfo = &(c->srcinfo);
+  struct jel_markers *mp = c->markers;
+  jpeg_saved_marker_ptr marker_p = dinfo->marker_list;
+  int i, n, nsaved = 0, count = 0;
+
+  if (!c->copy_markers) return 0;
+
+  /* The saved markers, with the ones kept in place among them: */
+  n = mp ? mp->count : 0;
+  for (i = 0; i <= n; i++) {
+    for (; marker_p && (i == n || nsaved < mp->ref[i].saved_before); marker_p = marker_p->next, nsaved++)
+      count += ijel_write_marker(c, marker_p->marker, marker_p->data, marker_p->data_length);
+    if (i < n)
+      count += ijel_write_marker(c, mp->ref[i].code, mp->ref[i].data, mp->ref[i].length);
+  }
+  return count;
+}
@@ -0,0 +1,100 @@
+/*
+ * JPEG Embedding Library - jel-plan.c
+ *
+ * Link plans.  Everything that jel_embed and jel_extract derive from
+ * the seed alone - the PRN list that drives MCU selection and the
+ * per-MCU frequency shuffle - is the same for every message sent over
+ * a link, yet each call used to draw it again with nrand48.  A plan
+ * draws it once.  It is never written after jel_plan_create returns,
+ * so any number of configs, on any number of threads, can share it.
+ *
+ * The list is a prefix of the sequence the seed produces, so an image
+ * that needs more PRNs than the plan holds simply falls back to a
+ * private list, with identical results.
+ */
+
+#include <pthread.h>
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+struct jel_plan {
+  pthread_mutex_t lock;      /* Protects refs only */
+  int refs;
+  unsigned int seed;
+  int nlist;
+  long *list;
+};
+
+
+jel_plan *jel_plan_create( jel_config *cfg, int nprns ) {
+  jel_plan *plan;
+  unsigned short seed16v[3];
+  int i;
+
+  if (nprns <= 0) nprns = JEL_DEFAULT_PRN_CACHE_SIZE;
+
+  plan = calloc(1, sizeof(jel_plan));
+  if (!plan) return NULL;
+
+  plan->list = malloc((size_t) nprns * sizeof(long));
+  if (!plan->list) {
+    free(plan);
+    return NULL;
+  }
+
+  pthread_mutex_init(&plan->lock, NULL);
+  plan->refs = 1;
+  plan->seed = cfg->seed;
+  plan->nlist = nprns;
+
+  /* The same draws ijel_prn_create makes: */
+  _makeSeed16v(cfg->seed, seed16v);
+  for (i = 0; i < nprns; i++) plan->list[i] = nrand48(seed16v);
+
+  return plan;
+}
+
+
+void jel_plan_release( jel_plan *plan ) {
+  int refs;
+
+  if (!plan) return;
+
+  pthread_mutex_lock(&plan->lock);
+  refs = --plan->refs;
+  pthread_mutex_unlock(&plan->lock);
+  if (refs > 0) return;
+
+  pthread_mutex_destroy(&plan->lock);
+  free(plan->list);
+  free(plan);
+}
+
+
+void jel_set_plan( jel_config *cfg, jel_plan *plan ) {
+  if (plan) {
+    pthread_mutex_lock(&plan->lock);
+    plan->refs++;
+    pthread_mutex_unlock(&plan->lock);
+  }
+  jel_plan_release(cfg->plan);
+  cfg->plan = plan;
+}
+
+
+/*
+ * Points cache at the plan's list if the config has one that fits.
+ * Returns 1 if it did, 0 if the caller must draw its own list.
+ */
+int ijel_plan_attach(jel_config *cfg, prn_cache *cache, int size) {
+  jel_plan *plan = cfg->plan;
+
+  if (!plan || plan->seed != cfg->seed || plan->nlist < size) return 0;
+
+  cache->nlist = size;
+  cache->list = plan->list;
+  cache->shared = 1;
+  return 1;
+}
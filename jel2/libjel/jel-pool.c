@@ -0,0 +1,114 @@
+/*
+ * JPEG Embedding Library - jel-pool.c
+ *
+ * A thread-safe pool of jel_config objects.  Creating a config means
+ * a calloc, jpeg_create_decompress, jpeg_create_compress,
+ * jpeg_set_defaults and jpeg_set_quality; freeing it tears all of
+ * that down again.  Senders that embed one message per config can
+ * instead borrow a config from a pool and hand it back, in which case
+ * it is jel_reset () and kept for the next caller.
+ */
+
+#include <pthread.h>
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+struct jel_pool {
+  pthread_mutex_t lock;
+  jel_config *tmpl;      /* Private copy of the caller's settings, or NULL */
+  int max_idle;          /* Idle configs beyond this are freed on release */
+  int nidle;
+  jel_config **idle;     /* Stack of idle, already reset configs */
+};
+
+
+jel_pool *jel_pool_create( jel_config *tmpl, int max_idle ) {
+  jel_pool *pool;
+
+  if (max_idle < 0) max_idle = 0;
+
+  pool = calloc(1, sizeof(jel_pool));
+  if (!pool) return NULL;
+
+  pool->idle = calloc((size_t) (max_idle > 0 ? max_idle : 1), sizeof(jel_config *));
+  if (!pool->idle) {
+    free(pool);
+    return NULL;
+  }
+  pool->max_idle = max_idle;
+
+  if (tmpl) {
+    /* Take a copy so that the caller is free to reuse or free tmpl: */
+    pool->tmpl = jel_init(tmpl->freqs.nlevels);
+    if (!pool->tmpl) {
+      free(pool->idle);
+      free(pool);
+      return NULL;
+    }
+    ijel_apply_settings(tmpl, pool->tmpl);
+  }
+
+  pthread_mutex_init(&pool->lock, NULL);
+
+  return pool;
+}
+
+
+/*
+ * Returns an idle config if there is one, otherwise a new one.
+ * Returns NULL only if a new config cannot be allocated.
+ */
+jel_config *jel_pool_acquire( jel_pool *pool ) {
+  jel_config *cfg = NULL;
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->nidle > 0) cfg = pool->idle[--pool->nidle];
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!cfg) {
+    cfg = jel_init(pool->tmpl ? pool->tmpl->freqs.nlevels : JEL_NLEVELS);
+    if (cfg && pool->tmpl) ijel_apply_settings(pool->tmpl, cfg);
+  }
+
+  return cfg;
+}
+
+
+/*
+ * Resets cfg and keeps it for the next jel_pool_acquire, unless the
+ * pool already holds max_idle configs.  The reset happens outside the
+ * lock, so releasing threads do not serialize on it.
+ */
+void jel_pool_release( jel_pool *pool, jel_config *cfg ) {
+  int kept = 0;
+
+  if (!cfg) return;
+
+  jel_reset(cfg);
+  if (pool->tmpl) ijel_apply_settings(pool->tmpl, cfg);
+
+  pthread_mutex_lock(&pool->lock);
+  if (pool->nidle < pool->max_idle) {
+    pool->idle[pool->nidle++] = cfg;
+    kept = 1;
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  if (!kept) jel_free(cfg);
+}
+
+
+void jel_pool_destroy( jel_pool *pool ) {
+  int i;
+
+  if (!pool) return;
+
+  for (i = 0; i < pool->nidle; i++) jel_free(pool->idle[i]);
+  if (pool->tmpl) jel_free(pool->tmpl);
+
+  pthread_mutex_destroy(&pool->lock);
+  free(pool->idle);
+  free(pool);
+}
@@ -0,0 +1,283 @@
+/*
+ * JPEG Embedding Library - jel-raw.c
+ *
+ * Pixel sources.  Video frames used to reach libjel as JPEGs: each
+ * frame was compressed, Huffman coding and all, only for
+ * jel_set_mem_source to decode it straight back into coefficients,
+ * and jel_embed then coded it a second time.  jel_set_raw_source takes
+ * the pixels instead.  libjpeg's compressor runs its color conversion,
+ * downsampling and forward DCT as usual, but with coef_capture set
+ * (see jpeglib.h) it leaves the quantized blocks in arrays belonging
+ * to the decompressor rather than coding them.  What it does write -
+ * the tables, the frame header and an empty scan - is read back by the
+ * decompressor, which then describes the image exactly as it would
+ * the JPEG, and jel_embed codes each block once.
+ *
+ * With a libjpeg that cannot capture coefficients, the frame is still
+ * compressed and read back, as the caller would have done, from a
+ * buffer kept here until the next frame.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+#include "jel/ijel-stats.h"
+#include "jel/jpeg-mem-src.h"
+
+
+struct jel_raw {
+  JOCTET *buf;                /* What the compressor wrote */
+  size_t alloc;               /* Allocated size of buf; only ever grows */
+  size_t len;                 /* Bytes of buf in use */
+  int compressing;            /* 1 while the compressor writes to buf */
+  struct jpeg_destination_mgr *saved_dest; /* The caller's destination meanwhile */
+#ifdef JPEG_COEF_CAPTURE
+  int active;                 /* 1 while the source is a captured frame */
+  int ncomp;
+  JDIMENSION width_in_blocks[MAX_COMPONENTS];
+  JDIMENSION height_in_blocks[MAX_COMPONENTS];
+  jvirt_barray_ptr coefs[MAX_COMPONENTS]; /* In the decompressor's image pool */
+#endif
+};
+
+
+/* A destination manager writing to rp->buf, which grows as needed: */
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  struct jel_raw *rp;
+} raw_destination_mgr;
+
+
+static void raw_init_destination(j_compress_ptr cinfo) {
+  raw_destination_mgr *dest = (raw_destination_mgr *) cinfo->dest;
+
+  dest->pub.next_output_byte = dest->rp->buf;
+  dest->pub.free_in_buffer = dest->rp->alloc;
+}
+
+
+/* The buffer is full: double it, and carry on where it ended. */
+static boolean raw_empty_output_buffer(j_compress_ptr cinfo) {
+  raw_destination_mgr *dest = (raw_destination_mgr *) cinfo->dest;
+  struct jel_raw *rp = dest->rp;
+  JOCTET *buf = realloc(rp->buf, 2 * rp->alloc);
+
+  if (!buf) ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 10);
+  dest->pub.next_output_byte = buf + rp->alloc;
+  dest->pub.free_in_buffer = rp->alloc;
+  rp->buf = buf;
+  rp->alloc *= 2;
+  return TRUE;
+}
+
+
+static void raw_term_destination(j_compress_ptr cinfo) {
+  raw_destination_mgr *dest = (raw_destination_mgr *) cinfo->dest;
+
+  dest->rp->len = (size_t) (dest->pub.next_output_byte - dest->rp->buf);
+}
+
+
+#ifdef JPEG_COEF_CAPTURE
+
+/*
+ * Called after jpeg_start_compress, which has sized the components.
+ * The arrays are the ones jpeg_read_coefficients would make, in the
+ * decompressor's image pool so that they live as long as its source.
+ */
+static void ijel_raw_capture(jel_config *cfg, struct jel_raw *rp) {
+  struct jpeg_compress_struct *cinfo = &(cfg->dstinfo);
+  struct jpeg_decompress_struct *srcinfo = &(cfg->srcinfo);
+  jpeg_component_info *compptr;
+  long h, v;
+  int ci;
+
+  rp->ncomp = cinfo->num_components;
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components; ci++, compptr++) {
+    h = compptr->h_samp_factor;
+    v = compptr->v_samp_factor;
+    rp->width_in_blocks[ci] = compptr->width_in_blocks;
+    rp->height_in_blocks[ci] = compptr->height_in_blocks;
+    rp->coefs[ci] = (*srcinfo->mem->request_virt_barray)
+      ((j_common_ptr) srcinfo, JPOOL_IMAGE, FALSE,
+       (JDIMENSION) ((compptr->width_in_blocks + h - 1) / h * h),
+       (JDIMENSION) ((compptr->height_in_blocks + v - 1) / v * v),
+       (JDIMENSION) v);
+  }
+  (*srcinfo->mem->realize_virt_arrays) ((j_common_ptr) srcinfo);
+
+  cinfo->coef_capture = rp->coefs;
+  rp->active = 1;
+}
+
+#endif
+
+
+void ijel_raw_destroy(jel_config *cfg) {
+  if (!cfg->raw) return;
+  free(cfg->raw->buf);
+  free(cfg->raw);
+  cfg->raw = NULL;
+}
+
+
+/*
+ * Compresses the frame with the config's compressor, and sets the
+ * decompressor's source to what was written.  Returns 0, or a JEL_ERR_*
+ * code if the frame cannot be compressed; libjpeg errors go to the
+ * caller's error manager, which must then call ijel_raw_release.
+ */
+int ijel_raw_source(jel_config *cfg, const unsigned char *pixels, int width, int height,
+                    jel_pixel_format format) {
+  struct jpeg_compress_struct *cinfo = &(cfg->dstinfo);
+  struct jel_raw *rp = cfg->raw;
+  raw_destination_mgr dest;
+  JSAMPROW rows[MAX_SAMP_FACTOR * DCTSIZE];
+  J_COLOR_SPACE space;
+  size_t stride, need;
+  JDIMENSION y;
+  int ncomp, n;
+  double t0;
+
+  switch (format) {
+  case JEL_PIXELS_GRAY:  ncomp = 1; space = JCS_GRAYSCALE; break;
+  case JEL_PIXELS_RGB:   ncomp = 3; space = JCS_RGB;       break;
+  case JEL_PIXELS_YCBCR: ncomp = 3; space = JCS_YCbCr;     break;
+  default: return JEL_ERR_BADDIMS;
+  }
+  if (!pixels || width <= 0 || height <= 0 ||
+      width > (int) JPEG_MAX_DIMENSION || height > (int) JPEG_MAX_DIMENSION)
+    return JEL_ERR_BADDIMS;
+
+  if (!rp) {
+    rp = calloc(1, sizeof(struct jel_raw));
+    if (!rp) return JEL_ERR_JPEG;
+    cfg->raw = rp;
+  }
+
+  /* Room for the headers, or, without capture, for a typical frame: */
+#ifdef JPEG_COEF_CAPTURE
+  need = 4096;
+#else
+  need = (size_t) width * (size_t) height * (size_t) ncomp / 4 + 4096;
+#endif
+  if (rp->alloc < need) {
+    free(rp->buf);
+    rp->alloc = 0;
+    rp->buf = malloc(need);
+    if (!rp->buf) return JEL_ERR_JPEG;
+    rp->alloc = need;
+  }
+
+  t0 = IJEL_STATS_START(cfg);
+  cinfo->image_width = (JDIMENSION) width;
+  cinfo->image_height = (JDIMENSION) height;
+  cinfo->input_components = ncomp;
+  cinfo->in_color_space = space;
+  jpeg_set_defaults(cinfo);
+  jpeg_set_quality(cinfo, cfg->quality > 0 ? cfg->quality : 75, FORCE_BASELINE);
+
+  /* The caller's destination, if any, is for jel_embed: */
+  dest.pub.init_destination = raw_init_destination;
+  dest.pub.empty_output_buffer = raw_empty_output_buffer;
+  dest.pub.term_destination = raw_term_destination;
+  dest.rp = rp;
+  rp->saved_dest = cinfo->dest;
+  rp->compressing = 1;
+  cinfo->dest = &dest.pub;
+
+  jpeg_start_compress(cinfo, TRUE);
+#ifdef JPEG_COEF_CAPTURE
+  ijel_raw_capture(cfg, rp);
+#endif
+
+  stride = (size_t) width * (size_t) ncomp;
+  while (cinfo->next_scanline < cinfo->image_height) {
+    for (n = 0, y = cinfo->next_scanline; n < MAX_SAMP_FACTOR * DCTSIZE && y < cinfo->image_height; n++, y++)
+      rows[n] = (JSAMPROW) (pixels + (size_t) y * stride);
+    (void) jpeg_write_scanlines(cinfo, rows, (JDIMENSION) n);
+  }
+  jpeg_finish_compress(cinfo);
+
+#ifdef JPEG_COEF_CAPTURE
+  cinfo->coef_capture = NULL;
+#endif
+  cinfo->dest = rp->saved_dest;
+  rp->compressing = 0;
+
+  ijel_memory_src(cfg, (unsigned char *) rp->buf, (int) rp->len);
+  IJEL_STATS_STOP(cfg, decode_usec, t0);
+  IJEL_STATS_COUNT(cfg, raw_sources, 1);
+  return 0;
+}
+
+
+#ifdef JPEG_COEF_CAPTURE
+
+int ijel_raw_active(jel_config *cfg) {
+  return cfg->raw && cfg->raw->active;
+}
+
+
+/*
+ * Called after jpeg_read_header has read the frame's headers, in place
+ * of jpeg_read_coefficients.  Returns the captured arrays, or NULL if
+ * the header does not describe them.  The decompressor only latches
+ * each component's quant table when it starts on the scan, which it
+ * never does here, so that is done too.
+ */
+jvirt_barray_ptr *ijel_raw_coefficients(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_raw *rp = cfg->raw;
+  jpeg_component_info *compptr;
+  JQUANT_TBL *qtbl;
+  int ci;
+
+  if (!ijel_raw_active(cfg) || cinfo->num_components != rp->ncomp) return NULL;
+
+  for (ci = 0, compptr = cinfo->comp_info; ci < cinfo->num_components; ci++, compptr++) {
+    qtbl = cinfo->quant_tbl_ptrs[compptr->quant_tbl_no];
+    if (compptr->width_in_blocks != rp->width_in_blocks[ci] ||
+        compptr->height_in_blocks != rp->height_in_blocks[ci] || !qtbl)
+      return NULL;
+    compptr->quant_table = (JQUANT_TBL *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE, sizeof(JQUANT_TBL));
+    memcpy(compptr->quant_table, qtbl, sizeof(JQUANT_TBL));
+  }
+  return rp->coefs;
+}
+
+#else  /* A libjpeg without capture: the frame is read back as a JPEG */
+
+int ijel_raw_active(jel_config *cfg) { (void) cfg; return 0; }
+jvirt_barray_ptr *ijel_raw_coefficients(jel_config *cfg) { (void) cfg; return NULL; }
+
+#endif
+
+
+/*
+ * Undoes whatever ijel_raw_source left behind: the compressor's
+ * destination, if it failed part way, and a captured frame's
+ * decompressor, which has read only headers and so can be aborted
+ * but not finished.  Returns 1 if there was a captured frame.
+ */
+int ijel_raw_release(jel_config *cfg) {
+  struct jel_raw *rp = cfg->raw;
+
+  if (!rp) return 0;
+  if (rp->compressing) {
+    jpeg_abort_compress(&(cfg->dstinfo));
+#ifdef JPEG_COEF_CAPTURE
+    cfg->dstinfo.coef_capture = NULL;
+#endif
+    cfg->dstinfo.dest = rp->saved_dest;
+    rp->compressing = 0;
+  }
+#ifdef JPEG_COEF_CAPTURE
+  if (rp->active) {
+    rp->active = 0;
+    jpeg_abort_decompress(&(cfg->srcinfo));
+    return 1;
+  }
+#endif
+  return 0;
+}
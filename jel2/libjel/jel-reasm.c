@@ -0,0 +1,520 @@
+/*
+ * JPEG Embedding Library - jel-reasm.c
+ *
+ * Reassembly of segmented messages.  A message is identified by its
+ * sender and message id.  The first segment to arrive allocates the
+ * whole message buffer and a bitmap of the segments claimed and
+ * received so far; each segment is written straight to its offset in
+ * that buffer, outside any lock.
+ *
+ * The table is split into shards, each a chained hash table under its
+ * own mutex, and a key always hashes to the same shard.  Receive
+ * threads only contend when two segments land on the same shard at
+ * the same moment, and the lock is only held to look up the message
+ * and flip bits, never while segment data is copied.
+ *
+ * Once jel_reasm_set_expiry has been called, partial messages that
+ * are not complete within that many seconds of their first segment
+ * are evicted.  Each shard keeps a two-level timer wheel: 256
+ * one-second slots, and 64 slots of 256 seconds whose entries cascade
+ * down as their time comes.  Advancing by one second touches a single
+ * slot, and wheels are advanced whenever a shard is used and by
+ * jel_reasm_tick, so abandoned messages are freed even when nothing
+ * more arrives for them.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+#define JEL_REASM_SHARDS   16     /* Default; always a power of two */
+#define JEL_REASM_BUCKETS  64     /* Initial buckets per shard */
+#define JEL_WHEEL0_BITS    8
+#define JEL_WHEEL0         (1 << JEL_WHEEL0_BITS)   /* One-second slots */
+#define JEL_WHEEL1         64                       /* JEL_WHEEL0-second slots */
+
+
+typedef struct ijel_partial {
+  struct ijel_partial *next;
+  uint64_t key;              /* sender << 32 | msgid */
+  int nsegs;
+  int msglen;
+  int nreceived;             /* Segments committed */
+  int writers;               /* Segments claimed but not yet committed */
+  uint64_t *claimed;         /* One bit per segment */
+  uint64_t *received;
+  unsigned char *msg;
+  int64_t deadline;          /* Evicted at this time, if expiry is on */
+  struct ijel_partial *wnext;     /* Timer wheel slot list */
+  struct ijel_partial **wprevp;   /* NULL when not on the wheel */
+} ijel_partial;
+
+
+typedef struct {
+  pthread_mutex_t lock;
+  ijel_partial **buckets;
+  int nbuckets;              /* Power of two */
+  int count;
+  long bytes;                /* Buffer bytes held by the partial messages */
+  int expiry;                /* Seconds; 0 means partial messages never expire */
+  int64_t now;               /* Time the wheel has been advanced to */
+  ijel_partial *wheel0[JEL_WHEEL0];
+  ijel_partial *wheel1[JEL_WHEEL1];
+  unsigned long expired_messages;
+  unsigned long expired_bytes;
+} ijel_shard;
+
+
+struct jel_reasm {
+  ijel_shard *shards;
+  int nshards;               /* Power of two */
+};
+
+
+static uint64_t ijel_reasm_key(unsigned int sender, unsigned int msgid) {
+  return (uint64_t) sender << 32 | msgid;
+}
+
+
+/* A 64-bit finalizer (from MurmurHash3), so that sequential message
+ * ids from one sender spread over the shards: */
+static uint64_t ijel_reasm_hash(uint64_t k) {
+  k ^= k >> 33;
+  k *= 0xff51afd7ed558ccdULL;
+  k ^= k >> 33;
+  k *= 0xc4ceb9fe1a85ec53ULL;
+  k ^= k >> 33;
+  return k;
+}
+
+
+static ijel_shard *ijel_reasm_shard(jel_reasm *r, uint64_t key, uint64_t *h) {
+  *h = ijel_reasm_hash(key);
+  return r->shards + (*h & (uint64_t) (r->nshards - 1));
+}
+
+
+/* The bucket index uses the hash bits above those that chose the shard: */
+static ijel_partial **ijel_reasm_bucket(jel_reasm *r, ijel_shard *sh, uint64_t h) {
+  return sh->buckets + ((h / (uint64_t) r->nshards) & (uint64_t) (sh->nbuckets - 1));
+}
+
+
+static ijel_partial *ijel_reasm_find(jel_reasm *r, ijel_shard *sh, uint64_t key, uint64_t h) {
+  ijel_partial *p;
+
+  for (p = *ijel_reasm_bucket(r, sh, h); p; p = p->next)
+    if (p->key == key) return p;
+  return NULL;
+}
+
+
+static void ijel_reasm_unlink(jel_reasm *r, ijel_shard *sh, ijel_partial *p) {
+  ijel_partial **pp = ijel_reasm_bucket(r, sh, ijel_reasm_hash(p->key));
+
+  while (*pp != p) pp = &(*pp)->next;
+  *pp = p->next;
+  sh->count--;
+}
+
+
+static void ijel_reasm_free_partial(ijel_partial *p) {
+  free(p->claimed);
+  free(p->msg);
+  free(p);
+}
+
+
+static void ijel_wheel_remove(ijel_partial *p) {
+  if (!p->wprevp) return;
+  *p->wprevp = p->wnext;
+  if (p->wnext) p->wnext->wprevp = p->wprevp;
+  p->wnext = NULL;
+  p->wprevp = NULL;
+}
+
+
+static void ijel_wheel_insert(ijel_shard *sh, ijel_partial *p) {
+  int64_t delta = p->deadline - sh->now;
+  ijel_partial **slot;
+
+  if (delta < 1) delta = 1;   /* Never the slot that is being emptied */
+  if (delta < JEL_WHEEL0)
+    slot = sh->wheel0 + ((sh->now + delta) & (JEL_WHEEL0 - 1));
+  else {
+    /* Deadlines past the top of the wheel wait in its last slot and
+     * are placed again when that slot cascades: */
+    int64_t t = delta < (int64_t) JEL_WHEEL0 * (JEL_WHEEL1 - 1) ? p->deadline
+      : sh->now + (int64_t) JEL_WHEEL0 * (JEL_WHEEL1 - 1);
+    slot = sh->wheel1 + ((t >> JEL_WHEEL0_BITS) & (JEL_WHEEL1 - 1));
+  }
+
+  p->wnext = *slot;
+  if (p->wnext) p->wnext->wprevp = &p->wnext;
+  p->wprevp = slot;
+  *slot = p;
+}
+
+
+/*
+ * Evicts p if its time has come, otherwise puts it back on the wheel.
+ * A message that is being written into is given another second
+ * instead, since its buffer is in use outside the lock.
+ */
+static void ijel_reasm_expire(jel_reasm *r, ijel_shard *sh, ijel_partial *p) {
+  if (p->deadline > sh->now) ijel_wheel_insert(sh, p);
+  else if (p->writers > 0) {
+    p->deadline = sh->now + 1;
+    ijel_wheel_insert(sh, p);
+  } else {
+    ijel_reasm_unlink(r, sh, p);
+    sh->bytes -= p->msglen;
+    sh->expired_messages++;
+    sh->expired_bytes += (unsigned long) p->msglen;
+    ijel_reasm_free_partial(p);
+  }
+}
+
+
+/*
+ * Moves the shard's wheel forward to time t, evicting what expires on
+ * the way.  Each second empties one slot of the first wheel, and every
+ * 256 seconds one slot of the second wheel cascades into the first.
+ */
+static void ijel_reasm_advance(jel_reasm *r, ijel_shard *sh, int64_t t) {
+  ijel_partial *p, *next, *all = NULL;
+  ijel_partial **slot;
+  int i;
+
+  if (t <= sh->now) return;
+
+  if (sh->count == 0) {
+    sh->now = t;
+    return;
+  }
+
+  if (t - sh->now >= (int64_t) JEL_WHEEL0 * JEL_WHEEL1) {
+    /* Every slot is due: take everything off and place it again. */
+    for (i = 0; i < JEL_WHEEL0 + JEL_WHEEL1; i++) {
+      slot = i < JEL_WHEEL0 ? sh->wheel0 + i : sh->wheel1 + i - JEL_WHEEL0;
+      for (p = *slot, *slot = NULL; p; p = next) {
+        next = p->wnext;
+        p->wnext = all;
+        all = p;
+      }
+    }
+    sh->now = t;
+    for (p = all; p; p = next) {
+      next = p->wnext;
+      p->wnext = NULL;
+      p->wprevp = NULL;
+      ijel_reasm_expire(r, sh, p);
+    }
+    return;
+  }
+
+  while (sh->now < t) {
+    sh->now++;
+
+    if ((sh->now & (JEL_WHEEL0 - 1)) == 0) {
+      slot = sh->wheel1 + ((sh->now >> JEL_WHEEL0_BITS) & (JEL_WHEEL1 - 1));
+      for (p = *slot, *slot = NULL; p; p = next) {
+        next = p->wnext;
+        p->wprevp = NULL;
+        ijel_wheel_insert(sh, p);
+      }
+    }
+
+    slot = sh->wheel0 + (sh->now & (JEL_WHEEL0 - 1));
+    for (p = *slot, *slot = NULL; p; p = next) {
+      next = p->wnext;
+      p->wnext = NULL;
+      p->wprevp = NULL;
+      ijel_reasm_expire(r, sh, p);
+    }
+  }
+}
+
+
+/* Doubles the shard's bucket array once chains average two entries: */
+static void ijel_reasm_grow(jel_reasm *r, ijel_shard *sh) {
+  ijel_partial **old = sh->buckets, *p, *next;
+  int i, n = sh->nbuckets;
+
+  sh->buckets = calloc((size_t) (2 * n), sizeof(ijel_partial *));
+  if (!sh->buckets) {
+    sh->buckets = old;
+    return;
+  }
+  sh->nbuckets = 2 * n;
+
+  for (i = 0; i < n; i++)
+    for (p = old[i]; p; p = next) {
+      ijel_partial **b = ijel_reasm_bucket(r, sh, ijel_reasm_hash(p->key));
+      next = p->next;
+      p->next = *b;
+      *b = p;
+    }
+  free(old);
+}
+
+
+static ijel_partial *ijel_reasm_insert(jel_reasm *r, ijel_shard *sh, uint64_t key, uint64_t h,
+                                       int nsegs, int msglen) {
+  ijel_partial *p = calloc(1, sizeof(ijel_partial));
+  size_t words = (size_t) (nsegs + 63) / 64;
+  ijel_partial **b;
+
+  if (!p) return NULL;
+  /* Both bitmaps in one allocation: */
+  p->claimed = calloc(2 * words, sizeof(uint64_t));
+  p->msg = malloc((size_t) (msglen > 0 ? msglen : 1));
+  if (!p->claimed || !p->msg) {
+    ijel_reasm_free_partial(p);
+    return NULL;
+  }
+  p->received = p->claimed + words;
+  p->key = key;
+  p->nsegs = nsegs;
+  p->msglen = msglen;
+  if (sh->expiry > 0) {
+    p->deadline = sh->now + sh->expiry;
+    ijel_wheel_insert(sh, p);
+  }
+
+  if (sh->count >= 2 * sh->nbuckets) ijel_reasm_grow(r, sh);
+  b = ijel_reasm_bucket(r, sh, h);
+  p->next = *b;
+  *b = p;
+  sh->count++;
+  sh->bytes += msglen;
+  return p;
+}
+
+
+jel_reasm *jel_reasm_create( int nshards ) {
+  jel_reasm *r;
+  int i, n = 1;
+
+  if (nshards <= 0) nshards = JEL_REASM_SHARDS;
+  while (n < nshards) n *= 2;
+
+  r = calloc(1, sizeof(jel_reasm));
+  if (!r) return NULL;
+  r->shards = calloc((size_t) n, sizeof(ijel_shard));
+  if (!r->shards) {
+    free(r);
+    return NULL;
+  }
+  r->nshards = n;
+
+  for (i = 0; i < n; i++) {
+    ijel_shard *sh = r->shards + i;
+    pthread_mutex_init(&sh->lock, NULL);
+    sh->now = (int64_t) time(NULL);
+    sh->nbuckets = JEL_REASM_BUCKETS;
+    sh->buckets = calloc(JEL_REASM_BUCKETS, sizeof(ijel_partial *));
+    if (!sh->buckets) {
+      r->nshards = i + 1;
+      jel_reasm_destroy(r);
+      return NULL;
+    }
+  }
+
+  return r;
+}
+
+
+/*
+ * Frees every partial message.  No other thread may be using r.
+ */
+void jel_reasm_destroy( jel_reasm *r ) {
+  ijel_partial *p, *next;
+  int i, j;
+
+  if (!r) return;
+
+  for (i = 0; i < r->nshards; i++) {
+    ijel_shard *sh = r->shards + i;
+    if (sh->buckets)
+      for (j = 0; j < sh->nbuckets; j++)
+        for (p = sh->buckets[j]; p; p = next) {
+          next = p->next;
+          ijel_reasm_free_partial(p);
+        }
+    free(sh->buckets);
+    pthread_mutex_destroy(&sh->lock);
+  }
+  free(r->shards);
+  free(r);
+}
+
+
+unsigned char *jel_reasm_claim( jel_reasm *r, unsigned int sender, unsigned int msgid,
+                                int nsegs, int seg, int msglen, int offset, int seglen,
+                                int *status ) {
+  uint64_t key = ijel_reasm_key(sender, msgid), h, bit;
+  ijel_shard *sh = ijel_reasm_shard(r, key, &h);
+  unsigned char *where = NULL;
+  ijel_partial *p;
+  int st = JEL_REASM_PARTIAL;
+
+  if (nsegs <= 0 || msglen < 0) st = JEL_REASM_BAD_NUM_SEG;
+  else if (seg < 0 || seg >= nsegs || offset < 0 || seglen < 0 || offset > msglen - seglen)
+    st = JEL_REASM_BAD_SEG_IDX;
+
+  if (st == JEL_REASM_PARTIAL) {
+    pthread_mutex_lock(&sh->lock);
+    if (sh->expiry > 0) ijel_reasm_advance(r, sh, (int64_t) time(NULL));
+    p = ijel_reasm_find(r, sh, key, h);
+    if (!p) p = ijel_reasm_insert(r, sh, key, h, nsegs, msglen);
+
+    bit = (uint64_t) 1 << (seg % 64);
+    if (!p) st = JEL_REASM_OUT_OF_MEM;
+    else if (p->nsegs != nsegs || p->msglen != msglen) st = JEL_REASM_BAD_NUM_SEG;
+    else if (p->claimed[seg / 64] & bit) st = JEL_REASM_DUP_SEGMENT;
+    else {
+      p->claimed[seg / 64] |= bit;
+      p->writers++;
+      where = p->msg + offset;
+    }
+    pthread_mutex_unlock(&sh->lock);
+  }
+
+  if (status) *status = st;
+  return where;
+}
+
+
+int jel_reasm_commit( jel_reasm *r, unsigned int sender, unsigned int msgid, int seg,
+                      unsigned char **msg, int *msglen ) {
+  uint64_t key = ijel_reasm_key(sender, msgid), h;
+  ijel_shard *sh = ijel_reasm_shard(r, key, &h);
+  ijel_partial *p, *whole = NULL;
+  int st = JEL_REASM_PARTIAL;
+  uint64_t bit = (uint64_t) 1 << ((seg < 0 ? 0 : seg) % 64);
+
+  pthread_mutex_lock(&sh->lock);
+  p = ijel_reasm_find(r, sh, key, h);
+  /* Only a segment that was claimed, and not yet committed: */
+  if (!p || seg < 0 || seg >= p->nsegs ||
+      !(p->claimed[seg / 64] & bit) || (p->received[seg / 64] & bit)) st = JEL_REASM_BAD_SEG_IDX;
+  else {
+    p->received[seg / 64] |= bit;
+    p->writers--;
+    if (++p->nreceived == p->nsegs) {
+      ijel_reasm_unlink(r, sh, p);
+      ijel_wheel_remove(p);
+      sh->bytes -= p->msglen;
+      whole = p;
+    }
+  }
+  pthread_mutex_unlock(&sh->lock);
+
+  if (!whole) return st;
+
+  *msg = whole->msg;
+  *msglen = whole->msglen;
+  whole->msg = NULL;
+  ijel_reasm_free_partial(whole);
+  return JEL_REASM_WHOLE;
+}
+
+
+/*
+ * Gives up a claim, so that a later copy of the segment is accepted.
+ */
+void jel_reasm_abort( jel_reasm *r, unsigned int sender, unsigned int msgid, int seg ) {
+  uint64_t key = ijel_reasm_key(sender, msgid), h;
+  ijel_shard *sh = ijel_reasm_shard(r, key, &h);
+  ijel_partial *p;
+
+  pthread_mutex_lock(&sh->lock);
+  p = ijel_reasm_find(r, sh, key, h);
+  if (p && seg >= 0 && seg < p->nsegs) {
+    uint64_t bit = (uint64_t) 1 << (seg % 64);
+    if ((p->claimed[seg / 64] & bit) && !(p->received[seg / 64] & bit)) {
+      p->claimed[seg / 64] &= ~bit;
+      p->writers--;
+    }
+  }
+  pthread_mutex_unlock(&sh->lock);
+}
+
+
+int jel_reasm_add( jel_reasm *r, unsigned int sender, unsigned int msgid,
+                   int nsegs, int seg, int msglen, int offset,
+                   unsigned char *data, int seglen,
+                   unsigned char **msg, int *len ) {
+  unsigned char *where;
+  int st;
+
+  where = jel_reasm_claim(r, sender, msgid, nsegs, seg, msglen, offset, seglen, &st);
+  if (!where) return st;
+
+  memcpy(where, data, (size_t) seglen);
+  return jel_reasm_commit(r, sender, msgid, seg, msg, len);
+}
+
+
+int jel_reasm_pending( jel_reasm *r ) {
+  int i, n = 0;
+
+  for (i = 0; i < r->nshards; i++) {
+    pthread_mutex_lock(&r->shards[i].lock);
+    n += r->shards[i].count;
+    pthread_mutex_unlock(&r->shards[i].lock);
+  }
+  return n;
+}
+
+
+/*
+ * Applies to messages whose first segment arrives from now on.
+ */
+void jel_reasm_set_expiry( jel_reasm *r, int seconds ) {
+  int i;
+
+  for (i = 0; i < r->nshards; i++) {
+    pthread_mutex_lock(&r->shards[i].lock);
+    r->shards[i].expiry = seconds > 0 ? seconds : 0;
+    pthread_mutex_unlock(&r->shards[i].lock);
+  }
+}
+
+
+/*
+ * Advances every shard's wheel to now (time (NULL) if now is 0), for
+ * callers that tick from a timer rather than rely on arrivals.
+ */
+void jel_reasm_tick( jel_reasm *r, long now ) {
+  int64_t t = now > 0 ? (int64_t) now : (int64_t) time(NULL);
+  int i;
+
+  for (i = 0; i < r->nshards; i++) {
+    pthread_mutex_lock(&r->shards[i].lock);
+    ijel_reasm_advance(r, r->shards + i, t);
+    pthread_mutex_unlock(&r->shards[i].lock);
+  }
+}
+
+
+int jel_reasm_get_stats( jel_reasm *r, jel_reasm_stats *stats ) {
+  int i;
+
+  memset(stats, 0, sizeof(jel_reasm_stats));
+  for (i = 0; i < r->nshards; i++) {
+    ijel_shard *sh = r->shards + i;
+    pthread_mutex_lock(&sh->lock);
+    stats->pending_messages += (unsigned long) sh->count;
+    stats->pending_bytes += (unsigned long) sh->bytes;
+    stats->expired_messages += sh->expired_messages;
+    stats->expired_bytes += sh->expired_bytes;
+    pthread_mutex_unlock(&sh->lock);
+  }
+  return 0;
+}
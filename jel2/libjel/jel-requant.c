@@ -0,0 +1,125 @@
+/*
+ * JPEG Embedding Library - jel-requant.c
+ *
+ * Requantization.  With JEL_PROP_QUALITY set, the output is written
+ * with the quant tables for that quality, and the message frequencies
+ * are chosen against them.  The coefficients, though, are still
+ * quantized with the source's tables, so swapping the tables alone
+ * scales every frequency of the picture by the ratio of the two.
+ * Here each coefficient is dequantized with the source table and
+ * quantized again with the output one, rounding to nearest (halves
+ * away from zero, as libjpeg's own quantizer does), before any
+ * message bit goes in.
+ *
+ * The inner loop has a fixed trip count of DCTSIZE2 and no branches,
+ * so that the compiler can vectorize it; each block row of a component
+ * is one pass over contiguous blocks.  The quotient is estimated with
+ * a single-precision reciprocal and corrected by one step, which is
+ * exact for every quotient up to the largest magnitude a baseline
+ * coefficient can have; larger ones are clamped to it anyway.
+ *
+ * Every block is new afterwards, so neither the source's coded bits
+ * (jel-splice.c) nor its symbol counts (jel-huff.c) are of any use.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+#include "jel/ijel-stats.h"
+
+
+/* Largest quantized magnitude the 8-bit baseline encoder accepts, and
+ * the largest an 8-bit source can hold: */
+#define IJEL_MAX_AC  1023
+#define IJEL_MAX_DC  1024
+#define IJEL_MAX_IN  2047
+
+typedef struct {
+  int qs[DCTSIZE2];             /* Source quant step, natural order */
+  int qd[DCTSIZE2];             /* Output quant step */
+  int half[DCTSIZE2];           /* qd / 2, for rounding */
+  float inv[DCTSIZE2];          /* 1 / qd */
+  int lim[DCTSIZE2];            /* Largest output magnitude */
+} ijel_requant;
+
+
+static void ijel_requantize_row(JBLOCKROW row, JDIMENSION nblocks, const ijel_requant *rq) {
+  JDIMENSION b;
+  JCOEF *c;
+  int k, sign, a, num, q, r;
+
+  for (b = 0; b < nblocks; b++) {
+    c = row[b];
+    for (k = 0; k < DCTSIZE2; k++) {
+      sign = - (c[k] < 0);
+      a = (c[k] ^ sign) - sign;
+      a = a < IJEL_MAX_IN ? a : IJEL_MAX_IN;
+      num = a * rq->qs[k] + rq->half[k];
+      q = (int) ((float) num * rq->inv[k]);
+      r = num - q * rq->qd[k];
+      q += (r >= rq->qd[k]) - (r < 0);
+      q = q < rq->lim[k] ? q : rq->lim[k];
+      c[k] = (JCOEF) ((q ^ sign) - sign);
+    }
+  }
+}
+
+
+/*
+ * Called by jel_embed before the message goes in.  Brings every
+ * component whose output quant table differs from its source table
+ * over to the output table, and returns the number of blocks changed.
+ */
+int ijel_requantize(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jpeg_compress_struct *dinfo = &(cfg->dstinfo);
+  jpeg_component_info *compptr;
+  JQUANT_TBL *src, *dst;
+  JBLOCKARRAY buffer;
+  JDIMENSION row;
+  ijel_requant rq;
+  int ci, k, changed, nblocks = 0;
+  double t0;
+
+  if (cfg->quality <= 0 || !cfg->coefs || dinfo->num_components != cinfo->num_components)
+    return 0;
+
+  t0 = IJEL_STATS_START(cfg);
+  for (ci = 0; ci < cinfo->num_components; ci++) {
+    compptr = cinfo->comp_info + ci;
+    src = compptr->quant_table;
+    dst = dinfo->quant_tbl_ptrs[dinfo->comp_info[ci].quant_tbl_no];
+    if (!src || !dst) continue;
+
+    changed = 0;
+    for (k = 0; k < DCTSIZE2; k++) {
+      rq.qs[k] = src->quantval[k];
+      rq.qd[k] = dst->quantval[k] ? dst->quantval[k] : 1;
+      rq.half[k] = rq.qd[k] >> 1;
+      rq.inv[k] = 1.0f / (float) rq.qd[k];
+      rq.lim[k] = k ? IJEL_MAX_AC : IJEL_MAX_DC;
+      if (rq.qs[k] != rq.qd[k]) changed = 1;
+    }
+    if (!changed) continue;
+
+    JEL_LOG(cfg, 2, "ijel_requantize: component %d to the output quant table.\n", ci);
+    for (row = 0; row < compptr->height_in_blocks; row++) {
+      buffer = (*cinfo->mem->access_virt_barray) ((j_common_ptr) cinfo, cfg->coefs[ci], row, 1, TRUE);
+      ijel_requantize_row(buffer[0], compptr->width_in_blocks, &rq);
+    }
+    nblocks += (int) (compptr->height_in_blocks * compptr->width_in_blocks);
+
+    /* The component's coefficients are now in the output table's steps.
+     * Its latched copy of the source table is only the decompressor's,
+     * for an IDCT that transcoding never does, so it records that - a
+     * second call has nothing to do: */
+    memcpy(src->quantval, dst->quantval, sizeof(src->quantval));
+  }
+
+  if (nblocks > 0) {
+    ijel_splice_forget(cfg);
+    ijel_huff_forget(cfg);
+    IJEL_STATS_COUNT(cfg, blocks_requantized, (unsigned long) nblocks);
+  }
+  IJEL_STATS_STOP(cfg, plan_usec, t0);
+  return nblocks;
+}
@@ -0,0 +1,138 @@
+/*
+ * JPEG Embedding Library - jel-scans.c
+ *
+ * Progressive covers.  jel_embed writes a sequential (baseline) JPEG
+ * whatever the source was, so a progressive cover came out in a
+ * different format, and usually a different size, from the one it went
+ * in as - a difference anyone comparing the two can see.  With
+ * jel_set_keep_scans, the decoder records the source's scan script
+ * (see scan_script in jpeglib.h), and the output is written with the
+ * same scans, through libjpeg's progressive Huffman encoder.
+ *
+ * libjpeg insists that a script it is given be complete: every
+ * coefficient of every component must be sent by some scan.  A source
+ * can be decoded without that (the missing coefficients are just
+ * zero), so the script is only kept if the decoder saw every one, read
+ * the source without warnings, and found the scans in the order the
+ * encoder accepts.  Otherwise, and for sequential sources, the output
+ * is sequential as before.
+ *
+ * Progressive output always has optimized tables: the Huffman tables
+ * of a progressive source belong to its scans, and libjpeg builds new
+ * ones for each scan with a statistics pass.  Neither splicing nor the
+ * symbol counts of jel-huff.c apply.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+#include "jel/ijel-stats.h"
+
+
+int jel_set_keep_scans( jel_config *cfg, int enable ) {
+  cfg->keep_scans = enable ? 1 : 0;
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+#ifdef JPEG_SCAN_SCRIPT
+
+#define IJEL_MAX_SCANS 100      /* As many as jpegtran's -scans allows */
+
+struct jel_scans {
+  jpeg_scan_info script[IJEL_MAX_SCANS];
+  int count;                  /* Scans recorded */
+  int usable;                 /* 1 if the script can be given to libjpeg */
+};
+
+
+void ijel_scans_destroy(jel_config *cfg) {
+  free(cfg->scans);
+  cfg->scans = NULL;
+}
+
+
+/* Called before jpeg_read_header, which reads the first SOS marker: */
+void ijel_scans_source(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_scans *sp = cfg->scans;
+
+  cinfo->scan_script = NULL;
+  cinfo->max_scan_script = 0;
+  cinfo->scan_script_count = 0;
+  if (sp) sp->usable = 0;
+
+  if (!cfg->keep_scans) return;
+
+  if (!sp) {
+    sp = calloc(1, sizeof(struct jel_scans));
+    if (!sp) return;
+    cfg->scans = sp;
+  }
+
+  cinfo->scan_script = sp->script;
+  cinfo->max_scan_script = IJEL_MAX_SCANS;
+}
+
+
+/* Called after jpeg_read_coefficients: */
+void ijel_scans_check(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_scans *sp = cfg->scans;
+  int ci, k, i;
+
+  if (!sp || !cinfo->scan_script) return;
+  cinfo->scan_script = NULL;
+  sp->count = cinfo->scan_script_count;
+
+  if (!cinfo->progressive_mode || sp->count <= 0 || cinfo->err->num_warnings > 0) {
+    JEL_LOG(cfg, 3, "ijel_scans_check: source is sequential or unreadable; output will be sequential.\n");
+    return;
+  }
+
+  /* Every coefficient was sent by some scan: */
+  for (ci = 0; ci < cinfo->num_components; ci++)
+    for (k = 0; k < DCTSIZE2; k++)
+      if (cinfo->coef_bits[ci][k] < 0) {
+        JEL_LOG(cfg, 2, "ijel_scans_check: component %d lacks coefficient %d; output will be sequential.\n", ci, k);
+        return;
+      }
+
+  /* Components within a scan are in frame order: */
+  for (k = 0; k < sp->count; k++)
+    for (i = 1; i < sp->script[k].comps_in_scan; i++)
+      if (sp->script[k].component_index[i] <= sp->script[k].component_index[i - 1]) {
+        JEL_LOG(cfg, 2, "ijel_scans_check: scan %d is out of order; output will be sequential.\n", k);
+        return;
+      }
+
+  sp->usable = 1;
+}
+
+
+/*
+ * Called just before jpeg_write_coefficients, ahead of the Huffman and
+ * splicing choices, which a script rules out.  Returns 1 if the output
+ * will have the source's scans.
+ */
+int ijel_scans_output(jel_config *cfg) {
+  struct jpeg_compress_struct *dstinfo = &(cfg->dstinfo);
+
+  if (!cfg->keep_scans || !cfg->scans || !cfg->scans->usable ||
+      dstinfo->num_components != cfg->srcinfo.num_components)
+    return 0;
+
+  dstinfo->scan_info = cfg->scans->script;
+  dstinfo->num_scans = cfg->scans->count;
+  IJEL_STATS_COUNT(cfg, scans_kept, 1);
+  return 1;
+}
+
+
+#else  /* A libjpeg that cannot record scans: output is always sequential */
+
+void ijel_scans_destroy(jel_config *cfg) { (void) cfg; }
+void ijel_scans_source(jel_config *cfg) { (void) cfg; }
+void ijel_scans_check(jel_config *cfg) { (void) cfg; }
+int  ijel_scans_output(jel_config *cfg) { (void) cfg; return 0; }
+
+#endif
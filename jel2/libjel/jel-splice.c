@@ -0,0 +1,374 @@
+/*
+ * JPEG Embedding Library - jel-splice.c
+ *
+ * Splicing.  An embedded message changes a few coefficients in a
+ * small fraction of the blocks, yet jel_embed used to Huffman-code
+ * every block of the output again.  When the source is in memory,
+ * the decoder records where each block's coded bits start (see
+ * jpeg_block_source in jpeglib.h), and the encoder copies the bits of
+ * any block that is unchanged, and whose DC prediction is unchanged,
+ * straight from the source.  Only the modified blocks, and the blocks
+ * just after them, are coded again.
+ *
+ * The copied bits are only meaningful under the source's Huffman
+ * tables, so the output takes those over.  Before it does, the blocks
+ * that will be coded again are checked against them: a table built
+ * for one image need not have a code for every symbol, and a block
+ * with a symbol it lacks cannot be written.  Then, as with a source
+ * that cannot be spliced at all (progressive, arithmetic-coded, read
+ * from a FILE, or with libjpeg warnings), every block is coded with
+ * the standard tables, as before.  Optimized tables (jel-huff.c) rule
+ * splicing out altogether, since every block must then be coded anew.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+#include "jel/ijel-stats.h"
+
+
+/* Huffman size category of a coefficient or DC difference: */
+int ijel_nbits(int v) {
+  int n = 0;
+
+  if (v < 0) v = -v;
+  while (v) {
+    n++;
+    v >>= 1;
+  }
+  return n;
+}
+
+
+#ifdef JPEG_BLOCK_SPLICING
+
+struct jel_splice {
+  jpeg_block_source *src;    /* One per coded block, in scan order */
+  long alloc;                /* Records allocated; only ever grows */
+  long nblocks;              /* Records the scan should fill */
+  int usable;                /* 1 once the decoder filled all of them */
+  int offset[MAX_COMPS_IN_SCAN]; /* Each component's first block in an MCU */
+};
+
+
+int jel_set_splice( jel_config *cfg, int enable ) {
+  cfg->splice_blocks = enable ? 1 : 0;
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+void ijel_splice_destroy(jel_config *cfg) {
+  if (!cfg->splice) return;
+  free(cfg->splice->src);
+  free(cfg->splice);
+  cfg->splice = NULL;
+}
+
+
+/*
+ * Called between jpeg_read_header and jpeg_read_coefficients.  The
+ * recorded positions point into the source buffer, so only a source
+ * that hands libjpeg the whole image at once ('whole') can be spliced.
+ */
+void ijel_splice_source(jel_config *cfg, int whole) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_splice *sp = cfg->splice;
+  jpeg_component_info *compptr;
+  long mcus_per_row, mcu_rows, blocks_in_mcu = 0;
+  int ci;
+
+  cinfo->block_sources = NULL;
+  cinfo->max_block_sources = 0;
+  cinfo->block_source_count = 0;
+  if (sp) sp->usable = 0;
+
+  if (!whole || !cfg->splice_blocks || cfg->optimize_huffman || cinfo->progressive_mode ||
+      cinfo->arith_code || cinfo->data_precision != BITS_IN_JSAMPLE)
+    return;
+
+  if (!sp) {
+    sp = calloc(1, sizeof(struct jel_splice));
+    if (!sp) return;
+    cfg->splice = sp;
+  }
+
+  /* The blocks in the first scan, which for a baseline image is the
+   * only one: */
+  if (cinfo->comps_in_scan == 1) {
+    compptr = cinfo->cur_comp_info[0];
+    sp->nblocks = (long) compptr->width_in_blocks * (long) compptr->height_in_blocks;
+  } else {
+    mcus_per_row = (long) (cinfo->image_width + cinfo->max_h_samp_factor * DCTSIZE - 1)
+      / (cinfo->max_h_samp_factor * DCTSIZE);
+    mcu_rows = (long) (cinfo->image_height + cinfo->max_v_samp_factor * DCTSIZE - 1)
+      / (cinfo->max_v_samp_factor * DCTSIZE);
+    for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+      compptr = cinfo->cur_comp_info[ci];
+      sp->offset[ci] = (int) blocks_in_mcu;
+      blocks_in_mcu += compptr->h_samp_factor * compptr->v_samp_factor;
+    }
+    sp->nblocks = mcus_per_row * mcu_rows * blocks_in_mcu;
+  }
+
+  if (sp->nblocks > sp->alloc) {
+    free(sp->src);
+    sp->alloc = 0;
+    sp->src = malloc((size_t) sp->nblocks * sizeof(jpeg_block_source));
+    if (!sp->src) return;
+    sp->alloc = sp->nblocks;
+  }
+
+  cinfo->block_sources = sp->src;
+  cinfo->max_block_sources = sp->nblocks;
+}
+
+
+/*
+ * Called after jpeg_read_coefficients.  The output is written as one
+ * interleaved scan with the components in frame order, so a source
+ * scan with any other layout cannot be spliced.
+ */
+void ijel_splice_check(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_splice *sp = cfg->splice;
+  int ci;
+
+  if (!sp || !cinfo->block_sources) return;
+  cinfo->block_sources = NULL;
+
+  if (cinfo->block_source_count != sp->nblocks || cinfo->err->num_warnings != 0 ||
+      cinfo->comps_in_scan != cinfo->num_components)
+    return;
+  for (ci = 0; ci < cinfo->num_components; ci++)
+    if (cinfo->cur_comp_info[ci] != cinfo->comp_info + ci) return;
+
+  sp->usable = 1;
+}
+
+
+int ijel_splice_active(jel_config *cfg) {
+  return cfg->splice && cfg->splice->usable;
+}
+
+
+/* Every block has changed (see jel-requant.c): */
+void ijel_splice_forget(jel_config *cfg) {
+  if (cfg->splice) cfg->splice->usable = 0;
+}
+
+
+/* Block (row, col) of component ci has been changed: */
+void ijel_splice_mark(jel_config *cfg, int ci, int row, int col) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_splice *sp = cfg->splice;
+  jpeg_component_info *compptr = cinfo->comp_info + ci;
+  long n;
+
+  if (!sp || !sp->usable) return;
+
+  if (cinfo->comps_in_scan == 1)
+    n = (long) row * compptr->width_in_blocks + col;
+  else
+    n = ((long) (row / compptr->v_samp_factor) * cinfo->MCUs_per_row
+         + col / compptr->h_samp_factor) * cinfo->blocks_in_MCU
+      + sp->offset[ci] + (row % compptr->v_samp_factor) * compptr->h_samp_factor
+      + col % compptr->h_samp_factor;
+
+  if (n >= 0 && n < sp->nblocks) sp->src[n].modified = 1;
+}
+
+
+/* Which symbols have a code in a table: */
+static void ijel_splice_symbols(JHUFF_TBL *htbl, unsigned char *has) {
+  int i, n = 0;
+
+  memset(has, 0, 256);
+  if (!htbl) return;
+  for (i = 1; i <= 16; i++) n += htbl->bits[i];
+  for (i = 0; i < n && i < 256; i++) has[htbl->huffval[i]] = 1;
+}
+
+
+/* Can block be coded, with this DC difference, under these tables? */
+static int ijel_splice_codable(JCOEF *block, int diff,
+                               unsigned char *dc_has, unsigned char *ac_has) {
+  int k, r = 0;
+
+  if (!dc_has[ijel_nbits(diff)]) return 0;
+  if (!block) return ac_has[0];
+
+  for (k = 1; k < DCTSIZE2; k++) {
+    if (block[jpeg_natural_order[k]] == 0) {
+      r++;
+      continue;
+    }
+    for (; r > 15; r -= 16)
+      if (!ac_has[0xF0]) return 0;
+    if (!ac_has[(r << 4) + ijel_nbits(block[jpeg_natural_order[k]])]) return 0;
+    r = 0;
+  }
+  return r == 0 || ac_has[0];
+}
+
+
+/*
+ * Walks the blocks in the order the encoder will see them and makes
+ * the same choice it will: a block is copied if it is unmodified, its
+ * DC value and prediction are as in the source, and the block after
+ * it (whose start marks its end) follows it directly.  Every other
+ * block must be codable under the source tables.  Dummy blocks at the
+ * right and bottom edges are built as jctrans.c builds them.
+ */
+static int ijel_splice_plan(jel_config *cfg) {
+  struct jpeg_decompress_struct *cinfo = &(cfg->srcinfo);
+  struct jel_splice *sp = cfg->splice;
+  jpeg_block_source *src = sp->src;
+  unsigned char (*has)[256];
+  JBLOCKARRAY rows[MAX_COMPS_IN_SCAN];
+  jpeg_component_info *compptr;
+  int last_dc[MAX_COMPS_IN_SCAN];
+  JDIMENSION mcu_row, mcu_col, nrows;
+  JCOEF *block;
+  int ci, xi, yi, dc, prev_dc = 0, ok = 1;
+  long n = 0;
+
+  has = malloc(2 * MAX_COMPS_IN_SCAN * 256);
+  if (!has) return 0;
+  for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+    compptr = cinfo->cur_comp_info[ci];
+    ijel_splice_symbols(cinfo->dc_huff_tbl_ptrs[compptr->dc_tbl_no], has[2 * ci]);
+    ijel_splice_symbols(cinfo->ac_huff_tbl_ptrs[compptr->ac_tbl_no], has[2 * ci + 1]);
+    last_dc[ci] = 0;
+  }
+
+  if (cinfo->comps_in_scan == 1) {
+    compptr = cinfo->cur_comp_info[0];
+    for (mcu_row = 0; mcu_row < compptr->height_in_blocks && ok; mcu_row++) {
+      rows[0] = (cinfo->mem->access_virt_barray)
+        ((j_common_ptr) cinfo, cfg->coefs[compptr->component_index], mcu_row, 1, FALSE);
+      for (mcu_col = 0; mcu_col < compptr->width_in_blocks && ok; mcu_col++, n++) {
+        block = rows[0][0][mcu_col];
+        if (n + 1 < sp->nblocks && !src[n].modified && !src[n+1].restart &&
+            src[n].dc == block[0] && src[n].dc_pred == last_dc[0]) {
+          last_dc[0] = block[0];
+          continue;
+        }
+        ok = ijel_splice_codable(block, block[0] - last_dc[0], has[0], has[1]);
+        last_dc[0] = block[0];
+      }
+    }
+    free(has);
+    return ok;
+  }
+
+  for (mcu_row = 0; n < sp->nblocks && ok; mcu_row++) {
+    for (ci = 0; ci < cinfo->comps_in_scan; ci++) {
+      compptr = cinfo->cur_comp_info[ci];
+      nrows = (JDIMENSION) compptr->v_samp_factor;
+      rows[ci] = (cinfo->mem->access_virt_barray)
+        ((j_common_ptr) cinfo, cfg->coefs[compptr->component_index],
+         mcu_row * nrows, nrows, FALSE);
+    }
+    for (mcu_col = 0; mcu_col < cinfo->MCUs_per_row && ok; mcu_col++) {
+      for (ci = 0; ci < cinfo->comps_in_scan && ok; ci++) {
+        compptr = cinfo->cur_comp_info[ci];
+        for (yi = 0; yi < compptr->v_samp_factor && ok; yi++) {
+          for (xi = 0; xi < compptr->h_samp_factor && ok; xi++, n++) {
+            block = NULL;
+            dc = prev_dc;
+            if (mcu_row * compptr->v_samp_factor + yi < compptr->height_in_blocks &&
+                mcu_col * compptr->h_samp_factor + xi < compptr->width_in_blocks) {
+              block = rows[ci][yi][mcu_col * compptr->h_samp_factor + xi];
+              dc = block[0];
+            }
+            prev_dc = dc;
+            if (n + 1 < sp->nblocks && !src[n].modified && !src[n+1].restart &&
+                src[n].dc == dc && src[n].dc_pred == last_dc[ci]) {
+              last_dc[ci] = dc;
+              continue;
+            }
+            ok = ijel_splice_codable(block, dc - last_dc[ci], has[2 * ci], has[2 * ci + 1]);
+            last_dc[ci] = dc;
+          }
+        }
+      }
+    }
+  }
+
+  free(has);
+  return ok;
+}
+
+
+/*
+ * Called just before jpeg_write_coefficients.  Returns 1, having
+ * pointed the compressor at the block records and given it the
+ * source's Huffman tables, if the output can be spliced; otherwise
+ * leaves the compressor as it was and returns 0.
+ */
+int ijel_splice_output(jel_config *cfg) {
+  struct jpeg_decompress_struct *srcinfo = &(cfg->srcinfo);
+  struct jpeg_compress_struct *dstinfo = &(cfg->dstinfo);
+  JHUFF_TBL **from, **to;
+  int ci, i;
+
+  dstinfo->splice_sources = NULL;
+  dstinfo->num_splice_sources = 0;
+
+  if (!ijel_splice_active(cfg) || dstinfo->optimize_coding || dstinfo->progressive_mode ||
+      dstinfo->arith_code || dstinfo->restart_interval || dstinfo->restart_in_rows ||
+      dstinfo->num_scans > 0 || dstinfo->num_components != srcinfo->num_components)
+    return 0;
+
+  if (!ijel_splice_plan(cfg)) {
+    JEL_LOG(cfg, 2, "ijel_splice_output: source Huffman tables lack codes for new blocks.\n");
+    return 0;
+  }
+
+  for (i = 0; i < 2 * NUM_HUFF_TBLS; i++) {
+    from = (i < NUM_HUFF_TBLS) ? srcinfo->dc_huff_tbl_ptrs : srcinfo->ac_huff_tbl_ptrs;
+    to = (i < NUM_HUFF_TBLS) ? dstinfo->dc_huff_tbl_ptrs : dstinfo->ac_huff_tbl_ptrs;
+    if (from[i % NUM_HUFF_TBLS] == NULL) continue;
+    if (to[i % NUM_HUFF_TBLS] == NULL)
+      to[i % NUM_HUFF_TBLS] = jpeg_alloc_huff_table((j_common_ptr) dstinfo);
+    memcpy(to[i % NUM_HUFF_TBLS]->bits, from[i % NUM_HUFF_TBLS]->bits,
+           sizeof(to[i % NUM_HUFF_TBLS]->bits));
+    memcpy(to[i % NUM_HUFF_TBLS]->huffval, from[i % NUM_HUFF_TBLS]->huffval,
+           sizeof(to[i % NUM_HUFF_TBLS]->huffval));
+    to[i % NUM_HUFF_TBLS]->sent_table = FALSE;
+  }
+  for (ci = 0; ci < srcinfo->num_components; ci++) {
+    dstinfo->comp_info[ci].dc_tbl_no = srcinfo->comp_info[ci].dc_tbl_no;
+    dstinfo->comp_info[ci].ac_tbl_no = srcinfo->comp_info[ci].ac_tbl_no;
+  }
+
+  dstinfo->splice_sources = cfg->splice->src;
+  dstinfo->num_splice_sources = cfg->splice->nblocks;
+  return 1;
+}
+
+
+/* Called once the output is written, or has failed: */
+void ijel_splice_done(jel_config *cfg) {
+  IJEL_STATS_COUNT(cfg, blocks_spliced, cfg->dstinfo.splice_sources ? cfg->dstinfo.splice_count : 0);
+  cfg->dstinfo.splice_sources = NULL;
+  cfg->dstinfo.num_splice_sources = 0;
+}
+
+
+#else  /* A libjpeg without block splicing: every block is coded again */
+
+int jel_set_splice( jel_config *cfg, int enable ) {
+  cfg->splice_blocks = enable ? 1 : 0;
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+void ijel_splice_destroy(jel_config *cfg) { (void) cfg; }
+void ijel_splice_source(jel_config *cfg, int whole) { (void) cfg; (void) whole; }
+void ijel_splice_check(jel_config *cfg) { (void) cfg; }
+int  ijel_splice_active(jel_config *cfg) { (void) cfg; return 0; }
+void ijel_splice_forget(jel_config *cfg) { (void) cfg; }
+void ijel_splice_mark(jel_config *cfg, int ci, int row, int col) { (void) cfg; (void) ci; (void) row; (void) col; }
+int  ijel_splice_output(jel_config *cfg) { (void) cfg; return 0; }
+void ijel_splice_done(jel_config *cfg) { (void) cfg; }
+
+#endif
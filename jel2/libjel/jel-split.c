@@ -0,0 +1,124 @@
+/*
+ * JPEG Embedding Library - jel-split.c
+ *
+ * Splitting one message over several covers.  A sender that cuts a
+ * message into fixed-size pieces before it knows which covers will
+ * carry them ends up with a half-empty last image, or with a piece
+ * that does not fit.  jel_plan_segments works from the capacities of
+ * the covers actually at hand (from a jel_index, or from
+ * jel_capacity_from_header) and picks both the covers and the piece
+ * sizes:
+ *
+ *   1. Fewest images: the k largest covers are the fewest that can
+ *      hold the message, so k is fixed first.
+ *   2. Fewest bytes: each of those k is then swapped, largest first,
+ *      for the smallest unused cover that still leaves enough room in
+ *      total.  Output size grows with capacity, so this keeps the
+ *      images, and the bytes sent, small.
+ *   3. Even fill: the message is shared out in proportion to what
+ *      each chosen cover can hold, so every image ends up about
+ *      equally full and none exceeds its capacity less the margin.
+ */
+
+#include "jel/jel.h"
+#include "jel/ijel.h"
+
+
+typedef struct {
+  int usable;                /* Capacity less margin and overhead */
+  int pos;                   /* Index into the caller's arrays */
+} ijel_split_cover;
+
+
+static int ijel_split_cmp(const void *a, const void *b) {
+  const ijel_split_cover *x = a, *y = b;
+
+  if (x->usable != y->usable) return x->usable < y->usable ? -1 : 1;
+  return x->pos < y->pos ? -1 : (x->pos > y->pos);
+}
+
+
+/* First of c[0..n) with at least min usable bytes: */
+static int ijel_split_lower_bound(ijel_split_cover *c, int n, int min) {
+  int lo = 0, hi = n, mid;
+
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (c[mid].usable < min) lo = mid + 1;
+    else hi = mid;
+  }
+  return lo;
+}
+
+
+int jel_plan_segments( const int *capacity, int ncovers, int payload,
+                       int overhead, int margin, int *seglen ) {
+  ijel_split_cover *c;
+  unsigned char *chosen;
+  long total = 0, slack, given;
+  int i, j, n = 0, k = 0;
+
+  if (payload <= 0) return JEL_ERR_NOMSG;
+  if (ncovers < 0) ncovers = 0;
+  if (overhead < 0) overhead = 0;
+  if (margin < 0) margin = 0;
+
+  c = malloc((size_t) (ncovers + 1) * sizeof(ijel_split_cover));
+  chosen = calloc((size_t) ncovers + 1, 1);
+  if (!c || !chosen) {
+    free(c);
+    free(chosen);
+    return JEL_ERR_NOMEM;
+  }
+
+  for (i = 0; i < ncovers; i++) {
+    seglen[i] = 0;
+    if (capacity[i] - margin - overhead <= 0) continue;
+    c[n].usable = capacity[i] - margin - overhead;
+    c[n].pos = i;
+    n++;
+  }
+  qsort(c, (size_t) n, sizeof(ijel_split_cover), ijel_split_cmp);
+
+  /* 1. The largest covers, until the message fits: */
+  for (i = n - 1; i >= 0 && total < payload; i--) {
+    chosen[i] = 1;
+    total += c[i].usable;
+    k++;
+  }
+  if (total < payload) {
+    free(c);
+    free(chosen);
+    return JEL_ERR_MSG_OVERFLOW;
+  }
+
+  /* 2. Trade each for the smallest unchosen cover the slack allows: */
+  slack = total - payload;
+  for (i = n - 1; i >= n - k; i--) {
+    if (!chosen[i] || slack == 0) continue;
+    j = ijel_split_lower_bound(c, n, (int) (c[i].usable - slack));
+    while (j < i && chosen[j]) j++;
+    if (j >= i || c[j].usable == c[i].usable) continue;
+    slack -= c[i].usable - c[j].usable;
+    total -= c[i].usable - c[j].usable;
+    chosen[i] = 0;
+    chosen[j] = 1;
+  }
+
+  /* 3. Share the message out in proportion to the room in each: */
+  given = 0;
+  for (i = 0; i < n; i++) {
+    if (!chosen[i]) continue;
+    seglen[c[i].pos] = (int) ((long long) payload * c[i].usable / total);
+    given += seglen[c[i].pos];
+  }
+  for (i = n - 1; given < payload; i = i > 0 ? i - 1 : n - 1) {
+    if (!chosen[i] || seglen[c[i].pos] >= c[i].usable) continue;
+    seglen[c[i].pos]++;
+    given++;
+  }
+
+  free(c);
+  free(chosen);
+  return k;
+}
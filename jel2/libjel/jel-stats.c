@@ -0,0 +1,61 @@
+/*
+ * JPEG Embedding Library - jel-stats.c
+ *
+ * Per-config instrumentation.  When enabled, jel_embed, jel_extract,
+ * jel_capacity and the source setters add their phase timings and
+ * counters to a jel_stats block hanging off the config; when
+ * disabled, that pointer is NULL and the IJEL_STATS_* macros in
+ * ijel-stats.h reduce to a pointer test.  The counters accumulate
+ * across images until jel_reset_stats is called - jel_reset leaves
+ * them alone, so a reused or pooled config can be sampled over many
+ * messages.
+ */
+
+#include <time.h>
+
+#include "jel/jel.h"
+#include "jel/ijel-stats.h"
+
+
+double ijel_now_usec(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1.0e6 + ts.tv_nsec / 1.0e3;
+}
+
+
+int jel_enable_stats(jel_config *cfg, int enable) {
+  if (enable && !cfg->stats) {
+    cfg->stats = calloc(1, sizeof(jel_stats));
+    if (!cfg->stats) return cfg->jel_errno = JEL_ERR_NOMEM;
+  } else if (!enable && cfg->stats) {
+    free(cfg->stats);
+    cfg->stats = (jel_stats *) NULL;
+  }
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+int jel_get_stats(jel_config *cfg, jel_stats *stats) {
+  jel_arena_stats arena;
+
+  if (!cfg->stats) {
+    memset(stats, 0, sizeof(jel_stats));
+    return cfg->jel_errno = JEL_ERR_NOSUCHPROP;
+  }
+
+  *stats = *cfg->stats;
+
+  /* The arena counts libjpeg's per-image memory whether or not it
+   * serves it: */
+  if (jel_get_arena_stats(cfg, &arena) == JEL_SUCCESS)
+    stats->peak_memory = arena.image_peak;
+
+  return cfg->jel_errno = JEL_SUCCESS;
+}
+
+
+void jel_reset_stats(jel_config *cfg) {
+  if (cfg->stats) memset(cfg->stats, 0, sizeof(jel_stats));
+}
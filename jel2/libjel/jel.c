@@ -33,6 +33,8 @@ bool jel_verbose = false;
 #include <setjmp.h>
 
 #include "jel/ijel.h"
+#include "jel/ijel-arena.h"
+#include "jel/ijel-stats.h"
 #include "jel/ijel-ecc.h"
 #include "jel/jpeg-mem-src.h"
 #include "jel/jpeg-mem-dst.h"
@@ -67,6 +69,7 @@ jel_config * jel_init( int nlevels ) {
 
   /* Allocate: */
   result = calloc(1, sizeof(jel_config) );
+  if (!result) return NULL;
 
   return _jel_init (nlevels, result);
 }
@@ -119,6 +122,15 @@ jel_config * _jel_init( int nlevels, jel_config *result ) {
   jpeg_set_defaults( cinfo );
   jpeg_set_quality( cinfo, 75, FORCE_BASELINE );
 
+  /* Serve per-image allocations of both objects from one arena: */
+  (void) ijel_arena_attach(result);
+
+  /* Copy unchanged blocks from memory sources rather than code them: */
+  result->splice_blocks = 1;
+
+  /* Copy the source's markers to the output, from FILE sources only: */
+  result->copy_markers = -1;
+
   result->srcinfo.dct_method = JDCT_ISLOW; /* Force this as the default. */
   result->dstinfo.dct_method = JDCT_ISLOW; /* Force this as the default. */
 
@@ -167,6 +179,7 @@ jel_config * _jel_init( int nlevels, jel_config *result ) {
   /* How to pack: */
   result->bits_per_freq = 1;
   result->mcu_density = -1;         // If -1, then we autocompute density
+  result->user_mcu_density = -1;
   result->maxmcus = 0;
   result->mcu_list = NULL;
   result->mcu_flag = NULL;
@@ -206,6 +219,18 @@ jel_config * _jel_init( int nlevels, jel_config *result ) {
 
 
 
+/*
+ * Done with the source.  A pixel source's decompressor has only read
+ * headers, so it is aborted rather than finished (jel-raw.c):
+ */
+static void ijel_finish_source( jel_config *cfg ) {
+  if (!cfg->needFinishDecompress) return;
+  if (!ijel_raw_release(cfg))
+    (void) jpeg_finish_decompress(&cfg->srcinfo);
+  cfg->needFinishDecompress = FALSE;
+}
+
+
 void jel_free( jel_config *cfg ) {
   jel_release (cfg);
 
@@ -216,8 +241,7 @@ void jel_free( jel_config *cfg ) {
 
 
 void jel_release( jel_config *cfg ) {
-  if (cfg->needFinishDecompress)
-    (void) jpeg_finish_decompress(&cfg->srcinfo);
+  ijel_finish_source(cfg);
   if (cfg->needFinishCompress)
     (void) jpeg_finish_compress(&cfg->dstinfo);
 
@@ -233,16 +257,20 @@ void jel_release( jel_config *cfg ) {
 
   memset(&cfg->srcinfo, 0, sizeof(struct jpeg_decompress_struct));
   memset(&cfg->dstinfo, 0, sizeof(struct jpeg_compress_struct));
+  cfg->stdio_src = (struct jpeg_source_mgr *) NULL;
+  cfg->mem_src = (struct jpeg_source_mgr *) NULL;
+  cfg->stdio_dest = (struct jpeg_destination_mgr *) NULL;
+  cfg->mem_dest = (struct jpeg_destination_mgr *) NULL;
 
   if (cfg->mcu_list /* != (unsigned int *) NULL */) {
     memset(cfg->mcu_list, 0, (size_t) (cfg->maxmcus * (int) sizeof (unsigned int)));
-    free(cfg->mcu_list);
+    ijel_scratch_free(cfg, cfg->mcu_list);
 
     memset(cfg->mcu_flag, 0, (size_t) cfg->maxmcus);
-    free(cfg->mcu_flag);
+    ijel_scratch_free(cfg, cfg->mcu_flag);
 
     memset(cfg->dc_values, 0, (size_t) cfg->maxmcus);
-    free(cfg->dc_values);
+    ijel_scratch_free(cfg, cfg->dc_values);
 
     cfg->mcu_list = (unsigned int *)  NULL;
     cfg->mcu_flag = (unsigned char *) NULL;
@@ -254,10 +282,124 @@ void jel_release( jel_config *cfg ) {
     //    cfg->plain    = (unsigned char *) NULL;
     memset(cfg->seed16v, 0, 3 * sizeof (unsigned short));
   }
+
+  ijel_arena_destroy(cfg);
+
+  free(cfg->held);
+  cfg->held = (unsigned char *) NULL;
+  free(cfg->stats);
+  cfg->stats = (jel_stats *) NULL;
+  jel_set_log_ring(cfg, 0);
+  jel_set_plan(cfg, (jel_plan *) NULL);
+  ijel_splice_destroy(cfg);
+  ijel_huff_destroy(cfg);
+  ijel_scans_destroy(cfg);
+  ijel_markers_destroy(cfg);
+  ijel_raw_destroy(cfg);
+  cfg->held_alloc = 0;
+  cfg->held_len = 0;
+}
+
+
+/*
+ * Return a config to its post-init state so that it can be used for
+ * another image.  Unlike jel_release, the libjpeg objects survive:
+ * only their per-image pools are dropped, so the permanent pools
+ * (quant and Huffman tables) are reused.  So are the source and
+ * destination managers, one of each kind, which the setters install
+ * afresh for each image.  Settings made through jel_setprop, jel_set_components,
+ * jel_set_frequencies and the logging calls are kept.  Everything
+ * that describes the previous image or message is cleared, and a new
+ * source (and destination, for embedding) must be set.
+ */
+void jel_reset( jel_config *cfg ) {
+  struct jpeg_compress_struct *cinfo = &(cfg->dstinfo);
+  int j;
+
+  /* The error managers installed by the API calls live on their
+   * stacks, so fall back to the one owned by the config: */
+  cfg->srcinfo.err = jpeg_std_error(&cfg->jerr);
+  cfg->dstinfo.err = jpeg_std_error(&cfg->jerr);
+
+  /* jel_set_mem_source destroys the decompressor if libjpeg fails: */
+  if (cfg->srcinfo.mem == NULL) {
+    jpeg_create_decompress( &(cfg->srcinfo) );
+    (void) ijel_arena_attach(cfg);
+    cfg->stdio_src = (struct jpeg_source_mgr *) NULL;
+    cfg->mem_src = (struct jpeg_source_mgr *) NULL;
+  }
+
+  /* Abort rather than finish: the previous image may have failed
+   * part way through, and aborting never touches the source or
+   * destination. */
+  (void) ijel_raw_release(cfg);
+  jpeg_abort_decompress(&cfg->srcinfo);
+  jpeg_abort_compress(cinfo);
+  cfg->needFinishDecompress = FALSE;
+  cfg->needFinishCompress = FALSE;
+
+  /* Stop saving or noting the markers of the last source: */
+  ijel_markers_skip(cfg);
+
+  /* Back to the compressor defaults set up by _jel_init.  The tables
+   * already exist in the permanent pool, so nothing is allocated: */
+  cinfo->in_color_space = JCS_GRAYSCALE;
+  cinfo->input_components = 1;
+  jpeg_set_defaults( cinfo );
+  jpeg_set_quality( cinfo, cfg->quality > 0 ? cfg->quality : 75, FORCE_BASELINE );
+  cfg->srcinfo.dct_method = JDCT_ISLOW;
+  cinfo->dct_method = JDCT_ISLOW;
+  cfg->qtable = cinfo->quant_tbl_ptrs[0];
+
+  /* Per-image state: */
+  cfg->coefs = (jvirt_barray_ptr *) NULL;
+  cfg->dstcoefs = (jvirt_barray_ptr *) NULL;
+  cfg->srcfp = (FILE *) NULL;
+  cfg->dstfp = (FILE *) NULL;
+
+  if (cfg->mcu_list) {
+    ijel_scratch_free(cfg, cfg->mcu_list);
+    ijel_scratch_free(cfg, cfg->mcu_flag);
+    ijel_scratch_free(cfg, cfg->dc_values);
+    cfg->mcu_list = (unsigned int *)  NULL;
+    cfg->mcu_flag = (unsigned char *) NULL;
+    cfg->dc_values = (unsigned int *) NULL;
+  }
+#if USE_PRN_CACHE
+  jelprn_destroy(&(cfg->prn_cache));
+#endif
+  /* Anything a failed embed or extract left in the arena goes too: */
+  ijel_arena_reset(cfg);
+  cfg->maxmcus = 0;
+  cfg->nmcus = 0;
+  cfg->mcu_index = 0;
+
+  /* Per-message state: */
+  cfg->data = (unsigned char *) NULL;
+  cfg->len = 0;
+  cfg->maxlen = 0;
+  cfg->jpeglen = 0;
+  cfg->jel_errno = 0;
+  cfg->held_len = 0;            /* The buffer itself is kept for reuse */
+  for (j = 0; j < 3; j++) {
+    cfg->data_ptr[j] = (unsigned char *) NULL;
+    cfg->data_lengths[j] = 0;
+    cfg->capacity[j] = 0;
+  }
+
+  /* Embedding and extraction overwrite these with values derived
+   * from the image or the bitstream header, so restore what the
+   * caller asked for.  Frequencies chosen from the previous image's
+   * quant tables are recomputed; explicit ones are kept. */
+  cfg->mcu_density = cfg->user_mcu_density;
+  if (!cfg->user_freqs) cfg->freqs.init = 0;
+
+  /* nrand48 advances the seed in place: */
+  _makeSeed16v (cfg->seed, cfg->seed16v);
 }
 
 
-   static void
+   void
 _makeSeed16v (unsigned long seed, unsigned short *seed16v)
 {
   for (int i = 0; i < 2; i++) {
@@ -290,6 +432,24 @@ void jel_copy_settings (jel_config *cfgIn, jel_config *cfgOut) {
 }
 
 
+/*
+ * Everything jel_copy_settings copies, plus the components and any
+ * explicitly chosen frequencies - enough for a second config to embed
+ * and extract exactly like the first.
+ */
+void ijel_apply_settings(jel_config *from, jel_config *to) {
+  jel_copy_settings(from, to);
+  jel_set_components(to, from->components[0], from->components[1], from->components[2]);
+  if (from->user_freqs)
+    jel_set_frequencies(to, from->freqs.freqs, from->freqs.maxfreqs);
+  if (from->plan != to->plan) jel_set_plan(to, from->plan);
+  to->splice_blocks = from->splice_blocks;
+  to->optimize_huffman = from->optimize_huffman;
+  to->keep_scans = from->keep_scans;
+  to->copy_markers = from->copy_markers;
+}
+
+
 void jel_describe( jel_config *cfg, int v ) {
   int i, nf;
   JEL_LOG(cfg, v, "jel_config Object 0x%x {\n", cfg);
@@ -350,57 +510,54 @@ static void jel_error_exit (j_common_ptr cinfo){
 
 }
 
-//clone of jround_up
-static long round_up (long a, long b)
-/* Compute a rounded up to next multiple of b, ie, ceil(a/b)*b */
-/* Assumes a >= 0, b > 0 */
-{
-  a += b - 1L;
-  return a - (a % b);
-}
-
-
 static void _ijel_prep_source (jel_config *cfg) {
-  if (cfg->needFinishDecompress) {
-    (void) jpeg_finish_decompress (&cfg->srcinfo);
-    cfg->needFinishDecompress = FALSE;
-  }
+  ijel_finish_source (cfg);
 }
 
 
 /*
- * Internal function to open the source and get coefficients:
+ * Internal function to open the source and get coefficients.  'whole'
+ * is set if the source manager hands over the entire image at once:
  */
-static int ijel_open_source(jel_config *cfg) {
-  int ci;
-  jvirt_barray_ptr *coef_arrays = NULL;
-  jpeg_component_info *compptr;
+static int ijel_open_source(jel_config *cfg, int whole) {
   struct jpeg_decompress_struct *srcinfo = &(cfg->srcinfo);
   struct jpeg_compress_struct *dstinfo = &(cfg->dstinfo);
+  double t0 = IJEL_STATS_START(cfg);
 
-  /* Read file header, set default decompression parameters */
+  /* Read file header, set default decompression parameters.  The
+   * header includes the first SOS marker, so the scan script must be
+   * asked for first, as must the markers that precede it: */
+  ijel_scans_source( cfg );
+  ijel_markers_source( cfg, whole );
   jpeg_read_header( srcinfo, TRUE);
 
   cfg->needFinishDecompress = TRUE;
 
-  /* Read the file as arrays of DCT coefficients: */
-  cfg->coefs = jpeg_read_coefficients( srcinfo );
+  if (ijel_raw_active( cfg )) {
+    /* A pixel source's blocks are already in arrays of the
+     * decompressor's, and have no coded bits or symbol counts: */
+    ijel_splice_forget( cfg );
+    ijel_huff_forget( cfg );
+    cfg->coefs = ijel_raw_coefficients( cfg );
+  } else {
+    /* Read the file as arrays of DCT coefficients, noting where each
+     * block's coded bits are if they can be spliced into the output, or
+     * counting its symbols if the output is to have optimal tables: */
+    ijel_splice_source( cfg, whole );
+    ijel_huff_source( cfg );
+    cfg->coefs = jpeg_read_coefficients( srcinfo );
+    ijel_splice_check( cfg );
+    ijel_huff_check( cfg );
+  }
+  ijel_scans_check( cfg );
+  IJEL_STATS_STOP(cfg, decode_usec, t0);
+  IJEL_STATS_COUNT(cfg, sources, 1);
   jpeg_copy_critical_parameters( srcinfo, dstinfo );
 
-  coef_arrays = (jvirt_barray_ptr *)
-      (*dstinfo->mem->alloc_small) ((j_common_ptr) srcinfo, JPOOL_IMAGE,
-                                    SIZEOF(jvirt_barray_ptr) * (size_t) srcinfo->num_components);
-  for (ci = 0; ci < srcinfo->num_components; ci++) {
-    compptr = srcinfo->comp_info + ci;
-    coef_arrays[ci] = (*dstinfo->mem->request_virt_barray)
-      ((j_common_ptr) dstinfo, JPOOL_IMAGE, FALSE,
-       (JDIMENSION) round_up((long) compptr->width_in_blocks,
-                              (long) compptr->h_samp_factor),
-       (JDIMENSION) round_up((long) compptr->height_in_blocks,
-                              (long) compptr->v_samp_factor),
-       (JDIMENSION) compptr->v_samp_factor);
-  }
-  cfg->dstcoefs = coef_arrays;
+  /* jpeg_write_coefficients () takes its coefficients straight from
+   * cfg->coefs, so the destination gets no arrays of its own - they
+   * would only double the per-image footprint: */
+  cfg->dstcoefs = (jvirt_barray_ptr *) NULL;
   
 
   /* Copy the source parameters to the destination object. This sets
@@ -410,6 +567,12 @@ static int ijel_open_source(jel_config *cfg) {
 
   jpeg_copy_critical_parameters( &(cfg->srcinfo), &(cfg->dstinfo) );
 
+  /* That copied the source's quant tables; an output quality set
+   * beforehand replaces them, so that frequencies are chosen against
+   * the tables the output will have: */
+  if (cfg->quality > 0)
+    jpeg_set_quality( dstinfo, cfg->quality, FORCE_BASELINE );
+
   if(jel_verbose){
     JEL_LOG(cfg, 2, "ijel_open_source: all done.\n");
   }
@@ -421,24 +584,33 @@ static int ijel_open_source(jel_config *cfg) {
 
 
 
+/*
+ * libjpeg's data source and destination calls reuse whatever manager
+ * the object already has, as if it were their own kind; a FILE manager
+ * is smaller than a memory one.  So the config keeps a manager of each
+ * kind and hands libjpeg the right one before each call:
+ */
+void ijel_memory_src( jel_config *cfg, unsigned char *mem, int size ) {
+  cfg->srcinfo.src = cfg->mem_src;
+  jpeg_memory_src( &(cfg->srcinfo), mem, size );
+  cfg->mem_src = cfg->srcinfo.src;
+}
+
+
 /*
  * Set the source to be a FILE pointer:
  */
 int jel_set_fp_source( jel_config *cfg, FILE *fpin ) {
   struct jel_error_mgr jerr;
-  int j;
 
   if (fpin == NULL) return JEL_ERR_INVALIDFPTR;
 
   _ijel_prep_source (cfg);
 
   cfg->srcfp = fpin;
-  /* Save Those Markers! */
-  jpeg_save_markers(&(cfg->srcinfo), JPEG_COM, 0xffff);
-  for (j=0;j<=15;j++) 
-    jpeg_save_markers(&(cfg->srcinfo), JPEG_APP0+j, 0xffff);
-  
+  cfg->srcinfo.src = cfg->stdio_src;
   jpeg_stdio_src( &(cfg->srcinfo), fpin );
+  cfg->stdio_src = cfg->srcinfo.src;
 
   /* graceful-ish exit on error  */
 
@@ -450,7 +622,7 @@ int jel_set_fp_source( jel_config *cfg, FILE *fpin ) {
     return -1; 
   }
 
-  return ijel_open_source( cfg );
+  return ijel_open_source( cfg, FALSE );
 }
 
 
@@ -464,7 +636,9 @@ int jel_set_fp_dest( jel_config *cfg, FILE *fpout ) {
   if (fpout == NULL) return JEL_ERR_INVALIDFPTR;
 
   cfg->dstfp = fpout;
+  cfg->dstinfo.dest = cfg->stdio_dest;
   jpeg_stdio_dest( &(cfg->dstinfo), fpout );
+  cfg->stdio_dest = cfg->dstinfo.dest;
 
   cfg->jel_errno = 0;
 
@@ -494,15 +668,60 @@ int jel_set_mem_source( jel_config *cfg, unsigned char *mem, int size ) {
 
   _ijel_prep_source (cfg);
 
-  jpeg_memory_src( &(cfg->srcinfo), mem, size );
+  ijel_memory_src( cfg, mem, size );
+  IJEL_STATS_COUNT(cfg, jpeg_bytes_in, size);
+
+  return ijel_open_source( cfg, TRUE );
+}
+
 
-  return ijel_open_source( cfg );
+/*
+ * Set the source to be a frame of pixels (jel-raw.c):
+ */
+int jel_set_raw_source( jel_config *cfg, const unsigned char *pixels, int width, int height,
+                        jel_pixel_format format ) {
+  struct jel_error_mgr jerr;
+  int ret;
+
+  /* The config's compressor does the compressing: */
+  cfg->srcinfo.err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+  cfg->dstinfo.err = &jerr.mgr;
+
+  if (setjmp(jerr.jmpbuff)) {
+    JEL_LOG(cfg, 2, "jel_set_raw_source: caught a libjpeg error!\n");
+    (void) ijel_raw_release(cfg);
+    jpeg_abort_decompress(&(cfg->srcinfo));
+    cfg->needFinishDecompress = FALSE;
+    cfg->coefs = (jvirt_barray_ptr *) NULL;
+    cfg->srcinfo.err = jpeg_std_error(&cfg->jerr);
+    cfg->dstinfo.err = cfg->srcinfo.err;
+    return cfg->jel_errno = JEL_ERR_JPEG;
+  }
+
+  _ijel_prep_source (cfg);
+
+  ret = ijel_raw_source( cfg, pixels, width, height, format );
+  if (ret == 0) {
+    ret = ijel_open_source( cfg, TRUE );
+    if (!cfg->coefs) {
+      JEL_LOG(cfg, 2, "jel_set_raw_source: the frame's headers do not match its blocks!\n");
+      ijel_finish_source( cfg );
+      ret = JEL_ERR_JPEG;
+    }
+  }
+
+  cfg->srcinfo.err = jpeg_std_error(&cfg->jerr);
+  cfg->dstinfo.err = cfg->srcinfo.err;
+  return cfg->jel_errno = ret;
 }
 
 
 int jel_set_mem_dest( jel_config *cfg, unsigned char *mem, int size) {
 
+  cfg->dstinfo.dest = cfg->mem_dest;
   jpeg_memory_dest( &(cfg->dstinfo), mem, size );
+  cfg->mem_dest = cfg->dstinfo.dest;
   cfg->jel_errno = 0;
 
   return 0;
@@ -633,8 +852,10 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
   case JEL_PROP_QUALITY:
     cfg->quality = value;
     /* Since jel_init initializes a compressor, we can always do this,
-     * even if we don't use it: */
+     * even if we don't use it.  Frequencies chosen against the old
+     * tables are chosen again: */
     jpeg_set_quality( &(cfg->dstinfo), value, FORCE_BASELINE );
+    if (!cfg->user_freqs) cfg->freqs.init = 0;
     return value;
 
   case JEL_PROP_EMBED_LENGTH:
@@ -647,7 +868,6 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
 
   case JEL_PROP_ECC_BLOCKLEN:
     cfg->ecc_blocklen = value;
-    ijel_set_ecc_blocklen(value);
     return value;
 
   case JEL_PROP_PRN_SEED:
@@ -659,11 +879,13 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
   case JEL_PROP_NLEVELS:
     cfg->freqs.nlevels = value;
     cfg->freqs.init    = 0;            /* 0 until frequencies are chosen */
+    cfg->user_freqs    = 0;
     return value;
 
   case JEL_PROP_NFREQS:
     cfg->freqs.nfreqs = value;
     cfg->freqs.init   = 0;             /* 0 until frequencies are chosen */
+    cfg->user_freqs   = 0;
 #if 0
     qtable = dinfo->quant_tbl_ptrs[0];
     if (!qtable) qtable = cinfo->quant_tbl_ptrs[0];
@@ -674,6 +896,7 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
   case JEL_PROP_MAXFREQS:
     cfg->freqs.maxfreqs = value;
     cfg->freqs.init     = 0;           /* 0 until frequencies are chosen */
+    cfg->user_freqs     = 0;
 #if 0
     qtable = dinfo->quant_tbl_ptrs[0];
     if (!qtable) qtable = cinfo->quant_tbl_ptrs[0];
@@ -683,6 +906,7 @@ int jel_setprop( jel_config *cfg, jel_property prop, int value ) {
 
   case JEL_PROP_MCU_DENSITY:
     cfg->mcu_density = value;
+    cfg->user_mcu_density = value;
     return value;
 
   case JEL_PROP_BITS_PER_MCU:
@@ -748,6 +972,7 @@ int jel_open_log(jel_config *cfg, char *filename) {
  * Close the log file, if any.
  */
 int jel_close_log(jel_config *cfg) {
+  jel_drain_log(cfg);
   if (cfg->logger != stderr && cfg->logger != NULL) {
     FILE* tmp = cfg->logger;
     cfg->logger = NULL;
@@ -767,7 +992,12 @@ int jel_close_log(jel_config *cfg) {
 
 int jel_log( jel_config *cfg, const char *format, ... ){
   int retval = 0;
-  if ( cfg->logger != NULL ) {
+  if ( cfg->log_ring != NULL ) {
+    va_list arg;
+    va_start(arg,format);
+    retval = ijel_log_ring_push(cfg, format, arg);
+    va_end(arg);
+  } else if ( cfg->logger != NULL ) {
     va_list arg;
     va_start(arg,format);
     retval = vfprintf(cfg->logger, format, arg); 
@@ -779,11 +1009,17 @@ int jel_log( jel_config *cfg, const char *format, ... ){
 
 /*
  * Log with a verbosity level.  The "current verbosity" is set within
- * the cfg struct.  A cfg->verbosity of 0 means no output.
+ * the cfg struct.  A cfg->verbosity of 0 means no output.  With a log
+ * ring installed, the entry is only formatted; jel_drain_log writes it.
  */
 int jel_vlog( jel_config *cfg, int level, const char *format, ... ){
   int retval = 0;
-  if ( cfg->logger != NULL && cfg->verbose > level) {
+  if ( cfg->log_ring != NULL && cfg->verbose > level) {
+    va_list arg;
+    va_start(arg,format);
+    retval = ijel_log_ring_push(cfg, format, arg);
+    va_end(arg);
+  } else if ( cfg->logger != NULL && cfg->verbose > level) {
     va_list arg;
     va_start(arg,format);
     retval = vfprintf(cfg->logger, format, arg); 
@@ -829,25 +1065,13 @@ char * jel_error_string( jel_config * cfg ) {
 
 
 /*
- * Returns an integer capacity in bytes, minus the header overhead (4
- * bytes).  This will return the capacity of the image in MESSAGE
- * bytes.
+ * Per-channel capacities of the source in cfg->srcinfo, which need
+ * not go further than jpeg_read_header.  Fills in cfg->capacity and
+ * returns the total in message bytes.
  */
-
-int    jel_capacity( jel_config * cfg ) {
-
-  /* Returns the capacity in bytes of the source.  This is only
-   * meaningful if we know enough about the srcinfo object, i.e., only
-   * AFTER we have called 'jel_set_xxx_source'.  At present, only
-   * luminance is considered.
-   */
-  int ijel_ecc_cap(int);
+static int ijel_capacity_total( jel_config * cfg ) {
   int total, cap1, k, chan;
 
-  
-  if (!cfg->coefs)
-    return 0;
-
   /* This measures total message capacity in terms of the number of
      bytes that can be embedded into this image.  ijel_image_capacity
      returns number of bits, but does not account for ECC or bitstream
@@ -861,7 +1085,7 @@ int    jel_capacity( jel_config * cfg ) {
 
       /* If ECC is requested, compute capacity subject to ECC overhead: */
       if (jel_getprop(cfg, JEL_PROP_ECC_METHOD) == JEL_ECC_RSCODE) {
-        cap1 = ijel_capacity_ecc(cap1);
+        cap1 = ijel_capacity_ecc(cfg->ecc_blocklen, cap1);
         JEL_LOG(cfg, 4, "jel_capacity assuming ECC returns %d for channel %d\n", cap1, chan);
       }
 
@@ -873,12 +1097,123 @@ int    jel_capacity( jel_config * cfg ) {
   
   cfg->jel_errno = JEL_SUCCESS;
 
-  //  printf("jel_capacity got capacity of %d, returning %d\n", cap1, cap1-4);
-
   return total; 
 }
 
 
+/*
+ * Returns an integer capacity in bytes, minus the header overhead (4
+ * bytes).  This will return the capacity of the image in MESSAGE
+ * bytes.
+ */
+
+int    jel_capacity( jel_config * cfg ) {
+
+  /* Returns the capacity in bytes of the source.  This is only
+   * meaningful if we know enough about the srcinfo object, i.e., only
+   * AFTER we have called 'jel_set_xxx_source'.  At present, only
+   * luminance is considered.
+   */
+  double t0 = IJEL_STATS_START(cfg);
+  int total;
+
+  if (!cfg->coefs)
+    return 0;
+
+  total = ijel_capacity_total(cfg);
+  IJEL_STATS_STOP(cfg, plan_usec, t0);
+  IJEL_STATS_COUNT(cfg, capacities, 1);
+
+  return total;
+}
+
+
+/*
+ * Capacity of the JPEG image in mem, from its header alone.  The
+ * capacity only depends on the block dimensions and quant tables, so
+ * the entropy-coded data is never decoded, and mem may hold as little
+ * as the markers up to the first SOS.  Like jel_set_mem_source, this
+ * replaces any source already set on cfg; afterwards cfg has no
+ * source.
+ *
+ * The result is what jel_capacity reports once the source is set and
+ * the output quality (if any) is applied, i.e. the capacity that
+ * jel_embed works with.  Returns a negative error code if the header
+ * cannot be parsed.
+ */
+int jel_capacity_from_header( unsigned char *mem, int size, jel_config *cfg ) {
+  return ijel_header_capacity(cfg, mem, size, NULL);
+}
+
+
+/* jel_capacity_from_header, also reporting what the header says: */
+int ijel_header_capacity(jel_config *cfg, unsigned char *mem, int size, ijel_header_info *info) {
+  struct jpeg_decompress_struct *srcinfo = &(cfg->srcinfo);
+  struct jpeg_compress_struct *dstinfo = &(cfg->dstinfo);
+  struct jel_error_mgr jerr;
+  int tblno, total, ci, k;
+
+  _ijel_prep_source (cfg);
+  cfg->coefs = (jvirt_barray_ptr *) NULL;
+
+  srcinfo->err = jpeg_std_error(&jerr.mgr);
+  jerr.mgr.error_exit = jel_error_exit;
+  dstinfo->err = &jerr.mgr;
+
+  if (setjmp(jerr.jmpbuff)) {
+    JEL_LOG(cfg, 2, "jel_capacity_from_header: caught a libjpeg error!\n");
+    jpeg_abort_decompress(srcinfo);
+    srcinfo->err = jpeg_std_error(&cfg->jerr);
+    dstinfo->err = srcinfo->err;
+    return cfg->jel_errno = JEL_ERR_JPEG;
+  }
+
+  ijel_memory_src( cfg, mem, size );
+  ijel_markers_skip( cfg );
+  jpeg_read_header( srcinfo, TRUE );
+
+  /* Pick the tables that jel_embed would: the source's, as copied by
+   * jpeg_copy_critical_parameters, unless an output quality is set: */
+  if (cfg->quality > 0)
+    jpeg_set_quality( dstinfo, cfg->quality, FORCE_BASELINE );
+  else {
+    for (tblno = 0; tblno < NUM_QUANT_TBLS; tblno++) {
+      if (srcinfo->quant_tbl_ptrs[tblno] == NULL) continue;
+      if (dstinfo->quant_tbl_ptrs[tblno] == NULL)
+        dstinfo->quant_tbl_ptrs[tblno] = jpeg_alloc_quant_table((j_common_ptr) dstinfo);
+      memcpy(dstinfo->quant_tbl_ptrs[tblno]->quantval,
+             srcinfo->quant_tbl_ptrs[tblno]->quantval,
+             sizeof(dstinfo->quant_tbl_ptrs[tblno]->quantval));
+      dstinfo->quant_tbl_ptrs[tblno]->sent_table = FALSE;
+    }
+  }
+
+  total = ijel_capacity_total(cfg);
+
+  if (info) {
+    memset(info, 0, sizeof(ijel_header_info));
+    info->width = (int) srcinfo->image_width;
+    info->height = (int) srcinfo->image_height;
+    info->ncomp = srcinfo->num_components;
+    for (ci = 0; ci < srcinfo->num_components && ci < 3; ci++) {
+      info->h_samp[ci] = srcinfo->comp_info[ci].h_samp_factor;
+      info->v_samp[ci] = srcinfo->comp_info[ci].v_samp_factor;
+    }
+    for (tblno = 0; tblno < 2; tblno++)
+      if (srcinfo->quant_tbl_ptrs[tblno])
+        for (k = 0; k < DCTSIZE2; k++)
+          info->qtables[tblno][k] = (unsigned short) srcinfo->quant_tbl_ptrs[tblno]->quantval[k];
+  }
+
+  /* Drop the per-image state; the objects are ready for a new source: */
+  jpeg_abort_decompress(srcinfo);
+  srcinfo->err = jpeg_std_error(&cfg->jerr);
+  dstinfo->err = srcinfo->err;
+
+  return total;
+}
+
+
 
 /*
  * Raw capacity - regardless of ECC, this is how many bytes we can
@@ -1010,36 +1345,61 @@ static int ijel_set_buffer(jel_config *cfg, unsigned char *buf, int maxlen) {
 }
 
 
+/* 1 if the compressor writes to the config's memory destination: */
+static int ijel_mem_dest_active(jel_config *cfg) {
+  return cfg->mem_dest != NULL && cfg->dstinfo.dest == cfg->mem_dest;
+}
+
+
 static size_t ijel_get_jpeg_length(jel_config * jel) {
   int k;
 
-  if (jel->dstfp == NULL)
+  /* Ask whichever of the config's managers the output went to; a
+   * destination the caller installed itself keeps its own count: */
+  if (ijel_mem_dest_active(jel))
     k = jpeg_mem_packet_size( &(jel->dstinfo) );
-  else
+  else if (jel->stdio_dest != NULL && jel->dstinfo.dest == jel->stdio_dest)
     k = jpeg_stdio_packet_size( &(jel->dstinfo) );
+  else
+    k = 0;
 
   return (size_t) k;
 }
 
 
-/*  
- * Embed a message in an image: 
+/*
+ * ijel_stuff_message or ijel_unstuff_message for one channel.  With
+ * stats enabled, the MCU selection and ECC time spent inside is
+ * booked to those phases and left out of stuff_usec.
  */
-int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
-  /* where:
-   *
-   * cfg       A properly initialized jel_config object
-   * msg       A region of memory containing bytes to be embedded
-   * len       The number of bytes of msg to embed
-   *
-   * Returns the number of bytes that were embedded, or a negative error
-   * code.  If the return value is positive but less than 'len', call
-   * 'jel_error' for more information.
-   */
+static int ijel_stuff_channel( jel_config * cfg, int chan, int extract ) {
+  double t0, nested;
+  int ret;
+
+  if (!cfg->stats)
+    return extract ? ijel_unstuff_message(cfg, chan) : ijel_stuff_message(cfg, chan);
+
+  nested = cfg->stats->select_usec + cfg->stats->ecc_usec;
+  t0 = ijel_now_usec();
+  ret = extract ? ijel_unstuff_message(cfg, chan) : ijel_stuff_message(cfg, chan);
+  cfg->stats->stuff_usec += ijel_now_usec() - t0
+    - (cfg->stats->select_usec + cfg->stats->ecc_usec - nested);
+
+  return ret;
+}
+
+
+/*
+ * Embeds into whatever destination cfg->dstinfo has; the callers
+ * below look after the output length.  *wrote is set to 1 once the
+ * compressor has finished, i.e., whenever there is output to measure.
+ */
+static int ijel_embed( jel_config * cfg, unsigned char * msg, int len, int *wrote) {
   int nwedge[3] = { 0, 0, 0 };
   int marker_count;
+  double t0;
 
-  cfg->jpeglen = 0;
+  *wrote = 0;
 
   /* If message is NULL, shouldn't we punt? */
   if ( !msg ) {
@@ -1081,6 +1441,14 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
   // Specifically, add char pointers to jel_config that tell
   // ijel_stuff_message where to start and stop for a given channel:
 
+  /* With an output quality set, bring the coefficients over to the
+   * output quant tables before anything is chosen against them: */
+  if (ijel_requantize(cfg) > 0)
+    JEL_LOG(cfg, 2, "jel_embed: requantized to quality %d.\n", cfg->quality);
+
+  t0 = IJEL_STATS_START(cfg);
+  IJEL_STATS_COUNT(cfg, embeds, 1);
+
   if (cfg->capacity[0] <= 0) {
     /* If we reach this point, we assume that jel_capacity hasn't been
        called yet, so do it here - this is how we determine allocation
@@ -1099,40 +1467,55 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
 
   if (!cfg->prn_cache) {
     JEL_LOG(cfg, 2, "jel_embed: calling jelprn_create with size %d\n", tot);
-    cfg->prn_cache = jelprn_create(tot, cfg->seed16v);
+    cfg->prn_cache = ijel_prn_create(cfg, tot);
+    if (!cfg->prn_cache) {
+      jel_log(cfg, "jel_embed: out of memory for the PRN list!\n");
+      return cfg->jel_errno = JEL_ERR_NOMEM;
+    }
   }
 #endif
+  IJEL_STATS_STOP(cfg, plan_usec, t0);
   
   if (cfg->components[0] > -1) {
     JEL_LOG(cfg, 2, "\njel_embed: Using component %d.\n", cfg->components[0]);
-    nwedge[0] = ijel_stuff_message(cfg, 0);
+    nwedge[0] = ijel_stuff_channel(cfg, 0, 0);
   }
 
   if (cfg->components[1] > -1) {
     JEL_LOG(cfg, 2, "\njel_embed: Using component %d.\n", cfg->components[1]);
-    nwedge[1] = ijel_stuff_message(cfg, 1);
+    nwedge[1] = ijel_stuff_channel(cfg, 1, 0);
   }  
 
   if (cfg->components[2] > -1) {
     JEL_LOG(cfg, 2, "\njel_embed: Using component %d.\n", cfg->components[2]);
-    nwedge[2] = ijel_stuff_message(cfg, 2);
+    nwedge[2] = ijel_stuff_channel(cfg, 2, 0);
   }
     
 #if USE_PRN_CACHE
-  if (cfg->prn_cache) jelprn_destroy(&(cfg->prn_cache));
+  if (cfg->prn_cache) {
+    IJEL_STATS_COUNT(cfg, prn_draws, cfg->prn_cache->ncalls);
+    jelprn_destroy(&(cfg->prn_cache));
+  }
 #endif
 
   JEL_LOG(cfg, 2, "jel_embed: Return values from ijel_stuff_message = %d %d %d.\n",
           nwedge[0], nwedge[1], nwedge[2]);
   
   
-  if ( cfg->quality > 0 ) {
-    jpeg_set_quality( &(cfg->dstinfo), cfg->quality, FORCE_BASELINE );
-    JEL_LOG(cfg, 3, "jel_embed: Reset quality to %d after jpeg_copy_critical_parameters.\n", cfg->quality);
-  }
-
   //  iJEL_LOG_qtables(cfg);
 
+  t0 = IJEL_STATS_START(cfg);
+
+  /* Keep a progressive source's scans if asked to.  Otherwise fit the
+   * Huffman tables to the output if asked to, or else copy unchanged
+   * blocks from the source if possible: */
+  if (ijel_scans_output(cfg))
+    JEL_LOG(cfg, 2, "jel_embed: writing the source's %d scans.\n", cfg->dstinfo.num_scans);
+  if (ijel_huff_output(cfg))
+    JEL_LOG(cfg, 2, "jel_embed: optimal Huffman tables from the symbol counts.\n");
+  if (ijel_splice_output(cfg))
+    JEL_LOG(cfg, 2, "jel_embed: splicing unchanged blocks from the source.\n");
+
   /* Start compressor (note no image data is actually written here) */
   jpeg_write_coefficients( &(cfg->dstinfo), cfg->coefs );
 
@@ -1147,15 +1530,14 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
   /* Finish compression and release memory */
   jpeg_finish_compress(&cfg->dstinfo);
   cfg->needFinishCompress = FALSE;
-
-  cfg->jpeglen = ijel_get_jpeg_length(cfg);
-  JEL_LOG(cfg, 2, "jel_embed: JPEG compressed output size is %d.\n", cfg->jpeglen);
+  ijel_splice_done(cfg);
+  *wrote = 1;
+  IJEL_STATS_STOP(cfg, encode_usec, t0);
 
   //ian moved this to jel_free
   //jpeg_destroy_compress(&cfg->dstinfo);
 
-  (void) jpeg_finish_decompress(&cfg->srcinfo);
-  cfg->needFinishDecompress = FALSE;
+  ijel_finish_source(cfg);
 
   //ian moved this to jel_free
   //jpeg_destroy_decompress(&cfg->srcinfo);
@@ -1167,11 +1549,171 @@ int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
   if (nwedge[1] < 0) return nwedge[1];
   if (nwedge[2] < 0) return nwedge[2];
 
+  IJEL_STATS_COUNT(cfg, msg_bytes_in, nwedge[0] + nwedge[1] + nwedge[2]);
   return nwedge[0] + nwedge[1] + nwedge[2]; /* suppress no-return-value warnings */
 
 }
 
 
+/*  
+ * Embed a message in an image: 
+ */
+int jel_embed( jel_config * cfg, unsigned char * msg, int len) {
+  /* where:
+   *
+   * cfg       A properly initialized jel_config object
+   * msg       A region of memory containing bytes to be embedded
+   * len       The number of bytes of msg to embed
+   *
+   * Returns the number of bytes that were embedded, or a negative error
+   * code.  If the return value is positive but less than 'len', call
+   * 'jel_error' for more information.
+   */
+  int ret, wrote;
+
+  cfg->jpeglen = 0;
+
+  ret = ijel_embed(cfg, msg, len, &wrote);
+  if (!wrote) return ret;
+
+  cfg->jpeglen = ijel_get_jpeg_length(cfg);
+  JEL_LOG(cfg, 2, "jel_embed: JPEG compressed output size is %d.\n", cfg->jpeglen);
+  IJEL_STATS_COUNT(cfg, jpeg_bytes_out, cfg->jpeglen);
+
+  if (ijel_mem_dest_active(cfg) && jpeg_mem_overflow( &(cfg->dstinfo) )) {
+    JEL_LOG(cfg, 1, "jel_embed: output needs %d bytes, more than the destination holds.\n", cfg->jpeglen);
+    cfg->jel_errno = JEL_ERR_DEST_OVERFLOW;
+    return cfg->jel_errno;
+  }
+
+  return ret;
+}
+
+
+/*
+ * A growable memory destination for jel_embed_size.  The buffer
+ * belongs to cfg and survives jel_reset, so a config that sizes
+ * message after message stops reallocating once it has seen its
+ * largest output.
+ */
+#define HELD_MIN_ALLOC 65536
+
+typedef struct {
+  struct jpeg_destination_mgr pub;
+  jel_config *cfg;
+  int failed;                   /* 1 if the buffer could not grow */
+} held_destination_mgr;
+
+
+/* Grows the buffer, or gives up on the image if it cannot; libjpeg
+ * has nowhere else to put its output: */
+static void ijel_held_grow(j_compress_ptr cinfo, size_t used) {
+  held_destination_mgr *dest = (held_destination_mgr *) cinfo->dest;
+  jel_config *cfg = dest->cfg;
+  size_t n = cfg->held_alloc ? 2 * cfg->held_alloc : HELD_MIN_ALLOC;
+  unsigned char *p = realloc(cfg->held, n);
+
+  if (!p) {
+    dest->failed = 1;
+    ERREXIT1(cinfo, JERR_OUT_OF_MEMORY, 0);
+  }
+  cfg->held = p;
+  cfg->held_alloc = n;
+  dest->pub.next_output_byte = p + used;
+  dest->pub.free_in_buffer = n - used;
+}
+
+
+static void ijel_held_init(j_compress_ptr cinfo) {
+  held_destination_mgr *dest = (held_destination_mgr *) cinfo->dest;
+  jel_config *cfg = dest->cfg;
+
+  if (cfg->held_alloc == 0) ijel_held_grow(cinfo, 0);
+  else {
+    dest->pub.next_output_byte = cfg->held;
+    dest->pub.free_in_buffer = cfg->held_alloc;
+  }
+}
+
+
+static boolean ijel_held_empty(j_compress_ptr cinfo) {
+  held_destination_mgr *dest = (held_destination_mgr *) cinfo->dest;
+
+  /* libjpeg only calls this with the buffer full: */
+  ijel_held_grow(cinfo, dest->cfg->held_alloc);
+  return TRUE;
+}
+
+
+static void ijel_held_term(j_compress_ptr cinfo) {
+  held_destination_mgr *dest = (held_destination_mgr *) cinfo->dest;
+
+  dest->cfg->held_len = (int) (dest->cfg->held_alloc - dest->pub.free_in_buffer);
+}
+
+
+/*
+ * Embed into cfg's own buffer and return the size of the JPEG:
+ */
+int jel_embed_size( jel_config * cfg, unsigned char * msg, int len) {
+  held_destination_mgr held;
+  struct jpeg_destination_mgr *saved = cfg->dstinfo.dest;
+  int ret, wrote;
+
+  memset(&held, 0, sizeof(held));
+  held.pub.init_destination = ijel_held_init;
+  held.pub.empty_output_buffer = ijel_held_empty;
+  held.pub.term_destination = ijel_held_term;
+  held.cfg = cfg;
+
+  cfg->held_len = 0;
+  cfg->jpeglen = 0;
+  cfg->dstinfo.dest = &held.pub;
+
+  ret = ijel_embed(cfg, msg, len, &wrote);
+
+  if (!wrote) {
+    /* Failed part way through; make sure libjpeg lets go of 'held': */
+    jpeg_abort_compress(&cfg->dstinfo);
+    cfg->held_len = 0;
+  }
+  cfg->dstinfo.dest = saved;
+
+  if (held.failed) {
+    cfg->held_len = 0;
+    ret = JEL_ERR_NOMEM;
+  }
+  cfg->held_ret = ret;
+  if (ret < 0) return ret;
+
+  cfg->jpeglen = cfg->held_len;
+  JEL_LOG(cfg, 2, "jel_embed_size: JPEG compressed output size is %d.\n", cfg->jpeglen);
+  return cfg->held_len;
+}
+
+
+/*
+ * Hand over what jel_embed_size encoded:
+ */
+int jel_embed_output( jel_config * cfg, unsigned char * mem, int size) {
+  if (cfg->held_len <= 0) {
+    cfg->jel_errno = JEL_ERR_NODEST;
+    return cfg->jel_errno;
+  }
+  if (size < cfg->held_len) {
+    cfg->jel_errno = JEL_ERR_DEST_OVERFLOW;
+    return cfg->jel_errno;
+  }
+
+  memcpy(mem, cfg->held, (size_t) cfg->held_len);
+  cfg->jpeglen = cfg->held_len;
+  IJEL_STATS_COUNT(cfg, jpeg_bytes_out, cfg->jpeglen);
+  cfg->held_len = 0;
+
+  return cfg->held_ret;
+}
+
+
 
 
 
@@ -1192,6 +1734,7 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int maxlen) {
    * contain the bytes that WERE extracted.
    */
   int msglen, clen;
+  double t0;
 
   /* graceful-ish exit on error */
   struct jel_error_mgr jerr;
@@ -1203,6 +1746,9 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int maxlen) {
   
   if (setjmp(jerr.jmpbuff)) { return -1; }
 
+  t0 = IJEL_STATS_START(cfg);
+  IJEL_STATS_COUNT(cfg, extracts, 1);
+
   if (cfg->capacity[0] <= 0) {
     /* If we reach this point, we assume that jel_capacity hasn't been
        called yet, so do it here - this is how we determine allocation
@@ -1233,34 +1779,43 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int maxlen) {
 
   if (!cfg->prn_cache) {
     JEL_LOG(cfg, 2, "jel_extract: calling jelprn_create with size %d\n", tot);
-    cfg->prn_cache = jelprn_create(tot, cfg->seed16v);
+    cfg->prn_cache = ijel_prn_create(cfg, tot);
+    if (!cfg->prn_cache) {
+      jel_log(cfg, "jel_extract: out of memory for the PRN list!\n");
+      return cfg->jel_errno = JEL_ERR_NOMEM;
+    }
   }
 #endif
+  IJEL_STATS_STOP(cfg, plan_usec, t0);
   
   cfg->len = maxlen;
   JEL_LOG(cfg, 2, "\njel_extract: Using component %d.\n", cfg->components[0]);
-  clen =  ijel_unstuff_message(cfg, 0);
+  clen =  ijel_stuff_channel(cfg, 0, 1);
   msglen = clen;
 
   JEL_LOG(cfg, 2, "jel_extract: component %d data length = %d.\n", cfg->components[0], msglen);
   
   if (cfg->components[1] > -1) {
     JEL_LOG(cfg, 2, "\njel_extract: Using component %d.\n", cfg->components[1]);
-    clen = ijel_unstuff_message(cfg, 1);
-    msglen += clen;
+    clen = ijel_stuff_channel(cfg, 1, 1);
+    if (msglen >= 0) msglen = clen < 0 ? clen : msglen + clen;
     JEL_LOG(cfg, 2, "jel_extract: component %d data length = %d.\n", cfg->components[1], clen);
   }
   
   if (cfg->components[2] > -1) {
     JEL_LOG(cfg, 2, "\njel_extract: Using component %d.\n", cfg->components[2]);
-    clen = ijel_unstuff_message(cfg, 2);
+    clen = ijel_stuff_channel(cfg, 2, 1);
     JEL_LOG(cfg, 2, "jel_extract: component %d data length = %d.\n", cfg->components[2], clen);
-    msglen += clen;
+    if (msglen >= 0) msglen = clen < 0 ? clen : msglen + clen;
   }
 
 #if USE_PRN_CACHE
-  if (cfg->prn_cache) jelprn_destroy(&(cfg->prn_cache));
+  if (cfg->prn_cache) {
+    IJEL_STATS_COUNT(cfg, prn_draws, cfg->prn_cache->ncalls);
+    jelprn_destroy(&(cfg->prn_cache));
+  }
 #endif
+  if (msglen > 0) IJEL_STATS_COUNT(cfg, msg_bytes_out, msglen);
   
   /* Compoact the per-channel message data into one blob: */
   unsigned char* next = cfg->data_ptr[0] + cfg->data_lengths[0];
@@ -1278,8 +1833,7 @@ int jel_extract( jel_config * cfg, unsigned char * msg, int maxlen) {
     JEL_LOG(cfg, 1, "jel_extract: %d bytes extracted\n", msglen);
   }    
 
-  (void) jpeg_finish_decompress(&(cfg->srcinfo));
-  cfg->needFinishDecompress = FALSE;
+  ijel_finish_source(cfg);
 
   //ian moved this to jel_free
   //jpeg_destroy_decompress(&(cfg->srcinfo));
@@ -1314,6 +1868,7 @@ int jel_init_frequencies(jel_config *cfg, int *flist, int len_flist) {
         cfg->freqs.freqs[i] = flist[i];
       j = len_flist;
       cfg->freqs.maxfreqs = len_flist;  /* We should relax this at some point */
+      cfg->user_freqs = 1;
     }
     cfg->freqs.init = 1;
   }
@@ -1335,6 +1890,7 @@ int jel_set_frequencies(jel_config *cfg, int *flist, int len_flist) {
   cfg->freqs.maxfreqs = len_flist;  /* We should relax this at some point */
 
   cfg->freqs.init = 1;
+  cfg->user_freqs = 1;
 
   return j;
 }
@@ -1371,6 +1927,11 @@ void jel_perror( char *msg, int jel_errno ) {
   case JEL_ERR_CREATE_MCU:   printf("Can't create MCU map.\n"); break;
   case JEL_ERR_ECC:          printf("ECC-related error.\n"); break;
   case JEL_ERR_CHECKSUM:     printf("Invalid bitstream checksum.\n"); break;
+  case JEL_ERR_ARENA:        printf("Arena unavailable or busy.\n"); break;
+  case JEL_ERR_DEST_OVERFLOW: printf("Output does not fit in the destination buffer.\n"); break;
+  case JEL_ERR_BUSY:         printf("Too many jobs pending.\n"); break;
+  case JEL_ERR_CANCELED:     printf("Job canceled before it started.\n"); break;
+  case JEL_ERR_NOMEM:        printf("Out of memory.\n"); break;
   default:		     printf("Unknown jel error code %d\n", jel_errno); break;
   }
 }
@@ -1410,11 +1971,42 @@ prn_cache* jelprn_create(int size, unsigned short seed[3]) {
 }
 
 
+/* As jelprn_create, but the cache lives in the config's scratch
+ * memory.  Returns NULL if that runs out.  The list is drawn from the
+ * seed alone, as a plan's is, so that every image the config embeds
+ * or extracts sees the same list, jel_reset or not: */
+prn_cache* ijel_prn_create(jel_config *cfg, int size) {
+  unsigned short seed16v[3];
+  prn_cache *cache;
+
+  cache = ijel_scratch_alloc(cfg, sizeof(prn_cache));
+  if (!cache) return NULL;
+  cache->owner = cfg;
+  if (ijel_plan_attach(cfg, cache, size)) return cache;
+
+  cache->nlist = size;
+  cache->list = ijel_scratch_alloc(cfg, (size_t) size * sizeof(long));
+  if (!cache->list) {
+    ijel_scratch_free(cfg, cache);
+    return NULL;
+  }
+  _makeSeed16v(cfg->seed, seed16v);
+  jelprn_reload(cache, seed16v);
+
+  return cache;
+}
+
+
 void jelprn_destroy(prn_cache **p) {
   if (*p == NULL) return;
   prn_cache *c = *p;
-  free(c->list);
-  free(c);
+  if (c->owner) {
+    if (!c->shared) ijel_scratch_free(c->owner, c->list);
+    ijel_scratch_free(c->owner, c);
+  } else {
+    free(c->list);
+    free(c);
+  }
   *p = NULL;
 }
 
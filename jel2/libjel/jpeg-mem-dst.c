@@ -10,34 +10,44 @@
  * 11/15/2002
  */
 
-/* Expanded data destination object for output to memory */
+/* Expanded data destination object for output to memory.  libjpeg
+ * writes straight into the target; only output that does not fit goes
+ * through a small spill buffer, to be counted and dropped. */
 
 typedef struct {
   struct jpeg_destination_mgr pub; /* public fields */
-  long length;                  /* Keeps track of the number of output bytes. */
+  long length;                  /* Number of output bytes, including any that did not fit. */
 
   unsigned char *outbuf;		/* target stream */
   int maxsize;
-  JOCTET * buffer;		/* start of buffer */
+  JOCTET * spill;		/* Where output goes once outbuf is full, or NULL */
+  int overflow;                 /* 1 once the output no longer fits in outbuf */
 } mem_destination_mgr;
 
 typedef mem_destination_mgr * mem_dest_ptr;
 
-#define OUTPUT_BUF_SIZE  4096	/* choose an efficiently fwrite'able size */
+#define SPILL_BUF_SIZE  4096	/* Output past the end of the target, counted a buffer at a time */
 
-static int judp_errno = 0;
 
-#define JUDP_ERR_CANTEMPTY     1
-#define JUDP_ERR_TOOMUCHDATA   2
+/*
+ * Switch to the spill buffer --- the target is full, or has no room at
+ * all.  libjpeg empties a buffer as soon as it fills, so the output may
+ * yet fit exactly: it only overflows if anything lands here.
+ */
 
-#if 0
+LOCAL(void)
+start_spill (j_compress_ptr cinfo)
+{
+  mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
 
-GLOBAL(int) jpeg_mem_errno() {
-  return judp_errno;
+  if (dest->spill == NULL)
+    dest->spill = (JOCTET *)
+      (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
+				  SPILL_BUF_SIZE * SIZEOF(JOCTET));
+  dest->pub.next_output_byte = dest->spill;
+  dest->pub.free_in_buffer = SPILL_BUF_SIZE;
 }
 
-#endif
-
 
 /*
  * Initialize destination --- called by jpeg_start_compress
@@ -49,63 +59,40 @@ init_destination (j_compress_ptr cinfo)
 {
   mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
 
-  judp_errno = 0;
-
   dest->length = 0;
-
-  dest->buffer = (JOCTET *)
-    (*cinfo->mem->alloc_small) ((j_common_ptr) cinfo, JPOOL_IMAGE,
-				OUTPUT_BUF_SIZE * SIZEOF(JOCTET));
-
-  dest->pub.next_output_byte = dest->buffer;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  dest->overflow = 0;
+  dest->spill = NULL;
+
+  if (dest->maxsize > 0) {
+    dest->pub.next_output_byte = dest->outbuf;
+    dest->pub.free_in_buffer = (size_t) dest->maxsize;
+  } else
+    start_spill(cinfo);
 }
 
 
 /*
  * Empty the output buffer --- called whenever buffer fills up.
  *
- * In typical applications, this should write the entire output buffer
- * (ignoring the current state of next_output_byte & free_in_buffer),
- * reset the pointer & count to the start of the buffer, and return TRUE
- * indicating that the buffer has been dumped.
- *
- * In applications that need to be able to suspend compression due to output
- * overrun, a FALSE return indicates that the buffer cannot be emptied now.
- * In this situation, the compressor will return to its caller (possibly with
- * an indication that it has not accepted all the supplied scanlines).  The
- * application should resume compression after it has made more room in the
- * output buffer.  Note that there are substantial restrictions on the use of
- * suspension --- see the documentation.
+ * The first time, that is the target, and everything else goes to the
+ * spill buffer, which is counted each time it fills and reused.
  *
- * When suspending, the compressor will back up to a convenient restart point
- * (typically the start of the current MCU). next_output_byte & free_in_buffer
- * indicate where the restart point will be if the current call returns FALSE.
- * Data beyond this point will be regenerated after resumption, so do not
- * write it out when emptying the buffer externally.
+ * We never suspend: output that does not fit is dropped but counted,
+ * and the caller learns about it from jpeg_mem_overflow ().
  */
 
 METHODDEF(boolean)
 empty_output_buffer (j_compress_ptr cinfo)
 {
-  int i, j;
   mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
 
-  j = dest->length;
-  for (i = 0; i < OUTPUT_BUF_SIZE && j < dest->maxsize; i++) {
-    dest->outbuf[j++] = dest->buffer[i];
+  if (dest->spill == NULL)
+    dest->length = dest->maxsize;
+  else {
+    dest->length += SPILL_BUF_SIZE;
+    dest->overflow = 1;
   }
-
-  dest->length = j;
-
-  if (j >= dest->maxsize) {
-    // printf("jpeg-mem-dst.c: empty_output_buffer exceeded the output buffer length.\n");
-    judp_errno = JUDP_ERR_CANTEMPTY;
-    return FALSE;
-  }
-
-  dest->pub.next_output_byte = dest->buffer;
-  dest->pub.free_in_buffer = OUTPUT_BUF_SIZE;
+  start_spill(cinfo);
 
   return TRUE;
 }
@@ -113,7 +100,7 @@ empty_output_buffer (j_compress_ptr cinfo)
 
 /*
  * Terminate destination --- called by jpeg_finish_compress
- * after all data has been written.  Usually needs to flush buffer.
+ * after all data has been written.  Counts what is in the buffer.
  *
  * NB: *not* called by jpeg_abort or jpeg_destroy; surrounding
  * application must deal with any cleanup that should happen even
@@ -123,22 +110,16 @@ empty_output_buffer (j_compress_ptr cinfo)
 METHODDEF(void)
 term_destination (j_compress_ptr cinfo)
 {
-  int i, j;
   mem_dest_ptr dest = (mem_dest_ptr) cinfo->dest;
-  size_t datacount = OUTPUT_BUF_SIZE - dest->pub.free_in_buffer;
-
-  /* Write any data remaining in the buffer */
-  if (datacount > 0) {
-    j = dest->length;
-    for (i = 0; i < (int) datacount && j < dest->maxsize; i++)
-      dest->outbuf[j++] = dest->buffer[i];
-
-    dest->length = j;
-    if (j >= dest->maxsize) {
-      // printf("jpeg-mem-dst.c: term_destination exceeded the output buffer length.\n");
-      judp_errno = JUDP_ERR_TOOMUCHDATA;
-    }
+  size_t datacount;
+
+  if (dest->spill == NULL) {
+    dest->length = (long) (dest->pub.next_output_byte - dest->outbuf);
+    return;
   }
+  datacount = SPILL_BUF_SIZE - dest->pub.free_in_buffer;
+  if (datacount > 0) dest->overflow = 1;
+  dest->length += (long) datacount;
 }
 
 
@@ -174,11 +155,21 @@ jpeg_memory_dest (j_compress_ptr cinfo, unsigned char* data, int size)
   dest->outbuf = data;
   dest->maxsize = size;
   dest->length = 0;
+  dest->overflow = 0;
+  dest->spill = NULL;
 }
 
+/* Bytes written - or, after an overflow, the size that was needed: */
 GLOBAL(int) jpeg_mem_packet_size(j_compress_ptr cinfo) {
   mem_dest_ptr dest;
   dest =  (mem_dest_ptr) cinfo->dest;
   return dest->length;
 }
 
+/* 1 if the output did not fit in the buffer given to jpeg_memory_dest: */
+GLOBAL(int) jpeg_mem_overflow(j_compress_ptr cinfo) {
+  mem_dest_ptr dest;
+  dest =  (mem_dest_ptr) cinfo->dest;
+  return dest->overflow;
+}
+
@@ -89,32 +89,35 @@ fill_input_buffer (j_decompress_ptr cinfo)
 {
   // Here, we're just swapping pointers around.  We've been given a
   // pointer to jpeg-compressed data in memory (deposited in inbuf),
-  // so just use that.
+  // so hand all of it over the first time we are called.  Any later
+  // call means the data ran out, e.g. because the caller only passed
+  // the first few KB of a file to read its header.
   int i = 0;
   my_src_ptr src = (my_src_ptr) cinfo->src;
   size_t nbytes;
 
-  src->buffer = (JOCTET*) src->inbuf;
-
-  nbytes = (size_t) src->nbytes;
-
-  if (nbytes <= 0) {
+  if (src->nbytes <= 0) {
     if (src->start_of_file)	/* Treat empty input file as fatal error */
       ERREXIT(cinfo, JERR_INPUT_EMPTY);
     WARNMS(cinfo, JWRN_JPEG_EOF);
-    /* Insert a fake EOI marker */
+    /* Insert a fake EOI marker - in our own buffer, not the caller's: */
     src->buffer[0] = (JOCTET) 0xFF;
     src->buffer[1] = (JOCTET) JPEG_EOI;
-    nbytes = 2;
+    src->pub.next_input_byte = src->buffer;
+    src->pub.bytes_in_buffer = 2;
+    return TRUE;
   }
 
+  nbytes = (size_t) src->nbytes;
+
   i = 0;
   if (src->start_of_file) {
-    for (i = 0; i < (int) nbytes && !src->buffer[i]; i++) continue;
+    for (i = 0; i < (int) nbytes && !src->inbuf[i]; i++) continue;
   }
 
-  src->pub.next_input_byte = src->buffer+i;
+  src->pub.next_input_byte = (JOCTET *) src->inbuf + i;
   src->pub.bytes_in_buffer = nbytes-(size_t) i;
+  src->nbytes = 0;
   src->start_of_file = FALSE;
 
   return TRUE;
@@ -77,12 +77,22 @@ typedef unsigned short BIT16;
 /* Maximum degree of various polynomials. */
 #define MAXDEG (NPAR*2)
 
+/* Scratch state of the encoder and decoder is per thread, so that
+ * independent threads can encode and decode at the same time.  The
+ * galois tables and generator polynomial are filled in once by
+ * initialize_ecc () and only read after that. */
+#ifdef __cplusplus
+#define RS_THREAD_LOCAL thread_local
+#else
+#define RS_THREAD_LOCAL _Thread_local
+#endif
+
 /*************************************/
 /* Encoder parity bytes */
-extern int pBytes[MAXDEG];
+extern RS_THREAD_LOCAL int pBytes[MAXDEG];
 
 /* Decoder syndrome bytes */
-extern int synBytes[MAXDEG];
+extern RS_THREAD_LOCAL int synBytes[MAXDEG];
 
 /* print debugging info */
 extern int DEBUG;
@@ -38,10 +38,10 @@
 #include "ecc.h"
 
 /* Encoder parity bytes */
-int pBytes[MAXDEG];
+RS_THREAD_LOCAL int pBytes[MAXDEG];
 
 /* Decoder syndrome bytes */
-int synBytes[MAXDEG];
+RS_THREAD_LOCAL int synBytes[MAXDEG];
 
 /* generator polynomial */
 int genPoly[MAXDEG*2];
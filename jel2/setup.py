@@ -20,6 +20,21 @@ from distutils.core import setup, Extension
 pyjel_module = Extension('_pyjel',
                          sources=['py/pyjel_wrap.c',
                                   'libjel/jel.c',
+                                  'libjel/jel-pool.c',
+                                  'libjel/jel-arena.c',
+                                  'libjel/jel-index.c',
+                                  'libjel/jel-stats.c',
+                                  'libjel/jel-log.c',
+                                  'libjel/jel-exec.c',
+                                  'libjel/jel-reasm.c',
+                                  'libjel/jel-plan.c',
+                                  'libjel/jel-split.c',
+                                  'libjel/jel-splice.c',
+                                  'libjel/jel-huff.c',
+                                  'libjel/jel-requant.c',
+                                  'libjel/jel-scans.c',
+                                  'libjel/jel-raw.c',
+                                  'libjel/jel-markers.c',
                                   'libjel/ijel.c',
                                   'libjel/ijel-ecc.c',
                                   'libjel/jpeg-mem-dst.c',
@@ -0,0 +1,1855 @@
+/*
+ * jel-bench.c - Timing harness for libjel.
+ *
+ * Embeds a message into an in-memory cover over and over, the way a
+ * high-rate sender would, and reports the cost per message.  The
+ * "fresh" runs pay for jel_init / jel_free on every message; the
+ * "pooled" runs borrow configs from a jel_pool, and the "reused" run
+ * jel_reset ()s a single config, which shows the per-message
+ * allocation counts once the config's arena has settled.  The
+ * "planned" run does the same with a jel_plan attached, so the PRN
+ * list is drawn once rather than per message, and then checks that a
+ * config embeds the same image twice over, without a jel_reset in
+ * between, with the plan and without, and that reading a cover's
+ * header from memory leaves a config's FILE source as it was.
+ * -noarena turns the arena off, so the system allocator can be
+ * compared, and -nosplice has every output block Huffman-coded again
+ * rather than copied from the cover.
+ *
+ * -sweep instead times jel_capacity, jel_embed and jel_extract over
+ * synthetic covers (a range of sizes, subsamplings and qualities) and
+ * over the embedding parameters, and writes the results as JSON so
+ * that they can be compared from release to release.  Starting from
+ * a baseline setting, one parameter is varied at a time.
+ *
+ * -threads N round-trips messages (embed, then extract and compare)
+ * from 1, 2, 4, ... N threads at once, each with its own seed and ECC
+ * block length and all borrowing configs from one shared jel_pool,
+ * and reports the throughput at each thread count.  Built with
+ * -fsanitize=thread, this is also the concurrency stress test.
+ *
+ * -async N runs N rounds of round trips through jel_embed_async and
+ * jel_extract_async on an executor of -threads workers (4 by
+ * default).  Each round has more jobs than the executor will queue,
+ * so that submissions are refused as busy and retried.  Every third embed is
+ * cancelled as soon as it is submitted.  Each config goes from job to
+ * job without being reset by the caller, and the last round's images
+ * are extracted again with fresh configs.
+ *
+ * -segments splits one large message (1 MB unless -length says
+ * otherwise) over as many copies of a cover as it takes, as planned
+ * by jel_plan_segments, and times jel_embed_segments with 1, 2, 4,
+ * ... -threads workers.
+ *
+ * -entropy times the entropy decoding and re-encoding of covers (the
+ * -sweep synthetic ones, plus any named on the command line) in MB/s
+ * of JPEG data.
+ *
+ * -huffman embeds into the same covers with the default Huffman
+ * tables (the cover's own, when spliced) and with -optimize (optimal
+ * tables, built from symbol counts taken during decoding), and reports
+ * what the smaller output costs in embedding time.
+ *
+ * -progressive makes the synthetic covers progressive JPEGs, and times
+ * their decoding in MB/s and embedding in messages per second, with a
+ * sequential output and with -keepscans (the cover's own scan script).
+ * Covers named on the command line are used as they are.
+ *
+ * -raw embeds into synthetic frames given as pixels, as video is sent:
+ * compressed to a JPEG in memory and set with jel_set_mem_source, and
+ * handed to jel_set_raw_source, which codes each block only once.
+ */
+
+#include <jel/jel.h>
+#include <jel/jpeg-mem-dst.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <time.h>
+#include <ctype.h>		/* to declare isprint() */
+#include <pthread.h>
+
+#define JEL_BENCH_VERSION "1.0.0"
+
+static const char * progname;		/* program name for error messages */
+static int iterations = 200;
+static int msglen = 64;
+static int seed = 0;
+static int quality = 0;
+static int use_arena = 1;
+static int use_splice = 1;
+static int use_optimize = 0;
+static int show_stats = 0;
+static int sweep = 0;
+static int async_rounds = 0;
+static int nthreads = 0;
+static int segments = 0;
+static int entropy = 0;
+static int huffman = 0;
+static int progressive = 0;
+static int keep_scans = 0;
+static int raw = 0;
+static int length_set = 0;
+static int iterations_set = 0;
+static const char *json_name = NULL;
+static const char *sizes_arg = "0.3,2";
+static const char *qualities_arg = "50,75,95";
+static const char *sampling_arg = "420,444";
+extern bool jel_verbose;
+
+LOCAL(void)
+usage (void)
+/* complain about bad command line */
+{
+  fprintf(stderr, "usage: %s [switches] coverfile\n", progname);
+  fprintf(stderr, "       %s -sweep [switches] [coverfile ...]\n", progname);
+  fprintf(stderr, "       %s -threads N [switches] coverfile\n", progname);
+  fprintf(stderr, "       %s -async N [-threads N] [switches] coverfile\n", progname);
+  fprintf(stderr, "       %s -segments [-threads N] [switches] [coverfile]\n", progname);
+  fprintf(stderr, "       %s -entropy [switches] [coverfile ...]\n", progname);
+  fprintf(stderr, "       %s -huffman [switches] [coverfile ...]\n", progname);
+  fprintf(stderr, "       %s -progressive [switches] [coverfile ...]\n", progname);
+  fprintf(stderr, "       %s -raw [switches]\n", progname);
+  fprintf(stderr, "Times repeated embedding into an in-memory JPEG cover.\n");
+  fprintf(stderr, "Switches (names may be abbreviated):\n");
+  fprintf(stderr, "  -async N        Round-trip N rounds of messages as async jobs, cancelling some.\n");
+  fprintf(stderr, "  -entropy        Time coefficient decoding and encoding of covers, in MB/s.\n");
+  fprintf(stderr, "  -huffman        Compare output size and embed time with and without -optimize.\n");
+  fprintf(stderr, "  -iterations N   Embed N messages per run (default=%d, 3 with -sweep).\n", iterations);
+  fprintf(stderr, "  -keepscans      Give the output of a progressive cover the cover's scans.\n");
+  fprintf(stderr, "  -length L       Embed L-byte messages (default=%d; -sweep fills the capacity).\n", msglen);
+  fprintf(stderr, "  -noarena        Use malloc for per-image memory instead of the arena.\n");
+  fprintf(stderr, "  -nosplice       Code every output block again instead of copying unchanged ones.\n");
+  fprintf(stderr, "  -optimize       Write optimal Huffman tables rather than the standard ones.\n");
+  fprintf(stderr, "  -progressive    Time decoding and embedding of progressive covers.\n");
+  fprintf(stderr, "  -quality Q      Ask for quality level Q for embedding.\n");
+  fprintf(stderr, "  -raw            Compare embedding into frames compressed first with jel_set_raw_source.\n");
+  fprintf(stderr, "  -seed <n>       Seed (shared secret) for random frequency selection.\n");
+  fprintf(stderr, "  -segments       Time one long message split over several covers in parallel.\n");
+  fprintf(stderr, "  -stats          Print the per-phase breakdown of the reused run.\n");
+  fprintf(stderr, "  -sweep          Time capacity/embed/extract over covers and parameters.\n");
+  fprintf(stderr, "  -json FILE      Write -sweep results to FILE (default stdout).\n");
+  fprintf(stderr, "  -sizes LIST     Synthetic cover sizes in megapixels (default=%s).\n", sizes_arg);
+  fprintf(stderr, "  -qualities LIST Synthetic cover qualities (default=%s).\n", qualities_arg);
+  fprintf(stderr, "  -sampling LIST  Synthetic cover subsampling, 420 and/or 444 (default=%s).\n", sampling_arg);
+  fprintf(stderr, "  -threads N      Round-trip messages from up to N threads and report the scaling.\n");
+  fprintf(stderr, "  -version        Print version info and exit.\n");
+  exit(EXIT_FAILURE);
+}
+
+
+static boolean
+keymatch (char * arg, const char * keyword, int minchars)
+{
+  register int ca, ck;
+  register int nmatched = 0;
+
+  while ((ca = *arg++) != '\0') {
+    if ((ck = *keyword++) == '\0')
+      return FALSE;		/* arg longer than keyword, no good */
+    if (isupper(ca))		/* force arg to lcase (assume ck is already) */
+      ca = tolower(ca);
+    if (ca != ck)
+      return FALSE;		/* no good */
+    nmatched++;			/* count matched characters */
+  }
+  /* reached end of argument; fail if it's too short for unique abbrev */
+  if (nmatched < minchars)
+    return FALSE;
+  return TRUE;			/* A-OK */
+}
+
+
+LOCAL(int)
+parse_switches (int argc, char **argv)
+{
+  int argn;
+  char * arg;
+
+  for (argn = 1; argn < argc; argn++) {
+    arg = argv[argn];
+    if (*arg != '-') break;
+
+    arg++;			/* advance past switch marker character */
+
+    if (keymatch(arg, "async", 3)) {
+      if (++argn >= argc || sscanf(argv[argn], "%d", &async_rounds) != 1 || async_rounds <= 0)
+        usage();
+    } else if (keymatch(arg, "entropy", 3)) {
+      entropy = 1;
+    } else if (keymatch(arg, "huffman", 3)) {
+      huffman = 1;
+    } else if (keymatch(arg, "iterations", 4)) {
+      if (++argn >= argc)
+        usage();
+      iterations = strtol(argv[argn], NULL, 10);
+      iterations_set = 1;
+    } else if (keymatch(arg, "json", 4)) {
+      if (++argn >= argc)
+        usage();
+      json_name = argv[argn];
+    } else if (keymatch(arg, "keepscans", 4)) {
+      keep_scans = 1;
+    } else if (keymatch(arg, "length", 3)) {
+      if (++argn >= argc)
+        usage();
+      msglen = strtol(argv[argn], NULL, 10);
+      length_set = 1;
+    } else if (keymatch(arg, "noarena", 3)) {
+      use_arena = 0;
+    } else if (keymatch(arg, "nosplice", 3)) {
+      use_splice = 0;
+    } else if (keymatch(arg, "optimize", 3)) {
+      use_optimize = 1;
+    } else if (keymatch(arg, "progressive", 4)) {
+      progressive = 1;
+    } else if (keymatch(arg, "quality", 4)) {
+      if (++argn >= argc)
+        usage();
+      quality = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "qualities", 9)) {
+      if (++argn >= argc)
+        usage();
+      qualities_arg = argv[argn];
+    } else if (keymatch(arg, "raw", 3)) {
+      raw = 1;
+    } else if (keymatch(arg, "sampling", 3)) {
+      if (++argn >= argc)
+        usage();
+      sampling_arg = argv[argn];
+    } else if (keymatch(arg, "seed", 4)) {
+      if (++argn >= argc)
+        usage();
+      seed = strtol(argv[argn], NULL, 10);
+    } else if (keymatch(arg, "segments", 3)) {
+      segments = 1;
+    } else if (keymatch(arg, "sizes", 3)) {
+      if (++argn >= argc)
+        usage();
+      sizes_arg = argv[argn];
+    } else if (keymatch(arg, "stats", 3)) {
+      show_stats = 1;
+    } else if (keymatch(arg, "sweep", 3)) {
+      sweep = 1;
+    } else if (keymatch(arg, "threads", 3)) {
+      if (++argn >= argc || sscanf(argv[argn], "%d", &nthreads) != 1 || nthreads <= 0)
+        usage();
+    } else if (keymatch(arg, "version", 7)) {
+      fprintf(stderr, "jel-bench version %s (libjel version %s)\n",
+              JEL_BENCH_VERSION, jel_version_string());
+      exit(-1);
+    } else {
+      usage();			/* bogus switch */
+    }
+  }
+
+  return argn;			/* return index of next arg (file name) */
+}
+
+
+static double now_usec(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1.0e6 + ts.tv_nsec / 1.0e3;
+}
+
+
+static unsigned char *read_file(const char *name, int *len) {
+  FILE *fp = fopen(name, "rb");
+  unsigned char *buf;
+  long n;
+
+  if (!fp) return NULL;
+  fseek(fp, 0L, SEEK_END);
+  n = ftell(fp);
+  fseek(fp, 0L, SEEK_SET);
+  buf = malloc((size_t) n);
+  if (buf && fread(buf, 1, (size_t) n, fp) != (size_t) n) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  *len = (int) n;
+  return buf;
+}
+
+
+static void apply_settings(jel_config *cfg) {
+  jel_set_arena(cfg, use_arena);
+  jel_set_splice(cfg, use_splice);
+  jel_set_optimize(cfg, use_optimize);
+  jel_set_keep_scans(cfg, keep_scans);
+  if (seed > 0) jel_setprop(cfg, JEL_PROP_PRN_SEED, seed);
+  if (quality > 0) jel_setprop(cfg, JEL_PROP_QUALITY, quality);
+}
+
+
+/* One message: set the source and destination, then embed. */
+static int embed_one(jel_config *cfg, unsigned char *cover, int cover_len,
+                     unsigned char *out, int out_len, unsigned char *msg) {
+  int ret;
+
+  if ((ret = jel_set_mem_source(cfg, cover, cover_len)) != 0) return ret;
+  jel_set_mem_dest(cfg, out, out_len);
+  return jel_embed(cfg, msg, msglen);
+}
+
+
+
+/*
+ * Embeds twice on one config, without a jel_reset in between, first
+ * without a plan and then with one.  All four images must be the same.
+ * Returns the number that differ from the first.
+ */
+static int check_plan(unsigned char *cover, int cover_len, unsigned char *msg) {
+  int out_len = 2 * cover_len + 65536;
+  unsigned char *out[4];
+  int len[4], i, k, bad = 0;
+  jel_config *cfg;
+  jel_plan *plan = NULL;
+
+  for (k = 0; k < 2; k++) {
+    cfg = jel_init(JEL_NLEVELS);
+    apply_settings(cfg);
+    if (seed <= 0) jel_setprop(cfg, JEL_PROP_PRN_SEED, 1);
+    if (k == 1) {
+      plan = jel_plan_create(cfg, 0);
+      jel_set_plan(cfg, plan);
+    }
+    for (i = 2 * k; i < 2 * k + 2; i++) {
+      out[i] = malloc((size_t) out_len);
+      len[i] = -1;
+      if (embed_one(cfg, cover, cover_len, out[i], out_len, msg) >= 0) len[i] = cfg->jpeglen;
+    }
+    jel_free(cfg);
+  }
+  jel_plan_release(plan);
+
+  for (i = 0; i < 4; i++)
+    if (len[i] < 0 || len[i] != len[0] || memcmp(out[i], out[0], (size_t) len[0]) != 0) bad++;
+  for (i = 0; i < 4; i++) free(out[i]);
+  return bad;
+}
+
+
+
+/*
+ * Sets a FILE source, reads the capacity from the cover's header in
+ * memory, and embeds from the FILE again, then once more, all on one
+ * config.  Both images must be the same, and the header must give the
+ * capacity that jel_capacity does.  Returns 0 if they are.
+ */
+static int check_header_capacity(unsigned char *cover, int cover_len, unsigned char *msg) {
+  int out_len = 2 * cover_len + 65536;
+  unsigned char *out[2];
+  int len[2], i, cap = -1, hcap = -1, bad;
+  jel_config *cfg;
+  FILE *fp;
+
+  if ((fp = tmpfile()) == NULL) return -1;
+  if (fwrite(cover, 1, (size_t) cover_len, fp) != (size_t) cover_len) {
+    fclose(fp);
+    return -1;
+  }
+
+  cfg = jel_init(JEL_NLEVELS);
+  apply_settings(cfg);
+  for (i = 0; i < 2; i++) {
+    out[i] = malloc((size_t) out_len);
+    len[i] = -1;
+    rewind(fp);
+    if (jel_set_fp_source(cfg, fp) != 0) continue;
+    if (i == 0) {
+      cap = jel_capacity(cfg);
+      hcap = jel_capacity_from_header(cover, cover_len, cfg);
+      rewind(fp);
+      if (jel_set_fp_source(cfg, fp) != 0) continue;
+    }
+    jel_set_mem_dest(cfg, out[i], out_len);
+    if (jel_embed(cfg, msg, msglen) >= 0) len[i] = cfg->jpeglen;
+  }
+  jel_free(cfg);
+  fclose(fp);
+
+  bad = cap < 0 || hcap != cap || len[0] < 0 || len[1] != len[0]
+    || memcmp(out[1], out[0], (size_t) len[0]) != 0;
+  for (i = 0; i < 2; i++) free(out[i]);
+  return bad;
+}
+
+
+
+/***********************************************************************
+ *                   Parameter sweep (-sweep)
+ */
+
+/* The parameters that one sweep point embeds and extracts with: */
+typedef struct {
+  const char *vary;     /* Which parameter differs from the baseline */
+  int bpf;
+  int nfreqs;
+  int maxfreqs;
+  int density;
+  int seed;
+  int ecc;
+  int ncomps;           /* 1 = Y only, 3 = Y, U and V */
+} bench_point;
+
+static const bench_point baseline = { "baseline", 1, 1, 6, 100, 0, 0, 1 };
+
+/* Each entry is the baseline with one parameter changed: */
+static const bench_point variations[] = {
+  { "bpf",      2, 1, 6, 100, 0,  0, 1 },
+  { "bpf",      3, 1, 6, 100, 0,  0, 1 },
+  { "nfreqs",   1, 2, 6, 100, 0,  0, 1 },
+  { "nfreqs",   1, 4, 6, 100, 0,  0, 1 },
+  { "maxfreqs", 1, 1, 4, 100, 0,  0, 1 },
+  { "maxfreqs", 1, 1, 8, 100, 0,  0, 1 },
+  { "density",  1, 1, 6, 25,  0,  0, 1 },
+  { "density",  1, 1, 6, 50,  0,  0, 1 },
+  { "seed",     1, 1, 6, 100, 17, 0, 1 },
+  { "ecc",      1, 1, 6, 100, 0,  1, 1 },
+  { "comps",    1, 1, 6, 100, 0,  0, 3 },
+};
+
+
+/* A synthetic cover, as JPEG bytes in memory: */
+typedef struct {
+  char name[64];
+  double mp;
+  int width, height;
+  int sampling;         /* 420 or 444; 0 for covers read from files */
+  int quality;
+  int progressive;      /* 1 for a progressive synthetic cover */
+  unsigned char *jpeg;
+  int len;
+} bench_cover;
+
+
+/* xorshift32: reproducible across platforms, unlike rand (): */
+static unsigned int xorshift(unsigned int *state) {
+  unsigned int x = *state;
+
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  return *state = x;
+}
+
+
+static void random_payload(unsigned char *msg, int len, unsigned int seed) {
+  unsigned int state = seed ? seed : 1;
+  int i;
+
+  for (i = 0; i < len; i++) msg[i] = (unsigned char) (xorshift(&state) >> 24);
+}
+
+
+static int parse_list(const char *arg, double *vals, int max) {
+  int n = 0;
+  char *end;
+
+  while (*arg && n < max) {
+    vals[n++] = strtod(arg, &end);
+    if (end == arg) usage();
+    arg = (*end == ',') ? end + 1 : end;
+  }
+  return n;
+}
+
+
+/*
+ * Renders a width x height RGB scene - smooth gradients, some
+ * periodic texture and a little noise, so that the coefficients look
+ * more like a photograph than a flat test card.
+ */
+static void render_scene(int w, int h, unsigned char *rgb) {
+  unsigned int state = 0x9e3779b9u ^ (unsigned int) (w * 31 + h);
+  unsigned char *row;
+  int x, y;
+
+  for (y = 0; y < h; y++) {
+    row = rgb + (size_t) y * w * 3;
+    for (x = 0; x < w; x++) {
+      int n = (int) (xorshift(&state) & 15);
+      int t = ((x >> 3) ^ (y >> 3)) & 31;
+      row[3*x]   = (unsigned char) ((x * 200) / w + t + n);
+      row[3*x+1] = (unsigned char) ((y * 200) / h + 24 + n);
+      row[3*x+2] = (unsigned char) (((x + y) * 100) / (w + h) + 2 * t + n);
+    }
+  }
+}
+
+
+/*
+ * Compresses an RGB frame into out with the given quality and
+ * subsampling (0 for libjpeg's default), progressively if asked.
+ * Returns the size of the JPEG, which did not fit if *overflow is set.
+ */
+static int compress_frame(const unsigned char *rgb, int w, int h, int quality, int sampling,
+                          int prog, unsigned char *out, int size, int *overflow) {
+  struct jpeg_compress_struct cinfo;
+  struct jpeg_error_mgr jerr;
+  JSAMPROW rows[1];
+  int y, len;
+
+  cinfo.err = jpeg_std_error(&jerr);
+  jpeg_create_compress(&cinfo);
+  jpeg_memory_dest(&cinfo, out, size);
+  cinfo.image_width = (JDIMENSION) w;
+  cinfo.image_height = (JDIMENSION) h;
+  cinfo.input_components = 3;
+  cinfo.in_color_space = JCS_RGB;
+  jpeg_set_defaults(&cinfo);
+  jpeg_set_quality(&cinfo, quality, TRUE);
+  if (sampling == 444) {
+    cinfo.comp_info[0].h_samp_factor = 1;
+    cinfo.comp_info[0].v_samp_factor = 1;
+  }
+  if (prog)
+    jpeg_simple_progression(&cinfo);
+  jpeg_start_compress(&cinfo, TRUE);
+
+  for (y = 0; y < h; y++) {
+    rows[0] = (JSAMPROW) (rgb + (size_t) y * w * 3);
+    jpeg_write_scanlines(&cinfo, rows, 1);
+  }
+  jpeg_finish_compress(&cinfo);
+
+  len = jpeg_mem_packet_size(&cinfo);
+  *overflow = jpeg_mem_overflow(&cinfo);
+  jpeg_destroy_compress(&cinfo);
+  return len;
+}
+
+
+/*
+ * Renders the cover's scene and compresses it with the cover's
+ * quality and subsampling, progressively if asked.
+ */
+static void make_cover(bench_cover *cover) {
+  int w = cover->width, h = cover->height, size, overflow;
+  unsigned char *rgb = malloc((size_t) w * h * 3);
+
+  render_scene(w, h, rgb);
+  size = w * h / 2 + 65536;
+  for (;;) {
+    cover->jpeg = malloc((size_t) size);
+    cover->len = compress_frame(rgb, w, h, cover->quality, cover->sampling, cover->progressive,
+                                cover->jpeg, size, &overflow);
+    if (!overflow) break;
+
+    /* Too small; the failed pass told us the exact size needed: */
+    free(cover->jpeg);
+    size = cover->len;
+  }
+
+  free(rgb);
+}
+
+
+static void apply_point(jel_config *cfg, const bench_point *pt) {
+  jel_set_arena(cfg, use_arena);
+  jel_set_splice(cfg, use_splice);
+  jel_set_optimize(cfg, use_optimize);
+  jel_set_keep_scans(cfg, keep_scans);
+  jel_setprop(cfg, JEL_PROP_MAXFREQS, pt->maxfreqs);
+  jel_setprop(cfg, JEL_PROP_NFREQS, pt->nfreqs);
+  jel_setprop(cfg, JEL_PROP_BITS_PER_FREQ, pt->bpf);
+  jel_setprop(cfg, JEL_PROP_MCU_DENSITY, pt->density);
+  jel_setprop(cfg, JEL_PROP_ECC_METHOD, pt->ecc ? JEL_ECC_RSCODE : JEL_ECC_NONE);
+}
+
+
+/* Settings that wedge and unwedge make once the source is known: */
+static void apply_point_source(jel_config *cfg, const bench_point *pt) {
+  if (pt->ncomps == 3) jel_set_components(cfg, 0, 1, 2);
+  else jel_set_components(cfg, 0, -1, -1);
+  if (quality > 0) jel_setprop(cfg, JEL_PROP_QUALITY, quality);
+  if (pt->seed > 0) jel_setprop(cfg, JEL_PROP_PRN_SEED, pt->seed);
+  jel_init_frequencies(cfg, NULL, 0);
+}
+
+
+/*
+ * Times one parameter point on one cover and writes its JSON record.
+ * Returns 0 if every iteration round-tripped the payload.
+ */
+static int run_point(FILE *out, int first, const bench_cover *cover, const bench_point *pt,
+                     unsigned char *dst, int dst_len, unsigned char *msg,
+                     unsigned char *got, int got_len) {
+  double t0, t_decode = 0.0, t_cap = 0.0, t_embed = 0.0, t_extract = 0.0;
+  int i, cap = 0, len = 0, embedded = 0, extracted = 0, jpeglen = 0, ok = 1;
+  jel_config *cfg;
+
+  for (i = 0; i < iterations; i++) {
+    cfg = jel_init(JEL_NLEVELS);
+    apply_point(cfg, pt);
+    t0 = now_usec();
+    if (jel_set_mem_source(cfg, cover->jpeg, cover->len) != 0) {
+      jel_free(cfg);
+      ok = 0;
+      break;
+    }
+    t_decode += now_usec() - t0;
+    apply_point_source(cfg, pt);
+
+    t0 = now_usec();
+    cap = jel_capacity(cfg);
+    t_cap += now_usec() - t0;
+
+    len = length_set ? msglen : cap;
+    if (len > cap) len = cap;
+    if (len <= 0) {
+      jel_free(cfg);
+      break;
+    }
+    random_payload(msg, len, (unsigned int) (i + 1));
+
+    jel_set_mem_dest(cfg, dst, dst_len);
+    t0 = now_usec();
+    embedded = jel_embed(cfg, msg, len);
+    t_embed += now_usec() - t0;
+    jpeglen = cfg->jpeglen;
+    jel_free(cfg);
+    if (embedded < 0) {
+      ok = 0;
+      break;
+    }
+
+    cfg = jel_init(JEL_NLEVELS);
+    apply_point(cfg, pt);
+    extracted = -1;
+    if (jel_set_mem_source(cfg, dst, jpeglen) == 0) {
+      apply_point_source(cfg, pt);
+      t0 = now_usec();
+      extracted = jel_extract(cfg, got, got_len);
+      t_extract += now_usec() - t0;
+    }
+    jel_free(cfg);
+    if (extracted != embedded || memcmp(msg, got, (size_t) embedded) != 0) ok = 0;
+  }
+  if (i == 0) i = 1;
+
+  fprintf(out, "%s    {\"cover\": \"%s\", \"vary\": \"%s\", "
+          "\"bpf\": %d, \"nfreqs\": %d, \"maxfreqs\": %d, \"mcu_density\": %d, "
+          "\"seed\": %s, \"ecc\": %s, \"components\": \"%s\",\n",
+          first ? "" : ",\n", cover->name, pt->vary,
+          pt->bpf, pt->nfreqs, pt->maxfreqs, pt->density,
+          pt->seed ? "true" : "false", pt->ecc ? "true" : "false",
+          pt->ncomps == 3 ? "yuv" : "y");
+  fprintf(out, "     \"capacity\": %d, \"payload\": %d, \"embedded\": %d, \"extracted\": %d, "
+          "\"jpeg_bytes\": %d, \"ok\": %s,\n",
+          cap, len, embedded, extracted, jpeglen, ok ? "true" : "false");
+  fprintf(out, "     \"usec\": {\"decode\": %.1f, \"capacity\": %.1f, \"embed\": %.1f, \"extract\": %.1f}}",
+          t_decode / i, t_cap / i, t_embed / i, t_extract / i);
+
+  return ok ? 0 : -1;
+}
+
+
+/* The synthetic covers from -sizes, -sampling and -qualities, then
+ * the covers named on the command line: */
+static bench_cover *make_covers(int argc, char **argv, int k, int *count) {
+  double sizes[16], quals[16], samps[4];
+  int nsizes, nquals, nsamps, ncovers = 0, i, j, m;
+  bench_cover *covers;
+
+  nsizes = parse_list(sizes_arg, sizes, 16);
+  nquals = parse_list(qualities_arg, quals, 16);
+  nsamps = parse_list(sampling_arg, samps, 4);
+
+  covers = calloc((size_t) (nsizes * nquals * nsamps + argc - k), sizeof(bench_cover));
+
+  for (i = 0; i < nsizes; i++)
+    for (j = 0; j < nsamps; j++)
+      for (m = 0; m < nquals; m++) {
+        bench_cover *c = covers + ncovers;
+        /* 4:3, in whole 16x16 MCUs: */
+        c->width = ((int) sqrt(sizes[i] * 1.0e6 * 4.0 / 3.0) + 15) & ~15;
+        c->height = ((c->width * 3 / 4) + 15) & ~15;
+        c->mp = c->width * (double) c->height / 1.0e6;
+        c->sampling = (int) samps[j];
+        c->quality = (int) quals[m];
+        c->progressive = progressive;
+        snprintf(c->name, sizeof(c->name), "synth-%dx%d-%d-q%d%s",
+                 c->width, c->height, c->sampling, c->quality, c->progressive ? "-p" : "");
+        make_cover(c);
+        ncovers++;
+      }
+
+  for (; k < argc; k++) {
+    bench_cover *c = covers + ncovers;
+    c->jpeg = read_file(argv[k], &c->len);
+    if (!c->jpeg) {
+      fprintf(stderr, "%s: Could not read cover %s!\n", progname, argv[k]);
+      exit(EXIT_FAILURE);
+    }
+    snprintf(c->name, sizeof(c->name), "%s", argv[k]);
+    ncovers++;
+  }
+
+  *count = ncovers;
+  return covers;
+}
+
+
+static int run_sweep(int argc, char **argv, int k) {
+  int ncovers, i, j, first = 1, failures = 0;
+  int dst_len = 0, max_cap = 0;
+  bench_cover *covers;
+  unsigned char *dst, *msg, *got;
+  FILE *out = stdout;
+  time_t now = time(NULL);
+
+  covers = make_covers(argc, argv, k, &ncovers);
+  for (i = 0; i < ncovers; i++) {
+    if (covers[i].len > dst_len) dst_len = covers[i].len;
+  }
+  /* Embedding can grow the JPEG, and the payload never exceeds the
+   * cover size at these densities: */
+  dst_len = 2 * dst_len + 65536;
+  max_cap = dst_len;
+  dst = malloc((size_t) dst_len);
+  msg = malloc((size_t) max_cap);
+  got = malloc((size_t) max_cap);
+
+  if (json_name && !(out = fopen(json_name, "w"))) {
+    fprintf(stderr, "%s: Could not open %s!\n", progname, json_name);
+    exit(EXIT_FAILURE);
+  }
+
+  fprintf(out, "{\"jel_bench_version\": \"%s\", \"libjel_version\": \"%s\",\n",
+          JEL_BENCH_VERSION, jel_version_string());
+  fprintf(out, " \"time\": %ld, \"iterations\": %d, \"arena\": %s, \"splice\": %s, \"optimize\": %s, \"quality\": %d,\n",
+          (long) now, iterations, use_arena ? "true" : "false", use_splice ? "true" : "false",
+          use_optimize ? "true" : "false", quality);
+  fprintf(out, " \"covers\": [\n");
+  for (i = 0; i < ncovers; i++)
+    fprintf(out, "    {\"name\": \"%s\", \"megapixels\": %.2f, \"width\": %d, \"height\": %d, "
+            "\"sampling\": %d, \"quality\": %d, \"bytes\": %d}%s\n",
+            covers[i].name, covers[i].mp, covers[i].width, covers[i].height,
+            covers[i].sampling, covers[i].quality, covers[i].len,
+            i + 1 < ncovers ? "," : "");
+  fprintf(out, " ],\n \"results\": [\n");
+
+  for (i = 0; i < ncovers; i++) {
+    failures += run_point(out, first, covers + i, &baseline, dst, dst_len, msg, got, max_cap) != 0;
+    first = 0;
+    for (j = 0; j < (int) (sizeof(variations) / sizeof(variations[0])); j++)
+      failures += run_point(out, 0, covers + i, variations + j, dst, dst_len, msg, got, max_cap) != 0;
+    fflush(out);
+  }
+
+  fprintf(out, "\n ],\n \"failures\": %d}\n", failures);
+  if (out != stdout) fclose(out);
+
+  for (i = 0; i < ncovers; i++) free(covers[i].jpeg);
+  free(covers);
+  free(dst);
+  free(msg);
+  free(got);
+
+  return failures;
+}
+
+
+
+/***********************************************************************
+ *                   Entropy coding throughput (-entropy)
+ */
+
+/*
+ * Re-encodes the coefficients of the source in cfg into out, the way
+ * jel_embed writes its output, iterations times.  Returns the time
+ * taken and sets *len to the size of the JPEG written.  The config's
+ * own compressor is used since, with an arena, the coefficient arrays
+ * belong to its memory manager.
+ */
+static double time_encode(jel_config *cfg, unsigned char *out, int out_len, int *len) {
+  double t0;
+  int it;
+
+  t0 = now_usec();
+  for (it = 0; it < iterations; it++) {
+    jpeg_copy_critical_parameters(&cfg->srcinfo, &cfg->dstinfo);
+    jel_set_mem_dest(cfg, out, out_len);
+    jpeg_write_coefficients(&cfg->dstinfo, cfg->coefs);
+    jpeg_finish_compress(&cfg->dstinfo);
+  }
+  t0 = now_usec() - t0;
+
+  *len = jpeg_mem_overflow(&cfg->dstinfo) ? 0 : jpeg_mem_packet_size(&cfg->dstinfo);
+  return t0;
+}
+
+
+/*
+ * Decodes each cover to coefficients, as every embed and extract
+ * does, then encodes them again, as every embed does, and reports
+ * both rates in megabytes of JPEG data per second.  Against the
+ * bundled jpeg-6b this is mostly the Huffman decoder and encoder.
+ */
+static int run_entropy(int argc, char **argv, int k) {
+  bench_cover *covers;
+  jel_config *cfg;
+  unsigned char *out = NULL;
+  double t0, dec, enc, in_bytes = 0.0, out_bytes = 0.0, dec_total = 0.0, enc_total = 0.0;
+  int ncovers, i, it, out_len = 0, len, failures = 0;
+
+  covers = make_covers(argc, argv, k, &ncovers);
+  cfg = jel_init(JEL_NLEVELS);
+  jel_set_arena(cfg, use_arena);
+
+  for (i = 0; i < ncovers; i++)
+    if (2 * covers[i].len + 65536 > out_len) out_len = 2 * covers[i].len + 65536;
+  out = malloc((size_t) out_len);
+
+  for (i = 0; i < ncovers; i++) {
+    /* One untimed decode to settle the arena: */
+    if (jel_set_mem_source(cfg, covers[i].jpeg, covers[i].len) != 0) {
+      fprintf(stderr, "%s: Could not decode %s!\n", progname, covers[i].name);
+      failures++;
+      continue;
+    }
+    jel_reset(cfg);
+
+    t0 = now_usec();
+    for (it = 0; it < iterations; it++) {
+      jel_set_mem_source(cfg, covers[i].jpeg, covers[i].len);
+      jel_reset(cfg);
+    }
+    dec = now_usec() - t0;
+
+    jel_set_mem_source(cfg, covers[i].jpeg, covers[i].len);
+    enc = time_encode(cfg, out, out_len, &len);
+    jel_reset(cfg);
+    if (len <= 0) {
+      fprintf(stderr, "%s: Could not encode %s!\n", progname, covers[i].name);
+      failures++;
+      continue;
+    }
+
+    printf("entropy: %-28s %9d bytes, decode %7.1f MB/s, encode %7.1f MB/s\n",
+           covers[i].name, covers[i].len,
+           (double) covers[i].len * iterations / dec, (double) len * iterations / enc);
+    in_bytes += (double) covers[i].len * iterations;
+    out_bytes += (double) len * iterations;
+    dec_total += dec;
+    enc_total += enc;
+  }
+  if (dec_total > 0.0 && enc_total > 0.0)
+    printf("entropy: %-28s %9.0f bytes, decode %7.1f MB/s, encode %7.1f MB/s\n",
+           "all covers", in_bytes / iterations, in_bytes / dec_total, out_bytes / enc_total);
+
+  jel_free(cfg);
+  for (i = 0; i < ncovers; i++) free(covers[i].jpeg);
+  free(covers);
+  free(out);
+  return failures;
+}
+
+
+
+/*
+ * Embeds the baseline message into one cover iterations times, with
+ * optimal Huffman tables or without and keeping the cover's scans or
+ * not, and checks that the last output gives the message back.
+ * Returns the mean embed time, or a negative value on failure; sets
+ * *len to the output size and adds the outputs' counters to *total.
+ */
+static double time_embed_with(const bench_cover *cover, int optimize, int keep,
+                              unsigned char *dst, int dst_len, unsigned char *msg,
+                              unsigned char *got, int *len, jel_stats *total) {
+  double t0, elapsed = 0.0;
+  int i, cap, n = 0, embedded = -1, extracted = -1;
+  jel_config *cfg;
+  jel_stats st;
+
+  *len = 0;
+  for (i = 0; i < iterations; i++) {
+    cfg = jel_init(JEL_NLEVELS);
+    apply_point(cfg, &baseline);
+    jel_set_optimize(cfg, optimize);
+    jel_set_keep_scans(cfg, keep);
+    jel_enable_stats(cfg, 1);
+    if (jel_set_mem_source(cfg, cover->jpeg, cover->len) != 0) {
+      jel_free(cfg);
+      return -1.0;
+    }
+    apply_point_source(cfg, &baseline);
+    cap = jel_capacity(cfg);
+    n = cap < msglen ? cap : msglen;
+    if (n <= 0) {
+      jel_free(cfg);
+      return -1.0;
+    }
+    random_payload(msg, n, 1);
+    jel_set_mem_dest(cfg, dst, dst_len);
+    t0 = now_usec();
+    embedded = jel_embed(cfg, msg, n);
+    elapsed += now_usec() - t0;
+    *len = cfg->jpeglen;
+    jel_get_stats(cfg, &st);
+    total->tables_fused += st.tables_fused;
+    total->scans_kept += st.scans_kept;
+    jel_free(cfg);
+    if (embedded < 0) return -1.0;
+  }
+
+  cfg = jel_init(JEL_NLEVELS);
+  apply_point(cfg, &baseline);
+  if (jel_set_mem_source(cfg, dst, *len) == 0) {
+    apply_point_source(cfg, &baseline);
+    extracted = jel_extract(cfg, got, dst_len);
+  }
+  jel_free(cfg);
+  if (extracted != embedded || memcmp(msg, got, (size_t) embedded) != 0) return -1.0;
+
+  return elapsed / iterations;
+}
+
+
+static int run_huffman(int argc, char **argv, int k) {
+  bench_cover *covers;
+  unsigned char *dst, *msg, *got;
+  double t_std, t_opt, std_bytes = 0.0, opt_bytes = 0.0, std_total = 0.0, opt_total = 0.0;
+  int ncovers, i, dst_len = 0, len_std, len_opt, failures = 0;
+  jel_stats st;
+
+  covers = make_covers(argc, argv, k, &ncovers);
+  for (i = 0; i < ncovers; i++)
+    if (2 * covers[i].len + 65536 > dst_len) dst_len = 2 * covers[i].len + 65536;
+  dst = malloc((size_t) dst_len);
+  msg = malloc((size_t) msglen);
+  got = malloc((size_t) dst_len);
+
+  for (i = 0; i < ncovers; i++) {
+    memset(&st, 0, sizeof(st));
+    t_std = time_embed_with(covers + i, 0, keep_scans, dst, dst_len, msg, got, &len_std, &st);
+    memset(&st, 0, sizeof(st));
+    t_opt = time_embed_with(covers + i, 1, keep_scans, dst, dst_len, msg, got, &len_opt, &st);
+    if (t_std < 0.0 || t_opt < 0.0) {
+      fprintf(stderr, "%s: Could not round-trip %s!\n", progname, covers[i].name);
+      failures++;
+      continue;
+    }
+    printf("huffman: %-28s default %9d bytes %9.1f usec, optimized %9d bytes %9.1f usec (%s): "
+           "%5.2f%% smaller, %+.1f usec\n",
+           covers[i].name, len_std, t_std, len_opt, t_opt,
+           st.tables_fused == (unsigned long) iterations ? "counted" : "2-pass",
+           100.0 * (len_std - len_opt) / len_std, t_opt - t_std);
+    std_bytes += len_std;
+    opt_bytes += len_opt;
+    std_total += t_std;
+    opt_total += t_opt;
+  }
+  if (std_bytes > 0.0)
+    printf("huffman: %-28s default %9.0f bytes %9.1f usec, optimized %9.0f bytes %9.1f usec: "
+           "%5.2f%% smaller, %+.1f usec\n",
+           "all covers", std_bytes, std_total, opt_bytes, opt_total,
+           100.0 * (std_bytes - opt_bytes) / std_bytes, opt_total - std_total);
+
+  for (i = 0; i < ncovers; i++) free(covers[i].jpeg);
+  free(covers);
+  free(dst);
+  free(msg);
+  free(got);
+  return failures;
+}
+
+
+
+/*
+ * Times the decoding of each cover, and embedding into it with a
+ * sequential output and with the cover's own scans.  The synthetic
+ * covers are progressive here (see make_cover).
+ */
+static int run_progressive(int argc, char **argv, int k) {
+  bench_cover *covers;
+  jel_config *cfg;
+  unsigned char *dst, *msg, *got;
+  double t0, dec, t_seq, t_keep;
+  int ncovers, i, it, dst_len = 0, len_seq, len_keep, failures = 0;
+  jel_stats st;
+
+  covers = make_covers(argc, argv, k, &ncovers);
+  for (i = 0; i < ncovers; i++)
+    if (2 * covers[i].len + 65536 > dst_len) dst_len = 2 * covers[i].len + 65536;
+  dst = malloc((size_t) dst_len);
+  msg = malloc((size_t) msglen);
+  got = malloc((size_t) dst_len);
+  cfg = jel_init(JEL_NLEVELS);
+  jel_set_arena(cfg, use_arena);
+
+  for (i = 0; i < ncovers; i++) {
+    /* One untimed decode to settle the arena, as with -entropy: */
+    if (jel_set_mem_source(cfg, covers[i].jpeg, covers[i].len) != 0) {
+      fprintf(stderr, "%s: Could not decode %s!\n", progname, covers[i].name);
+      failures++;
+      continue;
+    }
+    jel_reset(cfg);
+    t0 = now_usec();
+    for (it = 0; it < iterations; it++) {
+      jel_set_mem_source(cfg, covers[i].jpeg, covers[i].len);
+      jel_reset(cfg);
+    }
+    dec = now_usec() - t0;
+
+    memset(&st, 0, sizeof(st));
+    t_seq = time_embed_with(covers + i, use_optimize, 0, dst, dst_len, msg, got, &len_seq, &st);
+    memset(&st, 0, sizeof(st));
+    t_keep = time_embed_with(covers + i, use_optimize, 1, dst, dst_len, msg, got, &len_keep, &st);
+    if (t_seq < 0.0 || t_keep < 0.0) {
+      fprintf(stderr, "%s: Could not round-trip %s!\n", progname, covers[i].name);
+      failures++;
+      continue;
+    }
+
+    printf("progressive: %-28s %9d bytes, decode %7.1f MB/s; sequential %9d bytes %7.1f msgs/s, "
+           "kept scans %9d bytes %7.1f msgs/s (%lu of %d)\n",
+           covers[i].name, covers[i].len, (double) covers[i].len * iterations / dec,
+           len_seq, 1.0e6 / t_seq, len_keep, 1.0e6 / t_keep, st.scans_kept, iterations);
+  }
+
+  jel_free(cfg);
+  for (i = 0; i < ncovers; i++) free(covers[i].jpeg);
+  free(covers);
+  free(dst);
+  free(msg);
+  free(got);
+  return failures;
+}
+
+
+
+/*
+ * Times sending the baseline message in each synthetic frame from its
+ * pixels: compressing the frame and setting the JPEG as the source,
+ * against jel_set_raw_source.  One config is reset between frames, as
+ * for the "reused" run.  Frames use libjpeg's default 4:2:0 sampling,
+ * which is what jel_set_raw_source gives them, so -sampling is not
+ * used; the two outputs should be the same bytes.
+ */
+static int run_raw(void) {
+  double sizes[16], quals[16], t0, t_jpeg, t_raw;
+  unsigned char *rgb, *jpeg, *dst, *msg, *got;
+  int nsizes, nquals, i, m, it, w, h, q, size, len, overflow, n, cap;
+  int dst_len, len_jpeg = 0, len_raw = 0, ret = 0, failures = 0;
+  char name[64];
+  jel_config *cfg;
+
+  nsizes = parse_list(sizes_arg, sizes, 16);
+  nquals = parse_list(qualities_arg, quals, 16);
+  msg = malloc((size_t) msglen);
+  random_payload(msg, msglen, 1);
+
+  for (i = 0; i < nsizes; i++)
+    for (m = 0; m < nquals; m++) {
+      w = ((int) sqrt(sizes[i] * 1.0e6 * 4.0 / 3.0) + 15) & ~15;
+      h = ((w * 3 / 4) + 15) & ~15;
+      q = (int) quals[m];
+      snprintf(name, sizeof(name), "synth-%dx%d-q%d", w, h, q);
+      rgb = malloc((size_t) w * h * 3);
+      render_scene(w, h, rgb);
+      size = dst_len = w * h * 3 + 65536;
+      jpeg = malloc((size_t) size);
+      dst = malloc((size_t) dst_len);
+      got = malloc((size_t) dst_len);
+
+      /* Compress, decode, embed and code again.  The first frame sizes
+       * the arena and is not counted: */
+      cfg = jel_init(JEL_NLEVELS);
+      apply_point(cfg, &baseline);
+      t_jpeg = 0.0;
+      for (it = 0; it <= iterations && ret >= 0; it++) {
+        t0 = now_usec();
+        len = compress_frame(rgb, w, h, q, 0, 0, jpeg, size, &overflow);
+        ret = overflow ? -1 : jel_set_mem_source(cfg, jpeg, len);
+        if (ret == 0) {
+          apply_point_source(cfg, &baseline);
+          cap = jel_capacity(cfg);
+          n = cap < msglen ? cap : msglen;
+          jel_set_mem_dest(cfg, dst, dst_len);
+          ret = n > 0 ? jel_embed(cfg, msg, n) : -1;
+          len_jpeg = cfg->jpeglen;
+        }
+        if (it > 0) t_jpeg += now_usec() - t0;
+        jel_reset(cfg);
+        apply_point(cfg, &baseline);
+      }
+
+      /* Straight from the pixels: */
+      t_raw = 0.0;
+      for (it = 0; it <= iterations && ret >= 0; it++) {
+        t0 = now_usec();
+        jel_setprop(cfg, JEL_PROP_QUALITY, q);
+        ret = jel_set_raw_source(cfg, rgb, w, h, JEL_PIXELS_RGB);
+        if (ret == 0) {
+          apply_point_source(cfg, &baseline);
+          cap = jel_capacity(cfg);
+          n = cap < msglen ? cap : msglen;
+          jel_set_mem_dest(cfg, dst, dst_len);
+          ret = n > 0 ? jel_embed(cfg, msg, n) : -1;
+          len_raw = cfg->jpeglen;
+        }
+        if (it > 0) t_raw += now_usec() - t0;
+        jel_reset(cfg);
+        apply_point(cfg, &baseline);
+      }
+      jel_free(cfg);
+
+      /* The last raw output gives the message back: */
+      if (ret >= 0) {
+        cfg = jel_init(JEL_NLEVELS);
+        apply_point(cfg, &baseline);
+        if (jel_set_mem_source(cfg, dst, len_raw) == 0) {
+          apply_point_source(cfg, &baseline);
+          if (jel_extract(cfg, got, dst_len) != ret || memcmp(msg, got, (size_t) ret) != 0)
+            ret = -1;
+        } else
+          ret = -1;
+        jel_free(cfg);
+      }
+
+      if (ret < 0) {
+        fprintf(stderr, "%s: Could not round-trip %s!\n", progname, name);
+        failures++;
+        ret = 0;
+      } else
+        printf("raw: %-28s via JPEG %9d bytes %9.1f usec/frame, raw %9d bytes %9.1f usec/frame: "
+               "%.2fx\n", name, len_jpeg, t_jpeg / iterations, len_raw, t_raw / iterations,
+               t_jpeg / t_raw);
+
+      free(rgb);
+      free(jpeg);
+      free(dst);
+      free(got);
+    }
+
+  free(msg);
+  return failures;
+}
+
+
+
+/***********************************************************************
+ *                   Concurrent round trips (-threads)
+ */
+
+typedef struct {
+  pthread_t tid;
+  int id;
+  unsigned char *cover;
+  int cover_len;
+  jel_pool *pool;       /* Shared by all threads */
+  int failures;
+} bench_thread;
+
+
+/*
+ * One thread's share of the work.  Every thread uses its own seed and
+ * alternates between two ECC block lengths, so that any state leaking
+ * between configs shows up as a failed round trip.
+ */
+static void *thread_main(void *arg) {
+  bench_thread *bt = arg;
+  bench_point pt = baseline;
+  int blocklen = bt->id % 2 ? 32 : 20;
+  int dst_len = 2 * bt->cover_len + 65536;
+  unsigned char *dst = malloc((size_t) dst_len);
+  unsigned char *msg = malloc((size_t) msglen);
+  unsigned char *got = malloc((size_t) dst_len);   /* ECC data lands here before decoding */
+  int i, cap, len, embedded, extracted, jpeglen;
+  jel_config *cfg;
+
+  pt.seed = 1000 + bt->id;
+  pt.ecc = 1;
+
+  for (i = 0; i < iterations; i++) {
+    cfg = jel_pool_acquire(bt->pool);
+    apply_point(cfg, &pt);
+    jel_setprop(cfg, JEL_PROP_ECC_BLOCKLEN, blocklen);
+    embedded = -1;
+    jpeglen = 0;
+    len = 0;
+    if (jel_set_mem_source(cfg, bt->cover, bt->cover_len) == 0) {
+      apply_point_source(cfg, &pt);
+      /* ECC round trips are not reliable right up to the capacity: */
+      cap = jel_capacity(cfg) / 2;
+      len = cap < msglen ? cap : msglen;
+      random_payload(msg, len, (unsigned int) (bt->id * iterations + i + 1));
+      jel_set_mem_dest(cfg, dst, dst_len);
+      if (len > 0) embedded = jel_embed(cfg, msg, len);
+      jpeglen = cfg->jpeglen;
+    }
+    jel_pool_release(bt->pool, cfg);
+
+    cfg = jel_pool_acquire(bt->pool);
+    apply_point(cfg, &pt);
+    jel_setprop(cfg, JEL_PROP_ECC_BLOCKLEN, blocklen);
+    extracted = -1;
+    if (embedded > 0 && jel_set_mem_source(cfg, dst, jpeglen) == 0) {
+      apply_point_source(cfg, &pt);
+      extracted = jel_extract(cfg, got, dst_len);
+    }
+    jel_pool_release(bt->pool, cfg);
+
+    if (embedded <= 0 || extracted != embedded || memcmp(msg, got, (size_t) embedded) != 0)
+      bt->failures++;
+  }
+
+  free(dst);
+  free(msg);
+  free(got);
+  return NULL;
+}
+
+
+static int run_threads(unsigned char *cover, int cover_len) {
+  bench_thread *threads = calloc((size_t) nthreads, sizeof(bench_thread));
+  jel_pool *pool = jel_pool_create(NULL, nthreads * 2);
+  double t0, elapsed, rate, base_rate = 0.0;
+  int n, i, failures, total = 0;
+
+  for (n = 1; ; n = n * 2 < nthreads ? n * 2 : nthreads) {
+    failures = 0;
+    t0 = now_usec();
+    for (i = 0; i < n; i++) {
+      threads[i].id = i;
+      threads[i].cover = cover;
+      threads[i].cover_len = cover_len;
+      threads[i].pool = pool;
+      threads[i].failures = 0;
+      if (pthread_create(&threads[i].tid, NULL, thread_main, threads + i) != 0) {
+        fprintf(stderr, "%s: Could not start thread %d!\n", progname, i);
+        exit(EXIT_FAILURE);
+      }
+    }
+    for (i = 0; i < n; i++) {
+      pthread_join(threads[i].tid, NULL);
+      failures += threads[i].failures;
+    }
+    elapsed = (now_usec() - t0) / 1.0e6;
+
+    rate = n * iterations / elapsed;
+    if (n == 1) base_rate = rate;
+    printf("threads: %2d, %d round trips, %.1f round trips/sec, %.2fx, %d failures\n",
+           n, n * iterations, rate, rate / base_rate, failures);
+    total += failures;
+    if (n == nthreads) break;
+  }
+
+  jel_pool_destroy(pool);
+  free(threads);
+  return total;
+}
+
+
+
+/***********************************************************************
+ *                   Asynchronous jobs (-async)
+ */
+
+typedef struct bench_async bench_async;
+
+typedef struct {
+  bench_async *owner;
+  int seed;             /* Set once, when the config is made */
+  jel_config *cfg;      /* Handed from job to job without a jel_reset */
+  unsigned char *dst;
+  unsigned char *msg;
+  unsigned char *got;
+  int len;              /* Payload bytes */
+  long id;
+  int extract;          /* 1 while the job is an extract */
+  int canceled;         /* 1 if jel_async_cancel took the embed back */
+  int result;
+  int jpeglen;
+  int ncalls;           /* done () calls for the current job */
+} bench_slot;
+
+struct bench_async {
+  pthread_mutex_t lock;
+  pthread_cond_t done;
+  unsigned char *cover;
+  int cover_len;
+  int dst_len;
+  int outstanding;      /* Jobs submitted whose done () has not run */
+  long busy;            /* Submissions refused with JEL_ERR_BUSY at least once */
+};
+
+
+static void async_prepare(jel_config *cfg, void *arg) {
+  apply_point_source(cfg, &baseline);
+}
+
+
+static void async_done(jel_config *cfg, int result, void *arg) {
+  bench_slot *s = arg;
+  bench_async *a = s->owner;
+
+  pthread_mutex_lock(&a->lock);
+  s->result = result;
+  if (!s->extract) s->jpeglen = cfg->jpeglen;
+  s->ncalls++;
+  a->outstanding--;
+  pthread_cond_signal(&a->done);
+  pthread_mutex_unlock(&a->lock);
+}
+
+
+/*
+ * Submits an embed or an extract for slot s, and waits for a
+ * completion whenever the executor is full.  Returns the job's id or
+ * a negative error.
+ */
+static long async_submit(jel_executor *ex, bench_slot *s, int extract) {
+  bench_async *a = s->owner;
+  int refused = 0;
+  long id;
+
+  pthread_mutex_lock(&a->lock);
+  a->outstanding++;
+  s->extract = extract;
+  s->ncalls = 0;
+  pthread_mutex_unlock(&a->lock);
+
+  for (;;) {
+    if (extract)
+      id = jel_extract_async(ex, s->cfg, s->dst, s->jpeglen, s->got, a->dst_len, async_done, s);
+    else
+      id = jel_embed_async(ex, s->cfg, a->cover, a->cover_len, s->dst, a->dst_len,
+                           s->msg, s->len, async_done, s);
+    if (id != JEL_ERR_BUSY) break;
+
+    /* Room is only made once a worker has returned from done (), so
+     * with nothing else left to finish, just try again: */
+    pthread_mutex_lock(&a->lock);
+    if (!refused++) a->busy++;
+    if (a->outstanding > 1) pthread_cond_wait(&a->done, &a->lock);
+    pthread_mutex_unlock(&a->lock);
+  }
+
+  if (id < 0) {
+    pthread_mutex_lock(&a->lock);
+    a->outstanding--;
+    pthread_mutex_unlock(&a->lock);
+  }
+  return s->id = id;
+}
+
+
+static void async_wait(bench_async *a) {
+  pthread_mutex_lock(&a->lock);
+  while (a->outstanding > 0) pthread_cond_wait(&a->done, &a->lock);
+  pthread_mutex_unlock(&a->lock);
+}
+
+
+/* Extracts each slot's last image with a fresh config: */
+static int async_check_fresh(bench_slot *slots, int nslots, unsigned char *got, int got_len) {
+  int i, n, bad = 0;
+  jel_config *cfg;
+
+  for (i = 0; i < nslots; i++) {
+    if (slots[i].canceled) continue;
+    cfg = jel_init(JEL_NLEVELS);
+    apply_point(cfg, &baseline);
+    jel_setprop(cfg, JEL_PROP_PRN_SEED, slots[i].seed);
+    n = -1;
+    if (jel_set_mem_source(cfg, slots[i].dst, slots[i].jpeglen) == 0) {
+      apply_point_source(cfg, &baseline);
+      n = jel_extract(cfg, got, got_len);
+    }
+    jel_free(cfg);
+    if (n != slots[i].len || memcmp(got, slots[i].msg, (size_t) n) != 0) bad++;
+  }
+  return bad;
+}
+
+
+static int run_async(unsigned char *cover, int cover_len) {
+  int workers = nthreads > 0 ? nthreads : 4;
+  int nslots = 3 * workers;     /* More jobs than the executor queues */
+  bench_slot *slots = calloc((size_t) nslots, sizeof(bench_slot));
+  bench_async a;
+  jel_executor *ex;
+  jel_config *cfg;
+  unsigned char *got;
+  long trips = 0, canceled = 0, late = 0;
+  int r, i, cap, failures = 0;
+  double t0, elapsed;
+
+  memset(&a, 0, sizeof(a));
+  pthread_mutex_init(&a.lock, NULL);
+  pthread_cond_init(&a.done, NULL);
+  a.cover = cover;
+  a.cover_len = cover_len;
+  a.dst_len = 2 * cover_len + 65536;
+  got = malloc((size_t) a.dst_len);
+
+  ex = jel_executor_create(workers, workers, async_prepare);
+  if (!ex) {
+    fprintf(stderr, "%s: Could not start the executor!\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
+  for (i = 0; i < nslots; i++) {
+    slots[i].owner = &a;
+    slots[i].seed = 1000 + i;
+    slots[i].cfg = jel_init(JEL_NLEVELS);
+    apply_point(slots[i].cfg, &baseline);
+    jel_setprop(slots[i].cfg, JEL_PROP_PRN_SEED, slots[i].seed);
+    slots[i].dst = malloc((size_t) a.dst_len);
+    slots[i].msg = malloc((size_t) msglen);
+    slots[i].got = malloc((size_t) a.dst_len);
+  }
+
+  /* Half the capacity, as for -threads: */
+  cfg = jel_init(JEL_NLEVELS);
+  apply_point(cfg, &baseline);
+  cap = 0;
+  if (jel_set_mem_source(cfg, cover, cover_len) == 0) {
+    apply_point_source(cfg, &baseline);
+    cap = jel_capacity(cfg) / 2;
+  }
+  jel_free(cfg);
+  if (cap <= 0) {
+    fprintf(stderr, "%s: The cover has no capacity!\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
+  t0 = now_usec();
+  for (r = 0; r < async_rounds; r++) {
+    /* Embed, taking every third job back straight away: */
+    for (i = 0; i < nslots; i++) {
+      bench_slot *s = slots + i;
+
+      s->len = cap < msglen ? cap : msglen;
+      random_payload(s->msg, s->len, (unsigned int) (r * nslots + i + 1));
+      s->canceled = 0;
+      if (async_submit(ex, s, 0) < 0) {
+        failures++;
+        continue;
+      }
+      if (i % 3 == 2) {
+        if (jel_async_cancel(ex, s->id) == 0) {
+          s->canceled = 1;
+          canceled++;
+        } else {
+          late++;
+        }
+      }
+    }
+    async_wait(&a);
+
+    for (i = 0; i < nslots; i++) {
+      bench_slot *s = slots + i;
+
+      if (s->ncalls != 1 || (s->canceled && s->result != JEL_ERR_CANCELED) ||
+          (!s->canceled && s->result != s->len)) {
+        failures++;
+        s->canceled = 1;        /* Nothing to extract */
+      }
+      /* A finished job cannot be taken back: */
+      if (jel_async_cancel(ex, s->id) != -1) failures++;
+    }
+
+    /* Extract with the same configs: */
+    for (i = 0; i < nslots; i++)
+      if (!slots[i].canceled && async_submit(ex, slots + i, 1) < 0) failures++;
+    async_wait(&a);
+
+    for (i = 0; i < nslots; i++) {
+      bench_slot *s = slots + i;
+
+      if (s->canceled) continue;
+      if (s->ncalls != 1 || s->result != s->len || memcmp(s->got, s->msg, (size_t) s->len) != 0)
+        failures++;
+      else
+        trips++;
+    }
+  }
+  elapsed = (now_usec() - t0) / 1.0e6;
+
+  /* The embeds of the last round were made with configs that had
+   * already been through jobs: */
+  failures += async_check_fresh(slots, nslots, got, a.dst_len);
+
+  printf("async: %d threads, %ld round trips, %.1f round trips/sec, %ld canceled (%ld too late), "
+         "%ld busy retries, %d failures\n",
+         workers, trips, trips / elapsed, canceled, late, a.busy, failures);
+
+  jel_executor_destroy(ex);
+  for (i = 0; i < nslots; i++) {
+    jel_free(slots[i].cfg);
+    free(slots[i].dst);
+    free(slots[i].msg);
+    free(slots[i].got);
+  }
+  free(slots);
+  free(got);
+  pthread_cond_destroy(&a.done);
+  pthread_mutex_destroy(&a.lock);
+  return failures;
+}
+
+
+
+/***********************************************************************
+ *                   One message over many covers (-segments)
+ */
+
+/* Dense embedding, so that a few megapixels carry tens of kilobytes: */
+static const bench_point dense = { "dense", 1, 6, 6, 100, 0, 0, 1 };
+
+typedef struct {
+  int next;             /* Segment expected next */
+  long bytes;           /* JPEG bytes delivered */
+} bench_delivery;
+
+
+static void prepare_dense(jel_config *cfg, void *arg) {
+  apply_point_source(cfg, &dense);
+}
+
+
+static int deliver_segment(int seg, unsigned char *jpeg, int jpeglen, void *arg) {
+  bench_delivery *d = arg;
+
+  if (seg != d->next) return -1;   /* Out of order */
+  d->next++;
+  d->bytes += jpeglen;
+  return 0;
+}
+
+
+/* Extracts every segment again and compares it with the payload: */
+static int check_segments(jel_segment *segs, int nsegs, unsigned char *msg, unsigned char *got) {
+  int i, n, off = 0, bad = 0;
+  jel_config *cfg;
+
+  for (i = 0; i < nsegs; i++) {
+    cfg = jel_init(JEL_NLEVELS);
+    apply_point(cfg, &dense);
+    n = -1;
+    if (jel_set_mem_source(cfg, segs[i].dst, segs[i].cfg->jpeglen) == 0) {
+      prepare_dense(cfg, NULL);
+      n = jel_extract(cfg, got, segs[i].dst_len);
+    }
+    jel_free(cfg);
+    if (n != segs[i].msglen || memcmp(got, msg + off, (size_t) n) != 0) bad++;
+    off += segs[i].msglen;
+  }
+  return bad;
+}
+
+
+static int run_segments(int argc, char **argv, int k) {
+  bench_cover cover;
+  jel_segment *segs;
+  jel_executor *ex;
+  bench_delivery d;
+  unsigned char *msg, *got;
+  int payload = length_set ? msglen : 1 << 20;
+  int maxthreads = nthreads > 0 ? nthreads : 4;
+  int cap, nsegs, ncovers, dst_len, n, i, it, failures = 0;
+  int *caps, *seglen;
+  double t0, elapsed, base = 0.0;
+  jel_config *cfg;
+
+  memset(&cover, 0, sizeof(cover));
+  if (k < argc) {
+    cover.jpeg = read_file(argv[k], &cover.len);
+    if (!cover.jpeg) {
+      fprintf(stderr, "%s: Could not read cover %s!\n", progname, argv[k]);
+      exit(EXIT_FAILURE);
+    }
+    snprintf(cover.name, sizeof(cover.name), "%s", argv[k]);
+  } else {
+    cover.width = 2720;
+    cover.height = 2048;
+    cover.sampling = 420;
+    cover.quality = 75;
+    snprintf(cover.name, sizeof(cover.name), "synth-%dx%d-420-q75", cover.width, cover.height);
+    make_cover(&cover);
+  }
+
+  cfg = jel_init(JEL_NLEVELS);
+  apply_point(cfg, &dense);
+  cap = 0;
+  if (jel_set_mem_source(cfg, cover.jpeg, cover.len) == 0) {
+    prepare_dense(cfg, NULL);
+    cap = jel_capacity(cfg);
+  }
+  jel_free(cfg);
+  if (cap <= 0) {
+    fprintf(stderr, "%s: %s has no capacity!\n", progname, cover.name);
+    exit(EXIT_FAILURE);
+  }
+
+  /* Enough copies of the cover to choose from, split evenly: */
+  ncovers = payload / cap + 1;
+  caps = malloc((size_t) ncovers * sizeof(int));
+  seglen = malloc((size_t) ncovers * sizeof(int));
+  for (i = 0; i < ncovers; i++) caps[i] = cap;
+  nsegs = jel_plan_segments(caps, ncovers, payload, 0, 0, seglen);
+  if (nsegs <= 0) {
+    fprintf(stderr, "%s: Could not plan %d bytes over %s!\n", progname, payload, cover.name);
+    exit(EXIT_FAILURE);
+  }
+
+  dst_len = 2 * cover.len + 65536;
+  segs = calloc((size_t) nsegs, sizeof(jel_segment));
+  msg = malloc((size_t) payload);
+  got = malloc((size_t) dst_len);
+  random_payload(msg, payload, 1);
+  for (i = 0, n = 0; i < ncovers; i++) {
+    if (seglen[i] <= 0) continue;
+    segs[n].cfg = jel_init(JEL_NLEVELS);
+    segs[n].cover = cover.jpeg;
+    segs[n].cover_len = cover.len;
+    segs[n].dst = malloc((size_t) dst_len);
+    segs[n].dst_len = dst_len;
+    segs[n].msglen = seglen[i];
+    n++;
+  }
+  free(caps);
+  free(seglen);
+
+  for (n = 1; ; n = n * 2 < maxthreads ? n * 2 : maxthreads) {
+    ex = jel_executor_create(n, 2 * n, prepare_dense);
+    elapsed = 0.0;
+    for (it = 0; it < iterations; it++) {
+      for (i = 0; i < nsegs; i++) {
+        jel_reset(segs[i].cfg);
+        apply_point(segs[i].cfg, &dense);
+      }
+      memset(&d, 0, sizeof(d));
+      t0 = now_usec();
+      i = jel_embed_segments(ex, msg, segs, nsegs, deliver_segment, &d);
+      elapsed += now_usec() - t0;
+      if (i != nsegs || (it == 0 && check_segments(segs, nsegs, msg, got) != 0)) failures++;
+    }
+    jel_executor_destroy(ex);
+
+    elapsed /= iterations;
+    if (n == 1) base = elapsed;
+    printf("segments: %d bytes as %d x %d of %d over %s, %d threads: %.1f ms/message, %.2fx, %ld bytes out\n",
+           payload, nsegs, segs[0].msglen, cap, cover.name, n, elapsed / 1000.0, base / elapsed, d.bytes);
+    if (n == maxthreads) break;
+  }
+
+  for (i = 0; i < nsegs; i++) {
+    jel_free(segs[i].cfg);
+    free(segs[i].dst);
+  }
+  free(segs);
+  free(msg);
+  free(got);
+  free(cover.jpeg);
+  if (failures) fprintf(stderr, "%s: %d runs failed to round-trip\n", progname, failures);
+  return failures;
+}
+
+
+int
+main (int argc, char **argv)
+{
+  unsigned char *cover, *out, *msg;
+  int cover_len, out_len, i, k, ret;
+  double t0, t_fresh, t_pooled, t_reused, t_planned;
+  jel_config *cfg, *tmpl;
+  jel_plan *plan;
+  jel_arena_stats stats;
+  jel_stats phases;
+  jel_pool *pool;
+
+  progname = argv[0];
+  if (progname == NULL || progname[0] == 0)
+    progname = "jel-bench";
+
+  k = parse_switches(argc, argv);
+  if (sweep) {
+    if (!iterations_set) iterations = 3;
+    if (iterations <= 0 || msglen <= 0) usage();
+    return run_sweep(argc, argv, k) ? EXIT_FAILURE : 0;
+  }
+  if (entropy) {
+    if (!iterations_set) iterations = 10;
+    if (iterations <= 0) usage();
+    return run_entropy(argc, argv, k) ? EXIT_FAILURE : 0;
+  }
+  if (huffman) {
+    if (!iterations_set) iterations = 10;
+    if (iterations <= 0 || msglen <= 0) usage();
+    return run_huffman(argc, argv, k) ? EXIT_FAILURE : 0;
+  }
+  if (progressive) {
+    if (!iterations_set) iterations = 10;
+    if (iterations <= 0 || msglen <= 0) usage();
+    return run_progressive(argc, argv, k) ? EXIT_FAILURE : 0;
+  }
+  if (raw) {
+    if (!iterations_set) iterations = 10;
+    if (iterations <= 0 || msglen <= 0) usage();
+    return run_raw() ? EXIT_FAILURE : 0;
+  }
+  if (segments) {
+    if (!iterations_set) iterations = 3;
+    if (iterations <= 0 || msglen <= 0) usage();
+    return run_segments(argc, argv, k) ? EXIT_FAILURE : 0;
+  }
+  if (k >= argc || iterations <= 0 || msglen <= 0) usage();
+
+  cover = read_file(argv[k], &cover_len);
+  if (!cover) {
+    fprintf(stderr, "%s: Could not read cover %s!\n", progname, argv[k]);
+    exit(EXIT_FAILURE);
+  }
+
+  if (async_rounds > 0) {
+    ret = run_async(cover, cover_len);
+    free(cover);
+    return ret ? EXIT_FAILURE : 0;
+  }
+
+  if (nthreads > 0) {
+    ret = run_threads(cover, cover_len);
+    free(cover);
+    return ret ? EXIT_FAILURE : 0;
+  }
+
+  out_len = 2 * cover_len + 65536;
+  out = malloc((size_t) out_len);
+  msg = malloc((size_t) msglen);
+  for (i = 0; i < msglen; i++) msg[i] = (unsigned char) ('a' + i % 26);
+
+  /* Fresh config for every message: */
+  t0 = now_usec();
+  for (i = 0; i < iterations; i++) {
+    cfg = jel_init(JEL_NLEVELS);
+    apply_settings(cfg);
+    ret = embed_one(cfg, cover, cover_len, out, out_len, msg);
+    jel_free(cfg);
+    if (ret < 0) {
+      fprintf(stderr, "%s: jel_embed failed (%d)\n", progname, ret);
+      exit(EXIT_FAILURE);
+    }
+  }
+  t_fresh = (now_usec() - t0) / iterations;
+
+  /* Pooled configs: */
+  tmpl = jel_init(JEL_NLEVELS);
+  apply_settings(tmpl);
+  pool = jel_pool_create(tmpl, 4);
+  jel_free(tmpl);
+
+  t0 = now_usec();
+  for (i = 0; i < iterations; i++) {
+    cfg = jel_pool_acquire(pool);
+    jel_set_arena(cfg, use_arena);
+    jel_set_splice(cfg, use_splice);
+    jel_set_optimize(cfg, use_optimize);
+    ret = embed_one(cfg, cover, cover_len, out, out_len, msg);
+    jel_pool_release(pool, cfg);
+    if (ret < 0) {
+      fprintf(stderr, "%s: pooled jel_embed failed (%d)\n", progname, ret);
+      exit(EXIT_FAILURE);
+    }
+  }
+  t_pooled = (now_usec() - t0) / iterations;
+  jel_pool_destroy(pool);
+
+  /* One config, reset between messages.  The first message sizes the
+   * arena and is not counted: */
+  cfg = jel_init(JEL_NLEVELS);
+  apply_settings(cfg);
+  ret = embed_one(cfg, cover, cover_len, out, out_len, msg);
+  jel_reset(cfg);
+  apply_settings(cfg);
+  jel_reset_arena_stats(cfg);
+  if (show_stats) jel_enable_stats(cfg, 1);
+
+  t0 = now_usec();
+  for (i = 0; i < iterations && ret >= 0; i++) {
+    ret = embed_one(cfg, cover, cover_len, out, out_len, msg);
+    jel_reset(cfg);
+    apply_settings(cfg);
+  }
+  t_reused = (now_usec() - t0) / iterations;
+  if (ret < 0) {
+    fprintf(stderr, "%s: reused jel_embed failed (%d)\n", progname, ret);
+    exit(EXIT_FAILURE);
+  }
+  jel_get_arena_stats(cfg, &stats);
+  jel_get_stats(cfg, &phases);
+  jel_free(cfg);
+
+  /* As above, with the seed's PRN list drawn once up front: */
+  cfg = jel_init(JEL_NLEVELS);
+  apply_settings(cfg);
+  plan = jel_plan_create(cfg, 0);
+  jel_set_plan(cfg, plan);
+  ret = embed_one(cfg, cover, cover_len, out, out_len, msg);
+  jel_reset(cfg);
+  apply_settings(cfg);
+
+  t0 = now_usec();
+  for (i = 0; i < iterations && ret >= 0; i++) {
+    ret = embed_one(cfg, cover, cover_len, out, out_len, msg);
+    jel_reset(cfg);
+    apply_settings(cfg);
+  }
+  t_planned = (now_usec() - t0) / iterations;
+  if (ret < 0) {
+    fprintf(stderr, "%s: planned jel_embed failed (%d)\n", progname, ret);
+    exit(EXIT_FAILURE);
+  }
+  jel_free(cfg);
+  jel_plan_release(plan);
+
+  if (check_plan(cover, cover_len, msg) != 0) {
+    fprintf(stderr, "%s: a config embeds differently with and without a plan\n", progname);
+    exit(EXIT_FAILURE);
+  }
+  if (check_header_capacity(cover, cover_len, msg) != 0) {
+    fprintf(stderr, "%s: a config embeds differently from a file after reading a header in memory\n", progname);
+    exit(EXIT_FAILURE);
+  }
+
+  printf("arena:  %s\n", stats.enabled ? "on" : "off");
+  printf("fresh:  %d messages, %.1f usec/message\n", iterations, t_fresh);
+  printf("pooled: %d messages, %.1f usec/message\n", iterations, t_pooled);
+  printf("reused: %d messages, %.1f usec/message\n", iterations, t_reused);
+  printf("planned: %d messages, %.1f usec/message\n", iterations, t_planned);
+  printf("reused: %.1f allocations/message, %lu malloc calls, %lu resets\n",
+         (double) stats.allocs / iterations, stats.sys_allocs, stats.resets);
+  printf("reused: %lu bytes image peak, %lu bytes arena peak, %lu bytes held\n",
+         (unsigned long) stats.image_peak, (unsigned long) stats.peak,
+         (unsigned long) stats.capacity);
+  if (show_stats) {
+    printf("phases: decode %.1f, plan %.1f, select %.1f, stuff %.1f, ecc %.1f, encode %.1f usec/message\n",
+           phases.decode_usec / iterations, phases.plan_usec / iterations,
+           phases.select_usec / iterations, phases.stuff_usec / iterations,
+           phases.ecc_usec / iterations, phases.encode_usec / iterations);
+    printf("phases: %lu MCUs visited, %lu active, %lu PRN draws, %lu bytes in, %lu bytes out per message\n",
+           phases.mcus_visited / iterations, phases.mcus_active / iterations,
+           phases.prn_draws / iterations, phases.jpeg_bytes_in / iterations,
+           phases.jpeg_bytes_out / iterations);
+    printf("phases: %lu blocks spliced per message, %lu of %d outputs with counted optimal tables, "
+           "%lu with the cover's scans\n",
+           phases.blocks_spliced / iterations, phases.tables_fused, iterations, phases.scans_kept);
+    printf("phases: %lu blocks requantized, %lu marker bytes copied per message\n",
+           phases.blocks_requantized / iterations, phases.marker_bytes / iterations);
+  }
+
+  free(cover);
+  free(out);
+  free(msg);
+  return 0;
+}
@@ -42,13 +42,17 @@ static int ecc = 0;
 static int ecclen = 0;
 static int seed = 0;
 static int comps[3];
+static int decode = 0;         /* If 1, decode the whole image as jel_embed would. */
+static int use_index = 0;      /* If 1, the arguments are cover directories to index. */
+static int fit = -1;           /* With -index, pick the smallest cover holding this many bytes. */
 
 LOCAL(void)
 usage (void)
 /* complain about bad command line */
 {
-  fprintf(stderr, "usage: %s [switches] inputfile [outputfile]\n", progname);
-  fprintf(stderr, "Checks the steganographic capacity of a JPEG file.\n");
+  fprintf(stderr, "usage: %s [switches] inputfile [inputfile ...]\n", progname);
+  fprintf(stderr, "Checks the steganographic capacity of JPEG files.  With more than\n");
+  fprintf(stderr, "one file, each capacity is printed after the file name.\n");
   fprintf(stderr, "Switches (names may be abbreviated):\n");
   fprintf(stderr, "  -message M      Wedge a string M into the image\n");
   fprintf(stderr, "                  If not supplied, stdin will be used.\n");
@@ -76,6 +80,10 @@ usage (void)
   fprintf(stderr, "  -version        Print version info and exit.\n");
   fprintf(stderr, "  -component <c>  Components to use in order, eg 'y', 'yu', 'uyv', etc...\n");
   fprintf(stderr, "  -dump_mcus      Dump the contents (quantized coefficients) of all MCUs.\n");
+  fprintf(stderr, "  -decode         Decode each image instead of reading only its header.\n");
+  fprintf(stderr, "  -index          Treat the arguments as cover directories: build or\n");
+  fprintf(stderr, "                  refresh each one's .jel-index and report its size.\n");
+  fprintf(stderr, "  -fit N          With -index, print the smallest cover that holds N bytes.\n");
   exit(EXIT_FAILURE);
 }
 
@@ -219,6 +227,14 @@ parse_switches (jel_config *cfg, int argc, char **argv)
           else comps[2] = -1;
         } 
       }
+    } else if (keymatch(arg, "decode", 3)) {
+      decode = 1;
+    } else if (keymatch(arg, "index", 3)) {
+      use_index = 1;
+    } else if (keymatch(arg, "fit", 3)) {
+      if (++argn >= argc)
+        usage();
+      fit = strtol(argv[argn], NULL, 10);
     } else if (keymatch(arg, "version", 7)) {
       fprintf(stderr, "wedge version %s (libjel version %s)\n",
               WCAP_VERSION, jel_version_string());
@@ -231,6 +247,64 @@ parse_switches (jel_config *cfg, int argc, char **argv)
   return argn;			/* return index of next arg (file name) */
 }
 
+/*
+ * Reads the whole of a file into memory; returns NULL on failure.
+ */
+static unsigned char *read_file(const char *name, int *len) {
+  FILE *fp = fopen(name, "rb");
+  unsigned char *buf;
+  long n;
+
+  if (!fp) return NULL;
+  fseek(fp, 0L, SEEK_END);
+  n = ftell(fp);
+  fseek(fp, 0L, SEEK_SET);
+  buf = (n > 0) ? malloc((size_t) n) : NULL;
+  if (buf && fread(buf, 1, (size_t) n, fp) != (size_t) n) {
+    free(buf);
+    buf = NULL;
+  }
+  fclose(fp);
+  *len = (int) n;
+  return buf;
+}
+
+
+/*
+ * Capacity of one file, either from its header or, with -decode, by
+ * setting it as the source the way wedge does:
+ */
+static int file_capacity(jel_config *jel, const char *name) {
+  FILE * input_file;
+  unsigned char *data;
+  int len, ret;
+
+  if (!decode) {
+    data = read_file(name, &len);
+    if (!data) return JEL_ERR_CANTOPENFILE;
+    ret = jel_capacity_from_header(data, len, jel);
+    free(data);
+    return ret;
+  }
+
+  input_file = fopen(name, "rb");
+  ret = jel_set_fp_source(jel, input_file);
+  if (ret != 0) {
+    if (input_file != NULL) fclose(input_file);
+    return ret;
+  }
+
+  /* Setting the source copies its quant tables to the output, so the
+   * output quality has to be applied again: */
+  if ( quality > 0 ) jel_setprop( jel, JEL_PROP_QUALITY, quality );
+
+  ret = jel_capacity(jel);
+  jel_reset(jel);       /* Keeps the settings for the next file */
+  fclose(input_file);
+  return ret;
+}
+
+
 /*
  * The main program.
  */
@@ -239,8 +313,7 @@ int
 main (int argc, char **argv)
 {
   jel_config *jel;
-  FILE * input_file;
-  int max_bytes, ret, k;
+  int max_bytes, ret, k, single, status;
   //  int ecc_method;
   //  int mcudensity;
 
@@ -258,6 +331,7 @@ main (int argc, char **argv)
     usage();
     exit(-1);
   }
+  single = (argc - k == 1);
 
   jel_log(jel, "%s: Setting maxfreqs to %d\n", progname, maxfreq);
   if ( jel_setprop( jel, JEL_PROP_MAXFREQS, maxfreq ) != maxfreq )
@@ -283,15 +357,6 @@ main (int argc, char **argv)
   }
 
 
-  input_file = fopen(argv[k], "rb");
-  ret = jel_set_fp_source(jel, input_file);
-
-  if (ret != 0) {
-    fprintf(stderr, "Error - exiting - jel_set_fp_source failed to open %s!\n", argv[k]);
-    exit(EXIT_FAILURE);
-  }
-
-  
   if ( quality > 0 ) {
     jel_log(jel, "%s: Setting output quality to %d\n", progname, quality);
     if ( jel_setprop( jel, JEL_PROP_QUALITY, quality ) != quality )
@@ -307,21 +372,45 @@ main (int argc, char **argv)
   jel_log(jel, "%s: Using components: %d %d %d\n", progname, comps[0], comps[1], comps[2]);
   
   jel_setprop(jel, JEL_PROP_EMBED_LENGTH, embed_length);
-  max_bytes = jel_capacity(jel);
 
-  /* this is a real hack.  For unknown reasons, iteratively counting
-     the MCUs gives us a number that is too high.  We've empirically
-     found that the excess is somewhere around 86.  MAGIC_NUMBER is
-     set to 100. */
+  status = 0;
+  for (; k < argc && use_index; k++) {
+    jel_index *idx = jel_index_open(argv[k], NULL, jel);
+    const char *cover;
 
-  //  max_bytes -= MAGIC_NUMBER;
-  
-  jel_close_log(jel);
-  if (input_file != NULL && input_file != stdin) fclose(input_file);
+    if (!idx) {
+      fprintf(stderr, "Error - %s: could not index %s!\n", progname, argv[k]);
+      status = EXIT_FAILURE;
+      continue;
+    }
+    if (fit < 0)
+      printf("%s %d\n", argv[k], jel_index_size(idx));
+    else if ((cover = jel_index_take(idx, fit)) != NULL)
+      printf("%s\n", cover);
+    else {
+      fprintf(stderr, "%s: no cover in %s holds %d bytes\n", progname, argv[k], fit);
+      status = EXIT_FAILURE;
+    }
+    jel_index_close(idx);
+  }
 
-  // jel_capacity now returns image message capacity in bytes,
-  // accounting for overhead:
-  printf("%d\n", max_bytes);
+  for (; k < argc; k++) {
+    /* jel_capacity now returns image message capacity in bytes,
+     * accounting for overhead: */
+    max_bytes = file_capacity(jel, argv[k]);
+
+    if (max_bytes < 0) {
+      fprintf(stderr, "Error - %s: could not read the capacity of %s!\n", progname, argv[k]);
+      status = EXIT_FAILURE;
+      if (single) break;
+    } else if (single)
+      printf("%d\n", max_bytes);
+    else
+      printf("%s %d\n", argv[k], max_bytes);
+  }
+
+  jel_close_log(jel);
 
-  exit(0);
+  exit(status);
 }
+